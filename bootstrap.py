@@ -65,6 +65,12 @@ cmdLflagsCEGUI = ['CEGUI.LDFLAGS', 'pkg-config CEGUI-0 --libs']
 cmdCEGUIOPENGL = ['CEGUI-OpenGL', 'pkg-config CEGUI-0-OPENGL --atleast-version=0.5.0']
 cmdCflagsCEGUIOPENGL = ['CEGUIOPENGL.CXXFLAGS', 'pkg-config CEGUI-0-OPENGL --cflags']
 cmdLflagsCEGUIOPENGL = ['CEGUIOPENGL.LDFLAGS', 'pkg-config CEGUI-0-OPENGL --libs']
+cmdZLIB = ['zlib', 'pkg-config zlib --atleast-version=1.2.0']
+cmdCflagsZLIB = ['ZLIB.CXXFLAGS', 'pkg-config zlib --cflags']
+cmdLflagsZLIB = ['ZLIB.LDFLAGS', 'pkg-config zlib --libs']
+cmdSQLITE = ['SQLite', 'pkg-config sqlite3 --atleast-version=3.33.0']
+cmdCflagsSQLITE = ['SQLITE.CXXFLAGS', 'pkg-config sqlite3 --cflags']
+cmdLflagsSQLITE = ['SQLITE.LDFLAGS', 'pkg-config sqlite3 --libs']
 ######################################################################
 # </Special configuration>
 ######################################################################
@@ -137,6 +143,9 @@ parser.add_option("-b", "--with-bot",
 parser.add_option("-B", "--without-bot",
 		  action="store_false", dest="BOT", default=False,
                   help="don't compile bot [default]")
+parser.add_option("-n", "--no-debug-log",
+		  action="store_true", dest="NODEBUGLOG", default=False,
+                  help="remove the debug messages of the log at compile time")
 (options, args) = parser.parse_args()
 
 #
@@ -170,9 +179,14 @@ else:
     print "Compilation mode not set, aborting"
     os._exit(1)
 
+if options.NODEBUGLOG:
+    CXXFLAGS=CXXFLAGS + " -DLOG_STRIP_DEBUG"
+
 print " - Building mode: " + COMPILE_MODE
 if options.MODE == "F":
     print "   - Target processor: " + MARCH
+if options.NODEBUGLOG:
+    print "   - Debug messages of the log removed"
 print " - Compile flags: " + CXXFLAGS
 writeToFile(JAMRULES_FILE, 'CXXFLAGS = "' + CXXFLAGS + '"')
 writeToFile(JAMRULES_FILE, 'LDFLAGS = "' + LDFLAGS + '"')
@@ -210,6 +224,9 @@ writeToFile(JAMRULES_FILE, 'XERCES.AVAILABLE = "yes"')
 writeToFile(JAMRULES_FILE, 'XERCES.CXXFLAGS = ""')
 writeToFile(JAMRULES_FILE, 'XERCES.LDFLAGS = "-lxerces-c"')
 print " - Xerces-C: OK"
+checkToolLib(cmdZLIB)
+addLibFlags(cmdCflagsZLIB)
+addLibFlags(cmdLflagsZLIB)
 if options.CLIENT:
     print " Client:"
     checkToolLib(cmdOSG)
@@ -236,6 +253,17 @@ if options.SERVER:
     writeToFile(JAMRULES_FILE, 'POSTGRESQL.CXXFLAGS = "-DHAVE_POSTGRESQL"')
     writeToFile(JAMRULES_FILE, 'POSTGRESQL.LDFLAGS = "-lpq"')
     print " - PostgreSQL: OK"
+    # optional, embedded DB (UPDATE ... FROM needs 3.33)
+    (status, output) = commands.getstatusoutput(cmdSQLITE[1])
+    if status == 0:
+	writeToFile(JAMRULES_FILE, 'SQLITE.AVAILABLE = "yes"')
+	(status, output) = commands.getstatusoutput(cmdCflagsSQLITE[1])
+	writeToFile(JAMRULES_FILE, 'SQLITE.CXXFLAGS = "-DHAVE_SQLITE ' + output + '"')
+	addLibFlags(cmdLflagsSQLITE)
+	print " - SQLite: OK"
+    else:
+	writeToFile(JAMRULES_FILE, 'SQLITE.AVAILABLE = "no"')
+	print " - SQLite: not found (optional)"
 
 #
 # finish
@@ -0,0 +1,153 @@
+--
+-- SQLite database schema, equivalent to dbscheme-postgresql.sql
+--
+-- The server creates the tables with this file when the DB is empty (see
+-- Server.Database.SchemaFile in server.cfg), so there's no need to do it by
+-- hand.
+--
+
+CREATE TABLE usr_accts (
+    uid integer PRIMARY KEY AUTOINCREMENT,
+    username varchar(32) NOT NULL UNIQUE,
+    "password" varchar(40) NOT NULL,
+    realname varchar(64),
+    email varchar(64),
+    creation_date timestamp DEFAULT CURRENT_TIMESTAMP,
+    last_login timestamp,
+    last_login_ip varchar(15),
+    time_zone varchar(8),
+    roles integer DEFAULT 0 NOT NULL,
+    status integer DEFAULT 0 NOT NULL,
+    banned_until timestamp,
+    comments varchar(1024),
+    number_logins integer DEFAULT 0 NOT NULL
+);
+
+
+-- There are no sequences in SQLite, so the ids shared by characters, entities
+-- and creatures come from this table, and the triggers below assign them when
+-- the rows are inserted without id.
+CREATE TABLE entities_id_seq (
+    id integer PRIMARY KEY AUTOINCREMENT
+);
+
+
+-- time_playing is the number of seconds (interval in PostgreSQL)
+CREATE TABLE usr_chars (
+    creation_date timestamp DEFAULT CURRENT_TIMESTAMP,
+    last_login timestamp,
+    status integer DEFAULT 0,
+    comments varchar(1024),
+    area varchar(64) NOT NULL,
+    pos1 double precision NOT NULL,
+    pos2 double precision NOT NULL,
+    pos3 double precision NOT NULL,
+    rot double precision NOT NULL,
+    race varchar(32) NOT NULL,
+    gender varchar(1) NOT NULL,
+    class varchar(32) NOT NULL,
+    uid integer REFERENCES usr_accts(uid),
+    cid bigint UNIQUE,
+    charname varchar(64) NOT NULL UNIQUE,
+    number_logins integer DEFAULT 0,
+    time_playing integer DEFAULT 0
+);
+
+
+CREATE TABLE contact_list (
+    charname varchar(64) NOT NULL REFERENCES usr_chars(charname),
+    contact_charname varchar(64) NOT NULL REFERENCES usr_chars(charname),
+    creation_date timestamp DEFAULT CURRENT_TIMESTAMP NOT NULL,
+    "type" integer NOT NULL,
+    comments varchar(1024),
+    cid bigint REFERENCES usr_chars(cid),
+    contact_cid bigint REFERENCES usr_chars(cid)
+);
+
+
+CREATE TABLE player_stats (
+    health integer,
+    stamina integer,
+    magic integer,
+    ab_con integer,
+    ab_str integer,
+    ab_dex integer,
+    ab_int integer,
+    ab_wis integer,
+    ab_cha integer,
+    charname varchar(64) NOT NULL REFERENCES usr_chars(charname),
+    gold integer,
+    xp integer,
+    level integer
+);
+
+
+CREATE TABLE world (
+    "time" integer
+);
+
+
+CREATE TABLE entities (
+    creation_date timestamp NOT NULL,
+    id bigint UNIQUE,
+    area varchar(64) NOT NULL,
+    pos1 double precision NOT NULL,
+    pos2 double precision NOT NULL,
+    pos3 double precision NOT NULL,
+    rot double precision NOT NULL,
+    "type" varchar(32) NOT NULL,
+    subtype varchar(32) NOT NULL,
+    "owner" varchar(64)
+);
+
+
+CREATE TABLE creatures (
+    creation_date timestamp NOT NULL,
+    id bigint UNIQUE,
+    area varchar(64) NOT NULL,
+    pos1 double precision NOT NULL,
+    pos2 double precision NOT NULL,
+    pos3 double precision NOT NULL,
+    rot double precision NOT NULL,
+    "type" varchar(32) NOT NULL,
+    subtype varchar(32) NOT NULL,
+    "owner" varchar(64)
+);
+
+
+CREATE INDEX player_stats_charname_idx ON player_stats(charname);
+CREATE INDEX contact_list_charname_idx ON contact_list(charname);
+
+
+--------------------------------
+-- Ids from the shared sequence
+
+CREATE TRIGGER usr_chars_cid AFTER INSERT ON usr_chars
+    WHEN NEW.cid IS NULL
+BEGIN
+    INSERT INTO entities_id_seq(id) VALUES(NULL);
+    DELETE FROM entities_id_seq WHERE id < (SELECT max(id) FROM entities_id_seq);
+    UPDATE usr_chars SET cid=(SELECT max(id) FROM entities_id_seq)
+        WHERE rowid=NEW.rowid;
+END;
+
+CREATE TRIGGER entities_id AFTER INSERT ON entities
+    WHEN NEW.id IS NULL
+BEGIN
+    INSERT INTO entities_id_seq(id) VALUES(NULL);
+    DELETE FROM entities_id_seq WHERE id < (SELECT max(id) FROM entities_id_seq);
+    UPDATE entities SET id=(SELECT max(id) FROM entities_id_seq)
+        WHERE rowid=NEW.rowid;
+END;
+
+CREATE TRIGGER creatures_id AFTER INSERT ON creatures
+    WHEN NEW.id IS NULL
+BEGIN
+    INSERT INTO entities_id_seq(id) VALUES(NULL);
+    DELETE FROM entities_id_seq WHERE id < (SELECT max(id) FROM entities_id_seq);
+    UPDATE creatures SET id=(SELECT max(id) FROM entities_id_seq)
+        WHERE rowid=NEW.rowid;
+END;
+
+
+INSERT INTO world(time) VALUES(0);
@@ -31,6 +31,7 @@
 #include "bot.h"
 #include "botcommand.h"
 #include "botinventory.h"
+#include "botloginbench.h"
 #include "action/bottradeinv.h"
 #include "action/botmove.h"
 
@@ -208,6 +209,53 @@ public:
 };
 
 
+/** Benchmark of the logins in the server
+ */
+class BotCommandLoginBench : public Command
+{
+public:
+	BotCommandLoginBench() :
+		Command(PermLevel::PLAYER,
+			  "loginbench",
+			  "Measure the logins per second that the server attends")
+	{
+		mArgNames.push_back(string("connections"));
+		mArgNames.push_back(string("logins"));
+		mArgNames.push_back(string("username"));
+		mArgNames.push_back(string("password"));
+	}
+
+	virtual void execute(vector<string>& args, CommandOutput& out) {
+		if (args.size() != 4) {
+			out.appendLine("/loginbench connections logins username password");
+			return;
+		}
+
+		int connections = atoi(args[0].c_str());
+		int logins = atoi(args[1].c_str());
+		if (connections <= 0 || logins <= 0) {
+			out.appendLine("Connections and logins must be positive numbers");
+			return;
+		}
+
+		string host = ConfigMgr::instance().getConfigVar("Bot.Settings.Hostname", "localhost");
+		int port = atoi(ConfigMgr::instance().getConfigVar("Bot.Settings.Port", "20768"));
+		out.appendLine(StrFmt("Login benchmark: %d logins with %d connections to %s:%d...",
+				      logins, connections, host.c_str(), port));
+
+		BotLoginBench bench(host, port, args[2], args[3]);
+		if (!bench.run(connections, logins)) {
+			out.appendLine("Login benchmark not completed");
+		}
+		out.appendLine(StrFmt("Logins: %d ok, %d failed; %.1f logins/s;"
+				      " latency avg %.2f ms, max %.2f ms",
+				      bench.getLogins(), bench.getFailures(),
+				      bench.getLoginsPerSecond(),
+				      bench.getAvgLatency(), bench.getMaxLatency()));
+	}
+};
+
+
 class BotCommandJoin : public Command
 {
 public:
@@ -731,6 +779,7 @@ void BotCommandMgr::registerCommands()
 	addCommand(new BotCommandAuto());
 	addCommand(new BotCommandConnect());
 	addCommand(new BotCommandLogin());
+	addCommand(new BotCommandLoginBench());
 	addCommand(new BotCommandJoin());
 	addCommand(new BotCommandSay());
 	addCommand(new BotCommandPrivateMessage());
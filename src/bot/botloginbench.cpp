@@ -0,0 +1,274 @@
+/*
+ * botloginbench.cpp
+ * Copyright (C) 2006-2008 by Manuel A. Fernandez Montecelo <mafm@users.sourceforge.net>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "common/net/msgs.h"
+#include "common/sha1.h"
+
+#include "botloginbench.h"
+
+#include <poll.h>
+#include <sys/time.h>
+
+
+/// Seconds without any reply from the server before giving up
+#define LOGINBENCH_TIMEOUT	30
+
+
+/*******************************************************************************
+ * Handlers of the replies, forwarding them to the benchmark
+ ******************************************************************************/
+class BenchHdlConnectReply : public MsgHdlBase
+{
+public:
+	BenchHdlConnectReply(BotLoginBench* b) : mBench(b) { }
+	virtual MsgType getMsgType() const {
+		return MsgConnectReply::mType;
+	}
+	virtual void handleMsg(MsgBase& baseMsg, Netlink* netlink) {
+		MsgConnectReply* msg = dynamic_cast<MsgConnectReply*>(&baseMsg);
+		mBench->connectReplied(netlink,
+				       msg->resultCode == MsgUtils::Errors::SUCCESS);
+	}
+private:
+	BotLoginBench* mBench;
+};
+
+class BenchHdlLoginReply : public MsgHdlBase
+{
+public:
+	BenchHdlLoginReply(BotLoginBench* b) : mBench(b) { }
+	virtual MsgType getMsgType() const {
+		return MsgLoginReply::mType;
+	}
+	virtual void handleMsg(MsgBase& baseMsg, Netlink* netlink) {
+		MsgLoginReply* msg = dynamic_cast<MsgLoginReply*>(&baseMsg);
+		if (msg->resultCode != MsgUtils::Errors::SUCCESS) {
+			LogWRN("Login failed: %s",
+			       MsgUtils::Errors::getDescription(msg->resultCode));
+		}
+		mBench->loginReplied(netlink,
+				     msg->resultCode == MsgUtils::Errors::SUCCESS);
+	}
+private:
+	BotLoginBench* mBench;
+};
+
+
+/*******************************************************************************
+ * BotLoginBench
+ ******************************************************************************/
+BotLoginBench::BotLoginBench(const std::string& host, int port,
+			     const std::string& username, const std::string& password) :
+	mHost(host), mPort(port), mUsername(username),
+	mStarted(0), mLogins(0), mFailures(0),
+	mElapsed(0.0), mTotalLatency(0.0), mMaxLatency(0.0)
+{
+	SHA1::encode(password.c_str(), mPassword);
+
+	mMsgHdlFactory.registerMsgWithHdl(new MsgConnectReply,
+					  new BenchHdlConnectReply(this));
+	mMsgHdlFactory.registerMsgWithHdl(new MsgLoginReply,
+					  new BenchHdlLoginReply(this));
+}
+
+BotLoginBench::~BotLoginBench()
+{
+	for (size_t i = 0; i < mSlots.size(); ++i) {
+		mSlots[i]->socketLayer.disconnect();
+		delete mSlots[i];
+	}
+}
+
+bool BotLoginBench::run(int connections, int logins)
+{
+	if (connections <= 0 || logins <= 0)
+		return false;
+
+	for (int i = 0; i < connections; ++i) {
+		mSlots.push_back(new Slot());
+	}
+
+	double start = getTimeMsec();
+	double lastReply = start;
+	for (size_t i = 0; i < mSlots.size(); ++i) {
+		startSlot(mSlots[i], logins);
+	}
+
+	std::vector<struct pollfd> fds;
+	std::vector<Slot*> fdSlots;
+	while (mLogins + mFailures < logins) {
+		fds.clear();
+		fdSlots.clear();
+		for (size_t i = 0; i < mSlots.size(); ++i) {
+			Slot* slot = mSlots[i];
+			if (slot->state == Slot::IDLE)
+				continue;
+			struct pollfd pfd;
+			pfd.fd = slot->netlink.getSocket();
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			fds.push_back(pfd);
+			fdSlots.push_back(slot);
+		}
+		if (fds.empty()) {
+			LogERR("Login benchmark: no connections left, aborting");
+			break;
+		}
+
+		int result = poll(&fds[0], fds.size(), 1000);
+		if (result < 0) {
+			LogERR("Login benchmark: poll failed, aborting");
+			break;
+		} else if (result == 0) {
+			if (getTimeMsec() - lastReply > LOGINBENCH_TIMEOUT*1000.0) {
+				LogERR("Login benchmark: no replies in %d seconds, aborting",
+				       LOGINBENCH_TIMEOUT);
+				break;
+			}
+			continue;
+		}
+		lastReply = getTimeMsec();
+
+		for (size_t i = 0; i < fds.size(); ++i) {
+			if (fds[i].revents == 0)
+				continue;
+			Slot* slot = fdSlots[i];
+			if (!slot->netlink.processIncomingMsgs(mMsgHdlFactory)) {
+				stopSlot(slot);
+			} else {
+				slot->netlink.processOutgoingMsgs();
+			}
+		}
+
+		// connect again the ones finished
+		for (size_t i = 0; i < mSlots.size(); ++i) {
+			Slot* slot = mSlots[i];
+			if (slot->state == Slot::DONE) {
+				stopSlot(slot);
+				startSlot(slot, logins);
+			}
+		}
+	}
+	mElapsed = getTimeMsec() - start;
+
+	for (size_t i = 0; i < mSlots.size(); ++i) {
+		stopSlot(mSlots[i]);
+	}
+
+	return mLogins + mFailures >= logins;
+}
+
+double BotLoginBench::getLoginsPerSecond() const
+{
+	if (mElapsed <= 0.0)
+		return 0.0;
+	return mLogins * 1000.0 / mElapsed;
+}
+
+double BotLoginBench::getAvgLatency() const
+{
+	if (mLogins + mFailures == 0)
+		return 0.0;
+	return mTotalLatency / (mLogins + mFailures);
+}
+
+void BotLoginBench::connectReplied(Netlink* netlink, bool success)
+{
+	Slot* slot = static_cast<Slot*>(netlink->getSession());
+	if (!slot || slot->state != Slot::CONNECTING)
+		return;
+
+	if (!success) {
+		++mFailures;
+		slot->state = Slot::DONE;
+		return;
+	}
+
+	MsgLogin login;
+	login.username = mUsername;
+	login.pw_md5sum = mPassword;
+	slot->sentTime = getTimeMsec();
+	slot->state = Slot::LOGGING_IN;
+	netlink->sendMsg(login);
+}
+
+void BotLoginBench::loginReplied(Netlink* netlink, bool success)
+{
+	Slot* slot = static_cast<Slot*>(netlink->getSession());
+	if (!slot || slot->state != Slot::LOGGING_IN)
+		return;
+
+	double latency = getTimeMsec() - slot->sentTime;
+	mTotalLatency += latency;
+	if (latency > mMaxLatency)
+		mMaxLatency = latency;
+	if (success)
+		++mLogins;
+	else
+		++mFailures;
+	slot->state = Slot::DONE;
+}
+
+void BotLoginBench::startSlot(Slot* slot, int logins)
+{
+	if (mStarted >= logins)
+		return;
+
+	if (!slot->socketLayer.connectToServer(mHost.c_str(), mPort)) {
+		LogERR("Login benchmark: couldn't connect to the server");
+		return;
+	}
+	++mStarted;
+	slot->netlink.setSession(slot);
+	slot->state = Slot::CONNECTING;
+
+	MsgConnect msg;
+	slot->netlink.sendMsg(msg);
+}
+
+void BotLoginBench::stopSlot(Slot* slot)
+{
+	if (slot->state == Slot::IDLE)
+		return;
+
+	// lost in the middle of a request
+	if (slot->state == Slot::CONNECTING || slot->state == Slot::LOGGING_IN)
+		++mFailures;
+
+	slot->socketLayer.disconnect();
+	slot->state = Slot::IDLE;
+}
+
+double BotLoginBench::getTimeMsec()
+{
+	struct timeval now;
+	gettimeofday(&now, 0);
+	return now.tv_sec * 1000.0 + now.tv_usec / 1000.0;
+}
+
+
+// Local Variables: ***
+// mode: C++ ***
+// tab-width: 8 ***
+// c-basic-offset: 8 ***
+// indent-tabs-mode: t ***
+// fill-column: 80 ***
+// End: ***
+// ex: shiftwidth=2 tabstop=8
@@ -0,0 +1,127 @@
+/*
+ * botloginbench.h
+ * Copyright (C) 2006-2008 by Manuel A. Fernandez Montecelo <mafm@users.sourceforge.net>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FEARANN_BOT_LOGIN_BENCH_H__
+#define __FEARANN_BOT_LOGIN_BENCH_H__
+
+#include "common/net/netlayer.h"
+#include "common/net/msgbase.h"
+
+#include <string>
+#include <vector>
+
+
+/** Benchmark of the login pipeline of the server: it opens several connections
+ * at once, and each one connects, logs in and disconnects again and again,
+ * until the number of logins requested is done.  The result is the number of
+ * logins per second, and the latency of the login requests (from sending the
+ * request until receiving the reply).
+ *
+ * @author mafm
+ */
+class BotLoginBench
+{
+public:
+	/** Constructor */
+	BotLoginBench(const std::string& host, int port,
+		      const std::string& username, const std::string& password);
+	/** Destructor */
+	~BotLoginBench();
+
+	/** Run the benchmark (blocking until finished), returns false if it
+	 * couldn't be completed */
+	bool run(int connections, int logins);
+
+	/** Logins completed successfully */
+	int getLogins() const { return mLogins; }
+	/** Logins failed (rejected by the server or connections lost) */
+	int getFailures() const { return mFailures; }
+	/** Logins per second */
+	double getLoginsPerSecond() const;
+	/** Average latency of the login requests, in milliseconds */
+	double getAvgLatency() const;
+	/** Maximum latency of the login requests, in milliseconds */
+	double getMaxLatency() const { return mMaxLatency; }
+
+	/** Called by the handlers when the connect reply arrives */
+	void connectReplied(Netlink* netlink, bool success);
+	/** Called by the handlers when the login reply arrives */
+	void loginReplied(Netlink* netlink, bool success);
+
+private:
+	/** Each of the connections used */
+	class Slot {
+	public:
+		Slot() : socketLayer(&netlink), state(IDLE), sentTime(0.0) { }
+		/** State of the connection */
+		enum STATE { IDLE = 1, CONNECTING, LOGGING_IN, DONE };
+		Netlink netlink;
+		SocketLayer socketLayer;
+		STATE state;
+		/// Time when the last request was sent, in milliseconds
+		double sentTime;
+	};
+
+	/// Server to connect to
+	std::string mHost;
+	/// Port of the server
+	int mPort;
+	/// User name to log in
+	std::string mUsername;
+	/// Password, already encoded as the server expects it
+	std::string mPassword;
+	/// Connections
+	std::vector<Slot*> mSlots;
+	/// Message and handler factory, only with the replies that we need
+	MsgHdlFactory mMsgHdlFactory;
+
+	/// Logins started
+	int mStarted;
+	/// Logins done successfully
+	int mLogins;
+	/// Logins failed
+	int mFailures;
+	/// Time elapsed in the whole run, in milliseconds
+	double mElapsed;
+	/// Sum of the latencies, to calculate the average
+	double mTotalLatency;
+	/// Maximum latency
+	double mMaxLatency;
+
+	/** Connect the slot and send the first request, if there are logins
+	 * left to start */
+	void startSlot(Slot* slot, int logins);
+	/** Disconnect the slot, counting a failure if it was in the middle
+	 * of a request */
+	void stopSlot(Slot* slot);
+	/** Current time, in milliseconds */
+	static double getTimeMsec();
+};
+
+
+#endif
+
+
+// Local Variables: ***
+// mode: C++ ***
+// tab-width: 8 ***
+// c-basic-offset: 8 ***
+// indent-tabs-mode: t ***
+// fill-column: 80 ***
+// End: ***
+// ex: shiftwidth=2 tabstop=8
@@ -0,0 +1,261 @@
+/*
+ * cltcontentmanifest.cpp
+ * Copyright (C) 2006-2008 by Manuel A. Fernandez Montecelo <mafm@users.sourceforge.net>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "cltcontentmanifest.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+
+/// Identifier of the manifest files
+const char MANIFEST_MAGIC[4] = { 'F', 'M', 'C', 'M' };
+
+/// Version of the format of the manifest files
+const uint32_t MANIFEST_VERSION = 1;
+
+/// Size of the header: identifier, version and number of files
+const size_t MANIFEST_HEADER_SIZE = 12;
+
+/// Size of the fixed part of each file: size, modification time, and length
+/// of the name and the update key (followed by them)
+const size_t MANIFEST_FILE_SIZE = 12;
+
+
+/*******************************************************************************
+ * CltContentManifest
+ ******************************************************************************/
+CltContentManifest::CltContentManifest(const string& path) :
+	mPath(path), mLoaded(false), mData(0), mSize(0)
+{
+}
+
+CltContentManifest::~CltContentManifest()
+{
+	unmap();
+}
+
+void CltContentManifest::unmap()
+{
+	if (mData) {
+		munmap(const_cast<char*>(mData), mSize);
+		mData = 0;
+		mSize = 0;
+	}
+}
+
+bool CltContentManifest::load()
+{
+	if (mLoaded)
+		return true;
+
+	int fd = open(mPath.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat buf;
+	if (fstat(fd, &buf) != 0
+	    || static_cast<size_t>(buf.st_size) < MANIFEST_HEADER_SIZE) {
+		LogWRN("Content manifest not valid: '%s'", mPath.c_str());
+		close(fd);
+		return false;
+	}
+	void* data = mmap(0, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		LogERR("Unable to map content manifest '%s': %s",
+		       mPath.c_str(), strerror(errno));
+		return false;
+	}
+	mData = static_cast<const char*>(data);
+	mSize = buf.st_size;
+
+	// check the header and that all the files can be read, sorted
+	try {
+		uint32_t version = 0, count = 0;
+		memcpy(&version, mData + 4, 4);
+		memcpy(&count, mData + 8, 4);
+		if (memcmp(mData, MANIFEST_MAGIC, 4) != 0 || version != MANIFEST_VERSION)
+			throw "Content manifest not valid";
+
+		const char* position = mData + MANIFEST_HEADER_SIZE;
+		string name, previousName;
+		Entry entry;
+		for (uint32_t i = 0; i < count; ++i) {
+			position = readFile(position, name, entry);
+			if (!position)
+				throw "Content manifest truncated";
+			if (i > 0 && !(previousName < name))
+				throw "Content manifest not sorted";
+			previousName.swap(name);
+		}
+		if (position != mData + mSize)
+			throw "Content manifest with trailing data";
+	} catch (const char* error) {
+		LogWRN("%s: '%s'", error, mPath.c_str());
+		unmap();
+		return false;
+	}
+
+	mLoaded = true;
+	return true;
+}
+
+const char* CltContentManifest::readFile(const char* position,
+					 string& name,
+					 Entry& entry) const
+{
+	const char* end = mData + mSize;
+	if (position + MANIFEST_FILE_SIZE > end)
+		return 0;
+
+	uint16_t nameLength = 0, keyLength = 0;
+	memcpy(&entry.size, position, 4);
+	memcpy(&entry.mtime, position + 4, 4);
+	memcpy(&nameLength, position + 8, 2);
+	memcpy(&keyLength, position + 10, 2);
+	position += MANIFEST_FILE_SIZE;
+	if (position + nameLength + keyLength > end)
+		return 0;
+
+	name.assign(position, nameLength);
+	entry.updateKey.assign(position + nameLength, keyLength);
+	return position + nameLength + keyLength;
+}
+
+void CltContentManifest::getFiles(FileList& files) const
+{
+	// mafm: merging the files saved with the changes, both sorted
+	files.clear();
+	map<string, Entry>::const_iterator change = mChanges.begin();
+	if (mData) {
+		uint32_t count = 0;
+		memcpy(&count, mData + 8, 4);
+		files.reserve(count + mChanges.size());
+
+		const char* position = mData + MANIFEST_HEADER_SIZE;
+		string name;
+		Entry entry;
+		for (uint32_t i = 0; i < count; ++i) {
+			position = readFile(position, name, entry);
+			while (change != mChanges.end() && change->first < name) {
+				files.push_back(*change);
+				++change;
+			}
+			if (change != mChanges.end() && change->first == name) {
+				files.push_back(*change);
+				++change;
+			} else if (mRemoved.find(name) == mRemoved.end()) {
+				files.push_back(make_pair(name, entry));
+			}
+		}
+	}
+	for (; change != mChanges.end(); ++change) {
+		files.push_back(*change);
+	}
+}
+
+void CltContentManifest::setFile(const string& name, const Entry& entry)
+{
+	mRemoved.erase(name);
+	mChanges[name] = entry;
+}
+
+void CltContentManifest::removeFile(const string& name)
+{
+	mChanges.erase(name);
+	mRemoved.insert(name);
+}
+
+bool CltContentManifest::save()
+{
+	if (mChanges.empty() && mRemoved.empty())
+		return true;
+
+	// merge the changes with the manifest saved, if any and not loaded yet
+	// (otherwise we would lose the files in it)
+	if (!mLoaded)
+		load();
+
+	FileList files;
+	getFiles(files);
+	for (FileList::iterator it = files.begin(); it != files.end(); ) {
+		if (it->first.size() > 0xffff || it->second.updateKey.size() > 0xffff) {
+			LogWRN("Name too long for the content manifest: '%s'",
+			       it->first.c_str());
+			it = files.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	// write to a temporary file and rename it, so the manifest is never
+	// left half written
+	string tmpPath = mPath + ".tmp";
+	FILE* file = fopen(tmpPath.c_str(), "wb");
+	if (!file) {
+		LogERR("Couldn't save the content manifest: '%s'", tmpPath.c_str());
+		return false;
+	}
+	uint32_t count = files.size();
+	bool written = (fwrite(MANIFEST_MAGIC, 4, 1, file) == 1
+			&& fwrite(&MANIFEST_VERSION, 4, 1, file) == 1
+			&& fwrite(&count, 4, 1, file) == 1);
+	for (size_t i = 0; written && i < files.size(); ++i) {
+		const string& name = files[i].first;
+		const Entry& entry = files[i].second;
+		uint16_t nameLength = name.size();
+		uint16_t keyLength = entry.updateKey.size();
+		written = (fwrite(&entry.size, 4, 1, file) == 1
+			   && fwrite(&entry.mtime, 4, 1, file) == 1
+			   && fwrite(&nameLength, 2, 1, file) == 1
+			   && fwrite(&keyLength, 2, 1, file) == 1
+			   && fwrite(name.data(), 1, nameLength, file) == nameLength
+			   && fwrite(entry.updateKey.data(), 1, keyLength, file) == keyLength);
+	}
+	if (fclose(file) != 0 || !written
+	    || rename(tmpPath.c_str(), mPath.c_str()) != 0) {
+		LogERR("Couldn't save the content manifest: '%s'", mPath.c_str());
+		unlink(tmpPath.c_str());
+		return false;
+	}
+
+	// map the new one
+	unmap();
+	mLoaded = false;
+	mChanges.clear();
+	mRemoved.clear();
+	return load();
+}
+
+
+// Local Variables: ***
+// mode: C++ ***
+// tab-width: 8 ***
+// c-basic-offset: 8 ***
+// indent-tabs-mode: t ***
+// fill-column: 80 ***
+// End: ***
+// ex: shiftwidth=2 tabstop=8
@@ -0,0 +1,111 @@
+/*
+ * cltcontentmanifest.h
+ * Copyright (C) 2006-2008 by Manuel A. Fernandez Montecelo <mafm@users.sourceforge.net>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FEARANN_CLIENT_CONTENT_MANIFEST_H__
+#define __FEARANN_CLIENT_CONTENT_MANIFEST_H__
+
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+
+/** Manifest of the local content: the update key of each file, with the size
+ * and modification time that it had when downloaded, to know whether it
+ * changed since then.
+ *
+ * It's saved in a single binary file (in the byte order of the machine, it's
+ * not meant to be shared), with the files sorted by name, which is mapped in
+ * memory when loaded; so building the update query doesn't need to open a file
+ * for each one.  The changes are kept apart until saved, and then the file is
+ * written again and replaced atomically.
+ *
+ * @author mafm
+ */
+class CltContentManifest
+{
+public:
+	/** Information of a file in the manifest */
+	class Entry {
+	public:
+		Entry() : size(0), mtime(0) { }
+		/// Update key given by the server
+		std::string updateKey;
+		/// Size of the file when downloaded
+		uint32_t size;
+		/// Modification time of the file when downloaded
+		uint32_t mtime;
+	};
+	/// List of files (name and information), sorted by name
+	typedef std::vector<std::pair<std::string, Entry> > FileList;
+
+	/** Constructor, with the path of the file where it's saved */
+	CltContentManifest(const std::string& path);
+	/** Destructor */
+	~CltContentManifest();
+
+	/** Load the manifest saved, if not loaded yet.  Returns false if it
+	 * doesn't exist or it's not valid. */
+	bool load();
+	/** Save the manifest, if changed (merging the changes with the one
+	 * saved, loading it if needed).  Returns false if there's an
+	 * error. */
+	bool save();
+
+	/** Get the files in the manifest, sorted by name */
+	void getFiles(FileList& files) const;
+	/** Set the information of a file (added or updated) */
+	void setFile(const std::string& name, const Entry& entry);
+	/** Remove a file */
+	void removeFile(const std::string& name);
+
+private:
+	/// Path of the file where it's saved
+	std::string mPath;
+	/// Whether the manifest saved is loaded
+	bool mLoaded;
+	/// The manifest saved, mapped in memory (0 if not)
+	const char* mData;
+	/// Size of the manifest saved
+	size_t mSize;
+	/// Files added or updated since loaded
+	std::map<std::string, Entry> mChanges;
+	/// Files removed since loaded
+	std::set<std::string> mRemoved;
+
+	/** Read the file at the given position of the manifest saved.
+	 * Returns the position of the next one, or 0 if not valid. */
+	const char* readFile(const char* position,
+			     std::string& name,
+			     Entry& entry) const;
+	/** Unmap the manifest saved, if mapped */
+	void unmap();
+};
+
+#endif
+
+
+// Local Variables: ***
+// mode: C++ ***
+// tab-width: 8 ***
+// c-basic-offset: 8 ***
+// indent-tabs-mode: t ***
+// fill-column: 80 ***
+// End: ***
+// ex: shiftwidth=2 tabstop=8
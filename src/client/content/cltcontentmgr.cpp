@@ -20,27 +20,45 @@
 #include "client/cltconfig.h"
 
 #include "cltcontentmgr.h"
+#include "cltcontentmanifest.h"
 
 #include "common/net/msgs.h"
+#include "common/blocksum.h"
+#include "common/sha1.h"
 
 #include "client/net/cltnetmgr.h"
 
+#include <algorithm>
 #include <deque>
 #include <string>
 #include <fstream>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <cerrno>
 #include <cstdlib>
+#include <cstring>
 
+#include <zlib.h>
 
-/// This suffix is used to store a key value in original_filename.suffix, we'll
-/// send back the value when asking for updates, and so the server knows whether
-/// the file is outdated or not
+
+/// Size of the buffer to decompress the data received
+#define INFLATE_BUFFER_SIZE (16*1024)
+
+/// This suffix was used to store a key value in original_filename.suffix, now
+/// they're kept in the manifest and these files are only read to import them
 #define CONTROL_FILE_SUFFIX ".control"
 
+/// Name of the manifest file, in the root of the content dir
+#define MANIFEST_FILENAME ".manifest"
+
+/// This suffix is used for the files being received, until they're completed
+/// and renamed (ending with '~', so they're ignored as backup files)
+#define TEMP_FILE_SUFFIX ".part~"
+
 
 /*******************************************************************************
  * PartialContentFile
@@ -48,16 +66,153 @@
 PartialContentFile::PartialContentFile(const char* filename,
 				       const char* updateKey,
 				       uint32_t size,
-				       uint32_t parts) :
+				       uint32_t compressedSize) :
 	mFilename(filename), mUpdateKey(updateKey),
-	mSize(size), mPartsTotal(parts)
+	mSize(size),
+	mFile(-1), mReceived(0), mOldData(0), mOldSize(0), mInflater(0)
 {
 	mPartsCurrent = 0;
 	mCompleted = false;
+
+	mFullPath = StrFmt("%s/%s", CONTENT_DIR, mFilename.c_str());
+	mTempPath = mFullPath + TEMP_FILE_SUFFIX;
+
+	if (compressedSize > 0) {
+		mInflater = new z_stream;
+		mInflater->zalloc = Z_NULL;
+		mInflater->zfree = Z_NULL;
+		mInflater->opaque = Z_NULL;
+		mInflater->next_in = Z_NULL;
+		mInflater->avail_in = 0;
+		if (inflateInit(mInflater) != Z_OK) {
+			LogERR("Couldn't initialize the decompression of '%s'",
+			       mFilename.c_str());
+			delete mInflater;
+			mInflater = 0;
+			mCompleted = true;
+		}
+	}
+}
+
+PartialContentFile::~PartialContentFile()
+{
+	// the temporary file is left only if something went wrong
+	if (mFile >= 0) {
+		close(mFile);
+		unlink(mTempPath.c_str());
+	}
+	unmapOldData();
+	if (mInflater) {
+		inflateEnd(mInflater);
+		delete mInflater;
+	}
+}
+
+void PartialContentFile::prepareDelta(MsgContentFileSums& msg)
+{
+	msg.blockSize = 0;
+	msg.weakSums.clear();
+	msg.strongSums.clear();
+
+	// map the old version (it stays valid even when the new one replaces
+	// it in the directory)
+	int fd = open(mFullPath.c_str(), O_RDONLY);
+	if (fd < 0) {
+		LogWRN("Couldn't read the old version of '%s', getting the whole file",
+		       mFullPath.c_str());
+		return;
+	}
+	struct stat buf;
+	if (fstat(fd, &buf) != 0 || buf.st_size <= 0) {
+		close(fd);
+		return;
+	}
+	void* data = mmap(0, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		LogWRN("Couldn't read the old version of '%s', getting the whole file",
+		       mFullPath.c_str());
+		return;
+	}
+	mOldData = static_cast<const char*>(data);
+	mOldSize = buf.st_size;
+
+	// checksums of the complete blocks (the tail, if any, is sent again)
+	msg.blockSize = BlockSum::getBlockSize(mOldSize);
+	size_t blocks = mOldSize / msg.blockSize;
+	for (size_t i = 0; i < blocks; ++i) {
+		const char* block = mOldData + i * msg.blockSize;
+		msg.weakSums.push_back(BlockSum::getWeak(block, msg.blockSize));
+		msg.strongSums.push_back(BlockSum::getStrong(block, msg.blockSize));
+	}
+}
+
+void PartialContentFile::unmapOldData()
+{
+	if (mOldData) {
+		munmap(const_cast<char*>(mOldData), mOldSize);
+		mOldData = 0;
+		mOldSize = 0;
+	}
+}
+
+bool PartialContentFile::openTempFile()
+{
+	if (mFile >= 0)
+		return true;
+
+	string dirpath = mFullPath.substr(0, mFullPath.rfind('/'));
+	if (!CltContentMgr::makeDirsIfNeeded(dirpath)) {
+		LogERR("Directory hierarchy not ready to write the file: '%s'",
+		       mFullPath.c_str());
+		return false;
+	}
+
+	// (opened to read too, to check the hash when completed)
+	mFile = open(mTempPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (mFile < 0) {
+		LogERR("Failed opening the file in write mode: '%s': %s",
+		       mTempPath.c_str(), strerror(errno));
+		return false;
+	}
+
+	// reserve the space now, so the file is not fragmented as it grows
+	// and we know if the disk is full from the beginning (not all the
+	// filesystems support it, so we ignore other errors)
+	if (mSize > 0) {
+		int result = posix_fallocate(mFile, 0, mSize);
+		if (result == ENOSPC) {
+			LogERR("Not enough space in disk for file '%s'", mFullPath.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+bool PartialContentFile::appendData(const char* data, size_t size)
+{
+	// mafm: the parts arrive in order, so we only append (but writing at
+	// the offset, since the file is preallocated)
+	while (size > 0) {
+		ssize_t written = pwrite(mFile, data, size, mReceived);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			LogERR("Failed writing the file to the disk: '%s': %s",
+			       mTempPath.c_str(), strerror(errno));
+			return false;
+		}
+		data += written;
+		size -= written;
+		mReceived += written;
+	}
+	return true;
 }
 
 bool PartialContentFile::addPart(uint32_t numPart,
-				 const vector<char>& buffer)
+				 const vector<char>& buffer,
+				 uint32_t copyOffset,
+				 uint32_t copySize)
 {
 	// mafm: the return value means if the file is finished or not (and
 	// thus, ready to write it to disk), not always matching with if there
@@ -76,76 +231,138 @@ bool PartialContentFile::addPart(uint32_t numPart,
 		LogWRN("File '%s': received part %u, expected %u, ignoring",
 		       mFilename.c_str(), numPart, mPartsCurrent);
 		return false;
-	} else if (buffer.size() == 0 && mSize != 0) {
+	} else if (buffer.size() == 0 && copySize == 0 && mSize != 0) {
 		LogWRN("Empty chunk sent, but file size not zero: %s",
 		       mFilename.c_str());
 		mCompleted = true;
 		return true;
+	} else if (copySize > 0
+		   && (copyOffset > mOldSize
+		       || copySize > mOldSize - copyOffset)) {
+		LogWRN("File '%s': part %u refers to data out of the old version, ignoring",
+		       mFilename.c_str(), numPart);
+		mCompleted = true;
+		return true;
+	} else if (!openTempFile()) {
+		mCompleted = true;
+		return true;
 	}
 
-	// add the new data to the current one
-	for (size_t i = 0; i < buffer.size(); ++i) {
-		mData.push_back(buffer[i]);
+	// write the new data (decompressing it if needed), and then the data
+	// of the old version
+	bool dataOK = true;
+	if (mInflater) {
+		dataOK = inflatePart(buffer);
+	} else if (!buffer.empty()) {
+		dataOK = appendData(&buffer[0], buffer.size());
+	}
+	if (dataOK && copySize > 0) {
+		dataOK = appendData(mOldData + copyOffset, copySize);
+	}
+	if (!dataOK) {
+		mCompleted = true;
+		return true;
 	}
 	++mPartsCurrent;
 
-	// check whether we're finished
-	if (mPartsCurrent == mPartsTotal && mData.size() == mSize) {
+	// check whether we're finished: the size of the parts depends on the
+	// connection, so the file is complete when we have received the size
+	// announced
+	if (mReceived >= mSize) {
 		mCompleted = true;
+		unmapOldData();
 		return true;
 	} else {
 		return false;
 	}
+}
 
-	/* mafm: old code left somewhere
+bool PartialContentFile::inflatePart(const vector<char>& buffer)
+{
+	if (buffer.empty())
+		return true;
+
+	char out[INFLATE_BUFFER_SIZE];
+	mInflater->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(&buffer[0]));
+	mInflater->avail_in = buffer.size();
+
+	int result = Z_OK;
+	while (mInflater->avail_in > 0 && result != Z_STREAM_END) {
+		mInflater->next_out = reinterpret_cast<Bytef*>(out);
+		mInflater->avail_out = sizeof(out);
+		result = inflate(mInflater, Z_NO_FLUSH);
+		if (result != Z_OK && result != Z_STREAM_END) {
+			LogWRN("File '%s': compressed data not valid (zlib error %d)",
+			       mFilename.c_str(), result);
+			return false;
+		}
+
+		size_t produced = sizeof(out) - mInflater->avail_out;
+		if (mReceived + produced > mSize) {
+			LogWRN("File '%s': compressed data bigger than the size announced",
+			       mFilename.c_str());
+			return false;
+		}
+		if (!appendData(out, produced))
+			return false;
+	}
+	return true;
+}
 
-	// mafm: we don't calculate the md5sum now so this function doesn't make
-	// much sense, it might be better to delete it if we don't make reliable
-	// tests
+bool PartialContentFile::checkContentHash() const
+{
+	// the update key is the hash of the content, so we can check that we
+	// received (or rebuilt) the file correctly
+	string hash;
+	if (mSize == 0) {
+		SHA1::encode("", 0, hash);
+		return hash == mUpdateKey;
+	}
 
-	// calculate the size
-	if (mData.size() != mSize) {
-		LogERR("Sizes don't match for file '%s':\n"
-		       " - %zu (reported by server)\n"
-		       " - %zu (data received)",
-		       mFilename.c_str(), mSize, mData.size());
+	void* data = mmap(0, mSize, PROT_READ, MAP_SHARED, mFile, 0);
+	if (data == MAP_FAILED) {
+		LogERR("Unable to map file '%s': %s", mTempPath.c_str(), strerror(errno));
 		return false;
-	} else {
-		return true;
 	}
-	*/
+	madvise(data, mSize, MADV_SEQUENTIAL);
+	SHA1::encode(static_cast<const char*>(data), mSize, hash);
+	munmap(data, mSize);
+	return hash == mUpdateKey;
 }
 
 bool PartialContentFile::writeToDisk()
 {
-	string fullpath = StrFmt("%s/%s", CONTENT_DIR, mFilename.c_str());
-
 	try {
 		// sanity checks
 		if (!isComplete())
 			throw "File not valid/complete, refusing to write it";
-
-		// write file
-		bool writtenOK = CltContentMgr::writeFileToDisk(fullpath,
-								&mData[0],
-								mData.size());
-		if (!writtenOK)
+		if (!openTempFile())
 			throw "Failed to save file to disk";
-
-		// write control file
-		string controlFilename(fullpath + CONTROL_FILE_SUFFIX);
-		writtenOK = CltContentMgr::writeFileToDisk(fullpath + CONTROL_FILE_SUFFIX,
-							   mUpdateKey.data(),
-							   mUpdateKey.size());
-		if (!writtenOK)
-			throw "Failed to save control file to disk";
+		if (mReceived != mSize)
+			throw "Size of the file doesn't match the one in the server, refusing to write it";
+		if (!checkContentHash())
+			throw "Content of the file doesn't match the one in the server, refusing to write it";
+
+		// the data is already written in the temporary file, replace
+		// the old version with it (atomically, so we never leave a half
+		// written file)
+		if (close(mFile) != 0) {
+			mFile = -1;
+			unlink(mTempPath.c_str());
+			throw "Failed to save file to disk";
+		}
+		mFile = -1;
+		if (rename(mTempPath.c_str(), mFullPath.c_str()) != 0) {
+			unlink(mTempPath.c_str());
+			throw "Failed to save file to disk";
+		}
 
 		// could write the files, finishing...
-		LogNTC("Saved file '%s', size '%zu'", fullpath.c_str(), mData.size());
+		LogNTC("Saved file '%s', size '%zu'", mFullPath.c_str(), mSize);
 		return true;
 
 	} catch (const char* error) {
-		LogERR("%s: '%s'", error, fullpath.c_str());
+		LogERR("%s: '%s'", error, mFullPath.c_str());
 		return false;
 	}
 }
@@ -155,6 +372,11 @@ const char* PartialContentFile::getFilename() const
 	return mFilename.c_str();
 }
 
+const string& PartialContentFile::getUpdateKey() const
+{
+	return mUpdateKey;
+}
+
 size_t PartialContentFile::getSize() const
 {
 	return mSize;
@@ -166,7 +388,7 @@ float PartialContentFile::getProgress() const
 	if (mSize == 0) {
 		return 1.0f;
 	} else {
-		return static_cast<float>(mData.size())/static_cast<float>(mSize);
+		return static_cast<float>(mReceived)/static_cast<float>(mSize);
 	}
 }
 
@@ -181,7 +403,8 @@ bool PartialContentFile::isComplete() const
  ******************************************************************************/
 template <> CltContentMgr* Singleton<CltContentMgr>::INSTANCE = 0;
 
-CltContentMgr::CltContentMgr()
+CltContentMgr::CltContentMgr() :
+	mManifest(new CltContentManifest(StrFmt("%s/%s", CONTENT_DIR, MANIFEST_FILENAME)))
 {
 }
 
@@ -191,6 +414,9 @@ CltContentMgr::~CltContentMgr()
 		delete (*mUpdateList.begin()).second;
 		mUpdateList.erase(mUpdateList.begin());
 	}
+
+	mManifest->save();
+	delete mManifest;
 }
 
 bool CltContentMgr::filenameFilter(const string& filename, bool verbose)
@@ -294,37 +520,6 @@ bool CltContentMgr::makeDirsIfNeeded(const string& dirpath)
 	return true;
 }
 
-bool CltContentMgr::writeFileToDisk(const std::string& filename,
-				    const char* data,
-				    size_t size)
-{
-	try {
-		// make directories
-		string dirpath = filename.substr(0, filename.rfind('/'));
-		bool dirsOK = makeDirsIfNeeded(dirpath);
-		if (!dirsOK)
-			throw "Directory hierarchy not ready to write the file";
-
-		// write file
-		ofstream file;
-		file.open(filename.c_str(), ios::out | ios::trunc | ios::binary);
-		if (!file.is_open())
-			throw "Failed opening the file in write mode";
-		file.write(data, size);
-		if (file.bad())
-			throw "Failed writing the file to the disk";
-		file.close();
-
-		// exit successfully
-		// LogNTC("Saved file '%s', size '%zu'", filename.c_str(), size);
-		return true;
-
-	} catch (const char* error) {
-		LogERR("%s: '%s'", error, filename.c_str());
-		return false;
-	}
-}
-
 void CltContentMgr::sendUpdateQuery()
 {
 	// mafm: this function is very similar in client and server, although
@@ -339,7 +534,54 @@ void CltContentMgr::sendUpdateQuery()
 	}
 
 	MsgContentQueryUpdate msg;
+	msg.compression = MsgContentQueryUpdate::DEFLATE;
+
+	if (mManifest->load()) {
+		// mafm: the update keys are valid only if the files didn't
+		// change since downloaded, otherwise we send empty keys so the
+		// server sends them again
+		CltContentManifest::FileList files;
+		mManifest->getFiles(files);
+		msg.filepairs.reserve(files.size());
+		struct stat buf;
+		for (size_t i = 0; i < files.size(); ++i) {
+			const string& filename = files[i].first;
+			const CltContentManifest::Entry& entry = files[i].second;
+			string fullPath = StrFmt("%s/%s", CONTENT_DIR, filename.c_str());
+			if (stat(fullPath.c_str(), &buf) != 0 || !S_ISREG(buf.st_mode)) {
+				// removed locally
+				mManifest->removeFile(filename);
+			} else if (static_cast<uint32_t>(buf.st_size) != entry.size
+				   || static_cast<uint32_t>(buf.st_mtime) != entry.mtime) {
+				msg.addFile(filename, "");
+			} else {
+				msg.addFile(filename, entry.updateKey);
+			}
+		}
+		mManifest->save();
+	} else {
+		// no manifest yet, build it from the control files
+		importControlFiles(msg);
+	}
 
+	// sorted by name, so the server can compare them with its own in a
+	// single pass
+	sort(msg.filepairs.begin(), msg.filepairs.end());
+
+	/* mafm: debug only
+	LogDBG("Send update query with files:");
+	for (size_t i = 0; i < msg.filepairs.size(); ++i) {
+		LogDBG(" - '%s' '%s'", msg.filepairs[i].filename.c_str(), msg.filepairs[i].updatekey.c_str());
+	}
+	*/
+
+	// restore status and send the query
+	CltNetworkMgr::instance().sendToServer(msg);
+}
+
+void CltContentMgr::importControlFiles(MsgContentQueryUpdate& msg)
+{
+	vector<string> controlFiles;
 	deque<string> dirs;
 	string root = CONTENT_DIR;
 	dirs.push_back(root);
@@ -383,6 +625,7 @@ void CltContentMgr::sendUpdateQuery()
 				controlFile.open(controlFilename.c_str());
 				if (controlFile.is_open()) {
 					getline(controlFile, updateKey);
+					controlFiles.push_back(controlFilename);
 				} else {
 					// update key will be empty
 					LogWRN("Couldn't open control: %s", controlFilename.c_str());
@@ -394,8 +637,13 @@ void CltContentMgr::sendUpdateQuery()
 				// message
 				fullPath.replace(0, root.length()+1, "");
 
-				// add it to the message
+				// add it to the message and the manifest
 				msg.addFile(fullPath, updateKey);
+				CltContentManifest::Entry entry;
+				entry.updateKey = updateKey;
+				entry.size = buf.st_size;
+				entry.mtime = buf.st_mtime;
+				mManifest->setFile(fullPath, entry);
                         }
                 }
                 // close directory when finished, among other reasons to avoid
@@ -403,15 +651,14 @@ void CltContentMgr::sendUpdateQuery()
                 closedir(dp);
 	}
 
-	/* mafm: debug only
-	LogDBG("Send update query with files:");
-	for (size_t i = 0; i < msg.filepairs.size(); ++i) {
-		LogDBG(" - '%s' '%s'", msg.filepairs[i].filename.c_str(), msg.filepairs[i].updatekey.c_str());
+	// remove the control files only when the keys are safe in the manifest
+	if (mManifest->save()) {
+		LogNTC("Imported %zu control files to the content manifest",
+		       controlFiles.size());
+		for (size_t i = 0; i < controlFiles.size(); ++i) {
+			remove(controlFiles[i].c_str());
+		}
 	}
-	*/
-
-	// restore status and send the query
-	CltNetworkMgr::instance().sendToServer(msg);
 }
 
 void CltContentMgr::deleteOutdatedFiles(vector<string> delete_list)
@@ -432,18 +679,18 @@ void CltContentMgr::deleteOutdatedFiles(vector<string> delete_list)
 		if (!filenameFilter(fileName, true))
 			continue;
 
-		int error = remove(fileName.c_str());
+		string fullPath = StrFmt("%s/%s", CONTENT_DIR, fileName.c_str());
+		int error = remove(fullPath.c_str());
 		if (error == 0) {
 			LogDBG("  D '%s'", fileName.c_str());
 		} else {
 			LogERR("Error deleting file '%s'", fileName.c_str());
 		}
 
-		// delete the control file (we don't care about errors, it might
-		// not exist or whatever
-		string controlFilename = fileName + CONTROL_FILE_SUFFIX;
-		remove(controlFilename.c_str());
+		mManifest->removeFile(fileName);
 	}
+
+	mManifest->save();
 }
 
 void CltContentMgr::addUpdatedFiles(MsgContentUpdateList* msg)
@@ -473,9 +720,18 @@ void CltContentMgr::addUpdatedFiles(MsgContentUpdateList* msg)
 		pfile = new PartialContentFile(msg->updateList[i].filename.c_str(),
 						 msg->updateList[i].updatekey.c_str(),
 						 msg->updateList[i].size,
-						 msg->updateList[i].numParts);
+						 msg->updateList[i].compressedSize);
 		mUpdateList.insert(pair<uint32_t,PartialContentFile*>(transferID, pfile));
 
+		// we have an old version, the server waits for its checksums to
+		// send only the differences
+		if (msg->updateList[i].delta) {
+			MsgContentFileSums sums;
+			sums.transferID = transferID;
+			pfile->prepareDelta(sums);
+			CltNetworkMgr::instance().sendToServer(sums);
+		}
+
 		mStats.totalBytes += msg->updateList[i].size;
 	}
 
@@ -505,7 +761,8 @@ void CltContentMgr::addFilePart(MsgContentFilePart* msg)
 	}
 
 	// add part
-	bool fileFinished = pfile->addPart(msg->partNum, msg->buffer);
+	bool fileFinished = pfile->addPart(msg->partNum, msg->buffer,
+					   msg->copyOffset, msg->copySize);
 
 	// calculate stats and notify listeners
 	if (fileFinished) {
@@ -531,6 +788,7 @@ void CltContentMgr::addFilePart(MsgContentFilePart* msg)
 		bool result = pfile->writeToDisk();
 		if (!result)
 			return;
+		setManifestFile(pfile->getFilename(), pfile->getUpdateKey());
 
 		mUpdateList.erase(msg->transferID);
 		delete pfile;
@@ -541,6 +799,23 @@ void CltContentMgr::addFilePart(MsgContentFilePart* msg)
 		finished();
 }
 
+void CltContentMgr::setManifestFile(const string& filename,
+				    const string& updateKey)
+{
+	string fullPath = StrFmt("%s/%s", CONTENT_DIR, filename.c_str());
+	struct stat buf;
+	if (stat(fullPath.c_str(), &buf) != 0) {
+		LogERR("Can't stat file: %s", fullPath.c_str());
+		return;
+	}
+
+	CltContentManifest::Entry entry;
+	entry.updateKey = updateKey;
+	entry.size = buf.st_size;
+	entry.mtime = buf.st_mtime;
+	mManifest->setFile(filename, entry);
+}
+
 void CltContentMgr::finished()
 {
 	// sanity check
@@ -550,6 +825,10 @@ void CltContentMgr::finished()
 		return;
 	}
 
+	// save the keys of the files received (only once for all of them,
+	// since the whole manifest is written again)
+	mManifest->save();
+
 	// calculate final statistics
 	mStats.timeDownloadElapsed = time(0) - mStats.timeDownloadBegin;
 	float rate;
@@ -28,8 +28,12 @@
 #include <list>
 
 
+class CltContentManifest;
 class MsgContentFilePart;
+class MsgContentFileSums;
+class MsgContentQueryUpdate;
 class MsgContentUpdateList;
+struct z_stream_s;
 
 
 /** Listener for the events of the client content manager.
@@ -57,8 +61,13 @@ public:
 
 /** Represents an incoming file (content update in progress).
  *
- * Server sends the data in chunks, typically about 1KB for each part, and we
- * use this class to store the data before writing it on disk when completed.
+ * Server sends the data in chunks, of variable size depending on the
+ * connection, and we use this class to write them to a temporary file as they
+ * arrive, which replaces the old version when completed (so the memory used
+ * doesn't depend on the size of the files).  When we have an old version of the file, chunks can
+ * also refer to blocks of it, so only the differences are transferred.  New
+ * files can be sent compressed, and then they're decompressed as the chunks
+ * arrive.
  *
  * @author mafm
  */
@@ -73,25 +82,40 @@ public:
 	 *
 	 * @param size Size (in bytes) of the file
 	 *
-	 * @param parts Number of chunks to be sent
+	 * @param compressedSize Size of the compressed data sent, 0 if the
+	 * file is not sent compressed
 	 */
 	PartialContentFile(const char* filename,
 			   const char* updateKey,
 			   uint32_t size,
-			   uint32_t parts);
+			   uint32_t compressedSize);
+	/** Destructor */
+	~PartialContentFile();
 
-	/** Add the raw data of the given part to the data that we have so far.
+	/** Load the old version of the file that we have, and fill the message
+	 * with the checksums of its blocks, so the server sends only the
+	 * differences (the message has no blocks if the old version can't be
+	 * read, and then the server sends the whole file).
+	 */
+	void prepareDelta(MsgContentFileSums& msg);
+	/** Add the raw data of the given part to the data that we have so far,
+	 * followed by the given data of the old version.
 	 *
 	 * \returns true if file has been completed, false otherwise
 	 */
 	bool addPart(uint32_t numPart,
-		     const std::vector<char>& buffer);
-	/** If everything is OK saves the file to the disk.  If false is
-	 * returned, we need to ask the server to resend us the file.  In all
-	 * cases, the partial content file needs to be deleted. */
+		     const std::vector<char>& buffer,
+		     uint32_t copyOffset,
+		     uint32_t copySize);
+	/** If everything is OK saves the file to the disk (replacing the old
+	 * version with the data received).  If false is returned, we need to
+	 * ask the server to resend us the file.  In all cases, the partial
+	 * content file needs to be deleted. */
 	bool writeToDisk();
 	/** Get the filename of the file */
 	const char* getFilename() const;
+	/** Get the update key of the file */
+	const std::string& getUpdateKey() const;
 	/** Get the file size */
 	size_t getSize() const;
 	/** Get progress (in the range 0-1) */
@@ -103,20 +127,46 @@ public:
 private:
 	/// File name
 	std::string mFilename;
+	/// Path of the file in the disk
+	std::string mFullPath;
+	/// Path of the temporary file where we write the data received
+	std::string mTempPath;
 	/// Update key given by the server
 	std::string mUpdateKey;
 	/// Size (sent by server, so we know what we should expect)
 	size_t mSize;
-	/// Number of parts
-	uint32_t mPartsTotal;
 
-	/// Raw data of the file
-	std::vector<char> mData;
+	/// Descriptor of the temporary file (-1 if not opened)
+	int mFile;
+	/// Bytes of the file received (and written) so far
+	size_t mReceived;
+	/// Raw data of the old version of the file mapped in memory, when
+	/// receiving only the differences (0 if not)
+	const char* mOldData;
+	/// Size of the old version of the file
+	size_t mOldSize;
+	/// Stream to decompress the data, when receiving it compressed (0 if
+	/// not)
+	z_stream_s* mInflater;
 	/// Number of parts currently retrieved
 	uint32_t mPartsCurrent;
 	/// Completed (whether is complete or not, so we won't allow to write
 	/// more, etc)
 	bool mCompleted;
+
+	/** Open the temporary file if not already opened, returns false if it
+	 * can't be created */
+	bool openTempFile();
+	/** Write the data after the one received so far, returns false if it
+	 * can't be written */
+	bool appendData(const char* data, size_t size);
+	/** Decompress the data received and add it to the data that we have
+	 * so far, returns false if the data is not valid */
+	bool inflatePart(const std::vector<char>& buffer);
+	/** Check that the data received matches the content hash */
+	bool checkContentHash() const;
+	/** Unmap the old version of the file, if mapped */
+	void unmapOldData();
 };
 
 
@@ -128,13 +178,11 @@ private:
 class CltContentMgr : public Singleton<CltContentMgr>
 {
 public:
-	/** Saves a file to the disk.
+	/** Make the dir hierarchy given, if non-existant and possible.
 	 *
-	 * \returns false when the contents can be written, whatever the reason
-	 * (saves information in the log about that). */
-	static bool writeFileToDisk(const std::string& filename,
-				    const char* data,
-				    size_t size);
+	 * \returns false when there's an error that prevents to make the dirs
+	 * (or check whether they exist). */
+	static bool makeDirsIfNeeded(const std::string& dirpath);
 
 	/** Send a query to the server to update the content */
 	void sendUpdateQuery();
@@ -166,6 +214,9 @@ private:
 	/// List of listeners subscribed to our events
 	std::list<CltContentListener*> mListenerList;
 
+	/// Manifest with the update keys of the local content
+	CltContentManifest* mManifest;
+
 	/** Statistics for this class */
 	class Statistics {
 	public:
@@ -195,12 +246,6 @@ private:
 	/** Destructor */
 	~CltContentMgr();
 
-	/** Make the dir hierarchy given, if non-existant and possible.
-	 *
-	 * \returns false when there's an error that prevents to make the dirs
-	 * (or check whether they exist). */
-	static bool makeDirsIfNeeded(const std::string& dirpath);
-
 	/** Filter to check for potentially dangerous file (generated in servers
 	 * by error or maliciously).
 	 * 
@@ -210,6 +255,17 @@ private:
 	 */
 	bool filenameFilter(const std::string& filename, bool verbose);
 
+	/** Scan the local content reading the update keys from the control
+	 * files (kept next to each file by older versions), adding them to the
+	 * message and to the manifest, and removing the control files when the
+	 * manifest is saved. */
+	void importControlFiles(MsgContentQueryUpdate& msg);
+
+	/** Set the file in the manifest, with the size and modification time
+	 * that it has now */
+	void setManifestFile(const std::string& filename,
+			     const std::string& updateKey);
+
 	/** Performs the actions necessary to finish */
 	void finished();
 };
@@ -0,0 +1,90 @@
+/*
+ * blocksum.cpp
+ * Copyright (C) 2006-2008 by Manuel A. Fernandez Montecelo <mafm@users.sourceforge.net>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "blocksum.h"
+
+#include "common/sha1.h"
+
+
+
+
+/*******************************************************************************
+ * BlockSum
+ ******************************************************************************/
+BlockSum::BlockSum() :
+	mA(0), mB(0), mSize(0)
+{
+}
+
+void BlockSum::init(const char* data, size_t size)
+{
+	mA = mB = 0;
+	mSize = size;
+	for (size_t i = 0; i < size; ++i) {
+		uint8_t byte = static_cast<uint8_t>(data[i]);
+		mA += byte;
+		mB += (size - i) * byte;
+	}
+}
+
+void BlockSum::roll(char out, char in)
+{
+	uint8_t byteOut = static_cast<uint8_t>(out);
+	uint8_t byteIn = static_cast<uint8_t>(in);
+	mA += byteIn - byteOut;
+	mB += mA - mSize * byteOut;
+}
+
+uint32_t BlockSum::getWeak() const
+{
+	return (mA & 0xffff) | (mB << 16);
+}
+
+uint32_t BlockSum::getWeak(const char* data, size_t size)
+{
+	BlockSum sum;
+	sum.init(data, size);
+	return sum.getWeak();
+}
+
+uint64_t BlockSum::getStrong(const char* data, size_t size)
+{
+	return SHA1::encode64(data, size);
+}
+
+uint32_t BlockSum::getBlockSize(uint32_t fileSize)
+{
+	// blocks of 1KB multiples, as small as possible (so the changes resend
+	// little data) but not too many
+	uint32_t blockSize = ((fileSize + MAX_BLOCKS - 1) / MAX_BLOCKS + 1023) & ~1023u;
+	if (blockSize < MIN_BLOCK_SIZE)
+		blockSize = MIN_BLOCK_SIZE;
+	return blockSize;
+}
+
+
+// Local Variables: ***
+// mode: C++ ***
+// tab-width: 8 ***
+// c-basic-offset: 8 ***
+// indent-tabs-mode: t ***
+// fill-column: 80 ***
+// End: ***
+// ex: shiftwidth=2 tabstop=8
@@ -0,0 +1,85 @@
+/*
+ * blocksum.h
+ * Copyright (C) 2006-2008 by Manuel A. Fernandez Montecelo <mafm@users.sourceforge.net>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FEARANN_COMMON_BLOCKSUM_H__
+#define __FEARANN_COMMON_BLOCKSUM_H__
+
+
+#include <cstddef>
+#include <stdint.h>
+
+
+/** Checksums of the blocks of a file, to find the blocks that the peer already
+ * has (in the old version of a file) and send only the differences, in the
+ * same way that rsync does.
+ *
+ * The weak checksum can be rolled (calculated for the block starting in the
+ * next byte, with only the byte leaving and the one entering the block), so
+ * it's cheap to look for the blocks in any position; the strong checksum is
+ * only calculated to confirm the matches of the weak one.
+ *
+ * @author mafm
+ */
+class BlockSum
+{
+public:
+	/** Maximum number of blocks of a file, so the checksums fit in a
+	 * message */
+	static const uint32_t MAX_BLOCKS = 2048;
+	/** Minimum size of the blocks (they're multiples of 1KB) */
+	static const uint32_t MIN_BLOCK_SIZE = 2048;
+
+	/** Default constructor */
+	BlockSum();
+
+	/** Calculate the weak checksum of the given block */
+	void init(const char* data, size_t size);
+	/** Move the block one byte forward, given the byte leaving the block
+	 * and the one entering */
+	void roll(char out, char in);
+	/** Get the weak checksum of the current block */
+	uint32_t getWeak() const;
+
+	/** Get the weak checksum of the given block */
+	static uint32_t getWeak(const char* data, size_t size);
+	/** Get the strong checksum of the given block */
+	static uint64_t getStrong(const char* data, size_t size);
+	/** Get the size of the blocks for a file of the given size */
+	static uint32_t getBlockSize(uint32_t fileSize);
+
+private:
+	/// Sum of the bytes of the block
+	uint32_t mA;
+	/// Sum of the bytes weighted by their distance to the end
+	uint32_t mB;
+	/// Size of the block
+	uint32_t mSize;
+};
+
+
+#endif
+
+
+// Local Variables: ***
+// mode: C++ ***
+// tab-width: 8 ***
+// c-basic-offset: 8 ***
+// indent-tabs-mode: t ***
+// fill-column: 80 ***
+// End: ***
+// ex: shiftwidth=2 tabstop=8
@@ -69,6 +69,11 @@ float Vector3::distance(const Vector3& u) const
 	return sqrt(power2(x - u.x) + power2(y - u.y) + power2(z - u.z));
 }
 
+float Vector3::squaredDistance(const Vector3& u) const
+{
+	return power2(x - u.x) + power2(y - u.y) + power2(z - u.z);
+}
+
 void Vector3::Normalize(void)
 {
 	float const tol = 0.0000000001f;
@@ -46,6 +46,8 @@ public:
 	float operator*(const Vector3& u) const;
 	Vector3 operator/(float f) const;
 	float distance(const Vector3& u) const;
+	/** Squared distance, cheaper when only comparing distances */
+	float squaredDistance(const Vector3& u) const;
 	void Normalize(void);
 
 	float x;
@@ -72,6 +74,11 @@ public:
 	std::string name;
 	/** Second element of the pair, value */
 	std::string value;
+
+	/** Order by name, to sort lists of pairs */
+	bool operator<(const NameValuePair& other) const {
+		return name < other.name;
+	}
 };
 
 
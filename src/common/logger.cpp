@@ -18,54 +18,21 @@
  */
 
 #include <cstdarg>
-#include <ctime>
-#include <cstdio>
-#include <string>
 
 #include "logmgr.h"
 
 #include "logger.h"
 
-using namespace std;
 
-#define LOGSTR_LENGTH 256
-// Macro to parse printf-like arguments of a method into fixed string
-#define VARARG_PARSE()				\
-	va_list arg;				\
-	va_start(arg, msg);			\
-	char formatBuffer[LOGSTR_LENGTH] = { 0 };			\
-	vsnprintf(formatBuffer, sizeof(formatBuffer), msg, arg);	\
-	va_end(arg);
-
-
-void LogFATAL(const char* msg, ...)
-{
-	VARARG_PARSE();
-	LogMgr::instance().Log(LogMgr::FATAL, formatBuffer);
-}
-
-void LogERR(const char* msg, ...)
-{
-	VARARG_PARSE();
-	LogMgr::instance().Log(LogMgr::ERROR, formatBuffer);
-}
+volatile int gLogLevel = LOG_DEBUG;
 
-void LogWRN(const char* msg, ... )
-{
-	VARARG_PARSE();
-	LogMgr::instance().Log(LogMgr::WARNING, formatBuffer);
-}
 
-void LogNTC(const char* msg, ... )
+void LogMsg(LogLevel level, const char* msg, ...)
 {
-	VARARG_PARSE();
-	LogMgr::instance().Log(LogMgr::INFO, formatBuffer);
-}
-
-void LogDBG(const char* msg, ... )
-{
-	VARARG_PARSE();
-	LogMgr::instance().Log(LogMgr::DEBUG, formatBuffer);
+	va_list arg;
+	va_start(arg, msg);
+	LogMgr::instance().Log(static_cast<LogMgr::LogMsgType>(level), msg, arg);
+	va_end(arg);
 }
 
 
@@ -24,22 +24,64 @@
  * This file has all needed elements to access the log.  It would be more
  * elegant with a singleton class; but this way saves a lot of typing (it's used
  * everywhere, obviously).
+ *
+ * The LogXXX are macros checking the level of the log before anything else, so
+ * the arguments are not even evaluated (nor the message formatted) when the
+ * message is going to be discarded, which matters in the hot paths using
+ * LogDBG.  Defining LOG_STRIP_DEBUG at compile time removes the debug messages
+ * completely.
+ */
+
+/** Levels of the messages, matching LogMgr::LogMsgType */
+enum LogLevel { LOG_DEBUG = 1, LOG_INFO, LOG_WARNING, LOG_ERROR, LOG_FATAL };
+
+/** Current level of the log, messages with lower level are discarded.
+ *
+ * mafm: it's read without locks in every call to the macros; aligned int loads
+ * and stores are atomic in the platforms that we support, and when changing it
+ * from other thread it doesn't matter if a few messages are logged (or not) with
+ * the old level.
  */
+extern volatile int gLogLevel;
+
+/** Log a message with the given level, formatting it (only called by the
+ * macros, when the level is enabled) */
+void LogMsg(LogLevel level, const char* msg, ...) __attribute__((format(printf, 2, 3)));
+
+/** Whether the messages of the given level are logged */
+#define LogEnabled(level) ((level) >= gLogLevel)
+
+/** Log a message if the level is enabled, without evaluating the arguments
+ * otherwise */
+#define LOG_AT_LEVEL(level, ...)					\
+	do {								\
+		if (LogEnabled(level))					\
+			LogMsg(level, __VA_ARGS__);			\
+	} while (0)
 
 /** Log a fatal error */
-void LogFATAL(const char* msg, ...) __attribute__((format(printf, 1, 2)));
+#define LogFATAL(...) LOG_AT_LEVEL(LOG_FATAL, __VA_ARGS__)
 
 /** Log an error */
-void LogERR(const char* msg, ...) __attribute__((format(printf, 1, 2)));
+#define LogERR(...) LOG_AT_LEVEL(LOG_ERROR, __VA_ARGS__)
 
 /** Log a warning */
-void LogWRN(const char* msg, ...) __attribute__((format(printf, 1, 2)));
+#define LogWRN(...) LOG_AT_LEVEL(LOG_WARNING, __VA_ARGS__)
 
 /** Log a notice */
-void LogNTC(const char* msg, ...) __attribute__((format(printf, 1, 2)));
+#define LogNTC(...) LOG_AT_LEVEL(LOG_INFO, __VA_ARGS__)
 
 /** Log a debug message */
-void LogDBG(const char* msg, ...) __attribute__((format(printf, 1, 2)));
+#ifdef LOG_STRIP_DEBUG
+// keeping the format checks, but the optimizer removes the call
+#define LogDBG(...)							\
+	do {								\
+		if (false)						\
+			LogMsg(LOG_DEBUG, __VA_ARGS__);			\
+	} while (0)
+#else
+#define LogDBG(...) LOG_AT_LEVEL(LOG_DEBUG, __VA_ARGS__)
+#endif
 
 #endif
 
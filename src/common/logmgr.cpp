@@ -32,8 +32,7 @@ const size_t LOGSTR_LENGTH = 256;
 
 template <> LogMgr* Singleton<LogMgr>::INSTANCE = 0;
 
-LogMgr::LogMgr() :
-	logLevel(DEBUG)
+LogMgr::LogMgr()
 {
 }
 
@@ -41,9 +40,11 @@ LogMgr::~LogMgr()
 {
 }
 
-void LogMgr::Log(LogMsgType type, const char* msg)
+void LogMgr::Log(LogMsgType type, const char* msg, va_list args)
 {
-	if (type >= logLevel) {
+	// mafm: the macros already checked the level, but it can be changed in
+	// the meantime
+	if (LogEnabled(type)) {
 		/* first of all, it defines the message severity token you'll
 		 * see at the left side of the log message. It depends on the
 		 * LogMsgType level of course */
@@ -52,14 +53,20 @@ void LogMgr::Log(LogMsgType type, const char* msg)
 		/* define when the message has been sent */
 		char ts[TIMESTAMP_LENGTH];
 		time_t now = time(0);
-		strftime(ts, sizeof(ts), "%Y%m%d %H:%M:%S", localtime(&now));
+		struct tm nowTm;
+		localtime_r(&now, &nowTm);
+		strftime(ts, sizeof(ts), "%Y%m%d %H:%M:%S", &nowTm);
 
-		/* create the message <time>::<severity>::<message>*/
+		/* create the message <time>::<severity>::<message>, formatting
+		 * it directly after the prefix */
 		char fullMsg[LOGSTR_LENGTH] = { 0 };
-		snprintf(fullMsg, sizeof(fullMsg), "%s :: %s :: %s\n", ts, severity, msg);
+		int length = snprintf(fullMsg, sizeof(fullMsg), "%s :: %s :: ", ts, severity);
+		if (length >= 0 && static_cast<size_t>(length) < sizeof(fullMsg) - 1) {
+			vsnprintf(fullMsg + length, sizeof(fullMsg) - 1 - length, msg, args);
+		}
 
 		/* print the message in the standard error stream */
-		fprintf(stderr, "%s", fullMsg);
+		fprintf(stderr, "%s\n", fullMsg);
 	}
 }
 
@@ -68,7 +75,7 @@ bool LogMgr::setLogMsgLevel(LogMsgType level)
 	/* when you want to modify what kind of message you're ready to see,
 	 * you'll precise the level with a constant string. This method modifies
 	 * the severity level thanks to the user's token */
-	logLevel = level;
+	gLogLevel = level;
 	return true;
 }
 
@@ -77,7 +84,7 @@ bool LogMgr::setLogMsgLevel(const char* level)
 	string levelStr(level);
 	for (int l = DEBUG; l < LEVEL_COUNT; ++l) {
 		if (levelStr == translateToString(static_cast<LogMsgType>(l))) {
-			logLevel = static_cast<LogMsgType>(l);
+			gLogLevel = l;
 			return true;
 		}
 	}
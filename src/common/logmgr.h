@@ -24,14 +24,19 @@
 /** \file logger
  */
 
+#include "common/logger.h"
 #include "common/patterns/singleton.h"
 
+#include <cstdarg>
+
 
 class LogMgr : public Singleton<LogMgr>
 {
 public:
-	/** The different levels of the log message */
-	enum LogMsgType { DEBUG = 1, INFO, WARNING, ERROR, FATAL, LEVEL_COUNT };
+	/** The different levels of the log message (matching LogLevel, used
+	 * by the macros) */
+	enum LogMsgType { DEBUG = LOG_DEBUG, INFO = LOG_INFO, WARNING = LOG_WARNING,
+			  ERROR = LOG_ERROR, FATAL = LOG_FATAL, LEVEL_COUNT };
 
 	/**
 	 * Modify the level of the readable log messages
@@ -50,15 +55,8 @@ private:
 	/** Singleton friend access */
 	friend class Singleton<LogMgr>;
 
-	/* Adding the Log functions as friends of this class */
-	friend void LogFATAL(const char* msg, ...);
-	friend void LogERR(const char* msg, ...);
-	friend void LogWRN(const char* msg, ...);
-	friend void LogNTC(const char* msg, ...);
-	friend void LogDBG(const char* msg, ...);
-
-	/** the log severity level the instance will respect */
-	LogMsgType logLevel;
+	/* Adding the Log function as friend of this class */
+	friend void LogMsg(LogLevel level, const char* msg, ...);
 
 
 	/**
@@ -74,9 +72,10 @@ private:
 	 *
 	 * @author Arnaud Fleurentdidier Messaoudi (fken)
 	 * @param severity the severity level of the message you want to send
-	 * @param msg the message you want to send
+	 * @param msg the message you want to send (printf-like format)
+	 * @param args the arguments of the format
 	 */
-	void Log(LogMsgType severity, const char* msg);
+	void Log(LogMsgType severity, const char* msg, va_list args);
 
 	/** Translate log level to string, to print it or whatever */
 	const char* translateToString(LogMsgType level) const;
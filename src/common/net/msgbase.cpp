@@ -81,15 +81,13 @@ void MsgType::setType(uint32_t type)
 
 //---------------------------- MsgBase ---------------------------
 MsgBase::Buffer::Buffer() :
-	mSize(0), mData(0)
+	mSize(0), mCapacity(0), mReadPos(0), mData(0), mBegin(0)
 {
-	// mafm: This implementation is not very efficient, but at the time of
-	// writing this files are transferred at up to 2GB (with sleep functions
-	// in client and server loops, to avoid using 100% of CPU).  This is of
-	// course where the client needs more power, and it's very unlikely that
-	// neither clients or servers will use those speeds with an "official"
-	// game server (unless we have 100K users in the same server or things
-	// like that).
+	// mafm: Data is only appended when serializing and extracted when
+	// deserializing, never both in the same message, so we don't need to
+	// reclaim the space at the front as in a circular buffer.  When
+	// deserializing we don't even copy the data, we read it directly from
+	// the network buffer.
 }
 
 MsgBase::Buffer::~Buffer()
@@ -97,61 +95,94 @@ MsgBase::Buffer::~Buffer()
 	delete [] mData;
 }
 
-void MsgBase::Buffer::append(const char* buffer, size_t s)
+void MsgBase::Buffer::reserve(size_t s)
 {
-	if (mData == 0) {
-		// empty buffer, append the new one
-		mSize = s;
-		mData = new char[s];
-		memcpy(mData, buffer, s);
-	} else {
-		// existing buffer, append using a bigger buffer
-		char* final = new char[mSize+s];
+	if (mSize + s <= mCapacity)
+		return;
+
+	// grow to the double at least, so appending is amortized linear
+	size_t capacity = (mCapacity < 64) ? 64 : mCapacity*2;
+	if (capacity < mSize + s)
+		capacity = mSize + s;
+
+	char* final = new char[capacity];
+	if (mData) {
 		memcpy(final, mData, mSize);
-		memcpy(final+mSize, buffer, s);
-		mSize += s;
-		// delete old buffer
-		char* aux = mData;
-		delete [] aux;
-		mData = final;
+		delete [] mData;
 	}
+	mData = final;
+	mBegin = mData;
+	mCapacity = capacity;
+}
+
+void MsgBase::Buffer::setView(const char* buffer, size_t s)
+{
+	mBegin = buffer;
+	mSize = s;
+	mReadPos = 0;
+}
+
+void MsgBase::Buffer::clearView()
+{
+	mBegin = mData;
+	mSize = 0;
+	mReadPos = 0;
+}
+
+void MsgBase::Buffer::clear()
+{
+	mBegin = mData;
+	mSize = 0;
+	mReadPos = 0;
+}
+
+void MsgBase::Buffer::append(const char* buffer, size_t s)
+{
+	PERM_ASSERT(mBegin == mData);
+	reserve(s);
+	memcpy(mData+mSize, buffer, s);
+	mSize += s;
 }
 
 char MsgBase::Buffer::popFront()
 {
-	char c;
+	// initialized, so it's 0 if there's no data
+	char c = 0;
 	extractFront(&c, 1);
 	return c;
 }
 
 void MsgBase::Buffer::extractFront(char* buffer, size_t s)
 {
-	if (s > mSize) {
+	if (s > getSize()) {
 		LogERR("Requesting %zu but only %u bytes available in the buffer",
-		       s, mSize);
+		       s, getSize());
 		buffer = 0;
 		return;
 	} else {
 		// copy data to the given buffer
-		memcpy(buffer, mData, s);
-
-		// extract from existing buffer
-		if (s == mSize) {
-			// all of it
-			delete [] mData;
-			mData = 0;
-			mSize = 0;
-		} else {
-			// part of it, only
-			char* final = new char[mSize-s];
-			memcpy(final, mData+s, mSize-s);
-			mSize -= s;
-			// delete old buffer
-			char* aux = mData;
-			delete [] aux;
-			mData = final;
-		}
+		memcpy(buffer, mBegin+mReadPos, s);
+		mReadPos += s;
+	}
+}
+
+bool MsgBase::Buffer::extractString(std::string& s)
+{
+	if (getSize() == 0)
+		return false;
+
+	const char* front = mBegin+mReadPos;
+	const char* end = static_cast<const char*>(memchr(front, '\0', getSize()));
+	if (!end) {
+		// take the rest of the buffer
+		s.assign(front, getSize());
+		mReadPos = mSize;
+		return false;
 	}
+
+	s.assign(front, end-front);
+	mReadPos += (end-front) + 1;
+	return true;
 }
 
 void MsgBase::Buffer::overwritePosition(size_t index, char c)
@@ -166,12 +197,12 @@ void MsgBase::Buffer::overwritePosition(size_t index, char c)
 
 const char* MsgBase::Buffer::getBuffer() const
 {
-	return mData;
+	return mBegin+mReadPos;
 }
 
 uint32_t MsgBase::Buffer::getSize() const
 {
-	return mSize;
+	return mSize-mReadPos;
 }
 
 MsgBase::MsgBase() :
@@ -206,6 +237,11 @@ void MsgBase::serialize()
 	mIsSerialized = true;
 }
 
+bool MsgBase::isSerialized() const
+{
+	return mIsSerialized;
+}
+
 void MsgBase::deserialize(const char* buffer, size_t size)
 {
 	if (mIsDeserialized) {
@@ -217,7 +253,7 @@ void MsgBase::deserialize(const char* buffer, size_t size)
 	// set up the local buffer with the given data, ignoring header
 	size_t headerSize = sizeof(uint16_t) + sizeof(uint32_t);
 	PERM_ASSERT(size >= headerSize);
-	mBuffer.append(buffer+headerSize, size-headerSize);
+	mBuffer.setView(buffer+headerSize, size-headerSize);
 
 	// perform the message especific deserialization
 	deserializeData();
@@ -229,9 +265,24 @@ void MsgBase::deserialize(const char* buffer, size_t size)
 		       getType().getName(), size, mBuffer.getSize());
 	}
 
+	// the data belongs to the caller, don't keep references to it
+	mBuffer.clearView();
+
 	mIsDeserialized = true;
 }
 
+void MsgBase::reset()
+{
+	mBuffer.clear();
+	mIsSerialized = false;
+	mIsDeserialized = false;
+}
+
+void MsgBase::reserve(size_t bytes)
+{
+	mBuffer.reserve(sizeof(uint16_t) + sizeof(uint32_t) + bytes);
+}
+
 bool MsgBase::bufferGEThan(size_t bytes)
 {
 	bool bigEnough = mBuffer.getSize() >= bytes;
@@ -335,11 +386,6 @@ void MsgBase::read(char* data, size_t size)
 
 void MsgBase::read(std::string& s)
 {
-	// mafm: due to the interface available in vector (we cannot use
-	// std::string for this), we have to iterate considering the front
-	// position only, until we find the null character terminating the
-	// string, or else we go out of bounds
-
 	// mafm: needed this because we expect the string to be empty, and it
 	// might be not empty using dummy initialization values (<none>, etc).
 	// The result expected in the rest of the data types is to overwrite the
@@ -347,20 +393,19 @@ void MsgBase::read(std::string& s)
 	// want to maintain this consistency :)
 	s.clear();
 
-	while (bufferGEThan(sizeof(char))) {
-		char c = mBuffer.popFront();
-		if (c == '\0')
-			return;
-		else
-			s.append(1, c);
-	}
+	// no terminator means that we went out of bounds, complain
+	if (!mBuffer.extractString(s))
+		bufferGEThan(1);
 }
 
 void MsgBase::read(char& c)
 {
-	// check if there's enough data in the buffer
-	if (!bufferGEThan(sizeof(char)))
+	// check if there's enough data in the buffer (0 if not, so the values
+	// read from truncated messages are predictable)
+	if (!bufferGEThan(sizeof(char))) {
+		c = 0;
 		return;
+	}
 	c = mBuffer.popFront();
 }
 
@@ -457,20 +502,57 @@ const char* MsgBase::getBuffer() const
 
 
 //-------------------------- MsgHdlFactory -------------------------
+MsgHdlFactory::MsgHdlFactory() :
+	mTable(64), mEntryCount(0)
+{
+}
+
 MsgHdlFactory::~MsgHdlFactory()
 {
-	// delete message objects passed initially to the factory
-	while (!factories.empty()) {
-		delete factories.begin()->second.first;
-		delete factories.begin()->second.second;
-		factories.erase(factories.begin());
+	// delete message objects passed initially to the factory, and the
+	// instances created later
+	for (size_t i = 0; i < mTable.size(); ++i) {
+		Entry& entry = mTable[i];
+		if (!entry.prototype)
+			continue;
+		delete entry.prototype;
+		delete entry.hdl;
+		for (size_t j = 0; j < entry.pool.size(); ++j) {
+			delete entry.pool[j];
+		}
+	}
+	mTable.clear();
+}
+
+MsgHdlFactory::Entry& MsgHdlFactory::findEntry(uint32_t key)
+{
+	// mix the bits, since the keys are 4 ASCII chars
+	uint32_t hash = key ^ (key >> 16);
+	hash *= 0x45d9f3b;
+	hash ^= hash >> 16;
+
+	size_t mask = mTable.size() - 1;
+	size_t i = hash & mask;
+	while (mTable[i].prototype && mTable[i].key != key) {
+		i = (i + 1) & mask;
+	}
+	return mTable[i];
+}
+
+void MsgHdlFactory::growTable()
+{
+	vector<Entry> old(mTable.size()*2);
+	old.swap(mTable);
+	for (size_t i = 0; i < old.size(); ++i) {
+		if (old[i].prototype)
+			findEntry(old[i].key) = old[i];
 	}
 }
 
 void MsgHdlFactory::registerMsgWithHdl(MsgBase* msg, MsgHdlBase* hdl)
 {
 	uint32_t key = msg->getType().getID();
-	if (factories.find(key) != factories.end()) {
+	if (findEntry(key).prototype) {
 		LogWRN("Msg already registered (type: '%s')",
 		       msg->getType().getName());
 	} else if (msg->getType() != hdl->getMsgType()) {
@@ -479,65 +561,56 @@ void MsgHdlFactory::registerMsgWithHdl(MsgBase* msg, MsgHdlBase* hdl)
 		       hdl->getMsgType().getName());
 	} else {
 		// register the message and handler
-		factories[key].first = msg;
-		factories[key].second = hdl;
+		if ((mEntryCount+1)*2 > mTable.size())
+			growTable();
+		Entry& entry = findEntry(key);
+		entry.key = key;
+		entry.prototype = msg;
+		entry.hdl = hdl;
+		++mEntryCount;
 	}
 }
 
-MsgBase* MsgHdlFactory::createMsgInstance(uint32_t key)
-{
-	if (factories.find(key) == factories.end()) {
-		LogERR("Msg not found (type: '%s')",
-		       MsgType(key).getName());
-		return 0;
-	} else
-		return factories[key].first->createInstance();
-}
-
-MsgHdlBase* MsgHdlFactory::getHdl(uint32_t key)
-{
-	if (factories.find(key) == factories.end()) {
-		LogERR("Handler not found (type: '%s')",
-		       MsgType(key).getName());
-		return 0;
-	} else
-		return factories[key].second;
-}
-
 bool MsgHdlFactory::handleStream(Netlink& netlink,
 				 uint32_t key,
 				 const char* buffer,
 				 uint32_t size)
 {
-	// mafm: Note that we wouldn't need to create new instances of the
-	// message only for this. The current operation is that it creates a
-	// message based on the type especified in the stream, and it passes the
-	// raw buffer data to deserialize the message, etc.  What we could do
-	// instead is to use the instance of the message stored in the factory
-	// itself, cleaning up the buffer between calls. This would be very good
-	// not only to save memory and time when creating new instances, but to
-	// avoid to define the createInstance function in every message: as
-	// there are lots of messages it would save quite a lot of typing.
-	//
-	// The drawback is that we wouldn't have a clean message each time --
-	// the buffer would be clear but the variables of the derived messages
-	// would not. The solution would be to provide abstract functions for
-	// this, in the same way that serializeData and deserializeData, but
-	// this is a bigger problem than the time required to type the
-	// createInstance function for each type; so at the moment we'll stick
-	// with this.
+	// mafm: Instances of the messages are reused, so we don't allocate
+	// anything when the traffic is steady.  The instances are taken from
+	// the pool of the message type (creating a new one if empty, which
+	// happens the first time or if the handler makes us to process other
+	// message of the same type before returning), and put back there
+	// after being handled.  Since the variables of the derived messages
+	// are not cleaned between uses, deserializeData must overwrite all
+	// of them.
 
 	// see if we have the needed msg+hdl
-	MsgBase* msg = createMsgInstance(key);
-	MsgHdlBase* hdl = getHdl(key);
-	if (!msg || !hdl)
+	Entry& entry = findEntry(key);
+	if (!entry.prototype) {
+		LogERR("Msg not found (type: '%s')",
+		       MsgType(key).getName());
 		return false;
+	}
+
+	MsgBase* msg = 0;
+	if (entry.pool.empty()) {
+		msg = entry.prototype->createInstance();
+	} else {
+		msg = entry.pool.back();
+		entry.pool.pop_back();
+	}
+	MsgHdlBase* hdl = entry.hdl;
 
 	// deserialize and use the message
 	msg->deserialize(buffer, size);
 	//LogDBG("Message %s received", msg->getType().getName());
 	hdl->handleMsg(*msg, &netlink);
-	delete msg;
+
+	// the entry might be moved around by now if the handler registered
+	// messages, so we look it up again
+	msg->reset();
+	findEntry(key).pool.push_back(msg);
 
 	return true;
 }
@@ -154,12 +154,20 @@ public:
 	 * network. This prepares the packet (headers and so on) and relies on
 	 * the concrete implementation for the actual data. */
 	void serialize();
+	/** Whether the message is already serialized, so the buffer can be
+	 * sent as is (in example, to several connections) */
+	bool isSerialized() const;
 	/** Counterpart of the serialization, it must be performed in the same
 	 * order so the peer can rebuild an exact copy of the message. Note that
 	 * it needs the buffer in the argument, because the message comes from
 	 * the network -- the message is created empty initially, when received
 	 * in the peer. */
 	void deserialize(const char* buffer, size_t size);
+	/** Reset the message, so it can be deserialized again (used to reuse
+	 * the instances of incoming messages).  Note that the variables of the
+	 * derived messages are not touched, deserializeData has to overwrite
+	 * all of them (clearing containers before adding the elements, etc). */
+	void reset();
 
 protected:
 	/// Whether is not this message is already serialized
@@ -228,28 +236,59 @@ protected:
 	/** Extract the data from the buffer in apropriate format */
 	void read(Vector3& v3);
 
+	/** Reserve room in the buffer for the given amount of data (besides
+	 * the header), so messages known to be big (file parts, listings)
+	 * don't need to grow the buffer while serializing */
+	void reserve(size_t bytes);
+
 private:
-	/** Convenience wrapper around a simple buffer
+	/** Convenience wrapper around a simple buffer.  Data is appended at the
+	 * back of the buffer (growing ahead of the needs, so serializing needs
+	 * few allocations), and extracted from the front moving a read cursor
+	 * (so deserializing doesn't move or reallocate anything).
 	 */
 	class Buffer {
 	public:
 		Buffer();
 		~Buffer();
+		/** Make sure that there's room for the given bytes to be
+		 * appended without reallocating */
+		void reserve(size_t size);
+		/** Make the buffer a view of the given data (not owned nor
+		 * copied), to extract data from it */
+		void setView(const char* buffer, size_t size);
+		/** Drop the view set up, if any */
+		void clearView();
+		/** Drop all the data, but keep the memory allocated */
+		void clear();
 		/** Append to the buffer */
 		void append(const char* buffer, size_t size);
 		/** Pop the front element */
 		char popFront();
 		/** Extract given size from the front */
 		void extractFront(char* buffer, size_t size);
+		/** Extract a null-terminated string from the front, returns
+		 * false if there's no terminator (and then the rest of the
+		 * buffer is extracted) */
+		bool extractString(std::string& s);
 		/** Overwrite given position (to set message size, in example) */
 		void overwritePosition(size_t index, char c);
-		/** Get the buffer itself */
+		/** Get the buffer itself (data not extracted yet) */
 		const char* getBuffer() const;
-		/** Get current size of the buffer */
+		/** Get current size of the buffer (data not extracted yet) */
 		uint32_t getSize() const;
 	private:
+		/// Bytes of data written
 		uint32_t mSize;
+		/// Bytes allocated
+		uint32_t mCapacity;
+		/// Position of the next byte to extract
+		uint32_t mReadPos;
+		/// The data itself (owned, when writing)
 		char* mData;
+		/// The data to be read (either our own data, or a view of
+		/// external data when deserializing)
+		const char* mBegin;
 	} mBuffer;
 
 	/** Check if there's at least the given amount of data in the buffer, so
@@ -288,6 +327,8 @@ public:
 class MsgHdlFactory
 {
 public:
+	/** Default constructor. */
+	MsgHdlFactory();
 	/** Destructor. */
 	~MsgHdlFactory();
 
@@ -310,14 +351,34 @@ public:
 			  uint32_t size);
 
 private:
-	/// This is the structure holding the message types based on keys
-	std::map<uint32_t, std::pair<MsgBase*, MsgHdlBase*> > factories;
-
-	/** Create an instance of the class, deserialized with given buffer */
-	MsgBase* createMsgInstance(uint32_t key);
-
-	/** Get the handler of a message */
-	MsgHdlBase* getHdl(uint32_t key);
+	/** Entry of the table of registered messages, binding the message type
+	 * with its handler, and keeping the instances of the message ready to
+	 * be reused */
+	class Entry {
+	public:
+		Entry() : key(0), prototype(0), hdl(0) { }
+		/// Message type
+		uint32_t key;
+		/// Message passed when registering, to create instances
+		MsgBase* prototype;
+		/// Handler of the message
+		MsgHdlBase* hdl;
+		/// Instances not in use
+		std::vector<MsgBase*> pool;
+	};
+
+	/// This is the structure holding the message types based on keys, a
+	/// hash table with open addressing (the size is a power of 2, and it's
+	/// kept less than half full)
+	std::vector<Entry> mTable;
+	/// Number of messages registered
+	size_t mEntryCount;
+
+	/** Find the entry for the given message type (the empty slot where it
+	 * should be, if not registered) */
+	Entry& findEntry(uint32_t key);
+	/** Double the size of the table */
+	void growTable();
 };
 
 
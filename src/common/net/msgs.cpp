@@ -20,6 +20,8 @@
 
 #include "msgs.h"
 
+#include "common/blocksum.h"
+
 #include <cstdlib>
 
 
@@ -221,6 +223,7 @@ void MsgLoginReply::serializeData()
 
 void MsgLoginReply::deserializeData()
 {
+	charList.clear();
 	read(resultCode);
 	read(charNumber);
 	for (size_t i = 0; i < charNumber; ++i) {
@@ -666,6 +669,7 @@ void MsgInventoryListing::serializeData()
 
 void MsgInventoryListing::deserializeData()
 {
+	invListing.clear();
 	read(listSize);
 	for (size_t i = 0; i < listSize; ++i) {
 		uint32_t itemID;
@@ -867,6 +871,7 @@ MsgBase* MsgContentQueryUpdate::createInstance()
 
 void MsgContentQueryUpdate::serializeData()
 {
+	write(compression);
 	totalFiles = filepairs.size();
 	write(totalFiles);
 	for (size_t i = 0; i < totalFiles; ++i) {
@@ -877,6 +882,8 @@ void MsgContentQueryUpdate::serializeData()
 
 void MsgContentQueryUpdate::deserializeData()
 {
+	filepairs.clear();
+	read(compression);
 	read(totalFiles);
 	for (size_t i = 0; i < totalFiles; ++i) {
 		string filename, updatekey;
@@ -912,6 +919,7 @@ void MsgContentDeleteList::serializeData()
 
 void MsgContentDeleteList::deserializeData()
 {
+	deleteList.clear();
 	read(filesToDelete);
 	for (size_t i = 0; i < filesToDelete; ++i) 
 	{
@@ -940,24 +948,27 @@ void MsgContentUpdateList::serializeData()
 	write(filesToUpdate);
 	for (size_t i = 0; i < filesToUpdate; ++i) {
 		write(updateList[i].transferID);
-		write(updateList[i].numParts);
 		write(updateList[i].filename);
 		write(updateList[i].updatekey);
 		write(updateList[i].size);
+		write(updateList[i].delta);
+		write(updateList[i].compressedSize);
 	}
 }
 
 void MsgContentUpdateList::deserializeData()
 {
+	updateList.clear();
 	read(filesToUpdate);
 	for (size_t i = 0; i < filesToUpdate; ++i) 
 	{
 		ContentUpdateFileInfo file;
 		read(file.transferID);
-		read(file.numParts);
 		read(file.filename);
 		read(file.updatekey);
 		read(file.size);
+		read(file.delta);
+		read(file.compressedSize);
 		updateList.push_back(file);
 	}
 }
@@ -965,15 +976,17 @@ void MsgContentUpdateList::deserializeData()
 void MsgContentUpdateList::addFile(const char* filename,
 				   const char* updatekey,
 				   uint32_t transfer_id,
-				   uint32_t num_parts,
-				   uint32_t size)
+				   uint32_t size,
+				   bool delta,
+				   uint32_t compressed_size)
 {
 	ContentUpdateFileInfo file;
 	file.transferID = transfer_id;
-	file.numParts = num_parts;
 	file.filename = filename;
 	file.updatekey = updatekey;
 	file.size = size;
+	file.delta = delta;
+	file.compressedSize = compressed_size;
 	updateList.push_back(file);
 }
 
@@ -987,24 +1000,71 @@ MsgBase* MsgContentFilePart::createInstance()
 
 void MsgContentFilePart::serializeData()
 {
-	size = buffer.size();
+	if (!data)
+		size = buffer.size();
+	reserve(sizeof(transferID) + sizeof(partNum) + sizeof(copyOffset)
+		+ sizeof(copySize) + sizeof(size) + size);
 	write(transferID);
 	write(partNum);
+	write(copyOffset);
+	write(copySize);
 	write(size);
-	write(&buffer[0], size);
+	if (size > 0)
+		write(data ? data : &buffer[0], size);
 }
 
 void MsgContentFilePart::deserializeData()
 {
 	read(transferID);
 	read(partNum);
+	read(copyOffset);
+	read(copySize);
 	read(size);
-	char* buffaux = new char[size];
-	read(buffaux, size);
-	for (size_t i = 0; i < size; ++i) {
-		buffer.push_back(buffaux[i]);
+	buffer.resize(size);
+	if (size > 0)
+		read(&buffer[0], size);
+}
+
+MsgType MsgContentFileSums::mType("CFSu");
+
+MsgBase* MsgContentFileSums::createInstance()
+{
+	return new MsgContentFileSums;
+}
+
+void MsgContentFileSums::serializeData()
+{
+	numBlocks = min(weakSums.size(), strongSums.size());
+	reserve(sizeof(transferID) + sizeof(blockSize) + sizeof(numBlocks)
+		+ numBlocks*(sizeof(uint32_t) + sizeof(uint64_t)));
+	write(transferID);
+	write(blockSize);
+	write(numBlocks);
+	for (size_t i = 0; i < numBlocks; ++i) {
+		write(weakSums[i]);
+		write(strongSums[i]);
+	}
+}
+
+void MsgContentFileSums::deserializeData()
+{
+	weakSums.clear();
+	strongSums.clear();
+	read(transferID);
+	read(blockSize);
+	read(numBlocks);
+	if (numBlocks > BlockSum::MAX_BLOCKS) {
+		LogERR("Checksums of too many blocks (%u), ignoring", numBlocks);
+		numBlocks = 0;
+	}
+	for (size_t i = 0; i < numBlocks; ++i) {
+		uint32_t weak = 0;
+		uint64_t strong = 0;
+		read(weak);
+		read(strong);
+		weakSums.push_back(weak);
+		strongSums.push_back(strong);
 	}
-	delete[] buffaux;
 }
 
 //--------------------------------------------
@@ -1057,6 +1117,9 @@ void MsgTrade::serializeData()
 
 void MsgTrade::deserializeData()
 {
+	itemList.clear();
+	playerSelectedList.clear();
+	targetSelectedList.clear();
 	read(type);
 	read(target);
 	read(listSize);
@@ -1236,6 +1299,7 @@ void MsgNPCDialog::serializeData()
 
 void MsgNPCDialog::deserializeData()
 {
+	options.clear();
 	uint32_t listSize;
 	read(text);
 	read(target);
@@ -1033,6 +1033,14 @@ public:
 class MsgContentQueryUpdate : public MsgBase
 {
 public:
+	/// Enumeration of the compression methods
+	enum COMPRESSION
+		{
+			NONE = 0,
+			DEFLATE
+		};
+	/// Compression method that the client accepts for the files
+	uint32_t compression;
 	/// Total number of files sent from the client content tree
 	uint32_t totalFiles;
 	/// List of pairs filename:updatekey (content tree in the client)
@@ -1113,8 +1121,15 @@ public:
 		std::string filename;
 		std::string updatekey;
 		uint32_t transferID;
-		uint32_t numParts;
 		uint32_t size;
+		/// Whether the server waits for the checksums of the blocks
+		/// of the old version (MsgContentFileSums), to send only the
+		/// differences
+		bool delta;
+		/// Size of the data to transfer when the file is sent
+		/// compressed (with the method accepted by the client), 0 if
+		/// sent as is
+		uint32_t compressedSize;
 	};
 
 	/// Number of files to update (length of the following list)
@@ -1125,7 +1140,8 @@ public:
 	/** Add a file to update, we must provide just the filename and other
 	 * params and the counter is updated when serialized. */
 	void addFile(const char* filename, const char* updatekey,
-		     uint32_t transfer_id, uint32_t num_parts, uint32_t size);
+		     uint32_t transfer_id, uint32_t size,
+		     bool delta, uint32_t compressed_size);
 
 public:
 	/* Common abstract part that the it has to be defined */
@@ -1158,10 +1174,24 @@ public:
 	uint32_t partNum;
 	/// Size of the data
 	uint32_t size;
+	/// Offset of the data to copy from the old version of the file (which
+	/// the client already has), appended after the data of this part
+	uint32_t copyOffset;
+	/// Size of the data to copy from the old version, 0 if none
+	uint32_t copySize;
 	/** The data itself. */
 	std::vector<char> buffer;
+	/** Data to send instead of the buffer, if set (in example, pointing
+	 * to a file mapped in memory, to avoid copying it to the buffer
+	 * first); it must be valid until the message is serialized.  Not
+	 * used when receiving. */
+	const char* data;
 
 public:
+	MsgContentFilePart() :
+		transferID(0), partNum(0), size(0), copyOffset(0), copySize(0), data(0)
+		{ }
+
 	/* Common abstract part that the it has to be defined */
 
 	static MsgType mType;
@@ -1179,6 +1209,44 @@ public:
 	virtual void deserializeData();
 };
 
+/** Checksums of the blocks of the old version of a file that the client has,
+ * so the server can send only the differences.  Sent by the client for each
+ * file marked as delta in MsgContentUpdateList (without blocks if it can't read
+ * the old version).
+ */
+class MsgContentFileSums : public MsgBase
+{
+public:
+	/// Transfer ID of the file (see MsgContentUpdateList)
+	uint32_t transferID;
+	/// Size of the blocks
+	uint32_t blockSize;
+	/// Number of blocks (length of the following lists)
+	uint32_t numBlocks;
+	/// Weak (rolling) checksums of the blocks
+	std::vector<uint32_t> weakSums;
+	/// Strong checksums of the blocks
+	std::vector<uint64_t> strongSums;
+
+public:
+	/* Common abstract part that the it has to be defined */
+
+	static MsgType mType;
+
+	/** Returns the message type, it has to be different for each message of
+	 * course. */
+	MsgType getType() const { return mType; }
+	/** Returns an instance of the message */
+	virtual MsgBase* createInstance();
+	/** Performs the serialization of the data defined in this derived
+	 * class, the real content of the message. */
+	virtual void serializeData();
+	/** Reverse action of serialization, it must be performed in the same
+	 * order to obtain an exact copy of the message in the peer */
+	virtual void deserializeData();
+};
+
+
 /** This class represents a trade session
  */
 class MsgTrade : public MsgBase
@@ -35,6 +35,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/poll.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #endif
 
@@ -47,6 +48,9 @@
 /// enough)
 #define PACKET_MAX_SIZE 32768
 
+/// This is the initial size of the send buffer, it grows when needed
+#define SEND_BUFFER_INITIAL_SIZE 4096
+
 /// This is the exact size of the ping packet (2 bytes for id, 4 bytes for
 /// timestamp)
 #define PING_BUFFER_LENGTH 6
@@ -92,60 +96,118 @@ namespace NetLayerUtils
 
 
 //--------------------------- Netlink -------------------------
-Netlink::RawPacket::RawPacket(const char* buffer, size_t s)
+Netlink::RingBuffer::RingBuffer(size_t s) :
+	size(s)
 {
-	size = s;
-	data = new char[size];
-	memcpy(data, buffer, s);
+	buffer = new char[size];
+	front = 0;
+	used = 0;
 }
 
-Netlink::RawPacket::~RawPacket()
+Netlink::RingBuffer::~RingBuffer()
 {
-	delete [] data;
+	delete [] buffer;
 }
 
-Netlink::Buffer::Buffer(size_t s) :
-	size(s)
+size_t Netlink::RingBuffer::getStreamSize() const
 {
-	buffer = new char[size];
-	front = 0;
-	back = 0;
+	PERM_ASSERT(used <= size);
+	return used;
 }
 
-Netlink::Buffer::~Buffer()
+size_t Netlink::RingBuffer::getFreeSize() const
 {
-	delete [] buffer;
+	return size - used;
+}
+
+char Netlink::RingBuffer::at(size_t offset) const
+{
+	PERM_ASSERT(offset < used);
+	return buffer[(front + offset) % size];
+}
+
+bool Netlink::RingBuffer::isContiguous(size_t length) const
+{
+	return (front + length <= size);
 }
 
-size_t Netlink::Buffer::getStreamSize() const
+void Netlink::RingBuffer::copyFront(char* dest, size_t length) const
 {
-	PERM_ASSERT(back >= front && back <= size);
-	return (back - front);
+	PERM_ASSERT(length <= used);
+	size_t firstPart = min(length, size - front);
+	memcpy(dest, buffer + front, firstPart);
+	memcpy(dest + firstPart, buffer, length - firstPart);
+}
+
+void Netlink::RingBuffer::consume(size_t length)
+{
+	PERM_ASSERT(length <= used);
+	used -= length;
+	if (used == 0) {
+		// rewind, so the next data is stored in a single chunk
+		front = 0;
+	} else {
+		front = (front + length) % size;
+	}
+}
+
+void Netlink::RingBuffer::clear()
+{
+	front = 0;
+	used = 0;
+}
+
+void Netlink::RingBuffer::append(const char* data, size_t length)
+{
+	if (length > getFreeSize()) {
+		// grow to the double at least, putting the data at the
+		// beginning of the new buffer
+		size_t newSize = size*2;
+		while (newSize - used < length)
+			newSize *= 2;
+		char* newBuffer = new char[newSize];
+		copyFront(newBuffer, used);
+		delete [] buffer;
+		buffer = newBuffer;
+		size = newSize;
+		front = 0;
+	}
+
+	size_t back = (front + used) % size;
+	size_t firstPart = min(length, size - back);
+	memcpy(buffer + back, data, firstPart);
+	memcpy(buffer, data + firstPart, length - firstPart);
+	used += length;
 }
 
-char* Netlink::Buffer::operator [] (size_t index)
+int Netlink::RingBuffer::getDataChunks(struct iovec* chunks) const
 {
-	PERM_ASSERT(index <= size);
-	return buffer+index;
+	size_t firstPart = min(used, size - front);
+	chunks[0].iov_base = buffer + front;
+	chunks[0].iov_len = firstPart;
+	if (firstPart == used) {
+		return 1;
+	} else {
+		chunks[1].iov_base = buffer;
+		chunks[1].iov_len = used - firstPart;
+		return 2;
+	}
 }
 
 Netlink::Netlink(int socket, const char* ip, int port) :
-	mSocket(socket), mIP(ip), mPort(port), mWorkBuffer(PACKET_MAX_SIZE*2)
+	mSocket(socket), mIP(ip), mPort(port), mWorkBuffer(PACKET_MAX_SIZE*2),
+	mSendBuffer(SEND_BUFFER_INITIAL_SIZE), mFlushPending(false), mSession(0)
 {
 }
 
 Netlink::Netlink() :
-	mSocket(0), mIP("<not set>"), mPort(0), mWorkBuffer(PACKET_MAX_SIZE*2)
+	mSocket(0), mIP("<not set>"), mPort(0), mWorkBuffer(PACKET_MAX_SIZE*2),
+	mSendBuffer(SEND_BUFFER_INITIAL_SIZE), mFlushPending(false), mSession(0)
 {
 }
 
 Netlink::~Netlink()
 {
-	while (!mSendQueue.empty()) {
-		delete mSendQueue.front();
-		mSendQueue.pop_front();
-	}
-
         LogDBG("Statistics: sent (%u p, %u B, %.02f B/p), recv (%u p, %u B, %.02f B/p)",
 	       mNetlinkStats.packetsReceived,
 	       mNetlinkStats.bytesReceived,
@@ -171,16 +233,46 @@ void Netlink::disconnect()
 	mSocket = 0;
 }
 
-size_t Netlink::getBytesInSendQueue()
+size_t Netlink::getBytesInSendQueue() const
 {
-	size_t totalSize = 0;
-	for (size_t i = 0; i < mSendQueue.size(); ++i) {
-		totalSize += mSendQueue[i]->size;
-	}
-	return totalSize;
+	return mSendBuffer.getStreamSize();
+}
+
+bool Netlink::isFlushPending() const
+{
+	return mFlushPending;
+}
+
+void Netlink::setFlushPending(bool pending)
+{
+	mFlushPending = pending;
+}
+
+void* Netlink::getSession() const
+{
+	return mSession;
+}
+
+void Netlink::setSession(void* session)
+{
+	mSession = session;
 }
 
-bool Netlink::recvAvailableData(char* rawRecvBuffer, size_t& bytesRead)
+void Netlink::reset(int socket, const char* ip, int port)
+{
+	PERM_ASSERT(mSocket == 0);
+
+	mSocket = socket;
+	mIP = ip;
+	mPort = port;
+	mWorkBuffer.clear();
+	mSendBuffer.clear();
+	mFlushPending = false;
+	mSession = 0;
+	mNetlinkStats = NetLinkStats();
+}
+
+bool Netlink::recvAvailableData(size_t& bytesRead)
 {
 	// mafm: Instead of reading al the available data from the socket, if
 	// any, and push them into the buffer, it seems to be better to read
@@ -188,18 +280,50 @@ bool Netlink::recvAvailableData(char* rawRecvBuffer, size_t& bytesRead)
 	// tends to be shorter and thus the algorithms of other parts work much
 	// faster, under heavy load.
 
-	int rec = recv(mSocket, rawRecvBuffer, PACKET_MAX_SIZE, 0);
+	// the free space of the ring might be split in two chunks: from the
+	// back to the end of the buffer, and from the beginning to the front
+	size_t back = (mWorkBuffer.front + mWorkBuffer.used) % mWorkBuffer.size;
+	size_t freeSize = mWorkBuffer.getFreeSize();
+	if (freeSize == 0) {
+		// can't happen with messages fitting in the buffer
+		LogERR("Work buffer full for socket %d (IP='%s')", mSocket, getIP());
+		bytesRead = 0;
+		return false;
+	}
+	struct iovec chunks[2];
+	int chunkCount = 1;
+	chunks[0].iov_base = mWorkBuffer.buffer + back;
+	chunks[0].iov_len = min(freeSize, mWorkBuffer.size - back);
+	if (chunks[0].iov_len < freeSize) {
+		chunks[1].iov_base = mWorkBuffer.buffer;
+		chunks[1].iov_len = freeSize - chunks[0].iov_len;
+		++chunkCount;
+	}
+
+	ssize_t rec = 0;
+	do {
+		rec = readv(mSocket, chunks, chunkCount);
+	} while (rec < 0 && errno == EINTR);
+
 	if (rec == 0) {
 		// peer disconnected
 		bytesRead = 0;
 		return false;
 	} else if (rec < 0) {
-		// no data available, haven't read anything
 		bytesRead = 0;
-		return true;
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			// no data available, haven't read anything
+			return true;
+		} else {
+			// connection reset or similar, we won't be notified
+			// about this socket again so handle it as closed
+			LogDBG("recv (socket=%d): %s", mSocket, strerror(errno));
+			return false;
+		}
 	} else {
 		// read some data
 		bytesRead = static_cast<size_t>(rec);
+		mWorkBuffer.used += bytesRead;
 		return true;
 	}
 }
@@ -207,63 +331,55 @@ bool Netlink::recvAvailableData(char* rawRecvBuffer, size_t& bytesRead)
 bool Netlink::processIncomingMsgs(MsgHdlFactory& factory)
 {
 	// mafm: Note that returning false means that the peer closed the
-	// socket, so we must close our end too, so be careful.  The
-	// implementation of this function is somewhat tricky, but I couldn't
-	// find a cleaner solution which were somewhat performant.
-
-	// we first define local buffers to be used with recv()
-	static Buffer recvBuffer(PACKET_MAX_SIZE);
-	static size_t bytesRead = 0;
-
-	// move the remaining data from previous messages to the beginning of
-	// the buffer, to make sure that we'll have room for the rest of
-	// operations
-	if (mWorkBuffer.front != 0) {
-		PERM_ASSERT(mWorkBuffer.getStreamSize() <= PACKET_MAX_SIZE);
-		memcpy(recvBuffer[0],
-		       mWorkBuffer[mWorkBuffer.front],
-		       mWorkBuffer.getStreamSize());
-		memcpy(mWorkBuffer[0],
-		       recvBuffer[0],
-		       mWorkBuffer.getStreamSize());
-		mWorkBuffer.back = mWorkBuffer.getStreamSize();
-		mWorkBuffer.front = 0;
-	}
-
-	// check if we received something, otherwise stop here
-	bool result = recvAvailableData(recvBuffer[0], bytesRead);
-	if (!result) {
-		// peer disconnected
-		return false;
-	} else if (result && bytesRead == 0) {
-		// we don't have data to process
-		return true;
-	}
-
-	// append to work buffer (to process the stream "unsliced")
-	PERM_ASSERT(mWorkBuffer.front == 0);
-	memcpy(mWorkBuffer[mWorkBuffer.back], recvBuffer[0], bytesRead);
-	mWorkBuffer.back += bytesRead;
+	// socket, so we must close our end too, so be careful.
+	//
+	// The socket is drained until there's no more data available, since
+	// with edge-triggered notification we won't be told again about the
+	// data that we leave in the socket.
+
+	// buffer to put together the messages wrapping around the end of the
+	// work buffer, the rest are deserialized in place
+	static char wrappedMsg[PACKET_MAX_SIZE*2];
+	size_t bytesRead = 0;
+	const size_t headerSize = sizeof(uint16_t)+sizeof(uint32_t);
+
+	while (true) {
+		// check if we received something, otherwise stop here
+		bool result = recvAvailableData(bytesRead);
+		if (!result) {
+			// peer disconnected
+			return false;
+		} else if (result && bytesRead == 0) {
+			// we don't have more data to process
+			return true;
+		}
 
-	// loop while there's data enough to process new messages
-	while (mWorkBuffer.getStreamSize() >= sizeof(uint16_t)+sizeof(uint32_t)) {
-		uint16_t nextMsgSize = ( (*mWorkBuffer[mWorkBuffer.front] << 8) & 0xff00 )
-			| ( (*mWorkBuffer[mWorkBuffer.front+1] & 0xff) );
+		// loop while there's data enough to process new messages
+		while (mWorkBuffer.getStreamSize() >= headerSize) {
+			uint16_t nextMsgSize = ( (mWorkBuffer.at(0) << 8) & 0xff00 )
+				| ( (mWorkBuffer.at(1) & 0xff) );
+
+			if (nextMsgSize < headerSize) {
+				// we can't make sense of the rest of the
+				// stream, so we drop the connection
+				LogERR("Bad message size %u from socket %d (IP='%s'), closing",
+				       nextMsgSize, mSocket, getIP());
+				return false;
+			} else if (nextMsgSize > mWorkBuffer.getStreamSize()) {
+				// there's not enough data, wait for more
+				/*
+				LogDBG("Not enough data: next message size %u, data avail. %u",
+				       nextMsgSize, mWorkBuffer.getStreamSize());
+				*/
+				break;
+			}
 
-		if (nextMsgSize > mWorkBuffer.getStreamSize()) {
-			// there's not enough data, wait for more
-			/*
-			LogDBG("Not enough data: next message size %u, data avail. %u",
-			       nextMsgSize, mWorkBuffer.getStreamSize());
-			*/
-			return true;
-		} else {
 			// get the message type
 			char type[5] = "init";
-			type[0] = *mWorkBuffer[mWorkBuffer.front+2];
-			type[1] = *mWorkBuffer[mWorkBuffer.front+3];
-			type[2] = *mWorkBuffer[mWorkBuffer.front+4];
-			type[3] = *mWorkBuffer[mWorkBuffer.front+5];
+			type[0] = mWorkBuffer.at(2);
+			type[1] = mWorkBuffer.at(3);
+			type[2] = mWorkBuffer.at(4);
+			type[3] = mWorkBuffer.at(5);
 			MsgType nextMsgType(type);
 
 			/*
@@ -273,41 +389,44 @@ bool Netlink::processIncomingMsgs(MsgHdlFactory& factory)
 			*/
 
 			// handle the message based on the given factory
+			const char* msgData = mWorkBuffer.buffer + mWorkBuffer.front;
+			if (!mWorkBuffer.isContiguous(nextMsgSize)) {
+				mWorkBuffer.copyFront(wrappedMsg, nextMsgSize);
+				msgData = wrappedMsg;
+			}
 			factory.handleStream(*this,
 					     nextMsgType.getID(),
-					     &mWorkBuffer.buffer[mWorkBuffer.front],
+					     msgData,
 					     nextMsgSize);
 
 			// remove the message from the buffer
-			if (nextMsgSize == mWorkBuffer.getStreamSize()) {
-				mWorkBuffer.front = 0;
-				mWorkBuffer.back = 0;
-			} else {
-				mWorkBuffer.front += nextMsgSize;
-				PERM_ASSERT(mWorkBuffer.back >= mWorkBuffer.front);
-			}
+			mWorkBuffer.consume(nextMsgSize);
 
 			// update the stats
 			++mNetlinkStats.packetsReceived;
 			mNetlinkStats.bytesReceived += nextMsgSize;
 		}
 	}
-
-	// not enough data to continue processing, return true
-	return true;
 }
 
 bool Netlink::sendMsg(MsgBase& msg)
 {
-	// mafm: we could maybe improve this (provided that copying buffers up
-	// to 32KB and typically of tenths or hundreds of bytes make any
-	// different in this kind of program) by not copying into the queue if
-	// there's no queued data, but the logic of the function gets dirty (it
-	// has to be copied later if the message can't be sent, etc) and the
-	// code bigger, so at the moment the implementation is the simpler one
+	bool result = queueMsg(msg);
+	if (!result)
+		return false;
 
-	// prepare the message
-	msg.serialize();
+	// try to process immediately
+	processOutgoingMsgs();
+
+	return true;
+}
+
+bool Netlink::queueMsg(MsgBase& msg)
+{
+	// prepare the message, unless it's already encoded because it's being
+	// sent to several connections
+	if (!msg.isSerialized())
+		msg.serialize();
 
 	// check if the packet is longer than the limit for the packet
 	if (msg.getLength() > PACKET_MAX_SIZE)
@@ -319,14 +438,11 @@ bool Netlink::sendMsg(MsgBase& msg)
 	       getSocket(), getIP(), msg.getLength());
 	*/
 
-	mSendQueue.push_back(new RawPacket(msg.getBuffer(), msg.getLength()));
+	mSendBuffer.append(msg.getBuffer(), msg.getLength());
 
 	// update the stats
 	++mNetlinkStats.packetsSent;
 
-	// try to process immediately
-	processOutgoingMsgs();
-
 	return true;
 }
 
@@ -339,35 +455,24 @@ void Netlink::processOutgoingMsgs()
 	// you're in a local system, so we have to ignore it to not flood the
 	// logs.
 
-	// loop to send the maximum data possible
-	while (!mSendQueue.empty()) {
-		// just send a fragment
-		int sent = send(getSocket(),
-				mSendQueue[0]->data,
-				mSendQueue[0]->size,
-				MSG_NOSIGNAL);
-		if (sent == static_cast<int>(mSendQueue[0]->size)) {
-			// packet sent fully, remove from queue
-			RawPacket* full = mSendQueue[0];
-			mSendQueue.pop_front();
-			delete full;
+	// loop to send the maximum data possible, all the messages queued at
+	// once (the queue is in two chunks at most)
+	while (mSendBuffer.getStreamSize() > 0) {
+		struct iovec chunks[2];
+		struct msghdr hdr;
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.msg_iov = chunks;
+		hdr.msg_iovlen = mSendBuffer.getDataChunks(chunks);
 
-			// update the stats
-			mNetlinkStats.bytesSent += sent;
-		} else if (sent > 0) {
-			// remove the part sent (substituting for a new packet
-			// really). it's a bit expensive, but if the next
-			// iteration results in error, it's difficult to
-			// recover...
-			RawPacket* part = new RawPacket(mSendQueue[0]->data + sent,
-							mSendQueue[0]->size - sent);
-			RawPacket* full = mSendQueue[0];
-			mSendQueue.pop_front();
-			mSendQueue.insert(mSendQueue.begin(), part);
-			delete full;
+		ssize_t sent = sendmsg(getSocket(), &hdr, MSG_NOSIGNAL);
+		if (sent > 0) {
+			// remove the part sent, whole messages or not
+			mSendBuffer.consume(static_cast<size_t>(sent));
 
 			// update the stats
 			mNetlinkStats.bytesSent += sent;
+		} else if (sent < 0 && errno == EINTR) {
+			continue;
 		} else {
 			// see comment in the beginning
 			// LogDBG("send: %s", strerror(errno));
@@ -616,7 +721,12 @@ bool PingServer::listenForClients(const char* addr, int port, int backlog)
 	return true;
 }
 
-void PingServer::acceptIncoming()
+int PingServer::getSocket() const
+{
+	return mPingListener;
+}
+
+int PingServer::acceptIncoming()
 {
 	// connector's address information
 	struct sockaddr_in incoming_addr;
@@ -627,44 +737,51 @@ void PingServer::acceptIncoming()
 			    (struct sockaddr *)&incoming_addr,
 			    &sin_size);
 	if (socket != -1) {
+		fcntl(socket, F_SETFL, O_NONBLOCK);
 		mPingClients.push_back(socket);
 		string ip = inet_ntoa(incoming_addr.sin_addr);
 		int port = incoming_addr.sin_port;
 		LogNTC("Incoming ping connection: %s:%d", ip.c_str(), port);
 	}
+
+	return socket;
 }
 
-void PingServer::processPingRequests()
+bool PingServer::processPingRequests(int socket)
 {
 	static char buffer[PING_BUFFER_LENGTH];
 
-	// loop through the existing connections to know if we received anything
-	for (list<int>::iterator it = mPingClients.begin();
-	     it != mPingClients.end(); ++it) {
-		int rec = recv(*it, buffer, sizeof(buffer), 0);
-		if (rec == 0) {
+	// read until there's no more data available, since we're only told
+	// about new data
+	while (true) {
+		int rec = recv(socket, buffer, sizeof(buffer), 0);
+		if (rec == 0 || (rec < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
 			// peer disconnected
-			it = mPingClients.erase(it);
+			mPingClients.remove(socket);
+			close(socket);
+			return false;
 		} else if (rec < 0) {
 			// no data available, haven't read anything
-		} else if (rec == 6) {
+			if (errno != EINTR)
+				return true;
+		} else if (rec == PING_BUFFER_LENGTH) {
 			// we found a proper ping request
-			// LogDBG("Ping request from socket=%d: %d received", *it, rec);
+			// LogDBG("Ping request from socket=%d: %d received", socket, rec);
 
 			// send a reply
-			int sent = send(*it,
+			int sent = send(socket,
 					buffer,	PING_BUFFER_LENGTH,
 					MSG_NOSIGNAL);
-			if (sent == 6) {
+			if (sent == PING_BUFFER_LENGTH) {
 				// packet sent fully
 			} else {
 				LogDBG("Couldn't send ping reply for socket=%d: %d sent",
-				       *it, sent);
+				       socket, sent);
 			}
 		} else {
 			// read some data
 			LogDBG("Bad incoming ping data socket=%d: %d received",
-			       *it, rec);
+			       socket, rec);
 		}
 	}
 }
@@ -85,12 +85,13 @@
  * problems.
  */
 
+#include <ctime>
 #include <string>
-#include <deque>
 #include <list>
 
 class MsgBase;
 class MsgHdlFactory;
+struct iovec;
 
 
 /** Representation of a link from the application point of view, containing the
@@ -132,10 +133,29 @@ public:
 	/** Send a mesage to the peer (it puts the message in the queue and
 	 * tries to send data right away) */
 	bool sendMsg(MsgBase& msg);
+	/** Put a message in the queue, without trying to send it yet (so
+	 * several messages can be sent at once later with
+	 * processOutgoingMsgs) */
+	bool queueMsg(MsgBase& msg);
 
 	/** Get bytes in send queue, to see if we should queue more or not (in
 	 * example when sending files) */
-	size_t getBytesInSendQueue();
+	size_t getBytesInSendQueue() const;
+	/** Whether this connection is waiting to send queued data (for the
+	 * users of queueMsg, to keep track of the connections to flush) */
+	bool isFlushPending() const;
+	/** Set whether this connection is waiting to send queued data */
+	void setFlushPending(bool pending);
+
+	/** Get the session data of the application attached to this
+	 * connection (in example, the login data in the server), 0 if none */
+	void* getSession() const;
+	/** Attach the session data of the application to this connection, so
+	 * it can be retrieved directly when handling the messages */
+	void setSession(void* session);
+	/** Prepare a closed connection to be reused for a new socket, keeping
+	 * the memory of the buffers but discarding any data */
+	void reset(int socket, const char* ip, int port);
   
 	/** Operator to compare two connections */
 	bool operator == (const Netlink& other) const;
@@ -163,39 +183,61 @@ private:
 	/// The port of the connection
 	uint16_t mPort;
 
-	/** Raw packet (message) to be sent
+	/** Ring buffer to store the data received or to be sent.
+	 *
+	 * Received data waiting to be provided to a message to be deserialized
+	 * is received directly here, and messages are deserialized in place;
+	 * so the stream is not moved around, and only the messages wrapping
+	 * around the end of the buffer need to be copied to be seen as a
+	 * contiguous chunk.
+	 *
+	 * Data to be sent is appended to the back (growing the buffer if
+	 * needed), and sent from the front with a single system call for all
+	 * the messages queued, removing only the part sent.
 	 */
-	class RawPacket {
+	class RingBuffer {
 	public:
-		RawPacket(const char* buffer, size_t s);
-		~RawPacket();
-		size_t size;
-		char* data;
-	};
-
-	/// Buffer to store the data to be sent, the rest of the considerations
-	/// are the same as the ones for receive-buffers
-	std::deque<RawPacket*> mSendQueue;
-
-	/** Buffers to store the received data, waiting to be provided to a
-	 * message to be deserialized.
-	 */
-	class Buffer {
-	public:
-		Buffer(size_t s);
-		~Buffer();
+		RingBuffer(size_t s);
+		~RingBuffer();
+		/** Get the size of the data stored */
 		size_t getStreamSize() const;
-		char* operator [] (size_t index);
+		/** Get the room available for new data */
+		size_t getFreeSize() const;
+		/** Get the byte at the given offset from the front */
+		char at(size_t offset) const;
+		/** Whether the given amount of data from the front is
+		 * contiguous in memory, not wrapping around the end */
+		bool isContiguous(size_t length) const;
+		/** Copy the given amount of data from the front */
+		void copyFront(char* dest, size_t length) const;
+		/** Remove the given amount of data from the front */
+		void consume(size_t length);
+		/** Append data to the back, growing the buffer if needed */
+		void append(const char* data, size_t length);
+		/** Get the data stored, in (at most) two chunks, returning the
+		 * number of chunks */
+		int getDataChunks(struct iovec* chunks) const;
+		/** Discard all the data */
+		void clear();
 
 		char* buffer;
-		const size_t size;
+		size_t size;
+		/// Position of the first byte of data
 		size_t front;
-		size_t back;
+		/// Amount of data stored
+		size_t used;
 	};
 
 	/// Work buffer (to store the unprocessed data and so on).  It has to be
 	/// able to contain two full packets.
-	Buffer mWorkBuffer;
+	RingBuffer mWorkBuffer;
+
+	/// Buffer to store the data to be sent
+	RingBuffer mSendBuffer;
+	/// Whether the connection is waiting to send queued data
+	bool mFlushPending;
+	/// Session data of the application using this connection
+	void* mSession;
 
 	/// Statistics for the connection
 	class NetLinkStats {
@@ -210,11 +252,10 @@ private:
 		uint32_t bytesSent;
 	} mNetlinkStats;
 
-	/** Function to receive all the available data. If a whole packet is
-	 * received (or more than one), it will put it in the queue of packets
-	 * of the netlink.  Returns false if peer disconnected, true
+	/** Function to receive the available data directly in the free space
+	 * of the work buffer.  Returns false if peer disconnected, true
 	 * otherwise. */
-	bool recvAvailableData(char* rawRecvBuffer, size_t& bytesRead);
+	bool recvAvailableData(size_t& bytesRead);
 };
 
 
@@ -266,7 +307,7 @@ private:
 
 /** Abstraction for the ping server.  This opens a TCP socket and listens for
  * clients, when receives some client adds the incoming socket to a list, and
- * preriodically reads the socket to see if there's incoming data.  When there's
+ * reads the socket when notified that there's incoming data.  When there's
  * data it just bounces back the data to the client, so it can measure the time
  * that it took to receive the reply.
  */
@@ -278,10 +319,14 @@ public:
 
 	/** Listen for clients to connect */
 	bool listenForClients(const char* addr, int port, int backlog);
-	/** Accept incoming connections */
-	void acceptIncoming();
-	/** Process ping requests */
-	void processPingRequests();
+	/** Get the listening socket */
+	int getSocket() const;
+	/** Accept an incoming connection, returning its socket (or -1 if there
+	 * are no connections waiting) */
+	int acceptIncoming();
+	/** Process ping requests from the given client socket, returns false if
+	 * the peer disconnected (and the socket was closed) */
+	bool processPingRequests(int socket);
 
 private:
 	/// The base socket to listen to (it's the socket used to 'listen' in a
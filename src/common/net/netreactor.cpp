@@ -0,0 +1,164 @@
+/*
+ * netreactor.cpp
+ * Copyright (C) 2006-2008 by Manuel A. Fernandez Montecelo <mafm@users.sourceforge.net>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <cstring>
+#include <cerrno>
+
+#include "netreactor.h"
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+
+/// Maximum number of events retrieved from the kernel in each round, the rest
+/// are returned in the next call
+#define MAX_EVENTS_PER_ROUND 64
+
+
+//--------------------------- NetReactor -------------------------
+NetReactor::NetReactor()
+{
+	// mafm: the size is only a hint for old kernels, ignored nowadays
+	mEpollFD = epoll_create(256);
+	if (mEpollFD == -1) {
+		LogERR("epoll_create: '%s'", strerror(errno));
+	}
+}
+
+NetReactor::~NetReactor()
+{
+	for (map<int, Registration*>::iterator it = mRegistrations.begin();
+	     it != mRegistrations.end(); ++it) {
+		delete it->second;
+	}
+	mRegistrations.clear();
+
+	for (size_t i = 0; i < mRemoved.size(); ++i) {
+		delete mRemoved[i];
+	}
+	mRemoved.clear();
+
+	if (mEpollFD != -1)
+		close(mEpollFD);
+}
+
+bool NetReactor::addFD(int fd, Handler* handler, void* cookie, int events)
+{
+	if (mRegistrations.find(fd) != mRegistrations.end()) {
+		LogWRN("Descriptor %d already registered in the reactor", fd);
+		return false;
+	}
+
+	Registration* reg = new Registration(fd, handler, cookie);
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLRDHUP;
+	if (events & READ)
+		ev.events |= EPOLLIN;
+	if (events & WRITE)
+		ev.events |= EPOLLOUT;
+	if (events & EDGE)
+		ev.events |= EPOLLET;
+	ev.data.ptr = reg;
+
+	int result = epoll_ctl(mEpollFD, EPOLL_CTL_ADD, fd, &ev);
+	if (result == -1) {
+		LogERR("epoll_ctl (add fd=%d): '%s'", fd, strerror(errno));
+		delete reg;
+		return false;
+	}
+
+	mRegistrations[fd] = reg;
+	return true;
+}
+
+void NetReactor::removeFD(int fd)
+{
+	map<int, Registration*>::iterator it = mRegistrations.find(fd);
+	if (it == mRegistrations.end())
+		return;
+
+	// mafm: closing the descriptor removes it from the epoll set
+	// automatically, so we don't care about EBADF here
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	int result = epoll_ctl(mEpollFD, EPOLL_CTL_DEL, fd, &ev);
+	if (result == -1 && errno != EBADF && errno != ENOENT) {
+		LogERR("epoll_ctl (del fd=%d): '%s'", fd, strerror(errno));
+	}
+
+	// the registration may still be referenced by events of the current
+	// round, so we just mark it and free it later
+	it->second->handler = 0;
+	mRemoved.push_back(it->second);
+	mRegistrations.erase(it);
+}
+
+int NetReactor::waitForEvents(int timeout)
+{
+	struct epoll_event events[MAX_EVENTS_PER_ROUND];
+	int ready = epoll_wait(mEpollFD, events, MAX_EVENTS_PER_ROUND, timeout);
+	if (ready == -1) {
+		// interrupted by signals is not an error
+		if (errno != EINTR)
+			LogERR("epoll_wait: '%s'", strerror(errno));
+		return 0;
+	}
+
+	for (int i = 0; i < ready; ++i) {
+		Registration* reg = static_cast<Registration*>(events[i].data.ptr);
+		if (!reg->handler)
+			continue;
+
+		int flags = 0;
+		if (events[i].events & EPOLLIN)
+			flags |= READ;
+		if (events[i].events & EPOLLOUT)
+			flags |= WRITE;
+		if (events[i].events & (EPOLLRDHUP|EPOLLHUP|EPOLLERR))
+			flags |= HANGUP;
+
+		reg->handler->handleEvents(reg->fd, reg->cookie, flags);
+	}
+
+	// now nobody can reference the removed registrations
+	for (size_t i = 0; i < mRemoved.size(); ++i) {
+		delete mRemoved[i];
+	}
+	mRemoved.clear();
+
+	return ready;
+}
+
+size_t NetReactor::getNumberOfFDs() const
+{
+	return mRegistrations.size();
+}
+
+
+// Local Variables: ***
+// mode: C++ ***
+// tab-width: 8 ***
+// c-basic-offset: 8 ***
+// indent-tabs-mode: t ***
+// fill-column: 80 ***
+// End: ***
+// ex: shiftwidth=2 tabstop=8
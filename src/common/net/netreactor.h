@@ -0,0 +1,115 @@
+/*
+ * netreactor.h
+ * Copyright (C) 2006-2008 by Manuel A. Fernandez Montecelo <mafm@users.sourceforge.net>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FEARANN_COMMON_NET_NETREACTOR_H__
+#define __FEARANN_COMMON_NET_NETREACTOR_H__
+
+
+/** \file netreactor
+ *
+ * Readiness notification for file descriptors (sockets, and the terminal in the
+ * server), built on top of epoll.  Instead of polling every socket in each
+ * iteration of the main loop, the application registers the descriptors that
+ * it's interested in together with a handler, and then waits until some of
+ * them are ready (or until a timeout expires, so timers can be run too).
+ *
+ * Descriptors are registered in edge-triggered mode by default, so the handlers
+ * must consume all the available data (read until EAGAIN) when called, since
+ * they won't be notified again until new data arrives.
+ */
+
+#include <map>
+#include <vector>
+
+
+/** Wrapper around epoll, dispatching the events of the registered descriptors
+ * to their handlers.
+ */
+class NetReactor
+{
+public:
+	/** Flags for the events, used when registering descriptors and when
+	 * notifying handlers */
+	enum EVENTS {
+		READ = 1,	///< Data available for reading (or new connection)
+		WRITE = 2,	///< Room available for writing
+		HANGUP = 4,	///< The peer closed the connection, or error
+		EDGE = 8	///< Edge-triggered (only for registration)
+	};
+
+	/** Interface for the objects interested in the events of some
+	 * descriptor */
+	class Handler {
+	public:
+		virtual ~Handler() { }
+		/** Called when the descriptor is ready, the cookie is the one
+		 * given when registering and the events a combination of
+		 * READ, WRITE and HANGUP */
+		virtual void handleEvents(int fd, void* cookie, int events) = 0;
+	};
+
+	/** Default constructor */
+	NetReactor();
+	/** Destructor */
+	~NetReactor();
+
+	/** Register a descriptor, with the given events (READ, WRITE, EDGE).
+	 * Returns false if the descriptor can't be used with the reactor. */
+	bool addFD(int fd, Handler* handler, void* cookie, int events = READ|WRITE|EDGE);
+	/** Unregister a descriptor.  It's safe to call this from a handler,
+	 * even for descriptors with events pending in the current round, and
+	 * also when the descriptor is already closed. */
+	void removeFD(int fd);
+	/** Wait until some descriptor is ready or the timeout (in milliseconds,
+	 * -1 to block indefinitely) expires, and dispatch the events to the
+	 * handlers.  Returns the number of descriptors ready. */
+	int waitForEvents(int timeout);
+	/** Get the number of descriptors registered */
+	size_t getNumberOfFDs() const;
+
+private:
+	/** Data of each registered descriptor */
+	class Registration {
+	public:
+		Registration(int f, Handler* h, void* c) :
+			fd(f), handler(h), cookie(c) { }
+		int fd;
+		Handler* handler;
+		void* cookie;
+	};
+
+	/// The epoll descriptor
+	int mEpollFD;
+	/// Registered descriptors
+	std::map<int, Registration*> mRegistrations;
+	/// Registrations removed while dispatching, freed after the round
+	std::vector<Registration*> mRemoved;
+};
+
+
+#endif
+
+
+// Local Variables: ***
+// mode: C++ ***
+// tab-width: 8 ***
+// c-basic-offset: 8 ***
+// indent-tabs-mode: t ***
+// fill-column: 80 ***
+// End: ***
+// ex: shiftwidth=2 tabstop=8
@@ -44,9 +44,10 @@ Observer::~Observer()
 	// Observable::detachObserver() calls back to ::detachedFromObservable()
 	// and a race condition is raised accessing the list, so we have to ask
 	// for detaching with no call back
-	for (std::list<Observable*>::iterator it = _observables.begin(); it != _observables.end(); ++it) {
-		(*it)->detachObserver(this, false); // don't call back
-		it = _observables.erase(it);
+	while (!_observables.empty()) {
+		Observable* observable = _observables.front();
+		_observables.pop_front();
+		observable->detachObserver(this, false); // don't call back
 	}
 }
 
@@ -88,10 +89,12 @@ void Observable::detachObserver(Observer* observer, bool callback)
 
 void Observable::detachAllObservers()
 {
-	for (std::list<Observer*>::iterator it = _observers.begin(); it != _observers.end(); ++it) {
-		onDetachObserver(*it);
-		(*it)->detachedFromObservable(this);
-		it = _observers.erase(it);
+	// the list changes while detaching, so we take them one by one
+	while (!_observers.empty()) {
+		Observer* observer = _observers.front();
+		_observers.pop_front();
+		onDetachObserver(observer);
+		observer->detachedFromObservable(this);
 	}
 }
 
@@ -19,6 +19,7 @@
 #include "config.h"
 
 #include <cstdlib>
+#include <cstring>
 
 #include "sha1.h"
 
@@ -36,12 +37,27 @@ inline uint32_t SHA1::leftRotate(uint32_t word, uint8_t bits)
 
 void SHA1::encode(const char* message, string& digest)
 {
-	// prepare the internal message
-	vector<uint8_t> internalMessage;
-	while (*message != '\0') {
-		internalMessage.push_back(*(message++));
-	}
+	encode(message, strlen(message), digest);
+}
+
+void SHA1::encode(const char* data, size_t size, string& digest)
+{
+	processData(data, size);
+
+	// get readable form of the result
+	digest.clear();
+	calculateDigest(digest);
+}
 
+uint64_t SHA1::encode64(const char* data, size_t size)
+{
+	processData(data, size);
+
+	return (static_cast<uint64_t>(H[0]) << 32) | H[1];
+}
+
+void SHA1::processData(const char* data, size_t size)
+{
 	// reset the seeds
 	H[0] = 0x67452301;
 	H[1] = 0xEFCDAB89;
@@ -49,18 +65,23 @@ void SHA1::encode(const char* message, string& digest)
 	H[3] = 0x10325476;
 	H[4] = 0xC3D2E1F0;
 
-	// pad the message
-	padMessage(internalMessage);
+	// mafm: the complete chunks are processed directly from the data, so
+	// big data (files) is not copied; only the tail is copied to be padded
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+	size_t completeChunks = size / 64;
+	for (size_t i = 0; i < completeChunks; ++i) {
+		processChunk(bytes + i*64);
+	}
 
-	// process the message (process each block internally)
-	processMessage(internalMessage);
+	// pad the tail of the message
+	vector<uint8_t> tail(bytes + completeChunks*64, bytes + size);
+	padMessage(tail, size);
 
-	// get readable form of the result
-	digest.clear();
-	calculateDigest(digest);
+	// process the tail (process each block internally)
+	processMessage(tail);
 }
 
-void SHA1::padMessage(vector<uint8_t>& message)
+void SHA1::padMessage(vector<uint8_t>& message, uint64_t size)
 {
 	// mafm: The standard says that we should always pad the message (to
 	// form blocks of 512 bits, 64 bytes) even if we already have the
@@ -81,8 +102,8 @@ void SHA1::padMessage(vector<uint8_t>& message)
 	// 4- fill the remaining space with the size of the message (in bits)
 
 
-	// get message length (in bits) before spoiling it
-	uint64_t length = message.size() * 8;
+	// get message length (in bits), of the whole data
+	uint64_t length = size * 8;
 
 	// aux variables to simulate 1 bit (followed with 7 zeroes) and 8 zeroes
 	uint8_t zero = 0x0;
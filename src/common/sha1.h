@@ -41,6 +41,11 @@ class SHA1
 public:
 	/** Get the hash of the given message */
 	static void encode(const char* message, std::string& digest);
+	/** Get the hash of the given data (binary, can contain zeroes) */
+	static void encode(const char* data, size_t size, std::string& digest);
+	/** Get the first 64 bits of the hash of the given data, as a number
+	 * (in example, to compare blocks of files quickly) */
+	static uint64_t encode64(const char* data, size_t size);
 
 	/** Test the correctness, by testing the output of predefined strings
 	 * against the previously known results.  Left as public because we
@@ -56,11 +61,14 @@ private:
 	/** Shortcut for one operation needed in calculations. */
 	static inline uint32_t leftRotate(uint32_t word, uint8_t bits);
 
-	/** Pad the message */
-	static void padMessage(std::vector<uint8_t>& message);
+	/** Pad the message, being size the length of the whole data (the
+	 * message can be only the last part of it) */
+	static void padMessage(std::vector<uint8_t>& message, uint64_t size);
 	/** Process the message, taking 512bit-size blocks in turn and process
 	 * them. */
 	static void processMessage(std::vector<uint8_t>& message);
+	/** Reset the seeds and process the data, with padding */
+	static void processData(const char* data, size_t size);
 	/** Process chunk of 512bit-size with the core of the algorithm. */
 	static void processChunk(const uint8_t chunk[64]);
 	/** Calculate digest. */
@@ -23,6 +23,7 @@
 #include <memory>
 
 class Mutex {
+	friend class Condition;
 public:
 	Mutex() {
 		pthread_mutex_init(&m, 0);
@@ -39,6 +40,32 @@ private:
 	pthread_mutex_t m;
 };
 
+class Condition {
+public:
+	Condition() {
+		pthread_cond_init(&c, 0);
+	}
+	~Condition() {
+		pthread_cond_destroy(&c);
+	}
+
+	/* the mutex must be locked by the caller */
+	void wait(Mutex& m) {
+		pthread_cond_wait(&c, &m.m);
+	}
+
+	void signal() {
+		pthread_cond_signal(&c);
+	}
+
+	void broadcast() {
+		pthread_cond_broadcast(&c);
+	}
+
+private:
+	pthread_cond_t c;
+};
+
 class MutexLocker {
 public:
 	MutexLocker(Mutex & pm):m(pm) {
@@ -35,7 +35,8 @@ const int STRFMT_LENGTH = 256;
 //--------------------------- StrFmt -------------------------
 const char* StrFmt(const char* fmt, ...)
 {
-	static char strfmtBuffer[STRFMT_LENGTH];
+	// mafm: one buffer per thread, the DB threads use it too
+	static __thread char strfmtBuffer[STRFMT_LENGTH];
 	va_list arg;
 	va_start(arg, fmt);
 	int charsWritten = vsnprintf(strfmtBuffer, sizeof(strfmtBuffer), fmt, arg);
@@ -59,6 +59,14 @@ SrvCombatBattle::~SrvCombatBattle()
 }
 
 
+uint32_t SrvCombatBattle::getMsecsToNextTick() const
+{
+	if (mTicks >= 6000)
+		return 0;
+	else
+		return 6000 - mTicks;
+}
+
 void SrvCombatBattle::sendTick(uint32_t ticks)
 {
 	mTicks += ticks;
@@ -455,7 +463,7 @@ void SrvCombatBattle::performAction( SrvEntityPlayer * playerEntity )
 			if ( ( hp ) < 1 )
 			{
 				///\todo: duffolonious: nobody dies yet... but soon.
-				targetEntity->getPlayerInfo()->setHealth( 1 );
+				targetEntity->setHealth( 1 );
 
 				//target is dying or dead - and thus removed from battle
 				if ( type == MsgCombat::DUEL )
@@ -469,7 +477,7 @@ void SrvCombatBattle::performAction( SrvEntityPlayer * playerEntity )
 					mState = MsgCombat::END;
 			}
 			else
-				targetEntity->getPlayerInfo()->setHealth( hp );
+				targetEntity->setHealth( hp );
 
 			LogDBG("- remaining hp: %d", hp);
 
@@ -674,6 +682,21 @@ void SrvCombatMgr::sendTick(uint32_t ticks)
 	}
 }
 
+uint32_t SrvCombatMgr::getMsecsToNextTick() const
+{
+	// with no battles running, the next one would take a full round
+	uint32_t next = 6000;
+	std::vector<SrvCombatBattle*>::const_iterator it;
+	for ( it = battles.begin(); it != battles.end(); ++it )
+	{
+		if ( (*it)->getState() == MsgCombat::ACCEPTED )
+			next = min( next, (*it)->getMsecsToNextTick() );
+		else if ( (*it)->getState() == MsgCombat::END )
+			return 0;
+	}
+	return next;
+}
+
 SrvCombatBattle * SrvCombatMgr::findBattle( uint64_t entityID )
 {
 	vector<SrvCombatBattle*>::iterator it;
@@ -55,6 +55,8 @@ public:
 	/** Receives the tick from the main application to count the game
 	 * time */
 	void sendTick(uint32_t ticks);
+	/** Get the milliseconds left until the next round */
+	uint32_t getMsecsToNextTick() const;
 
 	///add entity
 	void addEntity( SrvEntityPlayer* entity );
@@ -114,6 +116,9 @@ public:
 	/** Receives the tick from the main application to count the game
 	 * time */
 	void sendTick(uint32_t ticks );
+	/** Get the milliseconds left until the next event of any battle, so
+	 * the main loop knows how much it can sleep */
+	uint32_t getMsecsToNextTick() const;
 
 	/// Find a battle
 	SrvCombatBattle * findBattle( uint64_t entityID );
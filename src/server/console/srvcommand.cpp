@@ -26,13 +26,21 @@
 
 #include "server/srvmain.h"
 #include "server/content/srvcontentmgr.h"
+#include "server/db/srvdbmgr.h"
+#include "server/db/srvdbpool.h"
+#include "server/db/srvdbwriter.h"
 #include "server/login/srvloginmgr.h"
 #include "server/net/srvnetworkmgr.h"
 #include "server/world/srvworldtimemgr.h"
+#include "server/world/srvworldgrid.h"
 #include "server/world/srvworldmgr.h"
 #include "server/action/srvcombatmgr.h"
+#include "server/entity/srventitybase.h"
 
 #include <cstdlib>
+#include <cmath>
+
+#include <sys/time.h>
 
 
 /** Quit, stop the server
@@ -89,6 +97,22 @@ public:
 		out.appendLine(StrFmt("Number of accounts: %d", numAccts));
 		out.appendLine(StrFmt("Number of characters: %d", numChars));
 		out.appendLine(StrFmt("Number of players: %d", numPlayers));
+
+		SrvDBWriteStats dbStats;
+		SrvDBMgr::instance().getWriteStats(dbStats);
+		out.appendLine(StrFmt("DB write queue: %zu queued (max %zu), "
+				      "%llu written, %llu failed, %llu coalesced, %llu stalls",
+				      dbStats.queued, dbStats.maxQueued,
+				      static_cast<unsigned long long>(dbStats.written),
+				      static_cast<unsigned long long>(dbStats.failed),
+				      static_cast<unsigned long long>(dbStats.coalesced),
+				      static_cast<unsigned long long>(dbStats.stalls)));
+
+		SrvDBPoolStats poolStats;
+		SrvDBMgr::instance().getPoolStats(poolStats);
+		out.appendLine(StrFmt("DB pool: %zu connections, %zu pending (max %zu), %llu executed",
+				      poolStats.connections, poolStats.pending, poolStats.maxPending,
+				      static_cast<unsigned long long>(poolStats.executed)));
 	}
 };
 
@@ -250,6 +274,38 @@ public:
 };
 
 
+/** Show the content transfers in progress. */
+class SrvCommandShowContent : public Command
+{
+public:
+	SrvCommandShowContent() :
+		Command(PermLevel::ADMIN,
+			  "show_content",
+			  "Show the content transfers in progress") {
+	}
+
+	virtual void execute(vector<string>& args, CommandOutput& out) {
+		if (args.size() > 0) {
+			out.appendLine("This command doesn't accept arguments, ignoring");
+		}
+
+		vector<SrvContentTransferStats> stats;
+		SrvContentMgr::instance().getTransferStats(stats);
+		out.appendLine(StrFmt("Content transfers in progress: %zu", stats.size()));
+		for (size_t i = 0; i < stats.size(); ++i) {
+			double rate = stats[i].bytesSent/1024.0/max(stats[i].seconds, 0.001);
+			out.appendLine(StrFmt(" - IP %s: %zu/%zu files, %.1fKB in %.1fs (%.1f KB/s)",
+					      stats[i].ip.c_str(),
+					      stats[i].filesTotal - stats[i].filesLeft,
+					      stats[i].filesTotal,
+					      stats[i].bytesSent/1024.0,
+					      stats[i].seconds,
+					      rate));
+		}
+	}
+};
+
+
 /** Reload content to be sent to clients. */
 class SrvCommandCombat : public Command
 {
@@ -341,6 +397,150 @@ public:
 };
 
 
+/** Benchmark of the proximity queries with the world grid, compared with
+ * checking all the entities (as done before having the grid)
+ */
+class SrvCommandBenchmarkGrid : public Command
+{
+public:
+	SrvCommandBenchmarkGrid() :
+		Command(PermLevel::ADMIN,
+			  "benchmark_grid",
+			  "Measure proximity queries with the given number of entities (default: 1000 10000 100000)") {
+		mArgNames.push_back(string("entities..."));
+	}
+
+	virtual void execute(vector<string>& args, CommandOutput& out) {
+		vector<int> sizes;
+		for (size_t i = 0; i < args.size(); ++i) {
+			int size = atoi(args[i].c_str());
+			if (size <= 0) {
+				out.appendLine(StrFmt("Invalid number of entities: '%s', aborting",
+						      args[i].c_str()));
+				return;
+			}
+			sizes.push_back(size);
+		}
+		if (sizes.empty()) {
+			sizes.push_back(1000);
+			sizes.push_back(10000);
+			sizes.push_back(100000);
+		}
+
+		for (size_t i = 0; i < sizes.size(); ++i) {
+			run(sizes[i], out);
+		}
+	}
+
+private:
+	/** Entity only used for the benchmark, never added to the world */
+	class BenchEntity : public SrvEntityBase {
+	public:
+		BenchEntity(const MsgEntityCreate& basic, const MsgEntityMove& mov) :
+			SrvEntityBase(basic, mov) { }
+		void moveTo(const MsgEntityMove& mov) { setMovementData(mov); }
+	};
+
+	/** Get the time in microseconds */
+	static double getMicroseconds() {
+		struct timeval now;
+		gettimeofday(&now, 0);
+		return now.tv_sec * 1000000.0 + now.tv_usec;
+	}
+
+	/** Random position in a square of the given side */
+	static Vector3 randomPosition(float side) {
+		return Vector3(side * (rand() / (RAND_MAX + 1.0f)),
+			       side * (rand() / (RAND_MAX + 1.0f)),
+			       0.0f);
+	}
+
+	/** Run the benchmark for the given number of entities */
+	void run(int size, CommandOutput& out) {
+		const int QUERIES = 1000;
+		const size_t NEAREST = 10;
+		const float RADIUS = 100.0f;
+
+		// same density with any number of entities, 1 per 10x10 units
+		float side = 10.0f * sqrtf(static_cast<float>(size));
+		srand(1);
+
+		SrvWorldGrid grid;
+		grid.setCellSize(RADIUS);
+		MsgEntityCreate basic;
+		MsgEntityMove mov;
+		mov.area = "benchmark";
+		vector<BenchEntity*> entities;
+		for (int i = 0; i < size; ++i) {
+			basic.entityID = i;
+			mov.position = randomPosition(side);
+			entities.push_back(new BenchEntity(basic, mov));
+			grid.addEntity(entities.back(), 0);
+		}
+
+		vector<Vector3> centers;
+		for (int i = 0; i < QUERIES; ++i) {
+			centers.push_back(randomPosition(side));
+		}
+
+		// checking all the entities
+		size_t found = 0;
+		Vector3 position;
+		double start = getMicroseconds();
+		for (int i = 0; i < QUERIES; ++i) {
+			for (size_t j = 0; j < entities.size(); ++j) {
+				entities[j]->getPosition(position);
+				if (centers[i].squaredDistance(position) <= RADIUS * RADIUS)
+					++found;
+			}
+		}
+		double linear = (getMicroseconds() - start) / QUERIES;
+
+		// radius with the grid
+		size_t foundGrid = 0;
+		vector<SrvEntityBase*> result;
+		start = getMicroseconds();
+		for (int i = 0; i < QUERIES; ++i) {
+			result.clear();
+			grid.getEntitiesInRadius(mov.area, centers[i], RADIUS, result);
+			foundGrid += result.size();
+		}
+		double radius = (getMicroseconds() - start) / QUERIES;
+
+		// nearest entities with the grid
+		start = getMicroseconds();
+		for (int i = 0; i < QUERIES; ++i) {
+			result.clear();
+			grid.getNearestEntities(mov.area, centers[i], NEAREST, side, result);
+		}
+		double nearest = (getMicroseconds() - start) / QUERIES;
+
+		// moving entities (small steps, only some of them change cell)
+		start = getMicroseconds();
+		for (int i = 0; i < QUERIES; ++i) {
+			BenchEntity* entity = entities[rand() % entities.size()];
+			entity->getPosition(position);
+			mov.position = Vector3(position.x + 5.0f, position.y + 5.0f, 0.0f);
+			entity->moveTo(mov);
+			grid.moveEntity(entity, 0, mov.area, position);
+		}
+		double move = (getMicroseconds() - start) / QUERIES;
+
+		out.appendLine(StrFmt("%d entities: all=%.2fus radius=%.2fus"
+				      " nearest(%u)=%.2fus move=%.2fus"
+				      " (%.1f found per query, %s)",
+				      size, linear, radius,
+				      static_cast<unsigned int>(NEAREST), nearest, move,
+				      static_cast<float>(found) / QUERIES,
+				      found == foundGrid ? "matching" : "NOT MATCHING"));
+
+		for (size_t i = 0; i < entities.size(); ++i) {
+			delete entities[i];
+		}
+	}
+};
+
+
 /*******************************************************************************
  * SrvCommandMgr
  ******************************************************************************/
@@ -371,8 +571,10 @@ void SrvCommandMgr::registerCommands()
 	addCommand(new SrvCommandLoadCreatures());
 	addCommand(new SrvCommandLoadTable());
 	addCommand(new SrvCommandReloadContent());
+	addCommand(new SrvCommandShowContent());
 	addCommand(new SrvCommandCombat());
 	addCommand(new SrvCommandSetLogLevel());
+	addCommand(new SrvCommandBenchmarkGrid());
 
 	// player commands
 	addCommand(new SrvCommandWho());
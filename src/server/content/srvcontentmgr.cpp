@@ -22,122 +22,336 @@
 
 #include "common/net/msgs.h"
 #include "common/configmgr.h"
+#include "common/sha1.h"
 
 #include "server/login/srvloginmgr.h"
 #include "server/net/srvnetworkmgr.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/inotify.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <stdio.h>
 #include <cerrno>
+#include <cmath>
+#include <linux/sockios.h>
 
+#include <algorithm>
 #include <deque>
+#include <set>
 #include <cstring>
 
+#include <zlib.h>
 
-/// If player has this number of bytes in send queue or higher, we don't try to
-/// send more data
-const unsigned int MAX_BYTES_IN_SEND_QUEUE = 8*1024;
 
-/// Maximum size of a chunk of file being sent
-const unsigned int PART_SIZE = 1024;
+/// Minimum number of bytes that we allow to be queued for a player, even if the
+/// buffer of the socket seems to be full (only the socket refusing data stops
+/// the transfer)
+const unsigned int MIN_BYTES_IN_SEND_QUEUE = 8*1024;
+
+/// Minimum size of a chunk of file being sent (unless the file is smaller)
+const unsigned int MIN_PART_SIZE = 1024;
+
+/// Maximum size of a chunk of file being sent (the messages can't be bigger
+/// than 32KB, including headers)
+const unsigned int MAX_PART_SIZE = 30*1024;
+
+/// Maximum number of files of a transfer sent at the same time (interleaving
+/// their parts)
+const unsigned int MAX_FILES_IN_PARALLEL = 4;
+
+/// Maximum time worth of data that the rate limits allow to send at once (in
+/// example after being idle), in seconds
+const double MAX_BURST_TIME = 0.5;
+
+/// Milliseconds to sleep when we don't have to wake up to send data (the
+/// network or other timers wake the main loop before, anyway)
+const uint32_t IDLE_TICK_MSECS = 60*1000;
+
+/// Minimum saving (in percentage of the size) for a compressed file to be sent
+/// instead of the original one
+const unsigned int MIN_COMPRESSION_SAVING = 10;
+
+/// Suffix of the compressed files in the cache
+const char* COMPRESSED_FILE_SUFFIX = ".z";
+
+/// Events of the content directories that we watch
+const uint32_t INOTIFY_MASK = IN_CREATE | IN_DELETE | IN_CLOSE_WRITE
+	| IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+/// Size of the buffer to read the inotify events
+const unsigned int INOTIFY_BUFFER_SIZE = 16*1024;
 
 /// Maximum size to get current working directory
 const unsigned int GETCWD_LENGTH = 1024;
 
 
+/** Current time, in seconds */
+static double getTimeSeconds()
+{
+	struct timeval now;
+	gettimeofday(&now, 0);
+	return now.tv_sec + now.tv_usec/1000000.0;
+}
+
+
 /*******************************************************************************
  * SrvContentFile
  ******************************************************************************/
 SrvContentFile::SrvContentFile(uint32_t transferID,
 			       const std::string& root,
 			       const std::string& filename,
-			       const std::string& updatekey) :
+			       const std::string& updatekey,
+			       bool delta,
+			       const std::string& compressedPath) :
 	mTransferID(transferID),
-	mFilename(filename), mUpdateKey(updatekey), mFile(0),
-	mSize(0), mCursor(0), mPartsSent(0)
+	mFilename(filename), mUpdateKey(updatekey), mValid(false),
+	mCompressed(false), mData(0), mSize(0), mContentSize(0), mCursor(0),
+	mPartsSent(0),
+	mWaitingSums(delta), mBlockSize(0), mScan(0), mRollingSumValid(false)
 {
 	mFilepath = root + "/" + filename;
-	openFile();
+
+	// mafm: only get the size now, the file is mapped when we start to
+	// send it, so the transfers with many files don't keep all of them
+	// opened
+	struct stat buf;
+	if (stat(mFilepath.c_str(), &buf) == 0) {
+		mSize = mContentSize = buf.st_size;
+		mValid = true;
+	} else {
+		LogERR("Unable to open file: '%s'", mFilepath.c_str());
+		return;
+	}
+
+	// the compressed version is empty when it's not worth to use it
+	if (!delta && !compressedPath.empty()
+	    && stat(compressedPath.c_str(), &buf) == 0 && buf.st_size > 0) {
+		mFilepath = compressedPath;
+		mSize = buf.st_size;
+		mCompressed = true;
+	}
 }
 
 SrvContentFile::~SrvContentFile()
 {
-	if (mFile) {
-		fclose(mFile);
-	}
+	unmapFile();
 }
 
-bool SrvContentFile::openFile()
+bool SrvContentFile::mapFile()
 {
-	if (mFile) {
+	if (mData) {
 		return true;
-	} else {
-		mFile = fopen(mFilepath.c_str(), "rb");
-		if (mFile) {
-			fseek(mFile, 0, SEEK_END);
-			mSize = ftell(mFile);
-			fseek(mFile, 0, SEEK_SET);
-			return true;
-		} else {
-			LogERR("Unable to open file: '%s'", mFilepath.c_str());
-			return false;
-		}
+	} else if (!mValid) {
+		return false;
 	}
+
+	int fd = open(mFilepath.c_str(), O_RDONLY);
+	if (fd < 0) {
+		LogERR("Unable to open file: '%s'", mFilepath.c_str());
+		mValid = false;
+		return false;
+	}
+
+	// the file might have changed since we got the size
+	struct stat buf;
+	if (fstat(fd, &buf) != 0 || static_cast<uint32_t>(buf.st_size) != mSize) {
+		LogERR("File changed since the content update was sent: '%s'",
+		       mFilepath.c_str());
+		close(fd);
+		mValid = false;
+		return false;
+	}
+
+	void* data = mmap(0, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		LogERR("Unable to map file '%s': %s", mFilepath.c_str(), strerror(errno));
+		mValid = false;
+		return false;
+	}
+	madvise(data, mSize, MADV_SEQUENTIAL);
+	mData = static_cast<const char*>(data);
+	return true;
 }
 
-bool SrvContentFile::sendPart(const LoginData* player)
+bool SrvContentFile::isReady() const
 {
-	if (!mFile) {
-		// pretend that finished so stops trying to send parts
-		return true;
+	return !mWaitingSums;
+}
+
+void SrvContentFile::setBlockSums(const MsgContentFileSums* msg)
+{
+	if (!mWaitingSums) {
+		LogWRN("Checksums of file '%s' not expected, ignoring", mFilename.c_str());
+		return;
+	}
+	mWaitingSums = false;
+
+	// without blocks (the client couldn't read the old version), or
+	// invalid, the whole file is sent
+	if (msg->weakSums.empty()
+	    || msg->weakSums.size() != msg->strongSums.size()) {
+		return;
+	}
+
+	// mafm: the block size comes from the client, so we can't trust it to
+	// read the file mapped, it has to be as calculated by BlockSum
+	if (msg->blockSize < BlockSum::MIN_BLOCK_SIZE
+	    || (msg->blockSize % 1024) != 0
+	    || msg->blockSize > mContentSize
+	    || static_cast<uint64_t>(msg->weakSums.size()) * msg->blockSize > mContentSize) {
+		LogWRN("Checksums of file '%s' not valid (block size %u, %zu blocks), sending it whole",
+		       mFilename.c_str(), msg->blockSize, msg->weakSums.size());
+		return;
+	}
+
+	mBlockSize = msg->blockSize;
+	mWeakSums = msg->weakSums;
+	mStrongSums = msg->strongSums;
+	for (uint32_t i = 0; i < mWeakSums.size(); ++i) {
+		mWeakIndex.insert(make_pair(mWeakSums[i], i));
 	}
+}
+
+void SrvContentFile::unmapFile()
+{
+	if (mData) {
+		munmap(const_cast<char*>(mData), mSize);
+		mData = 0;
+	}
+}
 
+bool SrvContentFile::sendPart(const LoginData* player, size_t maxPartSize, size_t& sent)
+{
+	sent = 0;
 	MsgContentFilePart msg;
 	msg.transferID = mTransferID;
 
+	if (mSize == 0 && mValid) {
+		LogWRN("File empty: '%s'", mFilename.c_str());
+		msg.partNum = 0;
+		msg.size = 0;
+		SrvNetworkMgr::instance().sendToPlayer(msg, player);
+		return true;
+	} else if (!mapFile()) {
+		// pretend that finished so stops trying to send parts
+		return true;
+	}
+
 	if (mCursor < mSize) {
 		// LogDBG("PART: '%s' (size %u, part %u, cursor %u)", mFilename.c_str(), mSize, mPartsSent, mCursor);
 
 		msg.partNum = mPartsSent;
 
-		// read binary data to memblock
-		char memblock[PART_SIZE+1];
-		fseek(mFile, mCursor, SEEK_SET);
-		msg.size = mSize - mCursor;
-		if (msg.size > PART_SIZE)
-			msg.size = PART_SIZE;
-		int bytesRead = fread(memblock, 1, msg.size, mFile);
-		if (bytesRead == -1 || bytesRead != static_cast<int>(msg.size)) {
-			LogERR("Error reading file '%s': %s", mFilename.c_str(), strerror(errno));
-			return true;
-		}
-
-		// copy the data over to the message
-		for (size_t i = 0; i < msg.size; ++i) {
-			msg.buffer.push_back(memblock[i]);
+		// serialize directly from the mapped file
+		size_t partSize = max(MIN_PART_SIZE, min(MAX_PART_SIZE, static_cast<unsigned int>(maxPartSize)));
+		if (mBlockSize > 0) {
+			prepareDeltaPart(msg, partSize);
+		} else {
+			msg.size = min(static_cast<uint32_t>(partSize), mSize - mCursor);
+			msg.data = mData + mCursor;
+			mCursor += msg.size;
 		}
 		SrvNetworkMgr::instance().sendToPlayer(msg, player);
+		sent = msg.size;
 
 		// update cursors and final cleanup
-		mCursor += msg.size;
 		++mPartsSent;
 
-		return (mCursor == mSize);
-	} else if (mSize == 0) {
-		LogWRN("File empty: '%s'", mFilename.c_str());
-		msg.partNum = 0;
-		msg.size = 0;
-		SrvNetworkMgr::instance().sendToPlayer(msg, player);
-		return true;
+		if (mCursor == mSize) {
+			unmapFile();
+			return true;
+		} else {
+			return false;
+		}
 	} else {
 		LogERR("Unknown error with the size/parts of a file being sent");
 		return false;
 	}
 }
 
+void SrvContentFile::prepareDeltaPart(MsgContentFilePart& msg, size_t maxPartSize)
+{
+	// mafm: we look for blocks of the old version starting at every byte
+	// (rolling the weak checksum), until we find one or we have enough
+	// data not found to fill a part; so each part has the data not found
+	// in the old version, followed by the blocks found (consecutive in
+	// both versions)
+	bool found = false;
+	uint32_t block = 0;
+	while (mScan - mCursor < maxPartSize) {
+		if (mBlockSize > mSize - mScan) {
+			// no room for more blocks, the rest is new data
+			mScan = min(mSize, mCursor + static_cast<uint32_t>(maxPartSize));
+			break;
+		}
+
+		if (!mRollingSumValid) {
+			mRollingSum.init(mData + mScan, mBlockSize);
+			mRollingSumValid = true;
+		}
+		if (findBlock(mRollingSum.getWeak(), mScan, block)) {
+			found = true;
+			break;
+		}
+
+		if (mBlockSize < mSize - mScan)
+			mRollingSum.roll(mData[mScan], mData[mScan + mBlockSize]);
+		else
+			mRollingSumValid = false;
+		++mScan;
+	}
+
+	// new data
+	msg.data = mData + mCursor;
+	msg.size = mScan - mCursor;
+	mCursor = mScan;
+
+	// blocks found
+	if (found) {
+		msg.copyOffset = block * mBlockSize;
+		msg.copySize = mBlockSize;
+		mScan += mBlockSize;
+		for (uint32_t next = block + 1;
+		     next < mWeakSums.size() && mBlockSize <= mSize - mScan;
+		     ++next) {
+			const char* data = mData + mScan;
+			if (BlockSum::getWeak(data, mBlockSize) != mWeakSums[next]
+			    || BlockSum::getStrong(data, mBlockSize) != mStrongSums[next])
+				break;
+			msg.copySize += mBlockSize;
+			mScan += mBlockSize;
+		}
+		mCursor = mScan;
+		mRollingSumValid = false;
+	}
+}
+
+bool SrvContentFile::findBlock(uint32_t weakSum, uint32_t position, uint32_t& block) const
+{
+	typedef std::tr1::unordered_multimap<uint32_t, uint32_t>::const_iterator BlockIter;
+	std::pair<BlockIter, BlockIter> candidates = mWeakIndex.equal_range(weakSum);
+	if (candidates.first == candidates.second)
+		return false;
+
+	// the weak checksum matches, confirm with the strong one
+	uint64_t strongSum = BlockSum::getStrong(mData + position, mBlockSize);
+	for (BlockIter it = candidates.first; it != candidates.second; ++it) {
+		if (mStrongSums[it->second] == strongSum) {
+			block = it->second;
+			return true;
+		}
+	}
+	return false;
+}
+
 const char* SrvContentFile::getFilename() const
 {
 	return mFilename.c_str();
@@ -150,15 +364,12 @@ const char* SrvContentFile::getUpdateKey() const
 
 size_t SrvContentFile::getSize() const
 {
-	return mSize;
+	return mContentSize;
 }
 
-uint32_t SrvContentFile::getNumberOfParts() const
+size_t SrvContentFile::getCompressedSize() const
 {
-	if ((mSize % PART_SIZE) == 0)
-		return (mSize/PART_SIZE);
-	else
-		return (mSize/PART_SIZE)+1;
+	return mCompressed ? mSize : 0;
 }
 
 uint32_t SrvContentFile::getTransferID() const
@@ -171,8 +382,16 @@ uint32_t SrvContentFile::getTransferID() const
  * SrvContentTransfer
  ******************************************************************************/
 SrvContentTransfer::SrvContentTransfer(LoginData* player) :
-	mPlayer(player)
+	mPlayer(player), mFilesTotal(0), mNextFile(0),
+	mBudget(0.0), mBytesSent(0), mTimeBegin(getTimeSeconds())
+{
+}
+
+SrvContentTransfer::~SrvContentTransfer()
 {
+	for (size_t i = 0; i < mFileList.size(); ++i) {
+		delete mFileList[i];
+	}
 }
 
 LoginData* SrvContentTransfer::getPlayer() const
@@ -188,17 +407,144 @@ size_t SrvContentTransfer::getNumberOfFiles() const
 void SrvContentTransfer::addFile(SrvContentFile* file)
 {
 	mFileList.push_back(file);
+	++mFilesTotal;
+}
+
+/** Remove the given path from the index, and everything under it if it's a
+ * directory */
+template <class T>
+static void erasePath(std::map<std::string, T>& index, const std::string& path)
+{
+	// '0' is the character after '/', so the range has all the paths
+	// starting with "path/"
+	index.erase(path);
+	index.erase(index.lower_bound(path + "/"), index.lower_bound(path + "0"));
+}
+
+/** Compare the files by size, for sorting */
+static bool isSmallerFile(const SrvContentFile* a, const SrvContentFile* b)
+{
+	return a->getSize() < b->getSize();
+}
+
+void SrvContentTransfer::sortFiles()
+{
+	stable_sort(mFileList.begin(), mFileList.end(), isSmallerFile);
+}
+
+size_t SrvContentTransfer::getSendRoom()
+{
+	// mafm: we queue as much data as the socket can take, so the part size
+	// adapts to the speed of the connection: fast connections (local ones,
+	// in example) get big parts, and slow connections don't pile up data
+	// in the queue of the application.
+	//
+	// We only stop when the socket refused data (EAGAIN leaves it in our
+	// queue), because then the reactor tells us when it's writable again;
+	// our estimate of the space left can be wrong (the kernel grows the
+	// buffer as needed), and if we stopped because of it nobody would wake
+	// us up.  So the buffer size is read again each time, and we always
+	// allow a minimum, to find out when it's really full.
+	Netlink* netlink = mPlayer->getNetlink();
+	if (netlink->getBytesInSendQueue() > 0) {
+		netlink->processOutgoingMsgs();
+		if (netlink->getBytesInSendQueue() > 0)
+			return 0;
+	}
+
+	int bufferSize = 0;
+	socklen_t len = sizeof(bufferSize);
+	if (getsockopt(netlink->getSocket(), SOL_SOCKET, SO_SNDBUF,
+		       &bufferSize, &len) != 0 || bufferSize < 0) {
+		bufferSize = 0;
+	}
+
+	// data still in the socket, not yet sent to the network
+	int pendingInSocket = 0;
+	if (ioctl(netlink->getSocket(), SIOCOUTQ, &pendingInSocket) != 0
+	    || pendingInSocket < 0) {
+		pendingInSocket = 0;
+	}
+
+	size_t room = 0;
+	if (bufferSize > pendingInSocket)
+		room = bufferSize - pendingInSocket;
+	return max(room, static_cast<size_t>(MIN_BYTES_IN_SEND_QUEUE));
+}
+
+bool SrvContentTransfer::hasDataReady() const
+{
+	for (size_t i = 0; i < mFileList.size(); ++i) {
+		if (mFileList[i]->isReady())
+			return true;
+	}
+	return false;
+}
+
+double SrvContentTransfer::getBudget() const
+{
+	return mBudget;
 }
 
-bool SrvContentTransfer::sendPart()
+void SrvContentTransfer::refillBudget(double bytes, double maxBudget)
 {
-	// send a new part of a file, remove it if it's complete
-	SrvContentFile* file = mFileList.back();
-	bool finished = file->sendPart(mPlayer);
+	mBudget = min(mBudget + bytes, maxBudget);
+}
+
+void SrvContentTransfer::getStats(SrvContentTransferStats& stats) const
+{
+	stats.ip = mPlayer->getIP();
+	stats.filesTotal = mFilesTotal;
+	stats.filesLeft = mFileList.size();
+	stats.bytesSent = mBytesSent;
+	stats.seconds = getTimeSeconds() - mTimeBegin;
+}
+
+SrvContentFile* SrvContentTransfer::getFile(uint32_t transferID) const
+{
+	for (size_t i = 0; i < mFileList.size(); ++i) {
+		if (mFileList[i]->getTransferID() == transferID)
+			return mFileList[i];
+	}
+	return 0;
+}
+
+bool SrvContentTransfer::sendPart(size_t maxPartSize, size_t& sent)
+{
+	// mafm: we send a part of the first files ready in turns (the small
+	// ones, once sorted), so several files progress at the same time; the
+	// ones waiting for the checksums of the old version are skipped until
+	// they're ready.  The file is removed when complete, and the next one
+	// takes its place.
+	sent = 0;
+	size_t ready = 0;
+	for (size_t i = 0; i < mFileList.size() && ready < MAX_FILES_IN_PARALLEL; ++i) {
+		if (mFileList[i]->isReady())
+			++ready;
+	}
+	if (ready == 0)
+		return false;
+
+	size_t turn = mNextFile % ready;
+	size_t index = 0;
+	for (; index < mFileList.size(); ++index) {
+		if (mFileList[index]->isReady()) {
+			if (turn == 0)
+				break;
+			--turn;
+		}
+	}
+
+	SrvContentFile* file = mFileList[index];
+	bool finished = file->sendPart(mPlayer, maxPartSize, sent);
+	mBytesSent += sent;
+	mBudget -= sent;
 	if (finished) {
 		LogDBG("File finished: %s", file->getFilename());
 		delete file;
-		mFileList.pop_back();
+		mFileList.erase(mFileList.begin() + index);
+	} else {
+		++mNextFile;
 	}
 
 	if (mFileList.empty()) {
@@ -215,7 +561,9 @@ bool SrvContentTransfer::sendPart()
 template <> SrvContentMgr* Singleton<SrvContentMgr>::INSTANCE = 0;
 
 SrvContentMgr::SrvContentMgr() :
-	mSerialCounter(0)
+	mInotify(-1), mRescanNeeded(false),
+	mSerialCounter(0), mMaxRate(0.0), mMaxRatePerClient(0.0), mBudget(0.0),
+	mTimeLastSend(getTimeSeconds())
 {
 
 	// get current working directory
@@ -237,20 +585,56 @@ SrvContentMgr::SrvContentMgr() :
 		return;
 	}
 
+	// rate limits (in KB/s, 0 means no limit)
+	mMaxRate = 1024.0 * atof(ConfigMgr::instance().getConfigVar("Server.Content.MaxRate", "0"));
+	mMaxRatePerClient = 1024.0 * atof(ConfigMgr::instance().getConfigVar("Server.Content.MaxRatePerClient", "0"));
+	mMaxRate = max(mMaxRate, 0.0);
+	mMaxRatePerClient = max(mMaxRatePerClient, 0.0);
+
+	// content hashes of the previous executions
+	mHashCacheFile = ConfigMgr::instance().getConfigVar("Server.Content.HashCacheFile", "");
+	loadHashCache();
+
+	// compressed versions of the files
+	mCompressedDir = ConfigMgr::instance().getConfigVar("Server.Content.CompressedCacheDir", "");
+	if (!mCompressedDir.empty()) {
+		struct stat buf;
+		if (stat(mCompressedDir.c_str(), &buf) != 0
+		    && mkdir(mCompressedDir.c_str(), 0755) != 0) {
+			LogERR("Couldn't create the dir for compressed content '%s': %s",
+			       mCompressedDir.c_str(), strerror(errno));
+			mCompressedDir.clear();
+		}
+	}
+
+	// watch the changes in the content, so we don't need to scan it
+	// completely when reloading
+	mInotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (mInotify < 0) {
+		LogWRN("Couldn't watch the content for changes (%s), reloading it will scan it completely",
+		       strerror(errno));
+	}
+
 	// load the content
 	loadContentTree();
 }
 
 void SrvContentMgr::finalize()
 {
-	for (list<SrvContentTransfer*>::iterator it = mTransferList.begin(); it != mTransferList.end(); ++it) {
-		SrvContentTransfer* transfer = *it;
+	while (!mTransferList.empty()) {
+		SrvContentTransfer* transfer = mTransferList.front();
 		LogNTC("Removing a transfer (IP %s) from the content manager (cleaning up)",
 		       transfer->getPlayer()->getIP());
 		transfer->getPlayer()->setDownloadingContent(false);
-		it = mTransferList.erase(it);
+		mTransferList.pop_front();
 		delete transfer;
 	}
+
+	if (mInotify >= 0) {
+		close(mInotify);
+		mInotify = -1;
+		mWatches.clear();
+	}
 }
 
 void SrvContentMgr::removeConnection(LoginData* loginData)
@@ -261,7 +645,7 @@ void SrvContentMgr::removeConnection(LoginData* loginData)
 			LogNTC("Removing a transfer (IP %s) from the manager",
 			       loginData->getIP());
 			loginData->setDownloadingContent(false);
-                        it = mTransferList.erase(it);
+			mTransferList.erase(it);
 			delete transfer;
 			return;
 		}
@@ -270,39 +654,142 @@ void SrvContentMgr::removeConnection(LoginData* loginData)
 
 void SrvContentMgr::sendDataToClients()
 {
-	// mafm: This function is a bit tricky and probably will need to be
-	// tweaked in the future; since too much data might flood the client and
-	// too few could make it awfully slow.  With the current network code
-	// and typical network speeds of today (at the time of writing this) it
-	// seems to work quite fine, downloading at 2MBytes/second in local
-	// system and 50-100KBytes/s in remote systems without causing packet
-	// drops in the network layer or anything; so it works decently.
+	// mafm: The size of the parts and the amount of data queued for each
+	// player depends on the room available in the buffer of the socket
+	// and on the rate limits, so we send as much as the connection can
+	// take without flooding the client or piling up data in our queues.
+	// The transfers send a part each in turns, until none can send more,
+	// so they share the global rate limit fairly; and the first one in
+	// the list changes each time.  The parts are serialized directly from
+	// the files mapped in memory.
 
 	if (mTransferList.size() == 0) {
 		return;
 	}
 
-	// iterating through the transfers (players) to send them data
-	for (list<SrvContentTransfer*>::iterator it = mTransferList.begin();
-	     it != mTransferList.end(); ++it) {
-		SrvContentTransfer* transfer = *it;
-		// check that this player has only a few bytes in the queue,
-		// otherwise skip
-		while (transfer->getPlayer()->getNetlink()->getBytesInSendQueue() < MAX_BYTES_IN_SEND_QUEUE) {
-			// put a new part of the file in the queue
-			bool finished = transfer->sendPart();
+	refillBudgets();
+
+	bool sentSomething = true;
+	while (sentSomething) {
+		sentSomething = false;
+		list<SrvContentTransfer*>::iterator it = mTransferList.begin();
+		while (it != mTransferList.end()) {
+			SrvContentTransfer* transfer = *it;
+			size_t partSize = getPartSize(transfer);
+			if (partSize == 0) {
+				++it;
+				continue;
+			}
+
+			// put a new part of a file in the queue
+			size_t sent = 0;
+			bool finished = transfer->sendPart(partSize, sent);
+			mBudget -= sent;
+			sentSomething = true;
 			if (finished) {
-				LogNTC("No more files left, removing transfer (IP: %s)",
-				       transfer->getPlayer()->getIP());
+				SrvContentTransferStats stats;
+				transfer->getStats(stats);
+				LogNTC("No more files left, removing transfer (IP: %s): "
+				       "%zu files, %.1fKB in %.1fs (%.1f KB/s)",
+				       stats.ip.c_str(), stats.filesTotal,
+				       stats.bytesSent/1024.0, stats.seconds,
+				       stats.bytesSent/1024.0/max(stats.seconds, 0.001));
 				transfer->getPlayer()->setDownloadingContent(false);
 				delete transfer;
 				it = mTransferList.erase(it);
-				// break the while loop to go to the next
-				// iteration of for()
-				break;
+			} else {
+				++it;
 			}
 		}
 	}
+
+	// next time, start with the next transfer
+	if (mTransferList.size() > 1) {
+		mTransferList.push_back(mTransferList.front());
+		mTransferList.pop_front();
+	}
+}
+
+uint32_t SrvContentMgr::getMsecsToNextTick() const
+{
+	// mafm: the transfers stop when the socket is full or when the budget
+	// of the rate limits is not enough for a part.  The socket tells us
+	// when it's writable again, but the budgets are only refilled when we
+	// wake up, so we tell when there will be enough for a part.
+	uint32_t next = IDLE_TICK_MSECS;
+	double elapsed = max(getTimeSeconds() - mTimeLastSend, 0.0);
+	for (list<SrvContentTransfer*>::const_iterator it = mTransferList.begin();
+	     it != mTransferList.end(); ++it) {
+		const SrvContentTransfer* transfer = *it;
+
+		// waiting for the checksums from the client, or for the
+		// socket to be writable (data left in our queue after the
+		// flush), in both cases we'll be woken up
+		if (!transfer->hasDataReady()
+		    || transfer->getPlayer()->getNetlink()->getBytesInSendQueue() > 0)
+			continue;
+
+		// seconds until the budgets have enough for a part
+		double wait = 0.0;
+		if (mMaxRate > 0.0) {
+			double budget = mBudget + mMaxRate * elapsed;
+			wait = max(wait, (MIN_PART_SIZE - budget) / mMaxRate);
+		}
+		if (mMaxRatePerClient > 0.0) {
+			double budget = transfer->getBudget() + mMaxRatePerClient * elapsed;
+			wait = max(wait, (MIN_PART_SIZE - budget) / mMaxRatePerClient);
+		}
+		if (wait <= 0.0)
+			return 0;
+		next = min(next, static_cast<uint32_t>(ceil(wait * 1000.0)));
+	}
+	return next;
+}
+
+void SrvContentMgr::refillBudgets()
+{
+	double now = getTimeSeconds();
+	double elapsed = max(now - mTimeLastSend, 0.0);
+	mTimeLastSend = now;
+
+	// the maximum allows a burst of data after being idle, but never less
+	// than a whole part, so slow limits can send parts anyway
+	if (mMaxRate > 0.0) {
+		double maxBudget = max(mMaxRate * MAX_BURST_TIME,
+				       static_cast<double>(MAX_PART_SIZE));
+		mBudget = min(mBudget + mMaxRate * elapsed, maxBudget);
+	}
+	if (mMaxRatePerClient > 0.0) {
+		double maxBudget = max(mMaxRatePerClient * MAX_BURST_TIME,
+				       static_cast<double>(MAX_PART_SIZE));
+		for (list<SrvContentTransfer*>::iterator it = mTransferList.begin();
+		     it != mTransferList.end(); ++it) {
+			(*it)->refillBudget(mMaxRatePerClient * elapsed, maxBudget);
+		}
+	}
+}
+
+size_t SrvContentMgr::getPartSize(SrvContentTransfer* transfer)
+{
+	if (!transfer->hasDataReady())
+		return 0;
+
+	// check that there's room in the socket for more data, skip if the
+	// socket is full (we'll be back when it's writable again)
+	size_t room = transfer->getSendRoom();
+	if (room == 0)
+		return 0;
+
+	// rate limits
+	double partSize = room;
+	if (mMaxRate > 0.0)
+		partSize = min(partSize, mBudget);
+	if (mMaxRatePerClient > 0.0)
+		partSize = min(partSize, transfer->getBudget());
+	if (partSize < MIN_PART_SIZE)
+		return 0;
+	else
+		return static_cast<size_t>(partSize);
 }
 
 bool SrvContentMgr::filenameFilter(const string& fileName)
@@ -317,6 +804,57 @@ bool SrvContentMgr::filenameFilter(const string& fileName)
 }
 
 void SrvContentMgr::loadContentTree()
+{
+	// the hashes are taken from the previous cache, so the files removed
+	// don't stay in it
+	HashCache previousHashes;
+	previousHashes.swap(mHashCache);
+
+	mContentTree.clear();
+	mChangedPaths.clear();
+	mRescanNeeded = false;
+	scanDir(mRootDirForOS, previousHashes);
+
+	LogNTC("Files in the server content tree: %zu", mContentTree.size());
+
+	saveHashCache();
+	purgeCompressedCache();
+}
+
+void SrvContentMgr::updateContentTree()
+{
+	// mafm: only the paths changed are scanned again (all the files under
+	// them if they're directories), the rest of the tree stays as it is
+	set<string> changedPaths;
+	changedPaths.swap(mChangedPaths);
+	for (set<string>::const_iterator it = changedPaths.begin();
+	     it != changedPaths.end(); ++it) {
+		updatePath(*it);
+	}
+
+	LogNTC("Files in the server content tree: %zu (%zu paths changed)",
+	       mContentTree.size(), changedPaths.size());
+
+	saveHashCache();
+}
+
+void SrvContentMgr::updatePath(const string& path)
+{
+	string name = path.substr(mRootDirForOS.length()+1);
+	erasePath(mContentTree, name);
+
+	struct stat buf;
+	if (stat(path.c_str(), &buf) != 0) {
+		// removed
+		erasePath(mHashCache, path);
+	} else if (S_ISDIR(buf.st_mode)) {
+		scanDir(path, mHashCache);
+	} else if (S_ISREG(buf.st_mode)) {
+		addFile(path, buf, mHashCache);
+	}
+}
+
+void SrvContentMgr::scanDir(const string& dir, const HashCache& previous)
 {
 	// mafm: This is not the most efficient or portable function in the
 	// world, but it's meant to not be tricky and complex.  Symbolic links
@@ -330,7 +868,7 @@ void SrvContentMgr::loadContentTree()
 	// setting the dir list to iterate, and pushing the root
 	deque<string> dirs;
 	deque<string> filesToProcess;
-	dirs.push_back(mRootDirForOS);
+	dirs.push_back(dir);
 
 	// iterating through all the tree for directories only
 	while (!dirs.empty()) {
@@ -343,6 +881,7 @@ void SrvContentMgr::loadContentTree()
 			LogERR("Cannot open dir: '%s'", CWD.c_str());
 			continue;
 		}
+		watchDir(CWD);
 
 		// read directory contents
 		struct dirent* dirp = 0;
@@ -374,7 +913,7 @@ void SrvContentMgr::loadContentTree()
 						// finished, among other reasons
 						// to avoid leaks
 						closedir(dp2);
-					} else if (fopen(fullPath.c_str(), "r")) {
+					} else if (access(fullPath.c_str(), R_OK) == 0) {
 						// .. as a file and NOT as a
 						// dir, the target is a file
 						// LogDBG("Link is file: %s", fullPath.c_str());
@@ -396,20 +935,313 @@ void SrvContentMgr::loadContentTree()
 			// LogDBG("file: %s", file.c_str());
 			filesToProcess.pop_front();
 
-			// with regular files, get the data
 			struct stat statbuf;
-			lstat(file.c_str(), &statbuf);
-			string updatekey = StrFmt("%lu-%lu", statbuf.st_size, statbuf.st_mtime);
+			if (stat(file.c_str(), &statbuf) != 0) {
+				LogERR("Can't stat file: %s", file.c_str());
+				continue;
+			}
+			addFile(file, statbuf, previous);
+		}
+	}
+}
 
-			// strip the root (including last /)
-			file.erase(0, mRootDirForOS.length()+1);
+void SrvContentMgr::addFile(const string& path, const struct stat& buf,
+			    const HashCache& previous)
+{
+	// the update key is the hash of the content, so it doesn't change
+	// when the files are copied or touched
+	string updatekey;
+	if (!getContentHash(path, buf, previous, updatekey)) {
+		LogERR("Can't get the content hash of file: %s", path.c_str());
+		return;
+	}
+	prepareCompressed(path, buf, updatekey);
+
+	// strip the root (including last /)
+	mContentTree[path.substr(mRootDirForOS.length()+1)] = updatekey;
+}
+
+void SrvContentMgr::watchDir(const string& dir)
+{
+	if (mInotify < 0)
+		return;
 
-			// push it into the tree
-			mContentTree.push_back(NameValuePair(file, updatekey));
+	int wd = inotify_add_watch(mInotify, dir.c_str(), INOTIFY_MASK);
+	if (wd < 0) {
+		LogWRN("Couldn't watch dir '%s' for changes (%s), reloading the content will scan it completely",
+		       dir.c_str(), strerror(errno));
+		mRescanNeeded = true;
+	} else {
+		mWatches[wd] = dir;
+	}
+}
+
+void SrvContentMgr::unwatchDir(const string& dir)
+{
+	string subdirs = dir + "/";
+	map<int, string>::iterator it = mWatches.begin();
+	while (it != mWatches.end()) {
+		if (it->second == dir
+		    || it->second.compare(0, subdirs.length(), subdirs) == 0) {
+			inotify_rm_watch(mInotify, it->first);
+			mWatches.erase(it++);
+		} else {
+			++it;
 		}
 	}
+}
 
-	LogNTC("Files in the server content tree: %zu", mContentTree.size());
+void SrvContentMgr::checkContentChanges()
+{
+	if (mInotify < 0)
+		return;
+
+	// mafm: we only take note of the paths changed here, the files are
+	// hashed when the content is reloaded (so the files being transferred
+	// don't change in the middle)
+	union {
+		struct inotify_event event;
+		char data[INOTIFY_BUFFER_SIZE];
+	} buffer;
+	ssize_t length = 0;
+	while ((length = read(mInotify, buffer.data, sizeof(buffer.data))) > 0) {
+		const char* position = buffer.data;
+		while (position < buffer.data + length) {
+			const struct inotify_event* event =
+				reinterpret_cast<const struct inotify_event*>(position);
+			position += sizeof(struct inotify_event) + event->len;
+
+			if (event->mask & IN_Q_OVERFLOW) {
+				LogWRN("Too many changes in the content, reloading it will scan it completely");
+				mRescanNeeded = true;
+				continue;
+			}
+
+			map<int, string>::iterator watch = mWatches.find(event->wd);
+			if (watch == mWatches.end()) {
+				continue;
+			} else if (event->mask & IN_IGNORED) {
+				mWatches.erase(watch);
+				continue;
+			} else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+				// we get the event in the parent too, except for
+				// the root
+				if (watch->second == mRootDirForOS)
+					mRescanNeeded = true;
+				continue;
+			} else if (event->len == 0 || filenameFilter(event->name)) {
+				continue;
+			}
+
+			string path = watch->second + "/" + event->name;
+			mChangedPaths.insert(path);
+
+			// the watches of a directory moved away would report
+			// the old paths
+			if ((event->mask & IN_ISDIR) && (event->mask & IN_MOVED_FROM))
+				unwatchDir(path);
+		}
+	}
+}
+
+bool SrvContentMgr::getContentHash(const string& path, const struct stat& buf,
+				   const HashCache& previous, string& hash)
+{
+	HashCache::const_iterator cached = previous.find(path);
+	if (cached != previous.end()
+	    && cached->second.size == static_cast<uint32_t>(buf.st_size)
+	    && cached->second.mtime == buf.st_mtime) {
+		hash = cached->second.hash;
+		mHashCache[path] = cached->second;
+		return true;
+	}
+
+	// not in the cache or changed, calculate it
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	const char* data = 0;
+	if (buf.st_size > 0) {
+		void* mapping = mmap(0, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping == MAP_FAILED) {
+			close(fd);
+			return false;
+		}
+		data = static_cast<const char*>(mapping);
+	}
+	SHA1::encode(data, buf.st_size, hash);
+	if (data)
+		munmap(const_cast<char*>(data), buf.st_size);
+	close(fd);
+
+	HashCacheEntry& entry = mHashCache[path];
+	entry.size = buf.st_size;
+	entry.mtime = buf.st_mtime;
+	entry.hash = hash;
+	return true;
+}
+
+void SrvContentMgr::loadHashCache()
+{
+	if (mHashCacheFile.empty())
+		return;
+
+	FILE* file = fopen(mHashCacheFile.c_str(), "r");
+	if (!file) {
+		LogNTC("Content hash cache not found, it will be created: '%s'",
+		       mHashCacheFile.c_str());
+		return;
+	}
+
+	// one file per line: hash, size, modification time and path
+	char line[GETCWD_LENGTH + 128];
+	while (fgets(line, sizeof(line), file)) {
+		char hash[41];
+		unsigned long size = 0, mtime = 0;
+		int pathStart = 0;
+		if (sscanf(line, "%40s %lu %lu %n", hash, &size, &mtime, &pathStart) < 3
+		    || pathStart == 0) {
+			continue;
+		}
+		string path(line + pathStart);
+		if (!path.empty() && path[path.length()-1] == '\n')
+			path.erase(path.length()-1);
+
+		HashCacheEntry& entry = mHashCache[path];
+		entry.size = size;
+		entry.mtime = mtime;
+		entry.hash = hash;
+	}
+	fclose(file);
+
+	LogNTC("Content hashes loaded from the cache: %zu", mHashCache.size());
+}
+
+void SrvContentMgr::saveHashCache() const
+{
+	if (mHashCacheFile.empty())
+		return;
+
+	// write to a temporary file and rename it, so the cache is never left
+	// half written
+	string tmpFilename = mHashCacheFile + ".tmp";
+	FILE* file = fopen(tmpFilename.c_str(), "w");
+	if (!file) {
+		LogERR("Couldn't save the content hash cache: '%s'", tmpFilename.c_str());
+		return;
+	}
+	for (HashCache::const_iterator it = mHashCache.begin();
+	     it != mHashCache.end(); ++it) {
+		fprintf(file, "%s %lu %lu %s\n",
+			it->second.hash.c_str(),
+			static_cast<unsigned long>(it->second.size),
+			static_cast<unsigned long>(it->second.mtime),
+			it->first.c_str());
+	}
+	if (fclose(file) != 0 || rename(tmpFilename.c_str(), mHashCacheFile.c_str()) != 0) {
+		LogERR("Couldn't save the content hash cache: '%s'", mHashCacheFile.c_str());
+		unlink(tmpFilename.c_str());
+	}
+}
+
+string SrvContentMgr::getCompressedPath(const string& hash) const
+{
+	if (mCompressedDir.empty())
+		return "";
+	else
+		return mCompressedDir + "/" + hash + COMPRESSED_FILE_SUFFIX;
+}
+
+void SrvContentMgr::prepareCompressed(const string& path, const struct stat& buf,
+				      const string& hash)
+{
+	// mafm: the files are compressed only once (named after the hash, so
+	// they're reused as long as the content doesn't change), so sending
+	// them doesn't cost any CPU.  When compressing is not worth (images
+	// and other formats already compressed), an empty file is left in the
+	// cache, so we don't try again.
+	string compressedPath = getCompressedPath(hash);
+	if (compressedPath.empty() || buf.st_size == 0)
+		return;
+	struct stat compressedBuf;
+	if (stat(compressedPath.c_str(), &compressedBuf) == 0)
+		return;
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		LogERR("Unable to open file: '%s'", path.c_str());
+		return;
+	}
+	void* data = mmap(0, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		LogERR("Unable to map file '%s': %s", path.c_str(), strerror(errno));
+		return;
+	}
+
+	uLongf compressedSize = compressBound(buf.st_size);
+	vector<Bytef> compressed(compressedSize);
+	int result = compress2(&compressed[0], &compressedSize,
+			       static_cast<const Bytef*>(data), buf.st_size,
+			       Z_BEST_COMPRESSION);
+	munmap(data, buf.st_size);
+	if (result != Z_OK) {
+		LogERR("Couldn't compress file '%s' (zlib error %d)", path.c_str(), result);
+		return;
+	}
+	if (compressedSize * 100 > static_cast<uint64_t>(buf.st_size) * (100 - MIN_COMPRESSION_SAVING)) {
+		compressedSize = 0;
+	}
+
+	// write to a temporary file and rename it, so we never send a half
+	// written one
+	string tmpPath = compressedPath + ".tmp";
+	FILE* file = fopen(tmpPath.c_str(), "wb");
+	if (!file) {
+		LogERR("Couldn't write compressed file: '%s'", tmpPath.c_str());
+		return;
+	}
+	bool written = (compressedSize == 0
+			|| fwrite(&compressed[0], compressedSize, 1, file) == 1);
+	if (fclose(file) != 0 || !written
+	    || rename(tmpPath.c_str(), compressedPath.c_str()) != 0) {
+		LogERR("Couldn't write compressed file: '%s'", compressedPath.c_str());
+		unlink(tmpPath.c_str());
+	}
+}
+
+void SrvContentMgr::purgeCompressedCache()
+{
+	if (mCompressedDir.empty())
+		return;
+
+	set<string> current;
+	for (ContentIndex::const_iterator it = mContentTree.begin();
+	     it != mContentTree.end(); ++it) {
+		current.insert(it->second + COMPRESSED_FILE_SUFFIX);
+	}
+
+	DIR* dp = opendir(mCompressedDir.c_str());
+	if (!dp) {
+		LogERR("Cannot open dir: '%s'", mCompressedDir.c_str());
+		return;
+	}
+	size_t purged = 0;
+	struct dirent* dirp = 0;
+	while ((dirp = readdir(dp)) != 0) {
+		string filename = dirp->d_name;
+		if (filename[0] == '.' || current.find(filename) != current.end())
+			continue;
+		string fullPath = mCompressedDir + "/" + filename;
+		if (unlink(fullPath.c_str()) == 0)
+			++purged;
+	}
+	closedir(dp);
+
+	if (purged > 0) {
+		LogNTC("Compressed files purged from the cache: %zu", purged);
+	}
 }
 
 void SrvContentMgr::clearContentTree()
@@ -422,11 +1254,16 @@ bool SrvContentMgr::reloadContentTree()
 	if (!mTransferList.empty()) {
 		LogWRN("There are active transfers, refusing to reload content tree");
 		return false;
-	} else {
+	}
+
+	checkContentChanges();
+	if (mInotify < 0 || mRescanNeeded) {
 		clearContentTree();
 		loadContentTree();
-		return true;
+	} else {
+		updateContentTree();
 	}
+	return true;
 }
 
 void SrvContentMgr::handleQueryFiles(LoginData* loginData,
@@ -444,61 +1281,95 @@ void SrvContentMgr::handleQueryFiles(LoginData* loginData,
 	// new transfer
 	SrvContentTransfer* transfer = new SrvContentTransfer(loginData);
 
-	// using a hash to retrive the files quickly (it will be compared with
-	// the ones in the server)
-	map<string, NameValuePair> client_tree;
-	for (size_t i = 0; i < msg->filepairs.size(); ++i) {
-		client_tree[msg->filepairs[i].name] = msg->filepairs[i];
+	// the list of the client sorted by name, so we can merge it with the
+	// content tree in a single pass (the clients send it sorted, but we
+	// can't trust them)
+	vector<NameValuePair>& clientFiles = msg->filepairs;
+	for (size_t i = 1; i < clientFiles.size(); ++i) {
+		if (clientFiles[i] < clientFiles[i-1]) {
+			sort(clientFiles.begin(), clientFiles.end());
+			break;
+		}
 	}
-	map<string, NameValuePair>::iterator client_file;
 
-	// loop though all files of content tree
-	for (size_t i = 0; i < mContentTree.size(); ++i) {
-		// trying to get the corresponding file in the client
-		client_file = client_tree.find(mContentTree[i].name);
+	// loop though all files of content tree and the client at the same
+	// time
+	ContentIndex::const_iterator serverFile = mContentTree.begin();
+	size_t clientFile = 0;
+	while (serverFile != mContentTree.end() || clientFile < clientFiles.size()) {
+		// skip duplicates in the client list
+		if (clientFile > 0 && clientFile < clientFiles.size()
+		    && clientFiles[clientFile].name == clientFiles[clientFile-1].name) {
+			++clientFile;
+			continue;
+		}
+
+		int order = 0;
+		if (serverFile == mContentTree.end())
+			order = 1;
+		else if (clientFile == clientFiles.size())
+			order = -1;
+		else
+			order = serverFile->first.compare(clientFiles[clientFile].name);
+
+		if (order > 0) {
+			// in the client but not in the server -> added to
+			// delete message
+			msg_delete.addFile(clientFiles[clientFile].name);
+			++clientFile;
+			continue;
+		}
 
 		string action;
-		if (client_file == client_tree.end()) {
+		if (order < 0) {
 			// add (same result as update)
 			action = "A";
-		} else if (mContentTree[i].name == (*client_file).second.name
-			   && mContentTree[i].value != (*client_file).second.value) {
+		} else if (serverFile->second != clientFiles[clientFile].value) {
 			// update
 			action = "U";
 		} else {
 			// ignore
 			action = "I";
 		}
-		// LogDBG(" %s %s", action.c_str(), mContentTree[i].filename.c_str());
+		// LogDBG(" %s %s", action.c_str(), serverFile->first.c_str());
 
 		// addin or update -> prepare file to be sent and add it to the
 		// tranfer (list of files to be sent related with a player)
+		//
+		// when updating, the client has the old version, so we'll send
+		// only the differences when it sends us the checksums of it;
+		// when adding, we send the compressed version if the client
+		// accepts it
 		if (action == "A" || action == "U") {
+			bool delta = (action == "U");
+			string compressedPath;
+			if (msg->compression == MsgContentQueryUpdate::DEFLATE)
+				compressedPath = getCompressedPath(serverFile->second);
 			SrvContentFile* file = new SrvContentFile(getNewTransferID(),
 								  mRootDirForOS.c_str(),
-								  mContentTree[i].name.c_str(),
-								  mContentTree[i].value.c_str());
+								  serverFile->first.c_str(),
+								  serverFile->second.c_str(),
+								  delta,
+								  compressedPath);
 			transfer->addFile(file);
 			msg_update.addFile(file->getFilename(),
 					   file->getUpdateKey(),
 					   file->getTransferID(),
-					   file->getNumberOfParts(),
-					   file->getSize());
+					   file->getSize(),
+					   delta,
+					   file->getCompressedSize());
 		}
-		client_tree.erase(mContentTree[i].name.c_str());
-  	}
 
-	// remaining files in the client (not processed because they're not in
-	// the server) -> added to delete message
-	for (map<string, NameValuePair>::iterator it = client_tree.begin();
-	     it != client_tree.end(); ++it) {
-		msg_delete.addFile((*it).second.name);
-	}
+		++serverFile;
+		if (order == 0)
+			++clientFile;
+  	}
 	SrvNetworkMgr::instance().sendToPlayer(msg_delete, loginData);
 
 	// add to the transfer list only if theres something to transmit,
 	// otherwise remove the new transfer created
 	if (transfer->getNumberOfFiles() > 0) {
+		transfer->sortFiles();
 		loginData->setDownloadingContent(true);
 		LogDBG("Content update for IP='%s': %zu files",
 		       loginData->getIP(), transfer->getNumberOfFiles());
@@ -511,6 +1382,41 @@ void SrvContentMgr::handleQueryFiles(LoginData* loginData,
 	SrvNetworkMgr::instance().sendToPlayer(msg_update, loginData);
 }
 
+void SrvContentMgr::handleFileSums(LoginData* loginData,
+				   MsgContentFileSums* msg)
+{
+	if (!loginData)
+		return;
+
+	for (list<SrvContentTransfer*>::iterator it = mTransferList.begin();
+	     it != mTransferList.end(); ++it) {
+		if ((*it)->getPlayer() != loginData)
+			continue;
+
+		SrvContentFile* file = (*it)->getFile(msg->transferID);
+		if (!file)
+			break;
+		LogDBG("Checksums for file '%s': %zu blocks of %u bytes",
+		       file->getFilename(), msg->weakSums.size(), msg->blockSize);
+		file->setBlockSums(msg);
+		return;
+	}
+
+	LogWRN("Checksums for a file not being transferred (IP: %s, transferID=%u)",
+	       loginData->getIP(), msg->transferID);
+}
+
+void SrvContentMgr::getTransferStats(vector<SrvContentTransferStats>& stats) const
+{
+	stats.clear();
+	for (list<SrvContentTransfer*>::const_iterator it = mTransferList.begin();
+	     it != mTransferList.end(); ++it) {
+		SrvContentTransferStats transferStats;
+		(*it)->getStats(transferStats);
+		stats.push_back(transferStats);
+	}
+}
+
 uint32_t SrvContentMgr::getNewTransferID()
 {
 	return ++mSerialCounter;
@@ -22,22 +22,36 @@
 
 #include "common/patterns/singleton.h"
 #include "common/datatypes.h"
+#include "common/blocksum.h"
 
 #include <string>
+#include <ctime>
 #include <list>
+#include <map>
+#include <set>
 #include <vector>
+#include <tr1/unordered_map>
 
 
 class MsgContentQueryUpdate;
+class MsgContentFilePart;
+class MsgContentFileSums;
 class LoginData;
 
 
 /** Represents a file being sent.
  *
- * Using good ol' cstdio instead of newer fstream methods to deal with files,
- * because the compiler was spitting weird errors about templates, parts being
- * private and so forth; preventing to make a clean design in some parts of the
- * manager.
+ * The file is mapped in memory when starting to send it, so the parts are
+ * serialized directly from the mapping to the connection, without reading
+ * them first into intermediate buffers.
+ *
+ * When the client has an old version of the file, it sends the checksums of
+ * its blocks, and then the parts contain only the data not found in the old
+ * version plus references to the blocks found (looked for in any position with
+ * the rolling checksum, as rsync does), instead of the whole file.
+ *
+ * When the file is new for the client and there's a compressed version of it
+ * in the cache, that one is sent instead, and the client decompresses it.
  *
  * @author mafm
  */
@@ -48,12 +62,22 @@ public:
 	SrvContentFile(uint32_t transfer_id,
 		       const std::string& root,
 		       const std::string& filename,
-		       const std::string& updatekey);
+		       const std::string& updatekey,
+		       bool delta,
+		       const std::string& compressedPath);
 	/** Destructor */
 	~SrvContentFile();
 
-	/** Send a new chunk of data.  Returns true if the file is fully sent */
-	bool sendPart(const LoginData* player);
+	/** Whether the file can be sent (it's not waiting for the checksums
+	 * of the old version) */
+	bool isReady() const;
+	/** Set the checksums of the blocks of the old version that the
+	 * client has, so we can start sending the differences */
+	void setBlockSums(const MsgContentFileSums* msg);
+
+	/** Send a new chunk of data, of the given size at most, and tell the
+	 * bytes of data sent.  Returns true if the file is fully sent */
+	bool sendPart(const LoginData* player, size_t maxPartSize, size_t& sent);
 
 	/** Returns the filename */
 	const char* getFilename() const;
@@ -61,8 +85,8 @@ public:
 	const char* getUpdateKey() const;
 	/** Returns the size */
 	size_t getSize() const;
-	/** Returns number of parts needed */
-	uint32_t getNumberOfParts() const;
+	/** Returns the size of the data sent if compressed, 0 if not */
+	size_t getCompressedSize() const;
 	/** Returns the transfer ID */
 	uint32_t getTransferID() const;
 
@@ -75,23 +99,81 @@ private:
 	std::string mFilename;
 	/// The update key
 	std::string mUpdateKey;
-	/// File in the hard disk
-	FILE* mFile;
-	/// The total size of the file
+	/// Whether the file could be found when creating this object
+	bool mValid;
+	/// Whether we send the compressed version of the file (in that case,
+	/// the file path and data refer to it)
+	bool mCompressed;
+	/// The contents of the file, mapped in memory (0 if not yet)
+	const char* mData;
+	/// The total size of the data to send
 	uint32_t mSize;
+	/// The size of the content of the file
+	uint32_t mContentSize;
 	/// The position where we read
 	uint32_t mCursor;
 	/// Number of parts already sent
 	uint32_t mPartsSent;
 
+	/// Whether we wait for the checksums of the old version
+	bool mWaitingSums;
+	/// Size of the blocks of the old version (0 if we don't have them)
+	uint32_t mBlockSize;
+	/// Weak checksums of the blocks of the old version
+	std::vector<uint32_t> mWeakSums;
+	/// Strong checksums of the blocks of the old version
+	std::vector<uint64_t> mStrongSums;
+	/// Index of the blocks by their weak checksum
+	std::tr1::unordered_multimap<uint32_t, uint32_t> mWeakIndex;
+	/// Position where we look for blocks of the old version (the data
+	/// between the cursor and this position is not found in it)
+	uint32_t mScan;
+	/// Rolling checksum of the block at the scan position
+	BlockSum mRollingSum;
+	/// Whether the rolling checksum is calculated for the scan position
+	bool mRollingSumValid;
+
 
-	/** Open the file if it's not opened, and return whether it could be
-	 * opened or not. */
-	bool openFile();
+	/** Map the file if it's not mapped, and return whether it could be
+	 * mapped or not. */
+	bool mapFile();
+	/** Unmap the file, if mapped */
+	void unmapFile();
+	/** Prepare a part with the differences with the old version */
+	void prepareDeltaPart(MsgContentFilePart& msg, size_t maxPartSize);
+	/** Find the block of the old version equal to the one in the given
+	 * position, returns false if none */
+	bool findBlock(uint32_t weakSum, uint32_t position, uint32_t& block) const;
+};
+
+
+/** Statistics of a transfer
+ */
+class SrvContentTransferStats
+{
+public:
+	SrvContentTransferStats() :
+		filesTotal(0), filesLeft(0), bytesSent(0), seconds(0.0)
+		{ }
+
+	/// IP of the player
+	std::string ip;
+	/// Files to send when the transfer started
+	size_t filesTotal;
+	/// Files not sent yet
+	size_t filesLeft;
+	/// Bytes of data sent so far
+	uint64_t bytesSent;
+	/// Time since the transfer started
+	double seconds;
 };
 
 
 /** Class representing a transfer (a player with a list of files to download)
+ *
+ * Several files are sent at the same time, interleaving their parts, and the
+ * small ones go first, so the client can start to load the scenes early
+ * instead of waiting for the big files that come before.
  *
  * @author mafm
  */
@@ -100,6 +182,8 @@ class SrvContentTransfer
 public:
 	/** Constructor */
 	SrvContentTransfer(LoginData* p);
+	/** Destructor */
+	~SrvContentTransfer();
 
 	/** Get the player */
 	LoginData* getPlayer() const;
@@ -107,22 +191,54 @@ public:
 	size_t getNumberOfFiles() const;
 	/** Add file to be transferred. */
 	void addFile(SrvContentFile* file);
-	/** Send data.  Returning true means that we finished or that there was
-	 * an error, the transfer should be removed because it won't be useful
-	 * anymore. */
-	bool sendPart();
+	/** Sort the files to send the small ones first, to be called when all
+	 * the files are added */
+	void sortFiles();
+	/** Send data, and tell the bytes of data sent.  Returning true means
+	 * that we finished or that there was an error, the transfer should be
+	 * removed because it won't be useful anymore. */
+	bool sendPart(size_t maxPartSize, size_t& sent);
+	/** Whether some of the files is ready to be sent */
+	bool hasDataReady() const;
+	/** Get the file with the given transfer ID, 0 if not found */
+	SrvContentFile* getFile(uint32_t transferID) const;
+	/** Room available to queue more data for the player, according to
+	 * the space left in the buffer of the socket (0 only when the socket
+	 * refused data, so we'll be notified when it's writable again) */
+	size_t getSendRoom();
+	/** Bytes that the player can receive now according to its rate limit
+	 * (the budget is refilled with the time elapsed, up to a maximum) */
+	double getBudget() const;
+	/** Add bytes to the budget of the player, up to the given maximum */
+	void refillBudget(double bytes, double maxBudget);
+	/** Get the statistics of the transfer */
+	void getStats(SrvContentTransferStats& stats) const;
 
 private:
 	/// The player
 	LoginData* mPlayer;
-	/// The list of files to send
+	/// The list of files to send (the small ones first, once sorted)
 	std::vector<SrvContentFile*> mFileList;
+	/// Number of files to send when the transfer started
+	size_t mFilesTotal;
+	/// Position of the next file to send, among the ones sent in parallel
+	size_t mNextFile;
+	/// Bytes that the player can receive now according to its rate limit
+	double mBudget;
+	/// Bytes of data sent so far
+	uint64_t mBytesSent;
+	/// Time when the transfer started
+	double mTimeBegin;
 };
 
 
 /** The server part of the content manager: it receives the content listing from
  * the player (pair of file:updatekey) and sends the data needed
  *
+ * The content tree is scanned completely only when starting, and then the
+ * directories are watched with inotify, so reloading it only needs to process
+ * the files changed since.
+ *
  * @author mafm
  */
 class SrvContentMgr : public Singleton<SrvContentMgr>
@@ -134,21 +250,46 @@ public:
 
 	/** Reload the content tree */
 	bool reloadContentTree();
+	/** Check for changes in the content tree, to take them into account
+	 * when reloading it */
+	void checkContentChanges();
 	/** Send some more data to clients */
 	void sendDataToClients();
+	/** Get the milliseconds left until we can send more data to some
+	 * client (when waiting for the rate limits), so the main loop knows
+	 * how much it can sleep */
+	uint32_t getMsecsToNextTick() const;
 	/** Remove a player connection, not sending more data to it */
 	void removeConnection(LoginData* loginData);
 	/** Handle a message querying for content updates */
 	void handleQueryFiles(LoginData* player, 
 			      MsgContentQueryUpdate* msg);
+	/** Handle a message with the checksums of the old version of a file */
+	void handleFileSums(LoginData* player,
+			    MsgContentFileSums* msg);
+	/** Get the statistics of the transfers in progress */
+	void getTransferStats(std::vector<SrvContentTransferStats>& stats) const;
 
 private:
 	/** Singleton friend access */
 	friend class Singleton<SrvContentMgr>;
 
 
-	/// Contains all the files currently being sent
-	std::vector<NameValuePair> mContentTree;
+	/// Hash of the content of the files, by name
+	typedef std::map<std::string, std::string> ContentIndex;
+	/// The files to send to the clients (sorted by name, so the queries
+	/// are answered merging it with the sorted list of the client)
+	ContentIndex mContentTree;
+	/// Descriptor of inotify, to know the files changed (-1 if not
+	/// available)
+	int mInotify;
+	/// Paths of the directories watched, by watch descriptor
+	std::map<int, std::string> mWatches;
+	/// Paths changed since the content tree was loaded
+	std::set<std::string> mChangedPaths;
+	/// Whether we lost track of the changes, and we need to scan the whole
+	/// tree again
+	bool mRescanNeeded;
 	/// The transfers -- using a list to have valid iterators after removing
 	/// elements
 	std::list<SrvContentTransfer*> mTransferList;
@@ -156,15 +297,82 @@ private:
 	uint32_t mSerialCounter;
 	/// Root real directory
 	std::string mRootDirForOS;
+	/// Maximum rate for all the transfers together (bytes/s, 0 if no
+	/// limit)
+	double mMaxRate;
+	/// Maximum rate for each of the transfers (bytes/s, 0 if no limit)
+	double mMaxRatePerClient;
+	/// Bytes that can be sent now according to the global rate limit
+	double mBudget;
+	/// Time when data was sent last time, to refill the budgets
+	double mTimeLastSend;
+
+	/** Content hash of a file, valid while the size and modification time
+	 * don't change */
+	class HashCacheEntry {
+	public:
+		HashCacheEntry() : size(0), mtime(0) { }
+		uint32_t size;
+		time_t mtime;
+		std::string hash;
+	};
+	/// Content hashes indexed by path
+	typedef std::map<std::string, HashCacheEntry> HashCache;
+	/// Content hashes of the files, so they're calculated only when the
+	/// files change
+	HashCache mHashCache;
+	/// File to save the content hashes between executions (empty if none)
+	std::string mHashCacheFile;
+	/// Directory with the compressed versions of the files, named after
+	/// their hash (empty if we don't compress)
+	std::string mCompressedDir;
 
 	/** Return true if we don't want this file to be considered */
 	bool filenameFilter(const std::string& filename);
-	/** Load the content tree */
+	/** Load the content tree, scanning it completely */
 	void loadContentTree();
+	/** Update the content tree with the paths changed */
+	void updateContentTree();
+	/** Scan the given directory and subdirectories, adding their files to
+	 * the tree */
+	void scanDir(const std::string& dir, const HashCache& previous);
+	/** Add the file to the content tree */
+	void addFile(const std::string& path, const struct stat& buf,
+		     const HashCache& previous);
+	/** Update the content tree with the current state of the path (a
+	 * file, a directory or nothing if it was removed) */
+	void updatePath(const std::string& path);
+	/** Watch the directory for changes */
+	void watchDir(const std::string& dir);
+	/** Stop watching the directory and subdirectories */
+	void unwatchDir(const std::string& dir);
+	/** Get the content hash of the file, from the previous cache if
+	 * possible, and add it to the current one */
+	bool getContentHash(const std::string& path, const struct stat& buf,
+			    const HashCache& previous, std::string& hash);
+	/** Load the content hashes saved in the cache file */
+	void loadHashCache();
+	/** Save the content hashes in the cache file */
+	void saveHashCache() const;
+	/** Path of the compressed version of the file with the given hash */
+	std::string getCompressedPath(const std::string& hash) const;
+	/** Create the compressed version of the file in the cache, if it's
+	 * not there already */
+	void prepareCompressed(const std::string& path, const struct stat& buf,
+			       const std::string& hash);
+	/** Remove from the cache the compressed files not in the content tree
+	 * anymore */
+	void purgeCompressedCache();
 	/** Clear the content tree */
 	void clearContentTree();
 	/** Allocate and return a new ID */
 	uint32_t getNewTransferID();
+	/** Refill the budgets of the rate limits with the time elapsed */
+	void refillBudgets();
+	/** Size of the next part that we can send to the player of the
+	 * transfer, according to the room in the connection and the rate
+	 * limits (0 if it can't receive more data now) */
+	size_t getPartSize(SrvContentTransfer* transfer);
 
 
 	/** Default constructor */
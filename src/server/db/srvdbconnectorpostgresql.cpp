@@ -41,7 +41,7 @@ SrvDBPostgresqlResult::~SrvDBPostgresqlResult()
 
 const char* SrvDBPostgresqlResult::getValue(size_t row, size_t column) const
 {
-	if (row > mNRows || column > mNFields) {
+	if (row >= mNRows || column >= mNFields) {
 		LogERR("DB PostgreSQL: getValue out of range (row '%zu', column '%zu')",
 		       row, column);
 		return 0;
@@ -52,7 +52,7 @@ const char* SrvDBPostgresqlResult::getValue(size_t row, size_t column) const
 
 const char* SrvDBPostgresqlResult::getColumnName(size_t column) const
 {
-	if (column > mNFields) {
+	if (column >= mNFields) {
 		LogERR("DB PostgreSQL: getColumnName out of range (column '%zu')",
 		       column);
 		return 0;
@@ -109,26 +109,89 @@ bool SrvDBConnectorPostgresql::connectToDB(const char* host,
 	}
 }
 
-SrvDBResult* SrvDBConnectorPostgresql::executeQuery(const char* sqlcmd) const
+SrvDBResult* SrvDBConnectorPostgresql::checkResult(PGresult* res) const
 {
-	PGresult* res = PQexec(mConn, sqlcmd);
-
 	// check to see that the backend connection was successfully made
 	if (! (PQresultStatus(res) == PGRES_COMMAND_OK
 	       || PQresultStatus(res) == PGRES_TUPLES_OK)) {
 		LogERR("DB failed: '%s'", PQresultErrorMessage(res));
+		PQclear(res);
 		return 0;
 	} else {
 		return new SrvDBPostgresqlResult(res);
 	}
 }
 
+SrvDBResult* SrvDBConnectorPostgresql::executeQuery(const char* sqlcmd) const
+{
+	return checkResult(PQexec(mConn, sqlcmd));
+}
+
+const string* SrvDBConnectorPostgresql::getPrepared(const char* sqlcmd, int nParams) const
+{
+	map<string, string>::iterator it = mPrepared.find(sqlcmd);
+	if (it != mPrepared.end())
+		return &it->second;
+
+	// mafm: the statements are built from the code, not from the data, so
+	// they should be a few; but just in case, we don't keep preparing
+	// statements forever
+	if (mPrepared.size() >= MAX_PREPARED)
+		return 0;
+
+	string name = StrFmt("fearann_%zu", mPrepared.size());
+	PGresult* res = PQprepare(mConn, name.c_str(), sqlcmd, nParams, 0);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+		LogERR("DB failed preparing statement '%s': '%s'",
+		       sqlcmd, PQresultErrorMessage(res));
+		PQclear(res);
+		return 0;
+	}
+	PQclear(res);
+
+	LogDBG("DB prepared statement '%s': '%s'", name.c_str(), sqlcmd);
+	return &mPrepared.insert(make_pair(string(sqlcmd), name)).first->second;
+}
+
+SrvDBResult* SrvDBConnectorPostgresql::executeQuery(const char* sqlcmd,
+						    const vector<string>& params) const
+{
+	if (params.empty())
+		return executeQuery(sqlcmd);
+
+	// mafm: values in text format, the server converts them to the type of
+	// the column as it does with quoted literals.  Passing the lengths it
+	// doesn't need to look for the end of the strings.
+	int nParams = static_cast<int>(params.size());
+	vector<const char*> values(nParams);
+	vector<int> lengths(nParams);
+	for (int i = 0; i < nParams; ++i) {
+		values[i] = params[i].c_str();
+		lengths[i] = static_cast<int>(params[i].size());
+	}
+
+	const string* name = getPrepared(sqlcmd, nParams);
+	if (name) {
+		return checkResult(PQexecPrepared(mConn, name->c_str(),
+						  nParams, &values[0], &lengths[0],
+						  0, 0));
+	} else {
+		return checkResult(PQexecParams(mConn, sqlcmd,
+						nParams, 0, &values[0], &lengths[0],
+						0, 0));
+	}
+}
+
 void SrvDBConnectorPostgresql::escapeData(string& out, const char* data, size_t length) const
 {
-	char escData[(length*2) + 1];
-	escData[0] = '\0';
-	PQescapeString(escData, data, length);
-	out = escData;
+	// mafm: not in the stack, the data might be big
+	vector<char> escData((length*2) + 1);
+	int error = 0;
+	PQescapeStringConn(mConn, &escData[0], data, length, &error);
+	if (error) {
+		LogERR("DB failed escaping data: '%s'", PQerrorMessage(mConn));
+	}
+	out = &escData[0];
 }
 
 
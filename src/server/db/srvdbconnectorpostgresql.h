@@ -27,7 +27,9 @@
 #else
 #include <postgresql/libpq-fe.h>
 #endif
+#include <map>
 #include <string>
+#include <vector>
 
 
 /** @ingroup database
@@ -92,6 +94,9 @@ public:
 				size_t length) const;
 	/** Overriden from base class */
 	virtual SrvDBResult* executeQuery(const char* cmd) const;
+	/** Overriden from base class */
+	virtual SrvDBResult* executeQuery(const char* cmd,
+					  const std::vector<std::string>& params) const;
 
 private:
 	/** Friend access */
@@ -100,6 +105,19 @@ private:
 
 	/// Stores a connection object
 	PGconn* mConn;
+	/// Statements prepared in this connection, the key is the SQL command
+	/// and the value the name of the prepared statement
+	mutable std::map<std::string, std::string> mPrepared;
+	/// Maximum number of statements to keep prepared
+	static const size_t MAX_PREPARED = 256;
+
+
+	/** Check the result of a query, returning the result object if
+	 * successful (and freeing it otherwise) */
+	SrvDBResult* checkResult(PGresult* res) const;
+	/** Get the name of the prepared statement for the SQL command,
+	 * preparing it if needed (empty if it couldn't be prepared) */
+	const std::string* getPrepared(const char* cmd, int nParams) const;
 
 
 	/** Default constructor */
@@ -0,0 +1,332 @@
+/*
+ * srvdbconnectorsqlite.cpp
+ * Copyright (C) 2006-2008 by Manuel A. Fernandez Montecelo <mafm@users.sourceforge.net>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_SQLITE
+
+#include "config.h"
+
+#include "srvdbconnectorsqlite.h"
+
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+
+/// Milliseconds to wait for the DB when locked by the other connection
+#define DB_SQLITE_BUSY_TIMEOUT	5000
+
+
+/*******************************************************************************
+ * SrvDBSqliteResult
+ ******************************************************************************/
+SrvDBSqliteResult::SrvDBSqliteResult() :
+	mNRows(0), mNAffected(0)
+{
+}
+
+SrvDBSqliteResult::~SrvDBSqliteResult()
+{
+}
+
+const char* SrvDBSqliteResult::getValue(size_t row, size_t column) const
+{
+	if (row >= mNRows || column >= mColumnNames.size()) {
+		LogERR("DB SQLite: getValue out of range (row '%zu', column '%zu')",
+		       row, column);
+		return 0;
+	} else {
+		return mValues[row*mColumnNames.size() + column].c_str();
+	}
+}
+
+const char* SrvDBSqliteResult::getColumnName(size_t column) const
+{
+	if (column >= mColumnNames.size()) {
+		LogERR("DB SQLite: getColumnName out of range (column '%zu')",
+		       column);
+		return 0;
+	} else {
+		return mColumnNames[column].c_str();
+	}
+}
+
+size_t SrvDBSqliteResult::getNumberOfRows() const
+{
+	return mNRows;
+}
+
+size_t SrvDBSqliteResult::getNumberOfColumns() const
+{
+	return mColumnNames.size();
+}
+
+size_t SrvDBSqliteResult::getNumberOfAffectedRows() const
+{
+	return mNAffected;
+}
+
+
+/*******************************************************************************
+ * SrvDBConnectorSqlite
+ ******************************************************************************/
+SrvDBConnectorSqlite::SrvDBConnectorSqlite(const std::string& schemaFile) :
+	mDB(0), mSchemaFile(schemaFile)
+{
+}
+
+SrvDBConnectorSqlite::~SrvDBConnectorSqlite()
+{
+	for (map<string, sqlite3_stmt*>::iterator it = mPrepared.begin();
+	     it != mPrepared.end(); ++it) {
+		sqlite3_finalize(it->second);
+	}
+	mPrepared.clear();
+
+	sqlite3_close(mDB);
+}
+
+bool SrvDBConnectorSqlite::connectToDB(const char* /* host */,
+				       const char* /* port */,
+				       const char* dbname,
+				       const char* /* dbuser */,
+				       const char* /* dbpass */)
+{
+	LogNTC("Opening SQLite DB '%s'", dbname);
+	int rc = sqlite3_open_v2(dbname, &mDB,
+				 SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 0);
+	if (rc != SQLITE_OK) {
+		LogERR("DB failed: '%s'", mDB ? sqlite3_errmsg(mDB) : sqlite3_errstr(rc));
+		return false;
+	}
+
+	// mafm: with WAL the readers don't block the writer and the other way
+	// around, and with synchronous=NORMAL there's no fsync for every
+	// transaction (only when checkpointing the WAL), the DB is still
+	// consistent after a crash but may lose the last transactions
+	sqlite3_busy_timeout(mDB, DB_SQLITE_BUSY_TIMEOUT);
+	char* errmsg = 0;
+	rc = sqlite3_exec(mDB,
+			  "PRAGMA journal_mode=WAL;"
+			  "PRAGMA synchronous=NORMAL;"
+			  "PRAGMA foreign_keys=ON;",
+			  0, 0, &errmsg);
+	if (rc != SQLITE_OK) {
+		LogERR("DB failed setting up SQLite: '%s'", errmsg);
+		sqlite3_free(errmsg);
+		return false;
+	}
+
+	return createSchema();
+}
+
+bool SrvDBConnectorSqlite::createSchema()
+{
+	SrvDBResult* res = executeQuery("SELECT count(*) FROM sqlite_master WHERE type='table'");
+	if (!res)
+		return false;
+	bool empty = (strcmp(res->getValue(0, 0), "0") == 0);
+	delete res;
+	if (!empty)
+		return true;
+
+	if (mSchemaFile.empty()) {
+		LogERR("DB SQLite: the DB is empty and there's no schema file to create it");
+		return false;
+	}
+
+	ifstream file(mSchemaFile.c_str());
+	if (!file) {
+		LogERR("DB SQLite: couldn't open schema file '%s'", mSchemaFile.c_str());
+		return false;
+	}
+	ostringstream schema;
+	schema << file.rdbuf();
+
+	LogNTC("DB SQLite: creating tables with schema file '%s'", mSchemaFile.c_str());
+	res = executeQuery(schema.str().c_str());
+	if (!res)
+		return false;
+	delete res;
+	return true;
+}
+
+SrvDBResult* SrvDBConnectorSqlite::executeStatement(sqlite3_stmt* stmt,
+						    const vector<string>& params) const
+{
+	// mafm: the statements use $1, $2... as PostgreSQL, so we look for them
+	// by name.  The values are bound as text, SQLite converts them to the
+	// affinity of the column as it does with quoted literals.  They're
+	// not copied, they live until we reset the statement.
+	for (size_t i = 0; i < params.size(); ++i) {
+		string name = StrFmt("$%zu", i+1);
+		int index = sqlite3_bind_parameter_index(stmt, name.c_str());
+		if (index == 0)
+			continue;
+		sqlite3_bind_text(stmt, index, params[i].data(),
+				  static_cast<int>(params[i].size()), SQLITE_STATIC);
+	}
+
+	SrvDBSqliteResult* result = new SrvDBSqliteResult();
+	size_t nColumns = sqlite3_column_count(stmt);
+	for (size_t column = 0; column < nColumns; ++column) {
+		result->mColumnNames.push_back(sqlite3_column_name(stmt, column));
+	}
+
+	int rc = 0;
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		for (size_t column = 0; column < nColumns; ++column) {
+			// NULL values are empty strings, as in PostgreSQL
+			const unsigned char* value = sqlite3_column_text(stmt, column);
+			if (value) {
+				result->mValues.push_back(string(reinterpret_cast<const char*>(value),
+								 sqlite3_column_bytes(stmt, column)));
+			} else {
+				result->mValues.push_back(string());
+			}
+		}
+		++result->mNRows;
+	}
+
+	if (rc != SQLITE_DONE) {
+		LogERR("DB failed: '%s'", sqlite3_errmsg(mDB));
+		delete result; result = 0;
+	} else if (sqlite3_stmt_readonly(stmt)) {
+		result->mNAffected = result->mNRows;
+	} else {
+		result->mNAffected = sqlite3_changes(mDB);
+	}
+
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+	return result;
+}
+
+SrvDBResult* SrvDBConnectorSqlite::executeQuery(const char* sqlcmd) const
+{
+	vector<string> noParams;
+
+	// the common case, a single statement
+	sqlite3_stmt* stmt = 0;
+	const char* tail = 0;
+	if (sqlite3_prepare_v2(mDB, sqlcmd, -1, &stmt, &tail) != SQLITE_OK) {
+		LogERR("DB failed: '%s'", sqlite3_errmsg(mDB));
+		return 0;
+	}
+	while (tail && isspace(static_cast<unsigned char>(*tail)))
+		++tail;
+	if (!tail || *tail == '\0') {
+		SrvDBResult* result = 0;
+		if (stmt) {
+			result = executeStatement(stmt, noParams);
+			sqlite3_finalize(stmt);
+		} else {
+			result = new SrvDBSqliteResult();
+		}
+		return result;
+	}
+	sqlite3_finalize(stmt);
+
+	// several statements, in a single transaction as PostgreSQL does (if
+	// we're not inside of one already), returning the result of the last
+	bool transaction = (sqlite3_get_autocommit(mDB) != 0);
+	if (transaction)
+		sqlite3_exec(mDB, "BEGIN", 0, 0, 0);
+
+	SrvDBResult* result = 0;
+	tail = sqlcmd;
+	while (tail && *tail != '\0') {
+		stmt = 0;
+		if (sqlite3_prepare_v2(mDB, tail, -1, &stmt, &tail) != SQLITE_OK) {
+			LogERR("DB failed: '%s'", sqlite3_errmsg(mDB));
+			delete result; result = 0;
+			break;
+		}
+		if (!stmt) {
+			// only whitespace or comments
+			continue;
+		}
+
+		delete result;
+		result = executeStatement(stmt, noParams);
+		sqlite3_finalize(stmt);
+		if (!result)
+			break;
+	}
+
+	if (transaction)
+		sqlite3_exec(mDB, result ? "COMMIT" : "ROLLBACK", 0, 0, 0);
+	return result;
+}
+
+SrvDBResult* SrvDBConnectorSqlite::executeQuery(const char* sqlcmd,
+						const vector<string>& params) const
+{
+	if (params.empty())
+		return executeQuery(sqlcmd);
+
+	map<string, sqlite3_stmt*>::iterator it = mPrepared.find(sqlcmd);
+	if (it != mPrepared.end())
+		return executeStatement(it->second, params);
+
+	sqlite3_stmt* stmt = 0;
+	if (sqlite3_prepare_v2(mDB, sqlcmd, -1, &stmt, 0) != SQLITE_OK) {
+		LogERR("DB failed preparing statement '%s': '%s'",
+		       sqlcmd, sqlite3_errmsg(mDB));
+		sqlite3_finalize(stmt);
+		return 0;
+	}
+
+	// mafm: as with PostgreSQL, the statements are built from the code so
+	// they should be a few, but just in case we don't keep preparing
+	// statements forever
+	if (mPrepared.size() >= MAX_PREPARED) {
+		SrvDBResult* result = executeStatement(stmt, params);
+		sqlite3_finalize(stmt);
+		return result;
+	}
+
+	LogDBG("DB prepared statement '%s'", sqlcmd);
+	mPrepared[sqlcmd] = stmt;
+	return executeStatement(stmt, params);
+}
+
+void SrvDBConnectorSqlite::escapeData(string& out, const char* data, size_t length) const
+{
+	// the only special character in SQL string literals is the quote
+	out.clear();
+	out.reserve(length + 8);
+	for (size_t i = 0; i < length && data[i] != '\0'; ++i) {
+		if (data[i] == '\'')
+			out += '\'';
+		out += data[i];
+	}
+}
+
+
+#endif
+
+
+// Local Variables: ***
+// mode: C++ ***
+// tab-width: 8 ***
+// c-basic-offset: 8 ***
+// indent-tabs-mode: t ***
+// fill-column: 80 ***
+// End: ***
+// ex: shiftwidth=2 tabstop=8
@@ -0,0 +1,146 @@
+/*
+ * srvdbconnectorsqlite.h
+ * Copyright (C) 2006-2008 by Manuel A. Fernandez Montecelo <mafm@users.sourceforge.net>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FEARANN_SERVER_DB_CONNECTOR_SQLITE_H__
+#define __FEARANN_SERVER_DB_CONNECTOR_SQLITE_H__
+
+
+#include "srvdbmgr.h"
+
+#include <sqlite3.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+
+/** @ingroup database
+ *  @{
+ */
+
+
+/** Implementation of DBResult class for SQLite.  SQLite returns the rows one
+ * by one while stepping the statement, so we copy them here.
+ *
+ * @author mafm
+ */
+class SrvDBSqliteResult : public SrvDBResult
+{
+public:
+	/** Default constructor */
+	SrvDBSqliteResult();
+	/** Destructor */
+	virtual ~SrvDBSqliteResult();
+
+	/** Get the number of results (for SELECT) */
+	virtual size_t getNumberOfRows() const;
+	/** Get the number of columns (for SELECT) */
+	virtual size_t getNumberOfColumns() const;
+	/** Get the number of rows affected (for INSERT, DELETE, UPDATE) */
+	virtual size_t getNumberOfAffectedRows() const;
+	/** Get the value of the given position in a SELECT result */
+	virtual const char* getValue(size_t row, size_t column) const;
+	/** Get the column name */
+	virtual const char* getColumnName(size_t column) const;
+
+private:
+	/** Friend access */
+	friend class SrvDBConnectorSqlite;
+
+	/// Names of the columns
+	std::vector<std::string> mColumnNames;
+	/// Values of all the rows, one after the other
+	std::vector<std::string> mValues;
+	/// Number of rows in result (SELECT)
+	size_t mNRows;
+	/// Number of rows affected in other queries
+	size_t mNAffected;
+};
+
+
+/** SQLite database connector, embedded in the server (the DB is a file).
+ *
+ * The DB is opened in WAL mode, so the reads don't block the writes from the
+ * DB writer (which has its own connection), and the statements are prepared
+ * only once.  If the DB is empty, the tables are created with the given
+ * schema file.
+ *
+ * @author mafm
+ */
+class SrvDBConnectorSqlite : public SrvDBConnectorBase
+{
+public:
+	/** Overriden from base class, dbname is the file of the DB and the
+	 * rest of parameters are ignored */
+	virtual bool connectToDB(const char* host,
+				 const char* port,
+				 const char* dbname,
+				 const char* dbuser,
+				 const char* dbpass);
+	/** Overriden from base class */
+	virtual void escapeData(std::string& out,
+				const char* data,
+				size_t length) const;
+	/** Overriden from base class */
+	virtual SrvDBResult* executeQuery(const char* cmd) const;
+	/** Overriden from base class */
+	virtual SrvDBResult* executeQuery(const char* cmd,
+					  const std::vector<std::string>& params) const;
+
+private:
+	/** Friend access */
+	friend class SrvDBMgr;
+
+
+	/// The DB
+	sqlite3* mDB;
+	/// File with the schema to create the tables in new DBs
+	std::string mSchemaFile;
+	/// Statements prepared, the key is the SQL command
+	mutable std::map<std::string, sqlite3_stmt*> mPrepared;
+	/// Maximum number of statements to keep prepared
+	static const size_t MAX_PREPARED = 256;
+
+
+	/** Constructor, with the file of the schema for new DBs */
+	SrvDBConnectorSqlite(const std::string& schemaFile);
+	/** Destructor */
+	~SrvDBConnectorSqlite();
+
+	/** Create the tables if the DB is empty */
+	bool createSchema();
+	/** Execute a statement already prepared with the given parameters,
+	 * returning the result (0 if failure) */
+	SrvDBResult* executeStatement(sqlite3_stmt* stmt,
+				      const std::vector<std::string>& params) const;
+};
+
+/// @}
+
+
+#endif
+
+
+// Local Variables: ***
+// mode: C++ ***
+// tab-width: 8 ***
+// c-basic-offset: 8 ***
+// indent-tabs-mode: t ***
+// fill-column: 80 ***
+// End: ***
+// ex: shiftwidth=2 tabstop=8
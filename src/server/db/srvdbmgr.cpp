@@ -21,11 +21,16 @@
 #include "srvdbmgr.h"
 
 #include "common/configmgr.h"
+#include "server/db/srvdbpool.h"
+#include "server/db/srvdbwriter.h"
 
 #ifdef HAVE_POSTGRESQL
 #include "server/db/srvdbconnectorpostgresql.h"
 #endif
-#if (!defined HAVE_POSTGRESQL)
+#ifdef HAVE_SQLITE
+#include "server/db/srvdbconnectorsqlite.h"
+#endif
+#if (!defined HAVE_POSTGRESQL) && (!defined HAVE_SQLITE)
 #error "You must choose at least one SQL database type"
 #endif
 
@@ -36,9 +41,20 @@
 /*******************************************************************************
  * SrvDBResult
  ******************************************************************************/
+int SrvDBResult::getColumnIndex(const char* columnName) const
+{
+	size_t nColumns = getNumberOfColumns();
+	for (size_t column = 0; column < nColumns; ++column) {
+		if (strcmp(columnName, getColumnName(column)) == 0) {
+			return static_cast<int>(column);
+		}
+	}
+	return -1;
+}
+
 void SrvDBResult::getValue(size_t row, const char* columnName, string& value) const
 {
-	if (row > getNumberOfRows()) {
+	if (row >= getNumberOfRows()) {
 		LogERR("Asked for row '%zu', nresults='%zu'",
 		       row, getNumberOfRows());
 		value = "<row out of bounds>";
@@ -46,16 +62,14 @@ void SrvDBResult::getValue(size_t row, const char* columnName, string& value) co
 	}
 
 	// Only useful if the column was used and the value initialized
-	size_t nColumns = getNumberOfColumns();
-	for (size_t column = 0; column < nColumns; ++column) {
-		if (string(columnName) == getColumnName(column)) {
-			value = getValue(row, column);
-			return;
-		}
+	int column = getColumnIndex(columnName);
+	if (column < 0) {
+		LogERR("Column '%s' not found, numcolumns=%zu",
+		       columnName, getNumberOfColumns());
+		value = "<column not found>";
+		return;
 	}
-	LogERR("Column '%s' not found, numcolumns=%zu",
-	       columnName, nColumns);
-	value = "<column not found>";
+	value = getValue(row, column);
 }
 
 void SrvDBResult::getValue(size_t row, const char* columnName, int& value) const
@@ -73,6 +87,75 @@ void SrvDBResult::getValue(size_t row, const char* columnName, float& value) con
 }
 
 
+/*******************************************************************************
+ * SrvDBResultCursor
+ ******************************************************************************/
+SrvDBResultCursor::SrvDBResultCursor(const SrvDBResult* result) :
+	mResult(result), mNRows(result ? result->getNumberOfRows() : 0),
+	mRow(0), mStarted(false)
+{
+}
+
+int SrvDBResultCursor::getColumn(const char* columnName) const
+{
+	if (!mResult)
+		return -1;
+
+	int column = mResult->getColumnIndex(columnName);
+	if (column < 0) {
+		LogERR("Column '%s' not found, numcolumns=%zu",
+		       columnName, mResult->getNumberOfColumns());
+	}
+	return column;
+}
+
+bool SrvDBResultCursor::next()
+{
+	if (!mStarted) {
+		mStarted = true;
+		mRow = 0;
+	} else if (mRow < mNRows) {
+		++mRow;
+	}
+	return mRow < mNRows;
+}
+
+size_t SrvDBResultCursor::getRow() const
+{
+	return mRow;
+}
+
+const char* SrvDBResultCursor::getString(int column) const
+{
+	// mafm: invalid columns were already reported by getColumn()
+	if (column < 0 || !mStarted || mRow >= mNRows)
+		return "";
+
+	const char* value = mResult->getValue(mRow, column);
+	return value ? value : "";
+}
+
+void SrvDBResultCursor::getString(int column, std::string& value) const
+{
+	value = getString(column);
+}
+
+int SrvDBResultCursor::getInt(int column) const
+{
+	return static_cast<int>(strtol(getString(column), 0, 10));
+}
+
+uint64_t SrvDBResultCursor::getUInt64(int column) const
+{
+	return strtoull(getString(column), 0, 10);
+}
+
+float SrvDBResultCursor::getFloat(int column) const
+{
+	return static_cast<float>(strtod(getString(column), 0));
+}
+
+
 /*******************************************************************************
  * SrvDBQuery
  ******************************************************************************/
@@ -117,19 +200,23 @@ void SrvDBQuery::setOrder(const char* order)
 	mOrder = order;
 }
 
-void SrvDBQuery::addColumnWithValue(const char* name, const char* value, bool escape)
+void SrvDBQuery::addConditionValue(const std::string& value)
 {
-	string val;
-	if (escape) {
-		string value_escaped = "<initialized>";
-		SrvDBMgr::instance().escape(value_escaped, value);
-		// variable values have to be quoted, too
-		val = StrFmt("'%s'", value_escaped.c_str());
-	} else {
-		val = value;
-	}
+	mCondValues.push_back(value);
+}
 
-	mFieldPair.push_back(NameValuePair(string(name), val));
+void SrvDBQuery::addConditionValue(const char* value)
+{
+	mCondValues.push_back(value);
+}
+
+void SrvDBQuery::addColumnWithValue(const char* name, const char* value, bool escape)
+{
+	// mafm: values to escape are passed as parameters of the statement, so
+	// they don't need escaping nor quoting, and statements with the same
+	// shape can be prepared only once.  The rest are SQL expressions.
+	mFieldPair.push_back(NameValuePair(string(name), string(value)));
+	mFieldIsParam.push_back(escape);
 }
 
 void SrvDBQuery::addColumnWithValue(const char* name, const string& value, bool escape)
@@ -196,13 +283,86 @@ void SrvDBQuery::setResult(SrvDBResult* result)
 }
 
 
+/*******************************************************************************
+ * SrvDBBatchUpdate
+ ******************************************************************************/
+SrvDBBatchUpdate::SrvDBBatchUpdate(const char* table, const char* keyColumn, const char* keyType) :
+	mTable(table), mKey(keyColumn, keyType)
+{
+}
+
+void SrvDBBatchUpdate::addColumn(const char* name, const char* type)
+{
+	PERM_ASSERT(mRows.empty());
+	mColumns.push_back(NameValuePair(name, type));
+}
+
+void SrvDBBatchUpdate::addRow(const std::string& key, const std::vector<std::string>& values)
+{
+	if (values.size() != mColumns.size()) {
+		LogERR("Batch update of '%s': row '%s' has %zu values, expected %zu",
+		       mTable.c_str(), key.c_str(), values.size(), mColumns.size());
+		return;
+	}
+
+	// mafm: these are not statements to prepare, the number of rows
+	// changes every time, so the values go escaped in the statement
+	string row = "('" + SrvDBMgr::instance().escape(key) + "'";
+	for (size_t i = 0; i < values.size(); ++i) {
+		row += ",'" + SrvDBMgr::instance().escape(values[i]) + "'";
+	}
+	row += ")";
+	mRows.push_back(row);
+}
+
+size_t SrvDBBatchUpdate::getNumberOfRows() const
+{
+	return mRows.size();
+}
+
+
 /*******************************************************************************
  * SrvDBMgr
  ******************************************************************************/
 template <> SrvDBMgr* Singleton<SrvDBMgr>::INSTANCE = 0;
 
 SrvDBMgr::SrvDBMgr() :
-	mConnector(0)
+	mConnector(0), mWriter(0), mPool(0)
+{
+	mConnector = createConnector();
+
+	// mafm: the writes that we don't need to wait for go through a separate
+	// thread with its own connection (libpq connections can't be shared
+	// between threads), so the game doesn't stall when the DB is slow
+	SrvDBConnectorBase* writerConnector = createConnector();
+	if (writerConnector) {
+		string queueSize = ConfigMgr::instance().getConfigVar("Server.Database.WriteQueueSize", "4096");
+		mWriter = new SrvDBWriter(writerConnector, atoi(queueSize.c_str()));
+		mWriter->start();
+	}
+
+	// pool of connections for the asynchronous queries, so the ones from
+	// different clients (login, creating characters...) don't have to
+	// wait for each other nor stall the main loop
+	int poolSize = atoi(ConfigMgr::instance().getConfigVar("Server.Database.PoolSize", "4"));
+	vector<SrvDBConnectorBase*> poolConnectors;
+	for (int i = 0; i < poolSize; ++i) {
+		SrvDBConnectorBase* poolConnector = createConnector();
+		if (!poolConnector)
+			break;
+		poolConnectors.push_back(poolConnector);
+	}
+	mPool = new SrvDBPool(poolConnectors);
+	if (!mPool->start()) {
+		LogWRN("DB pool not started, asynchronous queries will block");
+	}
+}
+
+SrvDBMgr::~SrvDBMgr()
+{
+}
+
+SrvDBConnectorBase* SrvDBMgr::createConnector() const
 {
 	string dbtype = ConfigMgr::instance().getConfigVar("Server.Database.Type", "");
 	string host = ConfigMgr::instance().getConfigVar("Server.Database.Host", "");
@@ -210,29 +370,173 @@ SrvDBMgr::SrvDBMgr() :
 	string dbname = ConfigMgr::instance().getConfigVar("Server.Database.DatabaseName", "");
 	string dbuser = ConfigMgr::instance().getConfigVar("Server.Database.Username", "");
 	string dbpass = ConfigMgr::instance().getConfigVar("Server.Database.Password", "");
-	if (dbtype.empty() || host.empty() || port.empty()
-	    || dbname.empty() || dbuser.empty() || dbpass.empty()) {
+	// sqlite only needs the file
+	if (dbtype.empty() || dbname.empty()
+	    || (dbtype != "sqlite"
+		&& (host.empty() || port.empty() || dbuser.empty() || dbpass.empty()))) {
 		LogERR("Couldn't read necessary config values for the DB");
 	}
 
+	SrvDBConnectorBase* connector = 0;
 #ifdef HAVE_POSTGRESQL
 	if (dbtype == "postgresql")
-		mConnector = new SrvDBConnectorPostgresql();
+		connector = new SrvDBConnectorPostgresql();
 #endif
+#ifdef HAVE_SQLITE
+	if (dbtype == "sqlite") {
+		string schemaFile = ConfigMgr::instance().getConfigVar("Server.Database.SchemaFile", "");
+		connector = new SrvDBConnectorSqlite(schemaFile);
+	}
+#endif
+	if (!connector) {
+		LogERR("Unknown DB type: '%s'", dbtype.c_str());
+		return 0;
+	}
 
 	// do connect
-	mConnector->connectToDB(host.c_str(), port.c_str(),
-				dbname.c_str(),
-				dbuser.c_str(), dbpass.c_str());
+	connector->connectToDB(host.c_str(), port.c_str(),
+			       dbname.c_str(),
+			       dbuser.c_str(), dbpass.c_str());
+	return connector;
 }
 
-SrvDBMgr::~SrvDBMgr()
+void SrvDBMgr::finalize()
 {
+	// mafm: the pool first, since its queries may wait for the writer
+	if (mPool) {
+		mPool->stop();
+		delete mPool; mPool = 0;
+	}
+
+	// write everything pending before closing
+	if (mWriter) {
+		mWriter->stop();
+		delete mWriter; mWriter = 0;
+	}
+
+	delete mConnector; mConnector = 0;
 }
 
-void SrvDBMgr::finalize()
+void SrvDBMgr::getTableNames(const std::string& tables, std::vector<std::string>& names)
+{
+	// mafm: the tables are separated by commas, with optional aliases (in
+	// example "usr_chars as ch,contact_list as cl")
+	names.clear();
+	size_t begin = 0;
+	while (begin < tables.size()) {
+		size_t end = tables.find(',', begin);
+		if (end == string::npos)
+			end = tables.size();
+		size_t nameBegin = tables.find_first_not_of(" \t", begin);
+		if (nameBegin < end) {
+			size_t nameEnd = tables.find_first_of(" \t,", nameBegin);
+			names.push_back(tables.substr(nameBegin, min(nameEnd, end) - nameBegin));
+		}
+		begin = end + 1;
+	}
+}
+
+uint64_t SrvDBMgr::getWriteSeq(const SrvDBQuery* query) const
+{
+	if (!mWriter)
+		return 0;
+
+	vector<string> tables;
+	getTableNames(query->mTables, tables);
+	return mWriter->getWriteSeq(tables);
+}
+
+void SrvDBMgr::waitForWrites(uint64_t writeSeq) const
+{
+	if (mWriter)
+		mWriter->waitFor(writeSeq);
+}
+
+void SrvDBMgr::waitForWrites(const SrvDBQuery* query) const
+{
+	// mafm: only the writes to the same tables queued before matter, so
+	// the query doesn't wait for unrelated ones (in example, a checkpoint
+	// of the entities when reading the inventory)
+	waitForWrites(getWriteSeq(query));
+}
+
+void SrvDBMgr::flushWrites()
+{
+	if (mWriter)
+		mWriter->flush();
+}
+
+void SrvDBMgr::getWriteStats(SrvDBWriteStats& stats) const
+{
+	if (mWriter)
+		mWriter->getStats(stats);
+	else
+		stats = SrvDBWriteStats();
+}
+
+void SrvDBMgr::queueInsert(const SrvDBQuery* query)
+{
+	string qry;
+	vector<string> params;
+	buildInsert(query, qry, params);
+
+	if (mWriter) {
+		vector<string> tables;
+		getTableNames(query->mTables, tables);
+		mWriter->queue("", tables, qry, params);
+	}
+	else
+		execute(qry.c_str(), params);
+}
+
+void SrvDBMgr::queueUpdate(const SrvDBQuery* query)
+{
+	string qry;
+	vector<string> params;
+	buildUpdate(query, qry, params);
+
+	// the key identifies the row and columns updated (the statement plus
+	// the values of the condition), so the newest update replaces the old
+	// one if it wasn't written yet
+	string key = qry;
+	for (size_t i = 0; i < query->mCondValues.size(); ++i) {
+		key += '\0';
+		key += query->mCondValues[i];
+	}
+
+	if (mWriter) {
+		vector<string> tables;
+		getTableNames(query->mTables, tables);
+		mWriter->queue(key, tables, qry, params);
+	}
+	else
+		execute(qry.c_str(), params);
+}
+
+void SrvDBMgr::queueBatchUpdates(const std::vector<const SrvDBBatchUpdate*>& batches)
 {
-	delete mConnector;
+	// mafm: several statements in the same command are executed in a
+	// single transaction, so either all the checkpoint is saved or none
+	string qry, batchQry;
+	vector<string> tables;
+	for (size_t i = 0; i < batches.size(); ++i) {
+		if (batches[i]->getNumberOfRows() == 0)
+			continue;
+
+		tables.push_back(batches[i]->mTable);
+		buildBatchUpdate(batches[i], batchQry);
+		if (!qry.empty())
+			qry += ";";
+		qry += batchQry;
+	}
+	if (qry.empty())
+		return;
+
+	vector<string> params;
+	if (mWriter)
+		mWriter->queue("", tables, qry, params);
+	else
+		execute(qry.c_str(), params);
 }
 
 void SrvDBMgr::escape(std::string& out, const std::string& in) const
@@ -247,9 +551,9 @@ string SrvDBMgr::escape(const std::string& in) const
 	return out;
 }
 
-bool SrvDBMgr::execute(const char* cmd) const
+bool SrvDBMgr::execute(const char* cmd, const std::vector<std::string>& params) const
 {
-	SrvDBResult* res = mConnector->executeQuery(cmd);
+	SrvDBResult* res = mConnector->executeQuery(cmd, params);
 	if (res) {
 		delete res;
 		return true;
@@ -258,31 +562,121 @@ bool SrvDBMgr::execute(const char* cmd) const
 	}
 }
 
-bool SrvDBMgr::queryInsert(const SrvDBQuery* query) const
+void SrvDBMgr::appendValue(const SrvDBQuery* query, size_t column,
+			   std::string& qry, std::vector<std::string>& params) const
+{
+	if (query->mFieldIsParam[column]) {
+		params.push_back(query->mFieldPair[column].value);
+		qry += StrFmt("$%zu", params.size());
+	} else {
+		qry += query->mFieldPair[column].value;
+	}
+}
+
+void SrvDBMgr::appendCondition(const SrvDBQuery* query,
+			       std::string& qry, std::vector<std::string>& params) const
 {
-	// auxiliar
-	string colname = "<initialized>";
-	string value = "<initialized>";
+	if (query->mCond.empty())
+		return;
+
+	qry += " WHERE ";
+
+	// mafm: conditions without values are used verbatim, since they might
+	// have literals containing '?'
+	if (query->mCondValues.empty()) {
+		qry += query->mCond;
+		return;
+	}
 
+	size_t nextValue = 0;
+	for (size_t i = 0; i < query->mCond.size(); ++i) {
+		if (query->mCond[i] == '?' && nextValue < query->mCondValues.size()) {
+			params.push_back(query->mCondValues[nextValue++]);
+			qry += StrFmt("$%zu", params.size());
+		} else {
+			qry += query->mCond[i];
+		}
+	}
+	if (nextValue != query->mCondValues.size()) {
+		LogERR("Condition '%s' has less placeholders than values (%zu)",
+		       query->mCond.c_str(), query->mCondValues.size());
+	}
+}
+
+void SrvDBMgr::buildInsert(const SrvDBQuery* query,
+			   std::string& qry, std::vector<std::string>& params) const
+{
 	// start to build the query
 	size_t numcolumns = query->getNumberOfColumns();
-	string qry = "INSERT INTO " + query->mTables + " (";
+	qry = "INSERT INTO " + query->mTables + " (";
 	for (size_t column = 0; column < numcolumns; ++column) {
-		query->getColumnName(column, colname);
 		if (0 != column) qry += ",";
-		qry += colname;
+		qry += query->mFieldPair[column].name;
 	}
 	qry += ") VALUES (";
 	for (size_t column = 0; column < numcolumns; ++column) {
-		query->getColumnValue(column, value);
 		if (0 != column) 
 			qry += ",";
-		qry += value;
+		appendValue(query, column, qry, params);
 	}
 	qry += ")";
+}
+
+void SrvDBMgr::buildUpdate(const SrvDBQuery* query,
+			   std::string& qry, std::vector<std::string>& params) const
+{
+	// start to build the query
+	qry = "UPDATE " + query->mTables + " SET ";
+	for (size_t column = 0; column < query->getNumberOfColumns(); ++column) {
+		if (0 != column) qry += ",";
+		qry += query->mFieldPair[column].name + "=";
+		appendValue(query, column, qry, params);
+	}
+
+	// condition?
+	appendCondition(query, qry, params);
+}
+
+void SrvDBMgr::buildBatchUpdate(const SrvDBBatchUpdate* batch, std::string& qry) const
+{
+	// mafm: the VALUES list goes in a WITH clause, rather than as a
+	// subquery with column aliases, so the same statement works in both
+	// PostgreSQL and SQLite.  The values are strings, so we have to cast
+	// them to the type of the column.
+	const string& key = batch->mKey.name;
+	qry = "WITH v(" + key;
+	for (size_t column = 0; column < batch->mColumns.size(); ++column) {
+		qry += "," + batch->mColumns[column].name;
+	}
+	qry += ") AS (VALUES ";
+	for (size_t row = 0; row < batch->mRows.size(); ++row) {
+		if (0 != row) qry += ",";
+		qry += batch->mRows[row];
+	}
+	qry += ") UPDATE " + batch->mTable + " SET ";
+	for (size_t column = 0; column < batch->mColumns.size(); ++column) {
+		const NameValuePair& col = batch->mColumns[column];
+		if (0 != column) qry += ",";
+		qry += col.name + "=CAST(v." + col.name + " AS " + col.value + ")";
+	}
+	qry += " FROM v WHERE " + batch->mTable + "." + key
+		+ "=CAST(v." + key + " AS " + batch->mKey.value + ")";
+}
+
+bool SrvDBMgr::queryInsert(const SrvDBQuery* query) const
+{
+	waitForWrites(query);
+	return doInsert(mConnector, query);
+}
+
+bool SrvDBMgr::doInsert(const SrvDBConnectorBase* connector, const SrvDBQuery* query) const
+{
+	string qry;
+	vector<string> params;
+	buildInsert(query, qry, params);
 
 	// final processing
-	SrvDBResult* res = mConnector->executeQuery(qry.c_str());
+	SrvDBResult* res = connector->executeQuery(qry.c_str(), params);
 	if (!res) {
 		return false;
 	} else {
@@ -294,25 +688,18 @@ bool SrvDBMgr::queryInsert(const SrvDBQuery* query) const
 
 int SrvDBMgr::queryUpdate(const SrvDBQuery* query) const
 {
-	// auxiliar
-	string colname = "<initialized>";
-	string value = "<initialized>";
-
-	// start to build the query
-	string qry = "UPDATE " + query->mTables + " SET ";
-	for (size_t column = 0; column < query->getNumberOfColumns(); ++column) {
-		query->getColumnName(column, colname);
-		query->getColumnValue(column, value);
-		if (0 != column) qry += ",";
-		qry += colname + "=" + value;
-	}
+	waitForWrites(query);
+	return doUpdate(mConnector, query);
+}
 
-	// condition?
-	if (query->mCond.size() > 0)
-		qry += " WHERE " + query->mCond;
+int SrvDBMgr::doUpdate(const SrvDBConnectorBase* connector, const SrvDBQuery* query) const
+{
+	string qry;
+	vector<string> params;
+	buildUpdate(query, qry, params);
 
 	// final processing
-	SrvDBResult* res = mConnector->executeQuery(qry.c_str());
+	SrvDBResult* res = connector->executeQuery(qry.c_str(), params);
 	if (!res) {
 		return -1;
 	} else {
@@ -323,16 +710,22 @@ int SrvDBMgr::queryUpdate(const SrvDBQuery* query) const
 }
 
 int SrvDBMgr::queryDelete(const SrvDBQuery* query) const
+{
+	waitForWrites(query);
+	return doDelete(mConnector, query);
+}
+
+int SrvDBMgr::doDelete(const SrvDBConnectorBase* connector, const SrvDBQuery* query) const
 {
 	// starting to build the query
 	string qry = "DELETE FROM " + query->mTables;
+	vector<string> params;
 
 	// condition ?
-	if (query->mCond.size() > 0)
-		qry += " WHERE " + query->mCond;
+	appendCondition(query, qry, params);
 
 	// final processing
-	SrvDBResult* res = mConnector->executeQuery(qry.c_str());
+	SrvDBResult* res = connector->executeQuery(qry.c_str(), params);
 	if (!res) {
 		return -1;
 	} else {
@@ -344,28 +737,30 @@ int SrvDBMgr::queryDelete(const SrvDBQuery* query) const
 
 int SrvDBMgr::querySelect(SrvDBQuery* query) const
 {
-	// auxiliar
-	string colname = "<initialized>";
+	waitForWrites(query);
+	return doSelect(mConnector, query);
+}
 
+int SrvDBMgr::doSelect(const SrvDBConnectorBase* connector, SrvDBQuery* query) const
+{
 	// starting to build the query
 	string qry = "SELECT ";
+	vector<string> params;
 	for (size_t column = 0; column < query->getNumberOfColumns(); ++column) {
-		query->getColumnName(column, colname);
 		if (0 != column) qry += ",";
-		qry += colname;
+		qry += query->mFieldPair[column].name;
 	}
 	qry += " FROM " + query->mTables;
 
 	// condition?
-	if (query->mCond.size() > 0)
-		qry += " WHERE " + query->mCond;
+	appendCondition(query, qry, params);
 
 	// order?
 	if (query->mOrder.size() > 0)
 		qry += " ORDER BY " + query->mOrder;
 
 	// final processing
-	SrvDBResult* result = mConnector->executeQuery(qry.c_str());
+	SrvDBResult* result = connector->executeQuery(qry.c_str(), params);
 	if (!result) {
 		return -1;
 	} else {
@@ -385,16 +780,22 @@ bool SrvDBMgr::queryMatch(const SrvDBQuery* query) const
 }
 
 int SrvDBMgr::queryMatchNumber(const SrvDBQuery* query) const
+{
+	waitForWrites(query);
+	return doMatchNumber(mConnector, query);
+}
+
+int SrvDBMgr::doMatchNumber(const SrvDBConnectorBase* connector, const SrvDBQuery* query) const
 {
 	// base
-	string qry = "SELECT count(*) FROM " + query->mTables;
+	string qry = "SELECT count(*) AS count FROM " + query->mTables;
+	vector<string> params;
 
 	// add condition
-	if (query->mCond.size() > 0)
-		qry += " WHERE " + query->mCond;
+	appendCondition(query, qry, params);
 
 	// execute the query itself
-	SrvDBResult* result = mConnector->executeQuery(qry.c_str());
+	SrvDBResult* result = connector->executeQuery(qry.c_str(), params);
 	if (!result) {
 		return -1;
 	} else {
@@ -405,6 +806,82 @@ int SrvDBMgr::queryMatchNumber(const SrvDBQuery* query) const
         }
 }
 
+int SrvDBMgr::runQuery(const SrvDBConnectorBase* connector, int type,
+			SrvDBQuery* query, uint64_t writeSeq) const
+{
+	if (!connector)
+		connector = mConnector;
+
+	// mafm: as the synchronous queries, the asynchronous ones must see the
+	// data written in the background before they were submitted (to their
+	// tables, the sequence number was taken when submitting)
+	waitForWrites(writeSeq);
+
+	switch (type) {
+	case SrvDBPool::INSERT:
+		return doInsert(connector, query) ? 1 : 0;
+	case SrvDBPool::UPDATE:
+		return doUpdate(connector, query);
+	case SrvDBPool::DELETE:
+		return doDelete(connector, query);
+	case SrvDBPool::SELECT:
+		return doSelect(connector, query);
+	case SrvDBPool::MATCH:
+		return doMatchNumber(connector, query);
+	default:
+		LogERR("Unknown type of asynchronous query: %d", type);
+		return -1;
+	}
+}
+
+void SrvDBMgr::queryInsertAsync(SrvDBQuery* query, SrvDBQueryListener* listener)
+{
+	mPool->submit(SrvDBPool::INSERT, query, listener);
+}
+
+void SrvDBMgr::queryUpdateAsync(SrvDBQuery* query, SrvDBQueryListener* listener)
+{
+	mPool->submit(SrvDBPool::UPDATE, query, listener);
+}
+
+void SrvDBMgr::queryDeleteAsync(SrvDBQuery* query, SrvDBQueryListener* listener)
+{
+	mPool->submit(SrvDBPool::DELETE, query, listener);
+}
+
+void SrvDBMgr::querySelectAsync(SrvDBQuery* query, SrvDBQueryListener* listener)
+{
+	mPool->submit(SrvDBPool::SELECT, query, listener);
+}
+
+void SrvDBMgr::queryMatchNumberAsync(SrvDBQuery* query, SrvDBQueryListener* listener)
+{
+	mPool->submit(SrvDBPool::MATCH, query, listener);
+}
+
+void SrvDBMgr::cancelQueries(SrvDBQueryListener* listener)
+{
+	if (mPool)
+		mPool->cancel(listener);
+}
+
+int SrvDBMgr::getCompletionFD() const
+{
+	return mPool ? mPool->getCompletionFD() : -1;
+}
+
+void SrvDBMgr::processCompletedQueries()
+{
+	if (mPool)
+		mPool->processCompleted();
+}
+
+void SrvDBMgr::getPoolStats(SrvDBPoolStats& stats) const
+{
+	if (mPool)
+		mPool->getStats(stats);
+}
+
 
 // Local Variables: ***
 // mode: C++ ***
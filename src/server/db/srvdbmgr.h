@@ -26,6 +26,12 @@
 #include <vector>
 
 
+class SrvDBPool;
+class SrvDBPoolStats;
+class SrvDBWriter;
+class SrvDBWriteStats;
+
+
 /** @defgroup database Database Group
  *
  * This group contains all database related classes.
@@ -56,6 +62,9 @@ public:
 	/** Get the column name */
 	virtual const char* getColumnName(size_t column) const = 0;
 
+	/** Get the index of the column with the given name, -1 if there's no
+	 * such column */
+	int getColumnIndex(const char* columnName) const;
 	/** Get the value of the row.columnName as string */
 	void getValue(size_t row, const char* columnName, std::string& value) const;
 	/** Get the value of the row.columnName, as an int */
@@ -65,6 +74,59 @@ public:
 };
 
 
+/** Cursor to read the rows of a result, when reading many of them: the
+ * columns are looked up by name only once, and the numbers are decoded
+ * directly from the data of the result, without intermediate strings.
+ *
+ * \code
+ * SrvDBResultCursor cursor(query.getResult());
+ * int id = cursor.getColumn("id");
+ * while (cursor.next()) {
+ *	uint64_t value = cursor.getUInt64(id);
+ * }
+ * \endcode
+ *
+ * @author mafm
+ */
+class SrvDBResultCursor
+{
+public:
+	/** Constructor, the result must be valid while the cursor is used */
+	SrvDBResultCursor(const SrvDBResult* result);
+
+	/** Get the index of the column with the given name, to use with the
+	 * get functions (-1 if not found) */
+	int getColumn(const char* columnName) const;
+	/** Move to the next row (the first one, in the first call), returns
+	 * false when there are no more rows */
+	bool next();
+	/** Get the current row */
+	size_t getRow() const;
+
+	/** Get the value of the column in the current row, pointing to the
+	 * data of the result (so it's valid while the result is) */
+	const char* getString(int column) const;
+	/** Get the value of the column in the current row */
+	void getString(int column, std::string& value) const;
+	/** Get the value of the column in the current row, as an int */
+	int getInt(int column) const;
+	/** Get the value of the column in the current row, as an uint64 */
+	uint64_t getUInt64(int column) const;
+	/** Get the value of the column in the current row, as a float */
+	float getFloat(int column) const;
+
+private:
+	/// The result
+	const SrvDBResult* mResult;
+	/// Number of rows in the result
+	size_t mNRows;
+	/// Current row
+	size_t mRow;
+	/// Whether we're already in a row
+	bool mStarted;
+};
+
+
 /** Query structure, to use with high level queries.
  *
  * It's for all functions where we need to pass or retrieve data from/to the DB,
@@ -91,6 +153,12 @@ public:
 	void setCondition(const char* cond);
 	/** Set the condition for the query */
 	void setCondition(const std::string& cond);
+	/** Add a value for the condition, replacing the next '?' in it (in
+	 * example, "charname=?").  The values are passed separately to the DB,
+	 * so they don't have to be escaped or quoted. */
+	void addConditionValue(const char* value);
+	/** Add a value for the condition, replacing the next '?' in it */
+	void addConditionValue(const std::string& value);
 	/** Set the order for the SELECT result */
 	void setOrder(const char* order);
 	/** Set the order for the SELECT result */
@@ -130,11 +198,53 @@ private:
 	std::string mOrder;
 	/// The structure of columns/fields for DB queries
 	std::vector<NameValuePair> mFieldPair;
+	/// Whether the value of each column is passed as parameter (or it's
+	/// an SQL expression)
+	std::vector<bool> mFieldIsParam;
+	/// The values for the placeholders of the condition
+	std::vector<std::string> mCondValues;
 	/// The result (for SELECT queries only)
 	SrvDBResult* mResult;
 };
 
 
+/** Update of the same columns in many rows at once, to save the state of the
+ * world in a single statement instead of one per entity.  It's converted to:
+ *
+ * UPDATE table SET col1=v.col1,... FROM (VALUES (key,val1,...),...)
+ *   AS v(key,col1,...) WHERE table.key=v.key
+ *
+ * @author mafm
+ */
+class SrvDBBatchUpdate
+{
+	friend class SrvDBMgr;
+public:
+	/** Constructor, with the table and the column (and its SQL type)
+	 * identifying the rows */
+	SrvDBBatchUpdate(const char* table, const char* keyColumn, const char* keyType);
+
+	/** Add a column to update, with its SQL type (the values are passed as
+	 * strings) */
+	void addColumn(const char* name, const char* type);
+	/** Add a row to update, with the values in the same order as the
+	 * columns were added */
+	void addRow(const std::string& key, const std::vector<std::string>& values);
+	/** Get the number of rows added */
+	size_t getNumberOfRows() const;
+
+private:
+	/// The table to update
+	std::string mTable;
+	/// The column identifying the rows, and its type
+	NameValuePair mKey;
+	/// The columns to update, and their types
+	std::vector<NameValuePair> mColumns;
+	/// The rows, already escaped as SQL values
+	std::vector<std::string> mRows;
+};
+
+
 /** Database connector, different for each DB backend
  */
 class SrvDBConnectorBase
@@ -155,10 +265,22 @@ public:
 	 * \note The caller is responsible for delete'ing object when
 	 * finished. */
 	virtual SrvDBResult* executeQuery(const char* sqlcmd) const = 0;
+	/** Execute a query with parameters ($1, $2...) and return output
+	 * (returns 0 if failure).  The statement is prepared the first time,
+	 * and reused when executed again with other parameters.
+	 *
+	 * \note The caller is responsible for delete'ing object when
+	 * finished. */
+	virtual SrvDBResult* executeQuery(const char* sqlcmd,
+					  const std::vector<std::string>& params) const = 0;
 
 protected:
 	/** Friend access */
 	friend class SrvDBMgr;
+	/** Friend access */
+	friend class SrvDBWriter;
+	/** Friend access */
+	friend class SrvDBPool;
 
 
 	/** Default constructor */
@@ -169,6 +291,22 @@ protected:
 };
 
 
+/** Interface for the objects interested in the result of asynchronous
+ * queries
+ */
+class SrvDBQueryListener
+{
+public:
+	/** Destructor */
+	virtual ~SrvDBQueryListener() { }
+
+	/** Called from the main loop when the query was executed, with the
+	 * same result as the synchronous functions (for queryInsert, 1 if
+	 * successful and 0 if not).  The query is deleted after returning. */
+	virtual void queryCompleted(SrvDBQuery* query, int result) = 0;
+};
+
+
 /** Database manager, abstract so it can be performed by several DB backends.
  * It contains some comfortable functions to perform the operations which should
  * be used whenever possible.
@@ -199,12 +337,58 @@ public:
 	 * the asked conditions */
 	int queryMatchNumber(const SrvDBQuery* query) const;
 
+	/** Asynchronous version of queryInsert: the query is executed by the
+	 * connection pool, and the listener notified from the main loop.  The
+	 * manager takes ownership of the query (which must be created with
+	 * new), it's deleted after notifying the listener. */
+	void queryInsertAsync(SrvDBQuery* query, SrvDBQueryListener* listener);
+	/** Asynchronous version of queryUpdate, see queryInsertAsync */
+	void queryUpdateAsync(SrvDBQuery* query, SrvDBQueryListener* listener);
+	/** Asynchronous version of queryDelete, see queryInsertAsync */
+	void queryDeleteAsync(SrvDBQuery* query, SrvDBQueryListener* listener);
+	/** Asynchronous version of querySelect, see queryInsertAsync */
+	void querySelectAsync(SrvDBQuery* query, SrvDBQueryListener* listener);
+	/** Asynchronous version of queryMatchNumber, see queryInsertAsync */
+	void queryMatchNumberAsync(SrvDBQuery* query, SrvDBQueryListener* listener);
+	/** Forget the listener (in example, because it's going to be
+	 * destroyed): its asynchronous queries are executed anyway, but it's
+	 * not notified */
+	void cancelQueries(SrvDBQueryListener* listener);
+	/** Descriptor which becomes readable when there are asynchronous queries
+	 * completed, so the main loop can wait for it (-1 if none) */
+	int getCompletionFD() const;
+	/** Notify the listeners of the asynchronous queries completed */
+	void processCompletedQueries();
+	/** Get statistics of the connection pool */
+	void getPoolStats(SrvDBPoolStats& stats) const;
+
+	/** Queue an insert to be written in the background, for when we don't
+	 * need to know the result */
+	void queueInsert(const SrvDBQuery* query);
+	/** Queue an update to be written in the background, for when we don't
+	 * need to know the result.  An update queued for the same row and
+	 * columns which wasn't written yet is replaced by this one. */
+	void queueUpdate(const SrvDBQuery* query);
+	/** Queue some batch updates to be written in the background, all of
+	 * them in the same transaction */
+	void queueBatchUpdates(const std::vector<const SrvDBBatchUpdate*>& batches);
+	/** Wait until all the queued writes are done */
+	void flushWrites();
+	/** Get statistics of the queued writes */
+	void getWriteStats(SrvDBWriteStats& stats) const;
+
 private:
 	/** Singleton friend access */
 	friend class Singleton<SrvDBMgr>;
+	/** Friend access, to execute the queries */
+	friend class SrvDBPool;
 
-	/** Default constructor */
+	/** Connector to the DB */
 	SrvDBConnectorBase* mConnector;
+	/** Write-behind queue, with its own connector */
+	SrvDBWriter* mWriter;
+	/** Pool of connections for asynchronous queries */
+	SrvDBPool* mPool;
 
 
 	/** Default constructor */
@@ -213,7 +397,52 @@ private:
 	~SrvDBMgr();
 
 	/** Execute a query where we don't care about the output */
-	bool execute(const char* sqlcmd) const;
+	bool execute(const char* sqlcmd, const std::vector<std::string>& params) const;
+	/** Create a connector of the given type and connect it to the DB,
+	 * returns 0 if failure */
+	SrvDBConnectorBase* createConnector() const;
+	/** Get the tables used in the query (the names, without the
+	 * aliases) */
+	static void getTableNames(const std::string& tables, std::vector<std::string>& names);
+	/** Get the sequence number of the last write queued to the tables of
+	 * the query (0 if none), to wait for it with waitForWrites() */
+	uint64_t getWriteSeq(const SrvDBQuery* query) const;
+	/** Wait for the queued writes up to the given sequence number, so the
+	 * queries see the data written before they were issued */
+	void waitForWrites(uint64_t writeSeq) const;
+	/** Wait for the queued writes to the tables of the query */
+	void waitForWrites(const SrvDBQuery* query) const;
+	/** Execute the query with the given connector (the main one if 0),
+	 * after the writes up to the given sequence number, returning the
+	 * result as the synchronous functions; the type is
+	 * SrvDBPool::QueryType.  Called from the threads of the pool. */
+	int runQuery(const SrvDBConnectorBase* connector, int type,
+		     SrvDBQuery* query, uint64_t writeSeq) const;
+	/** Implementation of queryInsert with the given connector */
+	bool doInsert(const SrvDBConnectorBase* connector, const SrvDBQuery* query) const;
+	/** Implementation of queryUpdate with the given connector */
+	int doUpdate(const SrvDBConnectorBase* connector, const SrvDBQuery* query) const;
+	/** Implementation of queryDelete with the given connector */
+	int doDelete(const SrvDBConnectorBase* connector, const SrvDBQuery* query) const;
+	/** Implementation of querySelect with the given connector */
+	int doSelect(const SrvDBConnectorBase* connector, SrvDBQuery* query) const;
+	/** Implementation of queryMatchNumber with the given connector */
+	int doMatchNumber(const SrvDBConnectorBase* connector, const SrvDBQuery* query) const;
+	/** Append the value of the column to the SQL command, as parameter if
+	 * needed */
+	void appendValue(const SrvDBQuery* query, size_t column,
+			 std::string& qry, std::vector<std::string>& params) const;
+	/** Append the condition to the SQL command, with the parameters */
+	void appendCondition(const SrvDBQuery* query,
+			     std::string& qry, std::vector<std::string>& params) const;
+	/** Build the SQL command for an INSERT */
+	void buildInsert(const SrvDBQuery* query,
+			 std::string& qry, std::vector<std::string>& params) const;
+	/** Build the SQL command for an UPDATE */
+	void buildUpdate(const SrvDBQuery* query,
+			 std::string& qry, std::vector<std::string>& params) const;
+	/** Build the SQL command for a batch UPDATE */
+	void buildBatchUpdate(const SrvDBBatchUpdate* batch, std::string& qry) const;
 };
 
 #endif
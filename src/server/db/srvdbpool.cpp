@@ -0,0 +1,265 @@
+/*
+ * srvdbpool.cpp
+ * Copyright (C) 2006-2008 by Manuel A. Fernandez Montecelo <mafm@users.sourceforge.net>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "srvdbpool.h"
+
+#include "server/db/srvdbmgr.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+/*******************************************************************************
+ * SrvDBPool
+ ******************************************************************************/
+SrvDBPool::SrvDBPool(const std::vector<SrvDBConnectorBase*>& connectors) :
+	mStop(false), mRunning(false)
+{
+	for (size_t i = 0; i < connectors.size(); ++i) {
+		mWorkers.push_back(new Worker(this, connectors[i]));
+	}
+	mStats.connections = mWorkers.size();
+
+	// mafm: non-blocking, we only need one byte in the pipe to wake up the
+	// main loop, it doesn't matter if it's full
+	mCompletionPipe[0] = mCompletionPipe[1] = -1;
+	if (pipe(mCompletionPipe) != 0) {
+		LogERR("Couldn't create the pipe of the DB pool: '%s'", strerror(errno));
+		mCompletionPipe[0] = mCompletionPipe[1] = -1;
+	} else {
+		for (int i = 0; i < 2; ++i) {
+			fcntl(mCompletionPipe[i], F_SETFL,
+			      fcntl(mCompletionPipe[i], F_GETFL) | O_NONBLOCK);
+			fcntl(mCompletionPipe[i], F_SETFD, FD_CLOEXEC);
+		}
+	}
+}
+
+SrvDBPool::~SrvDBPool()
+{
+	stop();
+
+	// the listeners are not notified anymore, we're shutting down
+	for (list<Job*>::iterator it = mCompleted.begin(); it != mCompleted.end(); ++it) {
+		delete (*it)->query;
+		delete *it;
+	}
+	mCompleted.clear();
+
+	for (size_t i = 0; i < mWorkers.size(); ++i) {
+		delete mWorkers[i]->connector;
+		delete mWorkers[i];
+	}
+	mWorkers.clear();
+
+	if (mCompletionPipe[0] >= 0) {
+		close(mCompletionPipe[0]);
+		close(mCompletionPipe[1]);
+	}
+}
+
+bool SrvDBPool::start()
+{
+	if (mRunning)
+		return true;
+
+	if (mCompletionPipe[0] < 0 || mWorkers.empty())
+		return false;
+
+	mStop = false;
+	for (size_t i = 0; i < mWorkers.size(); ++i) {
+		int result = pthread_create(&mWorkers[i]->thread, 0,
+					    &SrvDBPool::threadMain, mWorkers[i]);
+		if (result != 0) {
+			LogERR("Couldn't create the DB pool threads: '%s'", strerror(result));
+			// stop the ones already created
+			mMutex.lock();
+			mStop = true;
+			mPendingCond.broadcast();
+			mMutex.unlock();
+			for (size_t j = 0; j < i; ++j) {
+				pthread_join(mWorkers[j]->thread, 0);
+			}
+			return false;
+		}
+	}
+	mRunning = true;
+	return true;
+}
+
+void SrvDBPool::stop()
+{
+	if (!mRunning)
+		return;
+
+	mMutex.lock();
+	mStop = true;
+	mPendingCond.broadcast();
+	mMutex.unlock();
+
+	// the threads execute everything pending before finishing
+	for (size_t i = 0; i < mWorkers.size(); ++i) {
+		pthread_join(mWorkers[i]->thread, 0);
+	}
+	mRunning = false;
+
+	LogNTC("DB pool stopped: %llu queries executed",
+	       static_cast<unsigned long long>(mStats.executed));
+}
+
+void SrvDBPool::submit(QueryType type, SrvDBQuery* query, SrvDBQueryListener* listener)
+{
+	Job* job = new Job(type, query, listener,
+			   SrvDBMgr::instance().getWriteSeq(query));
+
+	if (!mRunning) {
+		// no threads, do it ourselves -- but the listener is notified
+		// later anyway, as when the query is executed by the threads
+		SrvDBConnectorBase* connector = mWorkers.empty() ? 0 : mWorkers[0]->connector;
+		job->result = SrvDBMgr::instance().runQuery(connector, type, query,
+							    job->writeSeq);
+		MutexLocker locker(mMutex);
+		++mStats.executed;
+		complete(job);
+		return;
+	}
+
+	MutexLocker locker(mMutex);
+	mPending.push_back(job);
+	mStats.maxPending = max(mStats.maxPending, mPending.size());
+	mPendingCond.signal();
+}
+
+void SrvDBPool::cancel(SrvDBQueryListener* listener)
+{
+	MutexLocker locker(mMutex);
+	for (list<Job*>::iterator it = mPending.begin(); it != mPending.end(); ++it) {
+		if ((*it)->listener == listener)
+			(*it)->listener = 0;
+	}
+	for (size_t i = 0; i < mWorkers.size(); ++i) {
+		if (mWorkers[i]->job && mWorkers[i]->job->listener == listener)
+			mWorkers[i]->job->listener = 0;
+	}
+	for (list<Job*>::iterator it = mCompleted.begin(); it != mCompleted.end(); ++it) {
+		if ((*it)->listener == listener)
+			(*it)->listener = 0;
+	}
+}
+
+int SrvDBPool::getCompletionFD() const
+{
+	return mCompletionPipe[0];
+}
+
+void SrvDBPool::processCompleted()
+{
+	// empty the pipe before taking the jobs, so we don't miss the ones
+	// completed meanwhile
+	char buffer[64];
+	while (mCompletionPipe[0] >= 0
+	       && read(mCompletionPipe[0], buffer, sizeof(buffer)) > 0) {
+		// nothing
+	}
+
+	// mafm: one by one and without the lock while notifying, so the
+	// listeners can submit new queries or cancel the ones completed
+	while (true) {
+		mMutex.lock();
+		if (mCompleted.empty()) {
+			mMutex.unlock();
+			break;
+		}
+		Job* job = mCompleted.front();
+		mCompleted.pop_front();
+		mMutex.unlock();
+
+		if (job->listener)
+			job->listener->queryCompleted(job->query, job->result);
+		delete job->query;
+		delete job;
+	}
+}
+
+void SrvDBPool::getStats(SrvDBPoolStats& stats) const
+{
+	MutexLocker locker(mMutex);
+	stats = mStats;
+	stats.pending = mPending.size();
+}
+
+void* SrvDBPool::threadMain(void* worker)
+{
+	Worker* w = static_cast<Worker*>(worker);
+	w->pool->run(w);
+	return 0;
+}
+
+void SrvDBPool::run(Worker* worker)
+{
+	mMutex.lock();
+	while (true) {
+		while (mPending.empty() && !mStop) {
+			mPendingCond.wait(mMutex);
+		}
+		if (mPending.empty() && mStop)
+			break;
+
+		Job* job = mPending.front();
+		mPending.pop_front();
+		worker->job = job;
+		mMutex.unlock();
+
+		job->result = SrvDBMgr::instance().runQuery(worker->connector,
+							    job->type, job->query,
+							    job->writeSeq);
+
+		mMutex.lock();
+		worker->job = 0;
+		++mStats.executed;
+		complete(job);
+	}
+	mMutex.unlock();
+}
+
+void SrvDBPool::complete(Job* job)
+{
+	bool wasEmpty = mCompleted.empty();
+	mCompleted.push_back(job);
+	if (wasEmpty && mCompletionPipe[1] >= 0) {
+		char c = 0;
+		if (write(mCompletionPipe[1], &c, 1) < 0 && errno != EAGAIN) {
+			LogERR("Couldn't wake up the main loop from the DB pool: '%s'",
+			       strerror(errno));
+		}
+	}
+}
+
+
+// Local Variables: ***
+// mode: C++ ***
+// tab-width: 8 ***
+// c-basic-offset: 8 ***
+// indent-tabs-mode: t ***
+// fill-column: 80 ***
+// End: ***
+// ex: shiftwidth=2 tabstop=8
@@ -0,0 +1,176 @@
+/*
+ * srvdbpool.h
+ * Copyright (C) 2006-2008 by Manuel A. Fernandez Montecelo <mafm@users.sourceforge.net>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FEARANN_SERVER_DB_POOL_H__
+#define __FEARANN_SERVER_DB_POOL_H__
+
+
+#include "common/threads.h"
+
+#include <list>
+#include <vector>
+#include <stdint.h>
+
+
+class SrvDBConnectorBase;
+class SrvDBQuery;
+class SrvDBQueryListener;
+
+
+/** @ingroup database
+ *  @{
+ */
+
+
+/** Statistics of the connection pool
+ */
+class SrvDBPoolStats
+{
+public:
+	SrvDBPoolStats() :
+		connections(0), pending(0), maxPending(0), executed(0)
+		{ }
+
+	/// Connections (and threads) of the pool
+	size_t connections;
+	/// Queries waiting for a connection
+	size_t pending;
+	/// Maximum number of queries waiting at the same time
+	size_t maxPending;
+	/// Queries executed
+	uint64_t executed;
+};
+
+
+/** Pool of connections to execute queries in parallel, out of the main loop.
+ *
+ * Each connection has its own thread, which takes the queries submitted in
+ * order.  When a query is done it goes to the completion queue, and the
+ * descriptor returned by getCompletionFD() becomes readable, so the main loop
+ * can wait for it along with the network; then processCompleted() notifies
+ * the listeners, in the main thread.
+ *
+ * @author mafm
+ */
+class SrvDBPool
+{
+public:
+	/** Type of the queries */
+	enum QueryType {
+		INSERT = 1,	///< Returns 1 if successful, 0 otherwise
+		UPDATE,		///< Returns the rows affected, -1 if failure
+		DELETE,		///< Returns the rows affected, -1 if failure
+		SELECT,		///< Returns the number of rows, -1 if failure
+		MATCH		///< Returns the number of rows, -1 if failure
+	};
+
+	/** Constructor, taking ownership of the connectors (which must be
+	 * already connected) */
+	SrvDBPool(const std::vector<SrvDBConnectorBase*>& connectors);
+	/** Destructor, executes the queries pending before returning */
+	~SrvDBPool();
+
+	/** Start the threads, returns false if they couldn't be started (and
+	 * then the queries are executed directly when submitted) */
+	bool start();
+	/** Execute the queries pending and stop the threads */
+	void stop();
+
+	/** Submit a query, taking ownership of it */
+	void submit(QueryType type, SrvDBQuery* query, SrvDBQueryListener* listener);
+	/** Forget the listener, the queries submitted by it are executed but
+	 * it's not notified */
+	void cancel(SrvDBQueryListener* listener);
+	/** Descriptor which is readable when there are queries completed */
+	int getCompletionFD() const;
+	/** Notify the listeners of the queries completed, and delete them */
+	void processCompleted();
+	/** Get the statistics */
+	void getStats(SrvDBPoolStats& stats) const;
+
+private:
+	/** Query submitted */
+	class Job {
+	public:
+		Job(QueryType t, SrvDBQuery* q, SrvDBQueryListener* l, uint64_t s) :
+			type(t), query(q), listener(l), writeSeq(s), result(-1) { }
+		QueryType type;
+		SrvDBQuery* query;
+		SrvDBQueryListener* listener;
+		/// Last write queued to the tables of the query when submitted,
+		/// to wait for it before executing the query
+		uint64_t writeSeq;
+		int result;
+	};
+
+	/** Data for each thread */
+	class Worker {
+	public:
+		Worker(SrvDBPool* p, SrvDBConnectorBase* c) :
+			pool(p), connector(c), job(0) { }
+		SrvDBPool* pool;
+		SrvDBConnectorBase* connector;
+		pthread_t thread;
+		/// Job being executed, if any
+		Job* job;
+	};
+
+	/// Threads, with their connections
+	std::vector<Worker*> mWorkers;
+	/// Queries waiting for a connection
+	std::list<Job*> mPending;
+	/// Queries done, waiting to be notified
+	std::list<Job*> mCompleted;
+	/// Pipe to wake up the main loop when there are queries done
+	int mCompletionPipe[2];
+	/// Whether the threads must finish
+	bool mStop;
+	/// Whether the threads are running
+	bool mRunning;
+	/// Protects all of the above (but the connectors), and the statistics
+	mutable Mutex mMutex;
+	/// Signals the threads that there are queries pending (or to stop)
+	Condition mPendingCond;
+	/// Statistics
+	SrvDBPoolStats mStats;
+
+
+	/** Entry point of the threads */
+	static void* threadMain(void* worker);
+	/** Loop of the threads */
+	void run(Worker* worker);
+	/** Move the job to the completion queue, waking up the main loop
+	 * (the mutex must be locked) */
+	void complete(Job* job);
+};
+
+
+/** @} */
+
+
+#endif
+
+
+// Local Variables: ***
+// mode: C++ ***
+// tab-width: 8 ***
+// c-basic-offset: 8 ***
+// indent-tabs-mode: t ***
+// fill-column: 80 ***
+// End: ***
+// ex: shiftwidth=2 tabstop=8
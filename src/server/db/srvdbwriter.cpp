@@ -0,0 +1,257 @@
+/*
+ * srvdbwriter.cpp
+ * Copyright (C) 2006-2008 by Manuel A. Fernandez Montecelo <mafm@users.sourceforge.net>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "srvdbwriter.h"
+
+#include "server/db/srvdbmgr.h"
+
+#include <cstring>
+
+
+/*******************************************************************************
+ * SrvDBWriter
+ ******************************************************************************/
+SrvDBWriter::SrvDBWriter(SrvDBConnectorBase* connector, size_t maxQueued) :
+	mConnector(connector), mMaxQueued(maxQueued),
+	mLastSeq(0), mStop(false), mRunning(false)
+{
+	if (mMaxQueued == 0)
+		mMaxQueued = 1;
+}
+
+SrvDBWriter::~SrvDBWriter()
+{
+	stop();
+	delete mConnector;
+}
+
+bool SrvDBWriter::start()
+{
+	if (mRunning)
+		return true;
+
+	mStop = false;
+	int result = pthread_create(&mThread, 0, &SrvDBWriter::threadMain, this);
+	if (result != 0) {
+		LogERR("Couldn't create the DB writer thread: '%s'", strerror(result));
+		return false;
+	}
+	mRunning = true;
+	return true;
+}
+
+void SrvDBWriter::stop()
+{
+	if (!mRunning)
+		return;
+
+	mMutex.lock();
+	mStop = true;
+	mQueuedCond.signal();
+	mMutex.unlock();
+
+	// the thread writes everything pending before finishing
+	pthread_join(mThread, 0);
+	mRunning = false;
+
+	LogNTC("DB writer stopped: %llu written, %llu failed, %llu coalesced, %llu stalls",
+	       static_cast<unsigned long long>(mStats.written),
+	       static_cast<unsigned long long>(mStats.failed),
+	       static_cast<unsigned long long>(mStats.coalesced),
+	       static_cast<unsigned long long>(mStats.stalls));
+}
+
+void SrvDBWriter::queue(const std::string& key,
+			const std::vector<std::string>& tables,
+			const std::string& sqlcmd,
+			const std::vector<std::string>& params)
+{
+	if (!mRunning) {
+		// no thread, do it ourselves
+		MutexLocker locker(mMutex);
+		if (execute(Statement(0, key, sqlcmd, params)))
+			++mStats.written;
+		else
+			++mStats.failed;
+		return;
+	}
+
+	MutexLocker locker(mMutex);
+
+	// replace the statement with the same key, if not written yet -- moving
+	// it to the end, so it's not written before other statements queued
+	// after the old one (in example, a checkpoint with older data).  It
+	// keeps the sequence number of the old one, so the queries waiting for
+	// it wait until the new one is written.
+	uint64_t seq = 0;
+	bool coalesced = false;
+	if (!key.empty()) {
+		map<string, list<Statement>::iterator>::iterator it = mQueuedKeys.find(key);
+		if (it != mQueuedKeys.end()) {
+			seq = it->second->seq;
+			mQueue.erase(it->second);
+			mQueue.push_back(Statement(seq, key, sqlcmd, params));
+			it->second = --mQueue.end();
+			++mStats.coalesced;
+			coalesced = true;
+		}
+	}
+
+	if (!coalesced) {
+		// mafm: the queue is bounded so we don't eat all the memory if
+		// the DB can't keep up, we prefer to slow down the game in that
+		// case
+		if (mQueue.size() >= mMaxQueued) {
+			++mStats.stalls;
+			LogWRN("DB write queue full (%zu statements), waiting", mQueue.size());
+			while (mQueue.size() >= mMaxQueued) {
+				mWrittenCond.wait(mMutex);
+			}
+		}
+
+		seq = ++mLastSeq;
+		mQueue.push_back(Statement(seq, key, sqlcmd, params));
+		if (!key.empty()) {
+			mQueuedKeys[key] = --mQueue.end();
+		}
+		mPendingSeqs.insert(seq);
+		mStats.maxQueued = max(mStats.maxQueued, mQueue.size());
+	}
+
+	for (size_t i = 0; i < tables.size(); ++i) {
+		uint64_t& tableSeq = mTableSeqs[tables[i]];
+		tableSeq = max(tableSeq, seq);
+	}
+	mQueuedCond.signal();
+}
+
+void SrvDBWriter::flush()
+{
+	MutexLocker locker(mMutex);
+	while (!mPendingSeqs.empty()) {
+		mWrittenCond.wait(mMutex);
+	}
+}
+
+uint64_t SrvDBWriter::getWriteSeq(const std::vector<std::string>& tables) const
+{
+	MutexLocker locker(mMutex);
+	uint64_t seq = 0;
+	for (size_t i = 0; i < tables.size(); ++i) {
+		map<string, uint64_t>::const_iterator it = mTableSeqs.find(tables[i]);
+		if (it != mTableSeqs.end())
+			seq = max(seq, it->second);
+	}
+	return seq;
+}
+
+void SrvDBWriter::waitFor(uint64_t seq)
+{
+	if (seq == 0)
+		return;
+
+	MutexLocker locker(mMutex);
+	while (!isWritten(seq)) {
+		mWrittenCond.wait(mMutex);
+	}
+}
+
+bool SrvDBWriter::isWritten(uint64_t seq) const
+{
+	// the statements are written in order, but the ones coalesced keep
+	// their old number, so we look at the oldest not written
+	return mPendingSeqs.empty() || *mPendingSeqs.begin() > seq;
+}
+
+void SrvDBWriter::getStats(SrvDBWriteStats& stats) const
+{
+	MutexLocker locker(mMutex);
+	stats = mStats;
+	stats.queued = mQueue.size();
+}
+
+void* SrvDBWriter::threadMain(void* writer)
+{
+	static_cast<SrvDBWriter*>(writer)->run();
+	return 0;
+}
+
+void SrvDBWriter::run()
+{
+	list<Statement> batch;
+
+	mMutex.lock();
+	while (true) {
+		while (mQueue.empty() && !mStop) {
+			mQueuedCond.wait(mMutex);
+		}
+		if (mQueue.empty() && mStop)
+			break;
+
+		// take everything queued, so the game can keep on queueing
+		// while we write
+		batch.swap(mQueue);
+		mQueuedKeys.clear();
+		mWrittenCond.broadcast();
+		mMutex.unlock();
+
+		// the queries waiting for a statement are woken up as soon as
+		// it's written, not when the whole batch is
+		for (list<Statement>::iterator it = batch.begin(); it != batch.end(); ++it) {
+			bool result = execute(*it);
+
+			mMutex.lock();
+			if (result)
+				++mStats.written;
+			else
+				++mStats.failed;
+			mPendingSeqs.erase(it->seq);
+			mWrittenCond.broadcast();
+			mMutex.unlock();
+		}
+		batch.clear();
+
+		mMutex.lock();
+	}
+	mMutex.unlock();
+}
+
+bool SrvDBWriter::execute(const Statement& statement)
+{
+	SrvDBResult* res = mConnector->executeQuery(statement.sqlcmd.c_str(),
+						    statement.params);
+	if (!res) {
+		LogERR("DB writer: failed statement: '%s'", statement.sqlcmd.c_str());
+		return false;
+	} else {
+		delete res;
+		return true;
+	}
+}
+
+
+// Local Variables: ***
+// mode: C++ ***
+// tab-width: 8 ***
+// c-basic-offset: 8 ***
+// indent-tabs-mode: t ***
+// fill-column: 80 ***
+// End: ***
+// ex: shiftwidth=2 tabstop=8
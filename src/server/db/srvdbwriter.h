@@ -0,0 +1,186 @@
+/*
+ * srvdbwriter.h
+ * Copyright (C) 2006-2008 by Manuel A. Fernandez Montecelo <mafm@users.sourceforge.net>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FEARANN_SERVER_DB_WRITER_H__
+#define __FEARANN_SERVER_DB_WRITER_H__
+
+
+#include "common/threads.h"
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+
+class SrvDBConnectorBase;
+
+
+/** @ingroup database
+ *  @{
+ */
+
+
+/** Statistics of the write-behind queue
+ */
+class SrvDBWriteStats
+{
+public:
+	SrvDBWriteStats() :
+		queued(0), maxQueued(0), written(0), failed(0), coalesced(0), stalls(0)
+		{ }
+
+	/// Statements waiting in the queue
+	size_t queued;
+	/// Maximum number of statements waiting at the same time
+	size_t maxQueued;
+	/// Statements executed successfully
+	uint64_t written;
+	/// Statements failed
+	uint64_t failed;
+	/// Statements replaced by newer ones before being executed
+	uint64_t coalesced;
+	/// Times that the queue was full and the game had to wait
+	uint64_t stalls;
+};
+
+
+/** Write-behind queue for the DB: statements whose result we don't need are
+ * queued and executed by a dedicated thread with its own connection, so the
+ * main loop doesn't wait for the DB (in example for a slow fsync).
+ *
+ * The queue is bounded, when it's full the caller waits until there's room.
+ * Statements with the same key (in example, updating the same columns of the
+ * same row) replace the one queued if it wasn't executed yet, so only the
+ * latest data is written.
+ *
+ * Each statement gets a sequence number when queued, and the last one writing
+ * to each table is remembered; so the queries reading a table only have to
+ * wait for the statements writing to it queued before, instead of for the
+ * whole queue.
+ *
+ * @author mafm
+ */
+class SrvDBWriter
+{
+public:
+	/** Constructor, taking ownership of the connector (which must be
+	 * already connected) */
+	SrvDBWriter(SrvDBConnectorBase* connector, size_t maxQueued);
+	/** Destructor, writes everything pending before returning */
+	~SrvDBWriter();
+
+	/** Start the thread, returns false if it couldn't be started (and then
+	 * the statements are executed directly when queued) */
+	bool start();
+	/** Write everything pending and stop the thread */
+	void stop();
+
+	/** Queue a statement with its parameters, with the given key for
+	 * coalescing (empty if the statement must be always executed) and the
+	 * tables that it writes to */
+	void queue(const std::string& key,
+		   const std::vector<std::string>& tables,
+		   const std::string& sqlcmd,
+		   const std::vector<std::string>& params);
+	/** Wait until all the statements queued are written */
+	void flush();
+	/** Get the sequence number of the last statement queued writing to
+	 * any of the given tables (0 if none), to wait for it with
+	 * waitFor() */
+	uint64_t getWriteSeq(const std::vector<std::string>& tables) const;
+	/** Wait until the statement with the given sequence number, and all
+	 * the ones queued before it, are written */
+	void waitFor(uint64_t seq);
+	/** Get the statistics */
+	void getStats(SrvDBWriteStats& stats) const;
+
+private:
+	/** Statement queued */
+	class Statement {
+	public:
+		Statement(uint64_t s,
+			  const std::string& k,
+			  const std::string& cmd,
+			  const std::vector<std::string>& p) :
+			seq(s), key(k), sqlcmd(cmd), params(p) { }
+		uint64_t seq;
+		std::string key;
+		std::string sqlcmd;
+		std::vector<std::string> params;
+	};
+
+	/// Connection used by the thread
+	SrvDBConnectorBase* mConnector;
+	/// Maximum number of statements queued
+	size_t mMaxQueued;
+	/// Statements queued
+	std::list<Statement> mQueue;
+	/// Statements queued with key, to coalesce them
+	std::map<std::string, std::list<Statement>::iterator> mQueuedKeys;
+	/// Sequence number of the last statement queued
+	uint64_t mLastSeq;
+	/// Sequence numbers of the statements not written yet (queued or
+	/// being written)
+	std::set<uint64_t> mPendingSeqs;
+	/// Sequence number of the last statement queued writing to each table
+	std::map<std::string, uint64_t> mTableSeqs;
+	/// Whether the thread must finish
+	bool mStop;
+	/// Whether the thread is running
+	bool mRunning;
+	/// The thread
+	pthread_t mThread;
+	/// Protects all of the above, and the statistics
+	mutable Mutex mMutex;
+	/// Signals the thread that there are statements queued (or to stop)
+	Condition mQueuedCond;
+	/// Signals the callers that statements were taken or written
+	Condition mWrittenCond;
+	/// Statistics
+	SrvDBWriteStats mStats;
+
+
+	/** Entry point of the thread */
+	static void* threadMain(void* writer);
+	/** Loop of the thread */
+	void run();
+	/** Execute a statement, returns whether it was successful */
+	bool execute(const Statement& statement);
+	/** Whether the statement with the given sequence number and the ones
+	 * before it are written (the mutex must be locked) */
+	bool isWritten(uint64_t seq) const;
+};
+
+
+/** @} */
+
+
+#endif
+
+
+// Local Variables: ***
+// mode: C++ ***
+// tab-width: 8 ***
+// c-basic-offset: 8 ***
+// indent-tabs-mode: t ***
+// fill-column: 80 ***
+// End: ***
+// ex: shiftwidth=2 tabstop=8
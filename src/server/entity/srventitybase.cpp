@@ -126,11 +126,30 @@ float SrvEntityBaseMovable::getDistanceToEntity(const SrvEntityBaseMovable& othe
 	return distance;
 }
 
+bool SrvEntityBaseMovable::isWithinDistance(const SrvEntityBaseMovable& other,
+					    float distance) const
+{
+	return mMov.area == other.mMov.area
+		&& mMov.position.squaredDistance(other.mMov.position) <= distance * distance;
+}
+
 const char* SrvEntityBaseMovable::getArea() const
 {
 	return mMov.area.c_str();
 }
 
+void SrvEntityBaseMovable::getPositionForDB(std::vector<std::string>& values) const
+{
+	// mafm: sometimes works bad with the "exact" data, +=0.5 for pos3=z
+	// (height)
+	values.clear();
+	values.push_back(mMov.area);
+	values.push_back(StrFmt("%.1f", mMov.position.x));
+	values.push_back(StrFmt("%.1f", mMov.position.y));
+	values.push_back(StrFmt("%.1f", mMov.position.z + 0.5f));
+	values.push_back(StrFmt("%.3f", mMov.rot));
+}
+
 void SrvEntityBaseMovable::setMovementData(const MsgEntityMove& mov)
 {
 	mMov = mov;
@@ -178,42 +197,49 @@ void SrvEntityBaseObservable::onDetachObserver(Observer* observer)
  ******************************************************************************/
 SrvEntityBase::SrvEntityBase(const MsgEntityCreate& basic,
 			     const MsgEntityMove& mov) :
-	SrvEntityBaseObservable(basic, mov)
+	SrvEntityBaseObservable(basic, mov), mDirtyFields(0)
 {
 	mMeshFactory = mBasic.meshType + "_" + mBasic.meshSubtype;
 }
 
+void SrvEntityBase::setDirty(uint32_t fields)
+{
+	mDirtyFields |= fields;
+}
+
+uint32_t SrvEntityBase::getDirty() const
+{
+	return mDirtyFields;
+}
+
+void SrvEntityBase::clearDirty()
+{
+	mDirtyFields = 0;
+}
+
 void SrvEntityBase::saveToDB()
 {
 	LogDBG("SrvEntityBase::saveToDB()");
 
-	// mafm: sometimes works bad with the "exact" data, +=0.5 for pos3=z
-	// (height)
 	string id = StrFmt("%lu", mBasic.entityID);
-	string area = mMov.area;
-	string pos1 = StrFmt("%.1f", mMov.position.x);
-	string pos2 = StrFmt("%.1f", mMov.position.y);
-	string pos3 = StrFmt("%.1f", mMov.position.z + 0.5f);
-	string rot = StrFmt("%.3f", mMov.rot);
+	vector<string> pos;
+	getPositionForDB(pos);
 
 	SrvDBQuery query;
 	query.setTables("entities");
-	query.setCondition("id='" + id + "'");
-	query.addColumnWithValue("area", area);
-	query.addColumnWithValue("pos1", pos1);
-	query.addColumnWithValue("pos2", pos2);
-	query.addColumnWithValue("pos3", pos3);
-	query.addColumnWithValue("rot", rot);
-	bool success = SrvDBMgr::instance().queryUpdate(&query);
-	if (!success) {
-		LogERR("Error while saving position for entity '%s'",
-		       id.c_str());
-		return;
-	}
+	query.setCondition("id=?");
+	query.addConditionValue(id);
+	query.addColumnWithValue("area", pos[0]);
+	query.addColumnWithValue("pos1", pos[1]);
+	query.addColumnWithValue("pos2", pos[2]);
+	query.addColumnWithValue("pos3", pos[3]);
+	query.addColumnWithValue("rot", pos[4]);
+	SrvDBMgr::instance().queueUpdate(&query);
+	clearDirty();
 
 	LogDBG("Saving position for entity '%s' in DB: '%s' (%s, %s, %s) rot=%s",
-	       id.c_str(), mMov.area.c_str(),
-	       pos1.c_str(), pos2.c_str(), pos3.c_str(), rot.c_str());
+	       id.c_str(), pos[0].c_str(),
+	       pos[1].c_str(), pos[2].c_str(), pos[3].c_str(), pos[4].c_str());
 }
 
 const char* SrvEntityBase::getName() const
@@ -48,8 +48,14 @@ public:
 	void getPositionWithRelativeOffset(Vector3& position, const Vector3& offset) const;
 	/** Return the distance of this entity to the one passed */
 	float getDistanceToEntity(const SrvEntityBaseMovable& other) const;
+	/** Whether the entity passed is within the given distance of this one
+	 * (cheaper than getting the distance) */
+	bool isWithinDistance(const SrvEntityBaseMovable& other, float distance) const;
 	/** Get the area where this player is currently in */
 	const char* getArea() const;
+	/** Get the area, position and rotation formatted to save them in the
+	 * DB, in this order */
+	void getPositionForDB(std::vector<std::string>& values) const;
 
 protected:
 	/// Data needed for movement
@@ -153,10 +159,24 @@ public:
 	/** Get the entity class */
 	const char* getEntityClass() const;
 
+	/** Fields of the entity which can change and have to be saved */
+	enum DirtyField {
+		DIRTY_POSITION = 1 << 0,
+		DIRTY_STATS = 1 << 1
+	};
+	/** Mark fields as changed since the last time saved to the DB */
+	void setDirty(uint32_t fields);
+	/** Get the fields changed since the last time saved to the DB */
+	uint32_t getDirty() const;
+	/** Mark all fields as saved to the DB */
+	void clearDirty();
+
 protected:
 	/// The mesh factory (generated on the fly, but has to be a variable
 	/// because we return a pointer)
 	std::string mMeshFactory;
+	/// Fields changed since the last time saved to the DB
+	uint32_t mDirtyFields;
 
 
 	/** Constructor
@@ -23,6 +23,7 @@
 
 #include "server/db/srvdbmgr.h"
 #include "server/net/srvnetworkmgr.h"
+#include "server/world/srvworldmgr.h"
 
 
 /*******************************************************************************
@@ -143,30 +144,21 @@ void SrvEntityCreature::insertIntoDB()
 
 void SrvEntityCreature::saveToDB()
 {
-	// mafm: sometimes works bad with the "exact" data, +=0.5 for pos3=z
-	// (height)
-	string charname = mBasic.entityName;
-	string area = mMov.area;
-	string pos1 = StrFmt("%.1f", mMov.position.x);
-	string pos2 = StrFmt("%.1f", mMov.position.y);
-	string pos3 = StrFmt("%.1f", mMov.position.z + 0.5f);
-	string rot = StrFmt("%.3f", mMov.rot);
 	string id = StrFmt("%lu", getID());
+	vector<string> pos;
+	getPositionForDB(pos);
 
 	SrvDBQuery query;
 	query.setTables("creatures");
-	query.setCondition("id='" + id + "'");
-	query.addColumnWithValue("area", area);
-	query.addColumnWithValue("pos1", pos1);
-	query.addColumnWithValue("pos2", pos2);
-	query.addColumnWithValue("pos3", pos3);
-	query.addColumnWithValue("rot", rot);
-	bool success = SrvDBMgr::instance().queryUpdate(&query);
-	if (!success) {
-		LogERR("Error while saving position for creature '%s'",
-		       charname.c_str());
-		return;
-	}
+	query.setCondition("id=?");
+	query.addConditionValue(id);
+	query.addColumnWithValue("area", pos[0]);
+	query.addColumnWithValue("pos1", pos[1]);
+	query.addColumnWithValue("pos2", pos[2]);
+	query.addColumnWithValue("pos3", pos[3]);
+	query.addColumnWithValue("rot", pos[4]);
+	SrvDBMgr::instance().queueUpdate(&query);
+	clearDirty();
 }
 
 void SrvEntityCreature::updateMovementFromClient(MsgEntityMove* msg)
@@ -179,8 +171,13 @@ void SrvEntityCreature::updateMovementFromClient(MsgEntityMove* msg)
     // than one anyway...
     msg->area = mBasic.area;
 
-    // "adopt" the message, and notify the subscribers
+    // "adopt" the message, update the subscriptions if we moved to other cell
+    // of the world, and notify the subscribers
+    string oldArea = mMov.area;
+    Vector3 oldPosition = mMov.position;
     mMov = *msg;
+    setDirty(DIRTY_POSITION);
+    SrvWorldMgr::instance().updateEntityPosition(this, oldArea, oldPosition);
     SrvEntityBaseObserverEvent event(SrvEntityBaseObserverEvent::ENTITY_CREATE, *msg);
     notifyObservers(event);
 
@@ -23,6 +23,7 @@
 #include "server/db/srvdbmgr.h"
 #include "server/login/srvloginmgr.h"
 #include "server/net/srvnetworkmgr.h"
+#include "server/world/srvworldmgr.h"
 #include "srventityobject.h"
 
 
@@ -130,19 +131,20 @@ SrvEntityPlayer::SrvEntityPlayer(MsgEntityCreate& basic,
 
 		SrvDBQuery query;
 		query.setTables("entities");
-		string condition = "owner='" + mBasic.entityName + "'";
-		query.setCondition(condition);
+		query.setCondition("owner=?");
+		query.addConditionValue(mBasic.entityName);
 		query.addColumnWithoutValue("id");
 		query.addColumnWithoutValue("type");
 		query.addColumnWithoutValue("subtype");
-		int numresults = SrvDBMgr::instance().querySelect(&query);
-		for (int row = 0; row < numresults; ++row) {
-			itemID = "0";
-			itemType = "<none>";
-			itemSubtype = "<none>";
-			query.getResult()->getValue(row, "id", itemID);
-			query.getResult()->getValue(row, "type", itemType);
-			query.getResult()->getValue(row, "subtype", itemSubtype);
+		SrvDBMgr::instance().querySelect(&query);
+		SrvDBResultCursor cursor(query.getResult());
+		int colID = cursor.getColumn("id");
+		int colType = cursor.getColumn("type");
+		int colSubtype = cursor.getColumn("subtype");
+		while (cursor.next()) {
+			cursor.getString(colID, itemID);
+			cursor.getString(colType, itemType);
+			cursor.getString(colSubtype, itemSubtype);
 
 			/// \todo mafm: adapt
 			/*
@@ -166,8 +168,8 @@ SrvEntityPlayer::SrvEntityPlayer(MsgEntityCreate& basic,
 	{
 		SrvDBQuery query;
 		query.setTables("usr_chars");
-		string condition = "charname='" + mBasic.entityName + "'";
-		query.setCondition(condition);
+		query.setCondition("charname=?");
+		query.addConditionValue(mBasic.entityName);
 		query.addColumnWithoutValue("race");
 		query.addColumnWithoutValue("gender");
 		query.addColumnWithoutValue("class");
@@ -215,57 +217,59 @@ SrvEntityPlayer::~SrvEntityPlayer()
 	delete mPlayerInfo; mPlayerInfo = 0;
 }
 
+void SrvEntityPlayer::getStatsForDB(std::vector<std::string>& values) const
+{
+	values.clear();
+	values.push_back(StrFmt("%d", mPlayerData.health_cur));
+	values.push_back(StrFmt("%d", mPlayerData.magic_cur));
+	values.push_back(StrFmt("%d", mPlayerData.stamina));
+	values.push_back(StrFmt("%d", mPlayerData.gold));
+}
+
+void SrvEntityPlayer::setHealth(int health)
+{
+	mPlayerInfo->setHealth(health);
+	mPlayerData.health_cur = health;
+	setDirty(DIRTY_STATS);
+}
+
 void SrvEntityPlayer::saveToDB()
 {
-	// mafm: sometimes works bad with the "exact" data, +=0.5 for pos3=z
-	// (height)
 	string charname = mBasic.entityName;
-	string area = mMov.area;
-	string pos1 = StrFmt("%.1f", mMov.position.x);
-	string pos2 = StrFmt("%.1f", mMov.position.y);
-	string pos3 = StrFmt("%.1f", mMov.position.z + 0.5f);
-	string rot = StrFmt("%.3f", mMov.rot);
+	vector<string> pos;
+	getPositionForDB(pos);
 
 	SrvDBQuery query;
 	query.setTables("usr_chars");
-	query.setCondition("charname='" + charname + "'");
-	query.addColumnWithValue("area", area);
-	query.addColumnWithValue("pos1", pos1);
-	query.addColumnWithValue("pos2", pos2);
-	query.addColumnWithValue("pos3", pos3);
-	query.addColumnWithValue("rot", rot);
-	bool success = SrvDBMgr::instance().queryUpdate(&query);
-	if (!success) {
-		LogERR("Error while saving position for player '%s'",
-		       charname.c_str());
-		return;
-	}
+	query.setCondition("charname=?");
+	query.addConditionValue(charname);
+	query.addColumnWithValue("area", pos[0]);
+	query.addColumnWithValue("pos1", pos[1]);
+	query.addColumnWithValue("pos2", pos[2]);
+	query.addColumnWithValue("pos3", pos[3]);
+	query.addColumnWithValue("rot", pos[4]);
+	SrvDBMgr::instance().queueUpdate(&query);
 
 	// player stats
-	string health = StrFmt("%d", mPlayerData.health_cur);
-	string magic = StrFmt("%d", mPlayerData.magic_cur);
-	string stamina = StrFmt("%d", mPlayerData.stamina);
-	string gold = StrFmt("%d", mPlayerData.gold);
+	vector<string> stats;
+	getStatsForDB(stats);
 
 	SrvDBQuery query2;
 	query2.setTables("player_stats");
-	query2.setCondition("charname='" + charname + "'");
-	query2.addColumnWithValue("health", health);
-	query2.addColumnWithValue("magic", magic);
-	query2.addColumnWithValue("stamina", stamina);
-	query2.addColumnWithValue("gold", gold);
-	success = SrvDBMgr::instance().queryUpdate(&query2);
-	if (!success) {
-		LogERR("Error while saving stats for character '%s'",
-		       charname.c_str());
-		return;
-	}
+	query2.setCondition("charname=?");
+	query2.addConditionValue(charname);
+	query2.addColumnWithValue("health", stats[0]);
+	query2.addColumnWithValue("magic", stats[1]);
+	query2.addColumnWithValue("stamina", stats[2]);
+	query2.addColumnWithValue("gold", stats[3]);
+	SrvDBMgr::instance().queueUpdate(&query2);
+	clearDirty();
 
 	LogDBG("Saving position for player '%s' in DB: '%s' (%s, %s, %s) rot=%s"
 	       " and data: H=%s M=%s S=%s G=%s",
-	       charname.c_str(), mMov.area.c_str(),
-	       pos1.c_str(), pos2.c_str(), pos3.c_str(), rot.c_str(),
-	       health.c_str(), magic.c_str(), stamina.c_str(), gold.c_str());
+	       charname.c_str(), pos[0].c_str(),
+	       pos[1].c_str(), pos[2].c_str(), pos[3].c_str(), pos[4].c_str(),
+	       stats[0].c_str(), stats[1].c_str(), stats[2].c_str(), stats[3].c_str());
 }
 
 void SrvEntityPlayer::updateMovementFromClient(MsgEntityMove* msg)
@@ -288,8 +292,13 @@ void SrvEntityPlayer::updateMovementFromClient(MsgEntityMove* msg)
 	// more than one anyway...
 	msg->area = mBasic.area;
 
-	// "adopt" the message, and notify the subscribers
+	// "adopt" the message, update the subscriptions if we moved to other
+	// cell of the world, and notify the subscribers
+	string oldArea = mMov.area;
+	Vector3 oldPosition = mMov.position;
 	mMov = *msg;
+	setDirty(DIRTY_POSITION);
+	SrvWorldMgr::instance().updateEntityPosition(this, oldArea, oldPosition);
 	SrvEntityBaseObserverEvent event(SrvEntityBaseObserverEvent::ENTITY_CREATE, *msg);
 	notifyObservers(event);
 
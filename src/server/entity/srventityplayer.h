@@ -109,6 +109,12 @@ public:
 	/** Remove entity from the inventory */
 	void removeFromInventory(uint32_t itemID);
 
+	/** Set the current health */
+	void setHealth(int health);
+	/** Get health, magic, stamina and gold formatted to save them in the
+	 * DB, in this order */
+	void getStatsForDB(std::vector<std::string>& values) const;
+
 	/** @see Observer::updateFromObservable */
         virtual void updateFromObservable(const ObserverEvent& event);
 
@@ -34,6 +34,8 @@
 #include "server/net/srvnetworkmgr.h"
 #include "server/world/srvworldmgr.h"
 
+#include <algorithm>
+
 
 /** Small internal class to serve as container when throwing errors, so we can
  * pass several parameters.
@@ -51,6 +53,60 @@ private:
 };
 
 
+/** Maximum number of requests of a connection waiting to be attended */
+#define MAX_REQUESTS_QUEUED	8
+
+
+/** Internal class holding the state of a request of a connection (login,
+ * create character, join...) while it waits for the DB.
+ *
+ * Each request goes through several stages, one per query; when a query is
+ * completed, the DB pool notifies us and the manager continues with the next
+ * stage, so the main loop doesn't block meanwhile.
+ *
+ * @author mafm
+ */
+class SrvLoginRequest : public SrvDBQueryListener
+{
+	friend class SrvLoginMgr;
+public:
+	/** @see SrvDBQueryListener */
+	virtual void queryCompleted(SrvDBQuery* query, int result) {
+		SrvLoginMgr::instance().continueRequest(this, query, result);
+	}
+
+private:
+	/** Type of the request */
+	enum TYPE { CONNECT = 1, LOGIN, CREATE_USER, CREATE_CHAR, DELETE_CHAR, JOIN };
+
+	SrvLoginRequest(TYPE t, LoginData* l) :
+		type(t), stage(0), loginData(l),
+		points_con(0), points_str(0), points_dex(0),
+		points_int(0), points_wis(0), points_cha(0),
+		totalUsers(0)
+		{ }
+
+	/// Type of the request
+	TYPE type;
+	/// Stage of the request, 0 when starting
+	int stage;
+	/// Connection which made the request
+	LoginData* loginData;
+
+	/// Data sent by the client
+	string username, password, email, realname;
+	string charname, race, gender, playerClass;
+	uint8_t points_con, points_str, points_dex, points_int, points_wis, points_cha;
+
+	/// Data collected in the previous stages
+	int totalUsers;
+	string cid;
+	MsgEntityCreate msgBasic;
+	MsgEntityMove msgMove;
+	MsgPlayerData msgPlayer;
+};
+
+
 /*******************************************************************************
  * LoginData
  ******************************************************************************/
@@ -162,8 +218,12 @@ void SrvLoginMgr::finalize()
 	while (!mPlayerList.empty()) {
 		LoginData* elem = mPlayerList.back();
 		mPlayerList.pop_back();
+		cancelRequests(elem);
+		elem->netlink->setSession(0);
 		delete elem;
 	}
+	mNameIndex.clear();
+	mIDIndex.clear();
 }
 
 void SrvLoginMgr::addConnection(Netlink* netlink)
@@ -174,7 +234,11 @@ void SrvLoginMgr::addConnection(Netlink* netlink)
 	// 2- Check if already logged in, otherwise register connection
 	// 3- get data (server statistics) from the db, and send it
 
-	MsgConnectReply repmsg;
+	if (netlink->getSession()) {
+		LogWRN("Connection already registered, ignoring (IP: '%s')",
+		       netlink->getIP());
+		return;
+	}
 
 	// 1- reload the content tree
 	SrvContentMgr::instance().reloadContentTree();
@@ -199,19 +263,10 @@ void SrvLoginMgr::addConnection(Netlink* netlink)
 	}
 	*/
 	mPlayerList.push_back(newConn);
+	netlink->setSession(newConn);
 
 	// 3- get data (server statistics) from the db, and send it
-	{
-		repmsg.resultCode = MsgUtils::Errors::SUCCESS;
-		repmsg.protocolVersion = mProtocolVersion;
-		repmsg.uptime = SrvMain::instance().getUptime();
-		repmsg.totalUsers = getNumberOfAccounts();
-		repmsg.totalChars = getNumberOfCharacters();
-		repmsg.currentPlayers = getNumberOfConnectionsPlaying();
-		mNetMgr->sendToPlayer(repmsg, newConn);
-		LogNTC("Sending connect reply info (IP: '%s')",
-		       newConn->netlink->getIP());
-	}
+	startRequest(new SrvLoginRequest(SrvLoginRequest::CONNECT, newConn));
 
 	/* test data, to check if the serialization/deserialization process is
 	 * done correctly
@@ -223,6 +278,50 @@ void SrvLoginMgr::addConnection(Netlink* netlink)
 	*/
 }
 
+void SrvLoginMgr::connectStep(SrvLoginRequest* request, SrvDBQuery* /* query */, int result)
+{
+	LoginData* loginData = request->loginData;
+
+	switch (request->stage) {
+	case 0:
+	{
+		// number of accounts
+		SrvDBQuery* query = new SrvDBQuery();
+		query->setTables("usr_accts");
+		query->setCondition("1=1");
+		mDBMgr->queryMatchNumberAsync(query, request);
+		request->stage = 1;
+		return;
+	}
+	case 1:
+	{
+		// number of characters
+		request->totalUsers = result;
+		SrvDBQuery* query = new SrvDBQuery();
+		query->setTables("usr_chars");
+		query->setCondition("1=1");
+		mDBMgr->queryMatchNumberAsync(query, request);
+		request->stage = 2;
+		return;
+	}
+	case 2:
+	{
+		MsgConnectReply repmsg;
+		repmsg.resultCode = MsgUtils::Errors::SUCCESS;
+		repmsg.protocolVersion = mProtocolVersion;
+		repmsg.uptime = SrvMain::instance().getUptime();
+		repmsg.totalUsers = request->totalUsers;
+		repmsg.totalChars = result;
+		repmsg.currentPlayers = getNumberOfConnectionsPlaying();
+		mNetMgr->sendToPlayer(repmsg, loginData);
+		LogNTC("Sending connect reply info (IP: '%s')",
+		       loginData->netlink->getIP());
+		finishRequest(request);
+		return;
+	}
+	}
+}
+
 void SrvLoginMgr::removeConnection(LoginData* loginData)
 {
 	removeConnection(loginData->netlink);
@@ -230,49 +329,127 @@ void SrvLoginMgr::removeConnection(LoginData* loginData)
 
 void SrvLoginMgr::removeConnection(Netlink* netlink)
 {
-	for (vector<LoginData*>::iterator it = mPlayerList.begin();
-	     it != mPlayerList.end(); ++it) {
-		if ((*it)->netlink == netlink) {
-			LogNTC("Removing dead connection (usr: '%s', char: '%s', IP: '%s')",
-			       (*it)->getUserName(),
-			       (*it)->getPlayerName(),
-			       (*it)->getIP());
-
-			// remove from content manager
-			if ((*it)->isDownloadingContent()) {
-				LogDBG("Player downloading content, removing from ContentMgr");
-				SrvContentMgr::instance().removeConnection(*it);
-			}
+	LoginData* loginData = static_cast<LoginData*>(netlink->getSession());
+	if (!loginData)
+		return;
 
-			// remove from world manager
-			if ((*it)->isPlaying()) {
-				LogDBG("Player playing, removing from WorldMgr");
-				SrvWorldMgr::instance().removePlayer(*it);
-
-				// update time playing
-				string charname = (*it)->charname;
-				SrvDBQuery query;
-				query.setTables("usr_chars");
-				query.setCondition("charname='" + charname + "'");
-				query.addColumnWithValue("time_playing",
-							 "time_playing+CURRENT_TIMESTAMP-last_login",
-							 false);
-				bool success = mDBMgr->queryUpdate(&query);
-				if (!success) {
-					LogERR("Couldn't update time_playing for character '%s'",
-					       charname.c_str());
-				}
-			}
+	LogNTC("Removing dead connection (usr: '%s', char: '%s', IP: '%s')",
+	       loginData->getUserName(),
+	       loginData->getPlayerName(),
+	       loginData->getIP());
 
-			// remove from this one
-			delete *it;
-			mPlayerList.erase(it);
-			return;
-		}
+	// the DB doesn't have to notify us anymore
+	cancelRequests(loginData);
+
+	// remove from content manager
+	if (loginData->isDownloadingContent()) {
+		LogDBG("Player downloading content, removing from ContentMgr");
+		SrvContentMgr::instance().removeConnection(loginData);
+	}
+
+	// remove from world manager
+	if (loginData->isPlaying()) {
+		LogDBG("Player playing, removing from WorldMgr");
+		SrvWorldMgr::instance().removePlayer(loginData);
+
+		// update time playing
+		string charname = loginData->charname;
+		SrvDBQuery query;
+		query.setTables("usr_chars");
+		query.setCondition("charname=?");
+		query.addConditionValue(charname);
+		query.addColumnWithValue("time_playing",
+					 "time_playing+CURRENT_TIMESTAMP-last_login",
+					 false);
+		mDBMgr->queueUpdate(&query);
+	}
+
+	// remove from this one (from the indices only if it's the same
+	// connection, the same character might be joined from other one)
+	netlink->setSession(0);
+	std::tr1::unordered_map<std::string, LoginData*>::iterator itName =
+		mNameIndex.find(loginData->charname);
+	if (itName != mNameIndex.end() && itName->second == loginData)
+		mNameIndex.erase(itName);
+	std::tr1::unordered_map<EntityID, LoginData*>::iterator itID =
+		mIDIndex.find(StrToUInt64(loginData->cid.c_str()));
+	if (itID != mIDIndex.end() && itID->second == loginData)
+		mIDIndex.erase(itID);
+	mPlayerList.erase(std::find(mPlayerList.begin(), mPlayerList.end(), loginData));
+	delete loginData;
+}
+
+void SrvLoginMgr::startRequest(SrvLoginRequest* request)
+{
+	LoginData* loginData = request->loginData;
+
+	// mafm: the clients wait for the reply before sending the next
+	// request, so there should be very few of them queued
+	if (loginData->requests.size() >= MAX_REQUESTS_QUEUED) {
+		LogWRN("Too many requests queued, ignoring (usr: '%s', IP: '%s')",
+		       loginData->getUserName(), loginData->getIP());
+		delete request;
+		return;
+	}
+
+	loginData->requests.push_back(request);
+	if (loginData->requests.size() == 1)
+		continueRequest(request, 0, 0);
+}
+
+void SrvLoginMgr::finishRequest(SrvLoginRequest* request)
+{
+	LoginData* loginData = request->loginData;
+	loginData->requests.remove(request);
+	delete request;
+
+	if (!loginData->requests.empty())
+		continueRequest(loginData->requests.front(), 0, 0);
+}
+
+void SrvLoginMgr::cancelRequests(LoginData* loginData)
+{
+	while (!loginData->requests.empty()) {
+		SrvLoginRequest* request = loginData->requests.front();
+		loginData->requests.pop_front();
+		mDBMgr->cancelQueries(request);
+		delete request;
+	}
+}
+
+void SrvLoginMgr::continueRequest(SrvLoginRequest* request, SrvDBQuery* query, int result)
+{
+	switch (request->type) {
+	case SrvLoginRequest::CONNECT:
+		connectStep(request, query, result);
+		break;
+	case SrvLoginRequest::LOGIN:
+		loginStep(request, query, result);
+		break;
+	case SrvLoginRequest::CREATE_USER:
+		createUserStep(request, query, result);
+		break;
+	case SrvLoginRequest::CREATE_CHAR:
+		createCharacterStep(request, query, result);
+		break;
+	case SrvLoginRequest::DELETE_CHAR:
+		deleteCharacterStep(request, query, result);
+		break;
+	case SrvLoginRequest::JOIN:
+		joinGameStep(request, query, result);
+		break;
 	}
 }
 
 void SrvLoginMgr::login(LoginData* loginData, string username, string pwd)
+{
+	SrvLoginRequest* request = new SrvLoginRequest(SrvLoginRequest::LOGIN, loginData);
+	request->username = username;
+	request->password = pwd;
+	startRequest(request);
+}
+
+void SrvLoginMgr::loginStep(SrvLoginRequest* request, SrvDBQuery* query, int result)
 {
 	// STEPS
 	// 1- get data from the client form, check if the usr exists in db
@@ -280,87 +457,112 @@ void SrvLoginMgr::login(LoginData* loginData, string username, string pwd)
 	// 3- update user data (last_login, etc)
 	// 4- send back data to user (chars available)
 
+	LoginData* loginData = request->loginData;
+	const string& username = request->username;
 	MsgLoginReply repmsg;
 
 	try {
-		// 1- get username data
-		username = mDBMgr->escape(username);
-		string uid, passworddb;
+		switch (request->stage) {
+		case 0:
 		{
-			SrvDBQuery query;
-			query.addColumnWithoutValue("uid");
-			query.addColumnWithoutValue("password");
-			query.setTables("usr_accts");
-			query.setCondition("username='" + username + "'");
-			int numresults = mDBMgr->querySelect(&query);
-			if (numresults != 1) {
+			// 1- get username data
+			SrvDBQuery* newQuery = new SrvDBQuery();
+			newQuery->addColumnWithoutValue("uid");
+			newQuery->addColumnWithoutValue("password");
+			newQuery->setTables("usr_accts");
+			newQuery->setCondition("username=?");
+			newQuery->addConditionValue(username);
+			mDBMgr->querySelectAsync(newQuery, request);
+			request->stage = 1;
+			return;
+		}
+		case 1:
+		{
+			if (result != 1) {
 				string logMsg = StrFmt("No such user '%s', numresults %d",
-						       username.c_str(), numresults);
+						       username.c_str(), result);
 				throw SrvLoginError(MsgUtils::Errors::EBADLOGIN, logMsg);
 			}
-			query.getResult()->getValue(0, "uid", uid);
-			query.getResult()->getValue(0, "password", passworddb);
-		}
+			string uid, passworddb;
+			query->getResult()->getValue(0, "uid", uid);
+			query->getResult()->getValue(0, "password", passworddb);
 
-		// 2- password cheching
-		if (passworddb != pwd) {
-			string logMsg = StrFmt("Wrong password for '%s'", username.c_str());
-			throw SrvLoginError(MsgUtils::Errors::EBADLOGIN, logMsg);
+			// 2- password cheching
+			if (passworddb != request->password) {
+				string logMsg = StrFmt("Wrong password for '%s'", username.c_str());
+				throw SrvLoginError(MsgUtils::Errors::EBADLOGIN, logMsg);
+			}
+			loginData->username = username;
+			loginData->uid = uid;
+
+			// 3- updating last login
+			SrvDBQuery* newQuery = new SrvDBQuery();
+			newQuery->setTables("usr_accts");
+			newQuery->setCondition("uid=?");
+			newQuery->addConditionValue(uid);
+			newQuery->addColumnWithValue("last_login", "CURRENT_TIMESTAMP", false);
+			newQuery->addColumnWithValue("number_logins", "number_logins+1", false);
+			newQuery->addColumnWithValue("last_login_ip", loginData->getIP());
+			mDBMgr->queryUpdateAsync(newQuery, request);
+			request->stage = 2;
+			return;
 		}
-		loginData->username = username;
-		loginData->uid = uid;
-
-		// 3- updating last login
+		case 2:
 		{
-			SrvDBQuery query;
-			query.setTables("usr_accts");
-			query.setCondition("uid='" + uid + "'");
-			query.addColumnWithValue("last_login", "CURRENT_TIMESTAMP", false);
-			query.addColumnWithValue("number_logins", "number_logins+1", false);
-			query.addColumnWithValue("last_login_ip", loginData->getIP());
-			bool success = mDBMgr->queryUpdate(&query);
-			if (!success) {
+			if (result <= 0) {
 				string logMsg = StrFmt("Couldn't update last_login for '%s'",
 						       username.c_str());
 				throw SrvLoginError(MsgUtils::Errors::EDATABASE, logMsg);
 			}
-		}
 
-		// 4. sending back data to user (chars available)
+			// 4. sending back data to user (chars available)
+			SrvDBQuery* newQuery = new SrvDBQuery();
+			newQuery->setTables("usr_chars");
+			newQuery->setCondition("uid=? AND status='0'");
+			newQuery->addConditionValue(loginData->uid);
+			newQuery->addColumnWithoutValue("charname");
+			newQuery->addColumnWithoutValue("race");
+			newQuery->addColumnWithoutValue("gender");
+			newQuery->addColumnWithoutValue("class");
+			newQuery->addColumnWithoutValue("area");
+			mDBMgr->querySelectAsync(newQuery, request);
+			request->stage = 3;
+			return;
+		}
+		case 3:
 		{
-			SrvDBQuery query;
-			query.setTables("usr_chars");
-			query.setCondition("uid='" + uid + "' AND status='0'");
-			query.addColumnWithoutValue("charname");
-			query.addColumnWithoutValue("race");
-			query.addColumnWithoutValue("gender");
-			query.addColumnWithoutValue("class");
-			query.addColumnWithoutValue("area");
-			int numresults = mDBMgr->querySelect(&query);
-			if (numresults > mMaxCharsPerAccount) {
+			if (result < 0) {
+				string logMsg = StrFmt("Couldn't get the characters of '%s'",
+						       username.c_str());
+				throw SrvLoginError(MsgUtils::Errors::EDATABASE, logMsg);
+			} else if (result > mMaxCharsPerAccount) {
 				string logMsg = StrFmt("This user has more than %d characters ('%s', num. chars %d)",
-							    mMaxCharsPerAccount, username.c_str(), numresults);
+						       mMaxCharsPerAccount, username.c_str(), result);
 				throw SrvLoginError(MsgUtils::Errors::ECHARCORRUPT, logMsg);
 			}
 
 			repmsg.resultCode = MsgUtils::Errors::SUCCESS;
-			repmsg.charNumber = numresults;
-			for (int row = 0; row < numresults; ++row) {
+			repmsg.charNumber = result;
+			for (int row = 0; row < result; ++row) {
 				string name, race, gender, playerClass, area;
-				query.getResult()->getValue(row, "charname", name);
-				query.getResult()->getValue(row, "race", race);
-				query.getResult()->getValue(row, "gender", gender);
-				query.getResult()->getValue(row, "class", playerClass);
-				query.getResult()->getValue(row, "area", area);
+				query->getResult()->getValue(row, "charname", name);
+				query->getResult()->getValue(row, "race", race);
+				query->getResult()->getValue(row, "gender", gender);
+				query->getResult()->getValue(row, "class", playerClass);
+				query->getResult()->getValue(row, "area", area);
 				repmsg.addCharacter(name, race, gender, playerClass, area);
 			}
 			mNetMgr->sendToPlayer(repmsg, loginData);
 			LogNTC("User login successful: '%s'", username.c_str());
+			finishRequest(request);
+			return;
+		}
 		}
 	} catch (SrvLoginError& e) {
 		repmsg.resultCode = e.errorCode;
 		mNetMgr->sendToPlayer(repmsg, loginData);
 		LogWRN("%s", e.logMsg.c_str());
+		finishRequest(request);
 		return;
 	}
 }
@@ -370,47 +572,66 @@ void SrvLoginMgr::createUser(LoginData* loginData,
 			     string pwd,
 			     string email,
 			     string realname)
+{
+	SrvLoginRequest* request = new SrvLoginRequest(SrvLoginRequest::CREATE_USER, loginData);
+	request->username = username;
+	request->password = pwd;
+	request->email = email;
+	request->realname = realname;
+	startRequest(request);
+}
+
+void SrvLoginMgr::createUserStep(SrvLoginRequest* request, SrvDBQuery* /* query */, int result)
 {
 	// STEPS
 	// 1- get data from the client form
 	// 2- check if username already exists
 	// 3- create the user account
 
+	LoginData* loginData = request->loginData;
+	const string& username = request->username;
 	MsgNewUserReply repmsg;
 
 	try {
-		// 1- get and prepare the data from the client
-		username = mDBMgr->escape(username);
-		pwd = mDBMgr->escape(pwd);
-		email = mDBMgr->escape(email);
-		realname = mDBMgr->escape(realname);
-
-		// 2- check if username already exists
+		switch (request->stage) {
+		case 0:
+		{
+			// 1- get and prepare the data from the client
+
+			// 2- check if username already exists
+			SrvDBQuery* newQuery = new SrvDBQuery();
+			newQuery->setTables("usr_accts");
+			newQuery->setCondition("username=?");
+			newQuery->addConditionValue(username);
+			mDBMgr->queryMatchNumberAsync(newQuery, request);
+			request->stage = 1;
+			return;
+		}
+		case 1:
 		{
-			SrvDBQuery query;
-			query.setTables("usr_accts");
-			query.setCondition("username='" + username + "'");
-			bool matches = mDBMgr->queryMatch(&query);
-			if (matches) {
+			if (result != 0) {
 				string logMsg = StrFmt("Create new user: already exists ('%s')",
 						       username.c_str());
 				throw SrvLoginError(MsgUtils::Errors::EUSERALREADYEXIST, logMsg);
 			}
-		}
 
-		// 3- insert new data into the usr_accts
+			// 3- insert new data into the usr_accts
+			SrvDBQuery* newQuery = new SrvDBQuery();
+			newQuery->setTables("usr_accts");
+			newQuery->addColumnWithValue("username", username);
+			newQuery->addColumnWithValue("password", request->password);
+			newQuery->addColumnWithValue("email", request->email);
+			newQuery->addColumnWithValue("realname", request->realname);
+			newQuery->addColumnWithValue("roles",
+						     StrFmt("%d", static_cast<int>(PermLevel::PLAYER)));
+			//newQuery->addColumnWithValue("creation_date", "CURRENT_TIMESTAMP", false);
+			mDBMgr->queryInsertAsync(newQuery, request);
+			request->stage = 2;
+			return;
+		}
+		case 2:
 		{
-			SrvDBQuery query;
-			query.setTables("usr_accts");
-			query.addColumnWithValue("username", username);
-			query.addColumnWithValue("password", pwd);
-			query.addColumnWithValue("email", email);
-			query.addColumnWithValue("realname", realname);
-			query.addColumnWithValue("roles",
-						 StrFmt("%d", static_cast<int>(PermLevel::PLAYER)));
-			//query.addColumnWithValue("creation_date", "CURRENT_TIMESTAMP", false);
-			bool success = mDBMgr->queryInsert(&query);
-			if (!success) {
+			if (result <= 0) {
 				string logMsg = StrFmt("Create new user: failed because of DB problems ('%s')",
 						       username.c_str());
 				throw SrvLoginError(MsgUtils::Errors::EDATABASE, logMsg);
@@ -419,11 +640,15 @@ void SrvLoginMgr::createUser(LoginData* loginData,
 			repmsg.resultCode = MsgUtils::Errors::SUCCESS;
 			mNetMgr->sendToPlayer(repmsg, loginData);
 			LogNTC("New user created successfully: '%s'", username.c_str());
+			finishRequest(request);
+			return;
+		}
 		}
 	} catch (SrvLoginError& e) {
 		repmsg.resultCode = e.errorCode;
 		mNetMgr->sendToPlayer(repmsg, loginData);
 		LogWRN("%s", e.logMsg.c_str());
+		finishRequest(request);
 		return;
 	}
 }
@@ -439,106 +664,150 @@ void SrvLoginMgr::createCharacter(LoginData* loginData,
 				  uint8_t points_int,
 				  uint8_t points_wis,
 				  uint8_t points_cha)
+{
+	SrvLoginRequest* request = new SrvLoginRequest(SrvLoginRequest::CREATE_CHAR, loginData);
+	request->charname = charname;
+	request->race = race;
+	request->gender = gender;
+	request->playerClass = playerClass;
+	request->points_con = points_con;
+	request->points_str = points_str;
+	request->points_dex = points_dex;
+	request->points_int = points_int;
+	request->points_wis = points_wis;
+	request->points_cha = points_cha;
+	startRequest(request);
+}
+
+void SrvLoginMgr::createCharacterStep(SrvLoginRequest* request, SrvDBQuery* /* query */, int result)
 {
 	// STEPS
 	// 1- get data from the client form
-	// 2- check if the character already exists
-	// 3- check if the user has <= 8 active chars
-	// 4- check if race, name and gender (and other data?) is appropriate
+	// 2- check if race, name and gender (and other data?) is appropriate
+	// 3- check if the character already exists
+	// 4- check if the user has <= 8 active chars
 	// 5- create the new character
+	//
+	// mafm: the data is checked first, so we don't bother the DB when it's
+	// wrong
 
+	LoginData* loginData = request->loginData;
+	const string& charname = request->charname;
+	const string& race = request->race;
 	MsgNewCharReply repmsg;
 
 	try {
-		// 1- get data from the client form
-		charname = mDBMgr->escape(charname);
-		race = mDBMgr->escape(race);
-		gender = mDBMgr->escape(gender);
-		playerClass = mDBMgr->escape(playerClass);
+		switch (request->stage) {
+		case 0:
+		{
+			// 1- get data from the client form
+			const string& gender = request->gender;
+			const string& playerClass = request->playerClass;
+
+			// 2- check if race, name and gender (and other data?) is appropriate
+			if (!(race == "dwarf" || race == "elf" || race == "human")
+			    || !(gender == "f" || gender == "m")
+			    || !(playerClass == "fighter" || playerClass == "sorcerer") ) {
+				string logMsg = StrFmt("Create new character: bad data "
+						       "(user %s, race '%s', gender '%s', class '%s')",
+						       loginData->username.c_str(), race.c_str(), 
+						       gender.c_str(), playerClass.c_str());
+				throw SrvLoginError(MsgUtils::Errors::ENEWCHARBADDATA, logMsg);
+			}
 
-		// 2- check if the character already exists
+			// abilities must be greater than 3 and less than 18, and if
+			// all points are used, the total should equal 78 (avg 13 per
+			// ability)
+			int points_con = request->points_con;
+			int points_str = request->points_str;
+			int points_dex = request->points_dex;
+			int points_int = request->points_int;
+			int points_wis = request->points_wis;
+			int points_cha = request->points_cha;
+			int abilities_sum = points_con + points_str + points_dex +
+				points_int + points_wis + points_cha;
+			if (78 != abilities_sum
+			    || points_str < 3 || points_str > 18
+			    || points_dex < 3 || points_dex > 18
+			    || points_con < 3 || points_con > 18
+			    || points_int < 3 || points_int > 18
+			    || points_wis < 3 || points_wis > 18
+			    || points_cha < 3 || points_cha > 18) {
+				string logMsg = StrFmt("Create new character: bad data (user '%s', points %d,"
+						       " con=%u str=%u agi=%u int=%u wis=%u cha=%u)",
+						       loginData->username.c_str(), abilities_sum,
+						       points_con, points_str, points_dex,
+						       points_int, points_wis, points_cha);
+				throw SrvLoginError(MsgUtils::Errors::ENEWCHARBADDATA, logMsg);
+			}
+
+			// 3- check if the character already exists
+			SrvDBQuery* newQuery = new SrvDBQuery();
+			newQuery->setTables("usr_chars");
+			newQuery->setCondition("charname=?");
+			newQuery->addConditionValue(charname);
+			mDBMgr->queryMatchNumberAsync(newQuery, request);
+			request->stage = 1;
+			return;
+		}
+		case 1:
 		{
-			SrvDBQuery query;
-			query.setTables("usr_chars");
-			query.setCondition("charname='" + charname + "'");
-			bool matches = mDBMgr->queryMatch(&query);
-			if (matches) {
+			if (result != 0) {
 				string logMsg = StrFmt("Create new character: already exists ('%s')",
 						       charname.c_str());
 				throw SrvLoginError(MsgUtils::Errors::ECHARALREADYEXIST, logMsg);
 			}
-		}
-	
 
-		// 3- check if the user has <ALLOWED active chars
+			// 4- check if the user has <ALLOWED active chars
+			SrvDBQuery* newQuery = new SrvDBQuery();
+			newQuery->setTables("usr_chars");
+			newQuery->setCondition("uid=? AND status='0'");
+			newQuery->addConditionValue(loginData->uid);
+			mDBMgr->queryMatchNumberAsync(newQuery, request);
+			request->stage = 2;
+			return;
+		}
+		case 2:
 		{
-			SrvDBQuery query;
-			query.setTables("usr_chars");
-			query.setCondition("uid='" + loginData->uid + "' AND status='0'");
-			int numresults = mDBMgr->queryMatchNumber(&query);
-			if (numresults >= mMaxCharsPerAccount) {
+			if (result >= mMaxCharsPerAccount) {
 				string logMsg = StrFmt("Create new character: too many chars (user '%s', %d)",
-						       loginData->username.c_str(), numresults);
+						       loginData->username.c_str(), result);
 				throw SrvLoginError(MsgUtils::Errors::EMAXCHARS, logMsg);
 			}
-		}
 
-		// 4- check if race, name and gender (and other data?) is appropriate
-		if (!(race == "dwarf" || race == "elf" || race == "human")
-		    || !(gender == "f" || gender == "m")
-		    || !(playerClass == "fighter" || playerClass == "sorcerer") ) {
-			string logMsg = StrFmt("Create new character: bad data "
-					       "(user %s, race '%s', gender '%s', class '%s')",
-					       loginData->username.c_str(), race.c_str(), 
-					       gender.c_str(), playerClass.c_str());
-			throw SrvLoginError(MsgUtils::Errors::ENEWCHARBADDATA, logMsg);
-		}
-
-		// abilities must be greater than 3 and less than 18, and if all
-		// points are used, the total should equal 78 (avg 13 per
-		// ability)
-
-		int abilities_sum = points_con + points_str + points_dex +
-			points_int + points_wis + points_cha;
-		if (78 != abilities_sum
-		    || points_str < 3 || points_str > 18
-		    || points_dex < 3 || points_dex > 18
-		    || points_con < 3 || points_con > 18
-		    || points_int < 3 || points_int > 18
-		    || points_wis < 3 || points_wis > 18
-		    || points_cha < 3 || points_cha > 18) {
-			string logMsg = StrFmt("Create new character: bad data (user '%s', points %d,"
-					       " con=%u str=%u agi=%u int=%u wis=%u cha=%u)",
-					       loginData->username.c_str(), abilities_sum,
-					       points_con, points_str, points_dex,
-					       points_int, points_wis, points_cha);
-			throw SrvLoginError(MsgUtils::Errors::ENEWCHARBADDATA, logMsg);
+			// 5- create the new character
+			SrvDBQuery* newQuery = new SrvDBQuery();
+			newQuery->setTables("usr_chars");
+			newQuery->addColumnWithValue("uid", loginData->uid);
+			//newQuery->addColumnWithValue("cid", "DEFAULT", false);
+			newQuery->addColumnWithValue("charname", charname);
+			newQuery->addColumnWithValue("area", mNewCharArea);
+			newQuery->addColumnWithValue("pos1", mNewCharPosX, false);
+			newQuery->addColumnWithValue("pos2", mNewCharPosY, false);
+			newQuery->addColumnWithValue("pos3", mNewCharPosZ, false);
+			newQuery->addColumnWithValue("rot", "0.0", false);
+			newQuery->addColumnWithValue("race", race);
+			newQuery->addColumnWithValue("gender", request->gender);
+			newQuery->addColumnWithValue("class", request->playerClass);
+			mDBMgr->queryInsertAsync(newQuery, request);
+			request->stage = 3;
+			return;
 		}
-
-		// 5- create the new character
+		case 3:
 		{
-			SrvDBQuery query;
-			query.setTables("usr_chars");
-			query.addColumnWithValue("uid", loginData->uid);
-			//query.addColumnWithValue("cid", "DEFAULT", false);
-			query.addColumnWithValue("charname", charname);
-			query.addColumnWithValue("area", mNewCharArea);
-			query.addColumnWithValue("pos1", mNewCharPosX, false);
-			query.addColumnWithValue("pos2", mNewCharPosY, false);
-			query.addColumnWithValue("pos3", mNewCharPosZ, false);
-			query.addColumnWithValue("rot", "0.0", false);
-			query.addColumnWithValue("race", race);
-			query.addColumnWithValue("gender", gender);
-			query.addColumnWithValue("class", playerClass);
-			bool success = mDBMgr->queryInsert(&query);
+			if (result <= 0) {
+				string logMsg = StrFmt("Create new character: DB failure (user '%s', char '%s')",
+						       loginData->username.c_str(), charname.c_str());
+				throw SrvLoginError(MsgUtils::Errors::EDATABASE, logMsg);
+			}
 
 			// sum base points plus player selected
-			int tot_con = points_con;
-			int tot_str = points_str;
-			int tot_dex = points_dex;
-			int tot_int = points_int;
-			int tot_wis = points_wis;
-			int tot_cha = points_cha;
+			int tot_con = request->points_con;
+			int tot_str = request->points_str;
+			int tot_dex = request->points_dex;
+			int tot_int = request->points_int;
+			int tot_wis = request->points_wis;
+			int tot_cha = request->points_cha;
 
 			// add race bonus - using d20 race modifiers
 			if (race == "elf") {
@@ -574,79 +843,108 @@ void SrvLoginMgr::createCharacter(LoginData* loginData,
 			 */
 			string magic = "0";
 
-			SrvDBQuery query2;
-			query2.setTables("player_stats");
-			query2.addColumnWithValue("charname", charname);
-			query2.addColumnWithValue("health", StrFmt("%i", health));
-			query2.addColumnWithValue("magic", magic);
-			query2.addColumnWithValue("stamina", "'100'", false);
-			query2.addColumnWithValue("ab_con", ab_con);
-			query2.addColumnWithValue("ab_str", ab_str);
-			query2.addColumnWithValue("ab_dex", ab_dex);
-			query2.addColumnWithValue("ab_int", ab_int);
-			query2.addColumnWithValue("ab_wis", ab_wis);
-			query2.addColumnWithValue("ab_cha", ab_cha);
-			query2.addColumnWithValue("level", "1");
-			success = mDBMgr->queryInsert(&query2);
-			if (!success) {
+			SrvDBQuery* newQuery = new SrvDBQuery();
+			newQuery->setTables("player_stats");
+			newQuery->addColumnWithValue("charname", charname);
+			newQuery->addColumnWithValue("health", StrFmt("%i", health));
+			newQuery->addColumnWithValue("magic", magic);
+			newQuery->addColumnWithValue("stamina", "'100'", false);
+			newQuery->addColumnWithValue("ab_con", ab_con);
+			newQuery->addColumnWithValue("ab_str", ab_str);
+			newQuery->addColumnWithValue("ab_dex", ab_dex);
+			newQuery->addColumnWithValue("ab_int", ab_int);
+			newQuery->addColumnWithValue("ab_wis", ab_wis);
+			newQuery->addColumnWithValue("ab_cha", ab_cha);
+			newQuery->addColumnWithValue("level", "1");
+			mDBMgr->queryInsertAsync(newQuery, request);
+			request->stage = 4;
+			return;
+		}
+		case 4:
+		{
+			if (result <= 0) {
 				string logMsg = StrFmt("Create new character: DB failure (user '%s', char '%s')",
-							    loginData->username.c_str(), charname.c_str());
+						       loginData->username.c_str(), charname.c_str());
 				throw SrvLoginError(MsgUtils::Errors::EDATABASE, logMsg);
 			}
 
 			repmsg.resultCode = MsgUtils::Errors::SUCCESS; // success
 			repmsg.charname = charname;
 			repmsg.race = race;
-			repmsg.gender = gender;
+			repmsg.gender = request->gender;
 			repmsg.area = mNewCharArea;
 			mNetMgr->sendToPlayer(repmsg, loginData);
 			LogNTC("New character created successfully (user '%s', char '%s')",
 			       loginData->username.c_str(), charname.c_str());
+			finishRequest(request);
+			return;
+		}
 		}
 	} catch (SrvLoginError& e) {
 		repmsg.resultCode = e.errorCode;
 		mNetMgr->sendToPlayer(repmsg, loginData);
 		LogWRN("%s", e.logMsg.c_str());
+		finishRequest(request);
 		return;
 	}
 }
 
 void SrvLoginMgr::deleteCharacter(LoginData* loginData, string charname)
+{
+	SrvLoginRequest* request = new SrvLoginRequest(SrvLoginRequest::DELETE_CHAR, loginData);
+	request->charname = charname;
+	startRequest(request);
+}
+
+void SrvLoginMgr::deleteCharacterStep(SrvLoginRequest* request, SrvDBQuery* /* query */, int result)
 {
 	// STEPS
 	// 1- get data from the client form
 	// 2- check if the character already exists and belongs to the user
 	// 3- delete the new character
 
+	LoginData* loginData = request->loginData;
+	const string& charname = request->charname;
 	MsgDelCharReply repmsg;
 
 	try {
-		// 1- get data from the client form
-		charname = mDBMgr->escape(charname);
-
-		// 2- check if already exists and belongs to the user
+		switch (request->stage) {
+		case 0:
 		{
-			SrvDBQuery query;
-			query.setTables("usr_chars");
-			query.setCondition("uid='" + loginData->uid
-					   + "' AND charname='" + charname + "'");
-			bool matches = mDBMgr->queryMatch(&query);
-			if (!matches) {
+			// 1- get data from the client form
+
+			// 2- check if already exists and belongs to the user
+			SrvDBQuery* newQuery = new SrvDBQuery();
+			newQuery->setTables("usr_chars");
+			newQuery->setCondition("uid=? AND charname=?");
+			newQuery->addConditionValue(loginData->uid);
+			newQuery->addConditionValue(charname);
+			mDBMgr->queryMatchNumberAsync(newQuery, request);
+			request->stage = 1;
+			return;
+		}
+		case 1:
+		{
+			if (result <= 0) {
 				string logMsg = StrFmt("Delete new character: doesn't exist or doesn't belong to"
 						       " (user '%s', char '%s')",
 						       loginData->username.c_str(), charname.c_str());
 				throw SrvLoginError(MsgUtils::Errors::ENOSUCHCHAR, logMsg);
 			}
-		}
 
-		// 3- delete the character
+			// 3- delete the character
+			SrvDBQuery* newQuery = new SrvDBQuery();
+			newQuery->setTables("usr_chars");
+			newQuery->setCondition("charname=?");
+			newQuery->addConditionValue(charname);
+			newQuery->addColumnWithValue("status", "1", false);
+			mDBMgr->queryUpdateAsync(newQuery, request);
+			request->stage = 2;
+			return;
+		}
+		case 2:
 		{
-			SrvDBQuery query;
-			query.setTables("usr_chars");
-			query.setCondition("charname='" + charname + "'");
-			query.addColumnWithValue("status", "1", false);
-			int numresults = mDBMgr->queryUpdate(&query);
-			if (numresults != 1) {
+			if (result != 1) {
 				string logMsg = StrFmt("Delete new character: DB failure (user '%s', char '%s')",
 						       loginData->username.c_str(), charname.c_str());
 				throw SrvLoginError(MsgUtils::Errors::ENOSUCHCHAR, logMsg);
@@ -657,16 +955,27 @@ void SrvLoginMgr::deleteCharacter(LoginData* loginData, string charname)
 			mNetMgr->sendToPlayer(repmsg, loginData);
 			LogNTC("Character deleted successfully (user '%s', char '%s')",
 			       loginData->username.c_str(), charname.c_str());
+			finishRequest(request);
+			return;
+		}
 		}
 	} catch (SrvLoginError& e) {
-                repmsg.resultCode = e.errorCode;
-                mNetMgr->sendToPlayer(repmsg, loginData);
-                LogWRN("%s", e.logMsg.c_str());
-                return;
-        }
+		repmsg.resultCode = e.errorCode;
+		mNetMgr->sendToPlayer(repmsg, loginData);
+		LogWRN("%s", e.logMsg.c_str());
+		finishRequest(request);
+		return;
+	}
 }
 
 void SrvLoginMgr::joinGame(LoginData* loginData, string charname)
+{
+	SrvLoginRequest* request = new SrvLoginRequest(SrvLoginRequest::JOIN, loginData);
+	request->charname = charname;
+	startRequest(request);
+}
+
+void SrvLoginMgr::joinGameStep(SrvLoginRequest* request, SrvDBQuery* query, int result)
 {
 	// STEPS
 	// 1- get data from the client form
@@ -674,65 +983,71 @@ void SrvLoginMgr::joinGame(LoginData* loginData, string charname)
 	// 3- check if the character belongs to the user, and get the data
 	// 4- join game
 
+	LoginData* loginData = request->loginData;
+	const string& charname = request->charname;
 	MsgJoinReply repmsg;
 
 	try {
-		// 1- get data from the client form
-		charname = mDBMgr->escape(charname);
-		string playerClass, cid;
-
-		// 2- check if the usr/char already joined the game with any character
-		if (loginData->charname != "<none>") {
-			string logMsg = StrFmt("Joining game: already playing (char '%s')",
-					       loginData->charname.c_str());
-			throw SrvLoginError(MsgUtils::Errors::EALREADYPLAYING, logMsg);
-		}
-
-		// 3- check if the character belongs to the user, and get the data
-		MsgEntityCreate msgBasic;
-		MsgEntityMove msgMove;
-		MsgPlayerData msgPlayer;
+		switch (request->stage) {
+		case 0:
 		{
+			// 1- get data from the client form
+
+			// 2- check if the usr/char already joined the game with any character
+			if (loginData->charname != "<none>") {
+				string logMsg = StrFmt("Joining game: already playing (char '%s')",
+						       loginData->charname.c_str());
+				throw SrvLoginError(MsgUtils::Errors::EALREADYPLAYING, logMsg);
+			}
+
+			// 3- check if the character belongs to the user, and get the data
 			LogNTC("uid: %s; charname '%s'", loginData->uid.c_str(), charname.c_str());
-			SrvDBQuery query;
-			query.setTables("usr_chars,usr_accts");
-			string condition = "charname='" + charname
-				+ "' AND usr_accts.uid='" + loginData->uid
-				+ "' AND usr_accts.uid=usr_chars.uid";
-			query.setCondition(condition);
-			query.addColumnWithoutValue("cid");
-			query.addColumnWithoutValue("area");
-			query.addColumnWithoutValue("pos1");
-			query.addColumnWithoutValue("pos2");
-			query.addColumnWithoutValue("pos3");
-			query.addColumnWithoutValue("rot");
-			query.addColumnWithoutValue("race");
-			query.addColumnWithoutValue("gender");
-			query.addColumnWithoutValue("class");
-			query.addColumnWithoutValue("roles");
-			int numresults = mDBMgr->querySelect(&query);
-			if (numresults != 1) {
+			SrvDBQuery* newQuery = new SrvDBQuery();
+			newQuery->setTables("usr_chars,usr_accts");
+			newQuery->setCondition("charname=? AND usr_accts.uid=?"
+					       " AND usr_accts.uid=usr_chars.uid");
+			newQuery->addConditionValue(charname);
+			newQuery->addConditionValue(loginData->uid);
+			newQuery->addColumnWithoutValue("cid");
+			newQuery->addColumnWithoutValue("area");
+			newQuery->addColumnWithoutValue("pos1");
+			newQuery->addColumnWithoutValue("pos2");
+			newQuery->addColumnWithoutValue("pos3");
+			newQuery->addColumnWithoutValue("rot");
+			newQuery->addColumnWithoutValue("race");
+			newQuery->addColumnWithoutValue("gender");
+			newQuery->addColumnWithoutValue("class");
+			newQuery->addColumnWithoutValue("roles");
+			mDBMgr->querySelectAsync(newQuery, request);
+			request->stage = 1;
+			return;
+		}
+		case 1:
+		{
+			if (result != 1) {
 				string logMsg = StrFmt("Joining game: no such char (char '%s', numresults %d)",
-						       loginData->charname.c_str(), numresults);
+						       charname.c_str(), result);
 				throw SrvLoginError(MsgUtils::Errors::ENOSUCHCHAR, logMsg);
 			}
 
+			MsgEntityCreate& msgBasic = request->msgBasic;
+			MsgEntityMove& msgMove = request->msgMove;
 			float pos1 = 0.0f, pos2 = 0.0f, pos3 = 0.0f, rot = 0.0f;
 			int roles = 0;
-			query.getResult()->getValue(0, "cid", cid);
-			query.getResult()->getValue(0, "area", msgMove.area);
-			query.getResult()->getValue(0, "pos1", pos1);
-			query.getResult()->getValue(0, "pos2", pos2);
-			query.getResult()->getValue(0, "pos3", pos3);
-			query.getResult()->getValue(0, "rot", rot);
-			query.getResult()->getValue(0, "race", msgBasic.meshType);
-			query.getResult()->getValue(0, "gender", msgBasic.meshSubtype);
-			query.getResult()->getValue(0, "class", playerClass);
-			query.getResult()->getValue(0, "roles", roles);
+			query->getResult()->getValue(0, "cid", request->cid);
+			query->getResult()->getValue(0, "area", msgMove.area);
+			query->getResult()->getValue(0, "pos1", pos1);
+			query->getResult()->getValue(0, "pos2", pos2);
+			query->getResult()->getValue(0, "pos3", pos3);
+			query->getResult()->getValue(0, "rot", rot);
+			query->getResult()->getValue(0, "race", msgBasic.meshType);
+			query->getResult()->getValue(0, "gender", msgBasic.meshSubtype);
+			query->getResult()->getValue(0, "class", request->playerClass);
+			query->getResult()->getValue(0, "roles", roles);
 
 			msgMove.position = Vector3(pos1, pos2, pos3);
 			msgMove.rot = rot;
-			msgMove.entityID = StrToUInt64(cid.c_str());
+			msgMove.entityID = StrToUInt64(request->cid.c_str());
 			msgBasic.entityID = msgMove.entityID;
 			msgBasic.area = msgMove.area;
 			msgBasic.entityName = charname;
@@ -750,41 +1065,48 @@ void SrvLoginMgr::joinGame(LoginData* loginData, string charname)
 			}
 
 			// get player statistics
-			SrvDBQuery query2;
-			query2.setTables("player_stats");
-			query2.setCondition("charname='" + charname + "'");
-			query2.addColumnWithoutValue("health");
-			query2.addColumnWithoutValue("magic");
-			query2.addColumnWithoutValue("stamina");
-			query2.addColumnWithoutValue("gold");
-			query2.addColumnWithoutValue("level");
-			query2.addColumnWithoutValue("ab_con");
-			query2.addColumnWithoutValue("ab_str");
-			query2.addColumnWithoutValue("ab_dex");
-			query2.addColumnWithoutValue("ab_int");
-			query2.addColumnWithoutValue("ab_wis");
-			query2.addColumnWithoutValue("ab_cha");
-			numresults = mDBMgr->querySelect(&query2);
-			if (numresults != 1) {
+			SrvDBQuery* newQuery = new SrvDBQuery();
+			newQuery->setTables("player_stats");
+			newQuery->setCondition("charname=?");
+			newQuery->addConditionValue(charname);
+			newQuery->addColumnWithoutValue("health");
+			newQuery->addColumnWithoutValue("magic");
+			newQuery->addColumnWithoutValue("stamina");
+			newQuery->addColumnWithoutValue("gold");
+			newQuery->addColumnWithoutValue("level");
+			newQuery->addColumnWithoutValue("ab_con");
+			newQuery->addColumnWithoutValue("ab_str");
+			newQuery->addColumnWithoutValue("ab_dex");
+			newQuery->addColumnWithoutValue("ab_int");
+			newQuery->addColumnWithoutValue("ab_wis");
+			newQuery->addColumnWithoutValue("ab_cha");
+			mDBMgr->querySelectAsync(newQuery, request);
+			request->stage = 2;
+			return;
+		}
+		case 2:
+		{
+			if (result != 1) {
 				string logMsg = StrFmt("Joining game: no such char stats (char '%s', numresults %d)",
-						       loginData->charname.c_str(), numresults);
+						       charname.c_str(), result);
 				throw SrvLoginError(MsgUtils::Errors::ENOSUCHCHAR, logMsg);
 			}
 
 			int health_cur = 0, magic_cur = 0, stamina = 0, gold = 0, level = 0;
 			int ab_con = 0, ab_str = 0, ab_dex = 0, ab_int = 0, ab_wis = 0, ab_cha = 0;
-			query2.getResult()->getValue(0, "health", health_cur);
-			query2.getResult()->getValue(0, "magic", magic_cur);
-			query2.getResult()->getValue(0, "stamina", stamina);
-			query2.getResult()->getValue(0, "gold", gold);
-			query2.getResult()->getValue(0, "level", level);
-			query2.getResult()->getValue(0, "ab_con", ab_con);
-			query2.getResult()->getValue(0, "ab_str", ab_str);
-			query2.getResult()->getValue(0, "ab_dex", ab_dex);
-			query2.getResult()->getValue(0, "ab_int", ab_int);
-			query2.getResult()->getValue(0, "ab_wis", ab_wis);
-			query2.getResult()->getValue(0, "ab_cha", ab_cha);
-
+			query->getResult()->getValue(0, "health", health_cur);
+			query->getResult()->getValue(0, "magic", magic_cur);
+			query->getResult()->getValue(0, "stamina", stamina);
+			query->getResult()->getValue(0, "gold", gold);
+			query->getResult()->getValue(0, "level", level);
+			query->getResult()->getValue(0, "ab_con", ab_con);
+			query->getResult()->getValue(0, "ab_str", ab_str);
+			query->getResult()->getValue(0, "ab_dex", ab_dex);
+			query->getResult()->getValue(0, "ab_int", ab_int);
+			query->getResult()->getValue(0, "ab_wis", ab_wis);
+			query->getResult()->getValue(0, "ab_cha", ab_cha);
+
+			MsgPlayerData& msgPlayer = request->msgPlayer;
 			msgPlayer.health_cur = health_cur;
 			msgPlayer.magic_cur = magic_cur;
 			msgPlayer.stamina = stamina;
@@ -807,46 +1129,66 @@ void SrvLoginMgr::joinGame(LoginData* loginData, string charname)
 			string strength = StrFmt("%d", ab_str);
 			msgPlayer.load_max = TableMgr::instance().getTable("load")->getValueAsInt(strength, "light");
 			msgPlayer.load_cur = 0;
-		}
 
-		// 4- join game
+			// 4- join game
+			SrvDBQuery* newQuery = new SrvDBQuery();
+			newQuery->setTables("usr_chars");
+			newQuery->setCondition("charname=?");
+			newQuery->addConditionValue(charname);
+			newQuery->addColumnWithValue("last_login", "CURRENT_TIMESTAMP", false);
+			newQuery->addColumnWithValue("number_logins", "number_logins+1", false);
+			mDBMgr->queryUpdateAsync(newQuery, request);
+			request->stage = 3;
+			return;
+		}
+		case 3:
 		{
-			SrvDBQuery query;
-			query.setTables("usr_chars");
-			query.setCondition("charname='" + charname + "'");
-			query.addColumnWithValue("last_login", "CURRENT_TIMESTAMP", false);
-			query.addColumnWithValue("number_logins", "number_logins+1", false);
-			bool success = mDBMgr->queryUpdate(&query);
-			if (!success) {
+			if (result <= 0) {
 				string logMsg = StrFmt("Joining game: DB failure (char '%s')",
-						       loginData->charname.c_str());
+						       charname.c_str());
 				throw SrvLoginError(MsgUtils::Errors::EDATABASE, logMsg);
 			}
-		}
 
-		LogDBG("charname '%s' joining ...", charname.c_str());
-		loginData->charname = charname;
-		loginData->cid = cid;
-		SrvEntityPlayer* player = new SrvEntityPlayer(msgBasic, msgMove, msgPlayer, loginData);
-		player->getPlayerInfo()->setClass(playerClass);
-		loginData->setPlayerEntity(player);
-		SrvWorldMgr::instance().addPlayer(loginData);
+			// mafm: other connection might have joined with the same
+			// character while we were waiting for the DB
+			if (mNameIndex.find(charname) != mNameIndex.end()) {
+				string logMsg = StrFmt("Joining game: already playing (char '%s')",
+						       charname.c_str());
+				throw SrvLoginError(MsgUtils::Errors::EALREADYPLAYING, logMsg);
+			}
 
+			LogDBG("charname '%s' joining ...", charname.c_str());
+			loginData->charname = charname;
+			loginData->cid = request->cid;
+			mNameIndex[charname] = loginData;
+			mIDIndex[StrToUInt64(request->cid.c_str())] = loginData;
+			SrvEntityPlayer* player = new SrvEntityPlayer(request->msgBasic,
+								      request->msgMove,
+								      request->msgPlayer,
+								      loginData);
+			player->getPlayerInfo()->setClass(request->playerClass);
+			loginData->setPlayerEntity(player);
+			SrvWorldMgr::instance().addPlayer(loginData);
+			finishRequest(request);
+			return;
+		}
+		}
 	} catch (SrvLoginError& e) {
-                repmsg.resultCode = e.errorCode;
-                mNetMgr->sendToPlayer(repmsg, loginData);
-                LogWRN("%s", e.logMsg.c_str());
-                return;
-       }
+		repmsg.resultCode = e.errorCode;
+		mNetMgr->sendToPlayer(repmsg, loginData);
+		LogWRN("%s", e.logMsg.c_str());
+		finishRequest(request);
+		return;
+	}
 }
 
 LoginData* SrvLoginMgr::findPlayer(const Netlink* netlink) const
 {
-	for (vector<LoginData*>::const_iterator it = mPlayerList.begin();
-	     it != mPlayerList.end(); ++it) {
-		if ((*it)->netlink == netlink) {
-			return *it;
-		}
+	// mafm: the login data is attached to the connection when created, so
+	// we don't need to search for it
+	LoginData* loginData = static_cast<LoginData*>(netlink->getSession());
+	if (loginData) {
+		return loginData;
 	}
 	LogWRN("Cannot find LoginData for netlink (socket %d, IP '%s')",
 	       netlink->getSocket(), netlink->getIP());
@@ -855,11 +1197,10 @@ LoginData* SrvLoginMgr::findPlayer(const Netlink* netlink) const
 
 LoginData* SrvLoginMgr::findPlayer(const std::string& playerName) const
 {
-	for (vector<LoginData*>::const_iterator it = mPlayerList.begin(); 
-	     it != mPlayerList.end(); ++it) {
-		if ((*it)->charname == playerName) {
-			return *it;
-		}
+	std::tr1::unordered_map<std::string, LoginData*>::const_iterator it =
+		mNameIndex.find(playerName);
+	if (it != mNameIndex.end()) {
+		return it->second;
 	}
 	LogWRN("Cannot find LoginData for player name '%s')",
 	       playerName.c_str());
@@ -868,11 +1209,10 @@ LoginData* SrvLoginMgr::findPlayer(const std::string& playerName) const
 
 LoginData* SrvLoginMgr::findPlayer(EntityID id) const
 {
-	for (vector<LoginData*>::const_iterator it = mPlayerList.begin(); 
-	     it != mPlayerList.end(); ++it) {
-		if (id == StrToUInt64((*it)->cid.c_str())) {
-			return *it;
-		}
+	std::tr1::unordered_map<EntityID, LoginData*>::const_iterator it =
+		mIDIndex.find(id);
+	if (it != mIDIndex.end()) {
+		return it->second;
 	}
 	LogWRN("Cannot find LoginData for player id '%lu')", id);
 	return 0;
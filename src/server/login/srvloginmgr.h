@@ -34,12 +34,15 @@
 
 #include <vector>
 #include <list>
+#include <tr1/unordered_map>
 
 
 class Netlink;
 class SrvNetworkMgr;
 class SrvDBMgr;
+class SrvDBQuery;
 class SrvEntityPlayer;
+class SrvLoginRequest;
 
 
 /** Structure for a player connected to the server, containing some accounting
@@ -107,6 +110,9 @@ private:
 	bool downloadingContent;
 	/// Flag to know if this connection is in the world manager
 	bool playingGame;
+	/// Requests being attended (waiting for the DB), the first one is the
+	/// one in progress and the rest wait for it, in order
+	std::list<SrvLoginRequest*> requests;
 
 
 	/** Constructor */
@@ -181,10 +187,16 @@ public:
 private:
 	/** Singleton friend access */
 	friend class Singleton<SrvLoginMgr>;
+	/** Friend access, to continue the requests */
+	friend class SrvLoginRequest;
 
 
 	/// Player (connection) list
 	std::vector<LoginData*> mPlayerList;
+	/// Index of the connections which joined the game, by character name
+	std::tr1::unordered_map<std::string, LoginData*> mNameIndex;
+	/// Index of the connections which joined the game, by character ID
+	std::tr1::unordered_map<EntityID, LoginData*> mIDIndex;
 	/// Pointer to the network manager
 	SrvNetworkMgr* mNetMgr;
 	/// Pointer to the database manager
@@ -206,6 +218,30 @@ private:
 
 	/** Default constructor */
 	SrvLoginMgr();
+
+	/** Queue a request of the connection, starting it if there are no
+	 * other requests in progress */
+	void startRequest(SrvLoginRequest* request);
+	/** Finish the request in progress (deleting it), and start the next
+	 * one of the connection, if any */
+	void finishRequest(SrvLoginRequest* request);
+	/** Cancel all the requests of the connection */
+	void cancelRequests(LoginData* loginData);
+	/** Continue the request with the result of the query, or start it if
+	 * the query is 0 */
+	void continueRequest(SrvLoginRequest* request, SrvDBQuery* query, int result);
+	/** Stages of the connect request, see addConnection */
+	void connectStep(SrvLoginRequest* request, SrvDBQuery* query, int result);
+	/** Stages of the login request, see login */
+	void loginStep(SrvLoginRequest* request, SrvDBQuery* query, int result);
+	/** Stages of the create user request, see createUser */
+	void createUserStep(SrvLoginRequest* request, SrvDBQuery* query, int result);
+	/** Stages of the create character request, see createCharacter */
+	void createCharacterStep(SrvLoginRequest* request, SrvDBQuery* query, int result);
+	/** Stages of the delete character request, see deleteCharacter */
+	void deleteCharacterStep(SrvLoginRequest* request, SrvDBQuery* query, int result);
+	/** Stages of the join request, see joinGame */
+	void joinGameStep(SrvLoginRequest* request, SrvDBQuery* query, int result);
 };
 
 
@@ -151,6 +151,19 @@ void MsgHdlContentQueryUpdate::handleMsg(MsgBase& baseMsg, Netlink* netlink)
 	SrvContentMgr::instance().handleQueryFiles(player, msg); 
 }
 
+//------------------ MsgHdlContentFileSums --------------------------
+MsgType MsgHdlContentFileSums::getMsgType() const
+{
+	return MsgContentFileSums::mType;
+}
+
+void MsgHdlContentFileSums::handleMsg(MsgBase& baseMsg, Netlink* netlink)
+{
+	MsgContentFileSums* msg = dynamic_cast<MsgContentFileSums*>(&baseMsg);
+	LoginData* player = SrvLoginMgr::instance().findPlayer(netlink);
+	SrvContentMgr::instance().handleFileSums(player, msg);
+}
+
 
 //---------------------------------------------------------------
 // Console
@@ -90,6 +90,13 @@ public:
 	virtual void handleMsg(MsgBase& msg, Netlink* netlink);
 };
 
+class MsgHdlContentFileSums : public MsgHdlBase
+{
+public:
+	virtual MsgType getMsgType() const;
+	virtual void handleMsg(MsgBase& msg, Netlink* netlink);
+};
+
 
 //---------------------------------------------------------------
 // Console
@@ -56,12 +56,21 @@ SrvNetworkMgr::SrvNetworkMgr() :
 
 void SrvNetworkMgr::finalize()
 {
+	flushOutgoingMsgs();
+
 	while (!mConnList.empty()) {
+		mReactor.removeFD(mConnList.front()->getSocket());
 		mConnList.front()->disconnect();
 		delete mConnList.front();
 		mConnList.pop_front();
 	}
 
+	for (size_t i = 0; i < mFreeConnections.size(); ++i) {
+		delete mFreeConnections[i];
+	}
+	mFreeConnections.clear();
+
+	mReactor.removeFD(mNetlink.getSocket());
 	mSocketLayer.disconnect();
 }
 
@@ -91,6 +100,7 @@ void SrvNetworkMgr::registerMsgHdls()
 
 	// content
 	REGHDL(MsgContentQueryUpdate, MsgHdlContentQueryUpdate);
+	REGHDL(MsgContentFileSums, MsgHdlContentFileSums);
 
 	// entities
 	REGHDL(MsgEntityMove, MsgHdlEntityMove);
@@ -124,8 +134,18 @@ bool SrvNetworkMgr::startListening(const char* host, int port, int maxPlayers)
 		// (backlog)
 		bool resultGame = mSocketLayer.listenForClients(host, port, 8);
 		bool resultPing = mPingServer.listenForClients(host, port-1, 8);
-		if (!resultGame || !resultPing)
+		if (!resultGame || !resultPing) {
 			LogERR("Couldn't set up Game or Ping listeners");
+			return false;
+		}
+
+		// listeners only need to know about incoming connections
+		resultGame = mReactor.addFD(mNetlink.getSocket(), this, &mNetlink,
+					    NetReactor::READ|NetReactor::EDGE);
+		resultPing = mReactor.addFD(mPingServer.getSocket(), this, &mPingServer,
+					    NetReactor::READ|NetReactor::EDGE);
+		if (!resultGame || !resultPing)
+			LogERR("Couldn't register Game or Ping listeners in the reactor");
 		return resultGame && resultPing;
 	}
 }
@@ -141,9 +161,7 @@ void SrvNetworkMgr::disconnectPlayer(Netlink& netlink)
 		if (**it == netlink) {
 			LogERR("Disconnecting player: %s:%d",
 			       netlink.getIP(), netlink.getPort());
-			mConnList.erase(it);
-			netlink.disconnect();
-			delete &netlink;
+			releaseConnection(&netlink);
 			return;
 		}
 	}
@@ -153,61 +171,160 @@ void SrvNetworkMgr::disconnectPlayer(Netlink& netlink)
 	       netlink.getIP(), netlink.getPort());
 }
 
-void SrvNetworkMgr::processIncomingMsgs()
+NetReactor& SrvNetworkMgr::getReactor()
 {
-	if (!mSocketLayer.isConnected()) {
-		// we just return without printing anything because otherwise it
-		// floods the client log until we get connected for the first
-		// time
-		return;
-	}
+	return mReactor;
+}
 
-	// attend ping requests
-	mPingServer.acceptIncoming();
-	mPingServer.processPingRequests();
+void SrvNetworkMgr::processIncomingMsgs(int timeout)
+{
+	// mafm: the reactor also dispatches the events of other descriptors
+	// registered by the application (the terminal), so we have to wait
+	// even if we're not listening
+	mReactor.waitForEvents(timeout);
+}
 
-	// to accept incoming connections, just 1 for loop so we autoprotect
-	// from floods
+void SrvNetworkMgr::handleEvents(int fd, void* cookie, int events)
+{
+	if (cookie == &mNetlink) {
+		acceptIncoming();
+	} else if (cookie == &mPingServer) {
+		if (fd == mPingServer.getSocket()) {
+			acceptIncomingPing();
+		} else if (!mPingServer.processPingRequests(fd)) {
+			mReactor.removeFD(fd);
+		}
+	} else {
+		processConnection(static_cast<Netlink*>(cookie), events);
+	}
+}
+
+void SrvNetworkMgr::acceptIncoming()
+{
+	// accept all the connections waiting, since we won't be notified again
+	// about them.  Floods are limited by MaxPlayers.
 	int socket = 0, port = 0; 
 	string ip;
-	bool result = mSocketLayer.acceptIncoming(socket, ip, port);
-	if (result) {
+	while (mSocketLayer.acceptIncoming(socket, ip, port)) {
 		if (mConnList.size() >= mMaxPlayers) {
 			LogWRN("MaxPlayers=%d reached, rejecting connection: %d (IP %s, port %d)",
 			       mMaxPlayers, socket, ip.c_str(), port);
 			close(socket);
-		} else {
-			LogDBG("Accepting incoming connection: %d (IP: %s, port %d)",
-			       socket, ip.c_str(), port);
-			fcntl(socket, F_SETFL, O_NONBLOCK);
-			Netlink* netlink = new Netlink(socket, ip.c_str(), port);
-			mConnList.push_back(netlink);
+			continue;
 		}
-        }
 
-	// loops through all the connections to see if they send anything new
-	// (and if the connection was closed, which is done with the result of
-	// the recv() system call).
-	for (list<Netlink*>::iterator it = mConnList.begin();
-	     it != mConnList.end(); ++it) {
-		// it will try to send queued messages
-		(**it).processOutgoingMsgs();
+		LogDBG("Accepting incoming connection: %d (IP: %s, port %d)",
+		       socket, ip.c_str(), port);
+		fcntl(socket, F_SETFL, O_NONBLOCK);
+		Netlink* netlink = allocateConnection(socket, ip, port);
+		if (!mReactor.addFD(socket, this, netlink)) {
+			LogERR("Couldn't register connection in the reactor, closing: %d",
+			       socket);
+			netlink->disconnect();
+			mFreeConnections.push_back(netlink);
+			continue;
+		}
+		mConnList.push_back(netlink);
+	}
+}
+
+Netlink* SrvNetworkMgr::allocateConnection(int socket, const std::string& ip, int port)
+{
+	if (mFreeConnections.empty()) {
+		return new Netlink(socket, ip.c_str(), port);
+	} else {
+		Netlink* netlink = mFreeConnections.back();
+		mFreeConnections.pop_back();
+		netlink->reset(socket, ip.c_str(), port);
+		return netlink;
+	}
+}
 
-		// we read data and there may be some messages available (so we
-		// should treat the messages appropriately)
-		bool resultProcessing = (**it).processIncomingMsgs(mMsgHdlFactory);
+void SrvNetworkMgr::releaseConnection(Netlink* netlink)
+{
+	mReactor.removeFD(netlink->getSocket());
+	SrvLoginMgr::instance().removeConnection(netlink);
+	removeFromPendingFlush(netlink);
+	mConnList.remove(netlink);
+	netlink->disconnect();
+
+	// mafm: we don't need to keep more than the maximum number of players,
+	// since we can't have more connections than that at once
+	if (mFreeConnections.size() < mMaxPlayers) {
+		mFreeConnections.push_back(netlink);
+	} else {
+		delete netlink;
+	}
+}
+
+void SrvNetworkMgr::acceptIncomingPing()
+{
+	int socket = -1;
+	while ((socket = mPingServer.acceptIncoming()) != -1) {
+		mReactor.addFD(socket, this, &mPingServer,
+			       NetReactor::READ|NetReactor::EDGE);
+	}
+}
+
+void SrvNetworkMgr::processConnection(Netlink* netlink, int events)
+{
+	// it will try to send queued messages
+	if (events & NetReactor::WRITE) {
+		netlink->processOutgoingMsgs();
+	}
+
+	// we read data and there may be some messages available (so we should
+	// treat the messages appropriately).  The connection is closed when
+	// detected by the result of the recv() system call.
+	if (events & (NetReactor::READ|NetReactor::HANGUP)) {
+		bool resultProcessing = netlink->processIncomingMsgs(mMsgHdlFactory);
 		if (!resultProcessing) {
-			LogDBG("Connection closed, invoking disconnection: %d", (*it)->getSocket());
-			SrvLoginMgr::instance().removeConnection(*it);
-			delete *it;
-			it = mConnList.erase(it);
+			LogDBG("Connection closed, invoking disconnection: %d", netlink->getSocket());
+			releaseConnection(netlink);
+		}
+	}
+}
+
+bool SrvNetworkMgr::queueMsg(MsgBase& msg, Netlink* netlink)
+{
+	// mafm: the messages are not sent right away, but when flushing at the
+	// end of the round, so all the messages for a connection (in example
+	// broadcasts of several events) go in a single system call
+	bool result = netlink->queueMsg(msg);
+	if (result && !netlink->isFlushPending()) {
+		netlink->setFlushPending(true);
+		mPendingFlush.push_back(netlink);
+	}
+	return result;
+}
+
+void SrvNetworkMgr::flushOutgoingMsgs()
+{
+	for (size_t i = 0; i < mPendingFlush.size(); ++i) {
+		mPendingFlush[i]->setFlushPending(false);
+		mPendingFlush[i]->processOutgoingMsgs();
+	}
+	mPendingFlush.clear();
+}
+
+void SrvNetworkMgr::removeFromPendingFlush(Netlink* netlink)
+{
+	if (!netlink->isFlushPending())
+		return;
+
+	for (size_t i = 0; i < mPendingFlush.size(); ++i) {
+		if (mPendingFlush[i] == netlink) {
+			mPendingFlush[i] = mPendingFlush.back();
+			mPendingFlush.pop_back();
+			break;
 		}
 	}
+	netlink->setFlushPending(false);
 }
 
 void SrvNetworkMgr::sendToConnection(MsgBase& msg, Netlink* netlink)
 {
-	int result = netlink->sendMsg(msg);
+	int result = queueMsg(msg, netlink);
 	if (!result) {
 		LogERR("Message '%s' for connection %d (IP='%s') too big (%u)",
 		       msg.getType().getName(),
@@ -220,7 +337,7 @@ void SrvNetworkMgr::sendToConnection(MsgBase& msg, Netlink* netlink)
 
 void SrvNetworkMgr::sendToPlayer(MsgBase& msg, const LoginData* player)
 {
-	int result = player->getNetlink()->sendMsg(msg);
+	int result = queueMsg(msg, player->getNetlink());
 	if (!result) {
 		LogERR("Message '%s' for player '%s' (IP='%s') too big (%u)",
 		       msg.getType().getName(),
@@ -231,43 +348,56 @@ void SrvNetworkMgr::sendToPlayer(MsgBase& msg, const LoginData* player)
 	}
 }
 
+void SrvNetworkMgr::broadcast(MsgBase& msg,
+			      const vector<LoginData*>& playerList,
+			      const LoginData* except)
+{
+	// mafm: the message is encoded only once, and then the same frame is
+	// copied to the send queue of every connection (we don't keep
+	// references to it, the queues are flushed in one go later)
+	if (!msg.isSerialized())
+		msg.serialize();
+
+	for (size_t i = 0; i < playerList.size(); ++i) {
+		if (playerList[i] == except)
+			continue;
+
+		bool result = queueMsg(msg, playerList[i]->getNetlink());
+		if (!result) {
+			// too big for anybody, so don't insist
+			LogERR("Message '%s' for %zu players too big (%u)",
+			       msg.getType().getName(),
+			       playerList.size(),
+			       msg.getLength());
+			return;
+		}
+	}
+}
+
 void SrvNetworkMgr::sendToAllConnections(MsgBase& msg)
 {
 	vector<LoginData*> allConnections;
 	SrvLoginMgr::instance().getAllConnections(allConnections);
-
-	for (size_t i = 0; i < allConnections.size(); ++i) {
-		sendToPlayer(msg, allConnections[i]);
-	}
+	broadcast(msg, allConnections, 0);
 }
 
 void SrvNetworkMgr::sendToAllPlayers(MsgBase& msg)
 {
 	vector<LoginData*> allPlayers;
 	SrvLoginMgr::instance().getAllConnectionsPlaying(allPlayers);
-
-	for (size_t i = 0; i < allPlayers.size(); ++i) {
-		sendToPlayer(msg, allPlayers[i]);
-	}
+	broadcast(msg, allPlayers, 0);
 }
 
 void SrvNetworkMgr::sendToPlayerList(MsgBase& msg, vector<LoginData*>& playerList)
 {
-	for (size_t i = 0; i < playerList.size(); ++i) {
-		sendToPlayer(msg, playerList[i]);
-	}
+	broadcast(msg, playerList, 0);
 }
 
 void SrvNetworkMgr::sendToAllButPlayer(MsgBase& msg, const LoginData* player)
 {
 	vector<LoginData*> allPlayers;
 	SrvLoginMgr::instance().getAllConnectionsPlaying(allPlayers);
-
-	for (size_t i = 0; i < allPlayers.size(); ++i) {
-		if (player != allPlayers[i]) {
-			sendToPlayer(msg, allPlayers[i]);
-		}
-	}
+	broadcast(msg, allPlayers, player);
 }
 
 
@@ -26,6 +26,7 @@
 
 #include "common/patterns/singleton.h"
 #include "common/net/netlayer.h"
+#include "common/net/netreactor.h"
 #include "common/net/msgbase.h"
 
 
@@ -40,11 +41,12 @@ class LoginData;
  * messages, and very little else.
  *
  * This class is also responsible for calling the appropriate modules when
- * messages requiring server's attention are received.  The application has to
- * call this manager every frame, or with some other frequency, so it can
- * process the incoming data.
+ * messages requiring server's attention are received.  All the sockets are
+ * registered in a reactor, so the application has to call this manager in its
+ * main loop to wait for network events (up to the next deadline of its timers),
+ * and only the connections ready are processed.
  */
-class SrvNetworkMgr : public Singleton<SrvNetworkMgr>
+class SrvNetworkMgr : public Singleton<SrvNetworkMgr>, public NetReactor::Handler
 {
 public:
 	/** Finalize, do whatever cleanup needed when the server shuts down. */
@@ -77,9 +79,22 @@ public:
 	 * playing or not */
 	void sendToAllConnections(MsgBase& msg);
 
-	/** Process incoming messages, called from the main app every frame or
-	 * at least with some regularity */
-	void processIncomingMsgs();
+	/** Wait for network events during the given time at most (in
+	 * milliseconds, -1 to wait indefinitely), and process the incoming
+	 * messages and pending outgoing data of the connections ready */
+	void processIncomingMsgs(int timeout);
+
+	/** Send the data queued by the messages sent since the last call, a
+	 * single system call per connection.  Called from the main app after
+	 * processing the events of each round. */
+	void flushOutgoingMsgs();
+
+	/** Get the reactor, to register other descriptors (such as the
+	 * terminal) and wait for all of them at the same time */
+	NetReactor& getReactor();
+
+	/** Handle the events of the sockets, called by the reactor */
+	virtual void handleEvents(int fd, void* cookie, int events);
 
 private:
 	/** Singleton friend access */
@@ -88,6 +103,9 @@ private:
 	/// Connection object (with data about us and the peer, the server)
 	Netlink mNetlink;
 
+	/// Readiness notification for all the sockets
+	NetReactor mReactor;
+
 	/// Network layer
 	SocketLayer mSocketLayer;
 
@@ -97,6 +115,13 @@ private:
 	/// The list of connections (clients)
 	std::list<Netlink*> mConnList;
 
+	/// Connections closed, kept to be reused for new clients without
+	/// allocating them (and their buffers) again
+	std::vector<Netlink*> mFreeConnections;
+
+	/// The connections with queued messages, waiting to be flushed
+	std::vector<Netlink*> mPendingFlush;
+
 	/// The handler for incoming ping requests
 	PingServer mPingServer;
 
@@ -109,6 +134,27 @@ private:
 
 	/** Register message handlers, called once to set it up */
 	void registerMsgHdls();
+
+	/** Accept the incoming connections waiting in the game listener */
+	void acceptIncoming();
+	/** Accept the incoming connections waiting in the ping listener */
+	void acceptIncomingPing();
+	/** Get a connection for a new client, reusing a free one if
+	 * possible */
+	Netlink* allocateConnection(int socket, const std::string& ip, int port);
+	/** Close a connection and forget about it, keeping it to be reused */
+	void releaseConnection(Netlink* netlink);
+	/** Process the events of a connection, removing it if closed */
+	void processConnection(Netlink* netlink, int events);
+	/** Queue a message in a connection, to be sent when flushing */
+	bool queueMsg(MsgBase& msg, Netlink* netlink);
+	/** Send a message to the given list of players, except to the given
+	 * one (if any) */
+	void broadcast(MsgBase& msg,
+		       const std::vector<LoginData*>& playerList,
+		       const LoginData* except);
+	/** Forget about a connection about to be deleted */
+	void removeFromPendingFlush(Netlink* netlink);
 };
 
 
@@ -124,31 +124,75 @@ void SrvMain::start()
 
 void SrvMain::mainLoop()
 {
+	// mafm: the terminal is read when the reactor tells us that there's
+	// input, along with the network events.  It's registered as
+	// level-triggered, since reading is line-based.
+	if (mInteractiveMode) {
+		bool result = SrvNetworkMgr::instance().getReactor().addFD(0, this, 0, NetReactor::READ);
+		if (!result) {
+			LogWRN("Couldn't register terminal for reading commands, ignoring input");
+		}
+	}
+
+	// the asynchronous DB queries completed are notified from here too
+	int dbFD = SrvDBMgr::instance().getCompletionFD();
+	if (dbFD >= 0) {
+		bool result = SrvNetworkMgr::instance().getReactor().addFD(dbFD, this, 0, NetReactor::READ);
+		if (!result) {
+			LogERR("Couldn't register the DB pool, asynchronous queries won't complete");
+		}
+	}
+
+	struct timeval last;
+	gettimeofday(&last, 0);
+
 	// infinite loop, the app will exit by another means
 	while (true) {
-		// be friendly to computer, sleeping for a while
-		static struct timespec interval = { 0, 10*1000*1000 };
-		struct timespec remaining = { 0, 0 };
-		nanosleep(&interval, &remaining);
-		struct timespec elapsed = { interval.tv_sec - remaining.tv_sec,
-					    interval.tv_nsec - remaining.tv_nsec };
-
-		// send a tick to the time manager (milliseconds)
-		SrvWorldTimeMgr::instance().sendTick(elapsed.tv_nsec/(1000*1000));
-
-		// send a tick to the time manager (milliseconds)
-		SrvCombatMgr::instance().sendTick(elapsed.tv_nsec/(1000*1000));
-
-		// if in interactive mode, try to read input
-		if (mInteractiveMode) {
-			interactiveModeReadInput();
-		}
+		// sleep until something happens in the network or until the
+		// next timer deadline
+		uint32_t timeout = min(SrvWorldTimeMgr::instance().getMsecsToNextTick(),
+				       SrvCombatMgr::instance().getMsecsToNextTick());
+		timeout = min(timeout, SrvWorldMgr::instance().getMsecsToNextTick());
+		timeout = min(timeout, SrvContentMgr::instance().getMsecsToNextTick());
 
 		// process incoming messages from the network
-		SrvNetworkMgr::instance().processIncomingMsgs();
+		SrvNetworkMgr::instance().processIncomingMsgs(static_cast<int>(timeout));
+
+		// calculate the time elapsed, keeping the remainder of
+		// milliseconds for the next round to avoid drifting
+		struct timeval now;
+		gettimeofday(&now, 0);
+		long elapsedUsecs = (now.tv_sec - last.tv_sec)*1000*1000
+			+ (now.tv_usec - last.tv_usec);
+		if (elapsedUsecs < 0) {
+			// the clock was set backwards
+			last = now;
+			elapsedUsecs = 0;
+		}
+		uint32_t elapsed = static_cast<uint32_t>(elapsedUsecs/1000);
+		if (elapsed > 0) {
+			long advanceUsecs = last.tv_usec + static_cast<long>(elapsed)*1000;
+			last.tv_sec += advanceUsecs / (1000*1000);
+			last.tv_usec = advanceUsecs % (1000*1000);
+
+			// send a tick to the time manager (milliseconds)
+			SrvWorldTimeMgr::instance().sendTick(elapsed);
+
+			// send a tick to the combat manager (milliseconds)
+			SrvCombatMgr::instance().sendTick(elapsed);
 
-		/// Send some data to clients
+			// send a tick to the world manager, to save its state
+			// periodically (milliseconds)
+			SrvWorldMgr::instance().sendTick(elapsed);
+		}
+
+		/// Take note of the changes in the content, and send some
+		/// data to clients
+		SrvContentMgr::instance().checkContentChanges();
 		SrvContentMgr::instance().sendDataToClients();
+
+		// send all the messages queued in this round
+		SrvNetworkMgr::instance().flushOutgoingMsgs();
 	}
 }
 
@@ -176,41 +220,43 @@ bool SrvMain::loadStartupScript(const std::string& file)
 	}
 }
 
-void SrvMain::interactiveModeReadInput() const
+bool SrvMain::interactiveModeReadInput() const
 {
 	// vars to store a command-line-in-progress, and the character to be
 	// read
 	string cmd;
-	char c;
-
-	// prepare values for select call (fd=1 is stdin)
-	int fd = 1;
-	fd_set fdset;
-	FD_ZERO(&fdset);
-	FD_SET(0, &fdset);
-	struct timeval tspec = {0, 0};
-
-	switch (select(fd, &fdset, 0, 0, &tspec))
-	{
-	case 1:
+	int c = getchar();
+	if (c == EOF) {
+		return false;
+	}
+
+	while ((c != '\n') && (c != EOF)) {
+		cmd.append(1, static_cast<char>(c));
 		c = getchar();
-		while ((c != '\n') && (c != EOF)) {
-			cmd.append(1, c);
-			c = getchar();
-		}
+	}
 
-		if (c == '\n') {
-			fprintf(stderr, "Command: %s\n", cmd.c_str());
-			if (cmd.length() > 0) {
-				executeCommand(cmd);
-			}
-			cmd.clear();
+	if (c == '\n') {
+		fprintf(stderr, "Command: %s\n", cmd.c_str());
+		if (cmd.length() > 0) {
+			executeCommand(cmd);
 		}
-		break;
-	default:
-		tspec.tv_sec = 0;
-		tspec.tv_usec = 0;
-		break;
+		cmd.clear();
+	}
+
+	return true;
+}
+
+void SrvMain::handleEvents(int fd, void* /* cookie */, int /* events */)
+{
+	if (fd == SrvDBMgr::instance().getCompletionFD()) {
+		SrvDBMgr::instance().processCompletedQueries();
+		return;
+	}
+
+	bool result = interactiveModeReadInput();
+	if (!result) {
+		LogWRN("Terminal closed, ignoring input from now on");
+		SrvNetworkMgr::instance().getReactor().removeFD(fd);
 	}
 }
 
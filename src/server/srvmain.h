@@ -21,6 +21,7 @@
 
 
 #include "common/patterns/singleton.h"
+#include "common/net/netreactor.h"
 
 #include <string>
 #include <ctime>
@@ -30,7 +31,7 @@
  *
  * @author mafm
  */
-class SrvMain : public Singleton<SrvMain>
+class SrvMain : public Singleton<SrvMain>, public NetReactor::Handler
 {
 public:
 	/** Main initialization routine, loading and initializing all modules
@@ -39,8 +40,12 @@ public:
 	/** Shut down the game (game-related parts of the application) */
 	static void shutdownGame();
 
-	/** Method to read the input from the terminal (defined in the bottom */
-	void interactiveModeReadInput() const;
+	/** Method to read the input from the terminal (defined in the bottom,
+	 * returns false if the input was closed */
+	bool interactiveModeReadInput() const;
+	/** Handle the events of the terminal and of the DB pool, called by the
+	 * reactor */
+	virtual void handleEvents(int fd, void* cookie, int events);
 	/** Get the uptime of the server */
 	std::string getUptime() const;
 
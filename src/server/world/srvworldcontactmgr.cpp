@@ -63,17 +63,15 @@ void SrvWorldContactMgr::addContact(const LoginData* player,
 
 	string charname = player->getPlayerName();
 	string cid = player->getPlayerID();
-	otherCharname = SrvDBMgr::instance().escape(otherCharname);
-	otherComment = SrvDBMgr::instance().escape(otherComment);
 	string otherType = StrFmt("%c", otherTypeChar);
   
 	// 1- check if player already has this contact
 	{
 		SrvDBQuery query;
 		query.setTables("contact_list");
-		string condition = "cid='" + cid +
-			+ "' AND contact_charname='" + otherCharname + "'";
-		query.setCondition(condition);
+		query.setCondition("cid=? AND contact_charname=?");
+		query.addConditionValue(cid);
+		query.addConditionValue(otherCharname);
 		bool matches = SrvDBMgr::instance().queryMatch(&query);
 		if (matches) {
 			LogERR("Player already has this contact (player '%s', "
@@ -92,8 +90,8 @@ void SrvWorldContactMgr::addContact(const LoginData* player,
 	{
 		SrvDBQuery query;
 		query.setTables("usr_chars");
-		string condition = "charname='" + otherCharname + "'";
-		query.setCondition(condition);
+		query.setCondition("charname=?");
+		query.addConditionValue(otherCharname);
 		query.addColumnWithoutValue("cid");
 		query.addColumnWithoutValue("last_login");
 		int numresults = SrvDBMgr::instance().querySelect(&query);
@@ -120,23 +118,15 @@ void SrvWorldContactMgr::addContact(const LoginData* player,
 		query.addColumnWithValue("type", otherType);
 		query.addColumnWithValue("comments", otherComment);
 		//query.addColumnWithValue("creation_date", "CURRENT_TIMESTAMP", false);
-		bool success = SrvDBMgr::instance().queryInsert(&query);
-		if (success) {
-			LogNTC("Success adding contact (player '%s', "
-			       "contact player '%s', type '%s', comment '%s')",
-			       player->getPlayerName(), otherCharname.c_str(),
-			       otherType.c_str(), otherComment.c_str());
-
-			sendConsoleReply(player, "Info: Successfully added contact");
-		} else {
-			LogERR("Add contact failed, unknown DB error (player '%s', "
-			       "contact player '%s', type '%s', comment '%s')",
-			       player->getPlayerName(), otherCharname.c_str(),
-			       otherType.c_str(), otherComment.c_str());
-			sendConsoleReply(player, "Add contact failed: "
-					 "There was a DB error trying to add it");
-			return;
-		}
+		// mafm: queued, we already checked that the data is valid and the
+		// DB errors are logged by the writer
+		SrvDBMgr::instance().queueInsert(&query);
+		LogNTC("Success adding contact (player '%s', "
+		       "contact player '%s', type '%s', comment '%s')",
+		       player->getPlayerName(), otherCharname.c_str(),
+		       otherType.c_str(), otherComment.c_str());
+
+		sendConsoleReply(player, "Info: Successfully added contact");
 	}
 
 	// 4- notify about the status of the recently added contact
@@ -155,13 +145,11 @@ void SrvWorldContactMgr::removeContact(const LoginData* player,
 	// STEPS
 	// 1- remove the contact, complain if there's an error
 
-	otherCharname = SrvDBMgr::instance().escape(otherCharname);
-
 	SrvDBQuery query;
 	query.setTables("contact_list");
-	string condition = "cid='" + string(player->getPlayerID()) +
-		"' AND contact_charname='" + otherCharname + "'";
-	query.setCondition(condition);
+	query.setCondition("cid=? AND contact_charname=?");
+	query.addConditionValue(player->getPlayerID());
+	query.addConditionValue(otherCharname);
 	bool success = SrvDBMgr::instance().queryDelete(&query);
 	if (success) {
 		sendConsoleReply(player, "Successfully removed contact");
@@ -231,9 +219,8 @@ void SrvWorldContactMgr::notifyPlayerOfContacts(const LoginData* player)
 	string cid = player->getPlayerID();
 	SrvDBQuery query;
 	query.setTables("usr_chars as ch,contact_list as cl");
-	string condition = "cl.cid='" + cid +
-		"' AND ch.cid=cl.contact_cid";
-	query.setCondition(condition);
+	query.setCondition("cl.cid=? AND ch.cid=cl.contact_cid");
+	query.addConditionValue(cid);
 	query.setOrder("contact_charname ASC");
 	query.addColumnWithoutValue("cl.contact_charname");
 	query.addColumnWithoutValue("cl.type");
@@ -281,9 +268,8 @@ void SrvWorldContactMgr::notifyOtherPlayers(const LoginData* player,
 	string cid = player->getPlayerID();
 	SrvDBQuery query;
 	query.setTables("usr_chars as ch,contact_list as cl");
-	string condition = "cl.contact_cid='" + cid +
-		"' AND ch.cid=cl.contact_cid";
-	query.setCondition(condition);
+	query.setCondition("cl.contact_cid=? AND ch.cid=cl.contact_cid");
+	query.addConditionValue(cid);
 	query.setOrder("cl.charname ASC");
 	query.addColumnWithoutValue("cl.charname");
 	query.addColumnWithoutValue("cl.type");
@@ -0,0 +1,293 @@
+/*
+ * srvworldgrid.cpp
+ * Copyright (C) 2006-2008 by Manuel A. Fernandez Montecelo <mafm@users.sourceforge.net>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "srvworldgrid.h"
+
+#include "server/entity/srventityplayer.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+/// Default size of the cells, if not set
+const float DEFAULT_CELL_SIZE = 100.0f;
+
+
+/*******************************************************************************
+ * SrvWorldGrid
+ ******************************************************************************/
+SrvWorldGrid::SrvWorldGrid() :
+	mCellSize(DEFAULT_CELL_SIZE)
+{
+}
+
+void SrvWorldGrid::setCellSize(float size)
+{
+	if (size <= 0.0f) {
+		LogERR("Invalid cell size for the world grid: %.1f, ignoring", size);
+		return;
+	}
+	mCellSize = size;
+}
+
+float SrvWorldGrid::getCellSize() const
+{
+	return mCellSize;
+}
+
+void SrvWorldGrid::getCellCoords(const Vector3& position, int32_t& x, int32_t& y) const
+{
+	x = static_cast<int32_t>(floorf(position.x / mCellSize));
+	y = static_cast<int32_t>(floorf(position.y / mCellSize));
+}
+
+uint64_t SrvWorldGrid::getCellKey(int32_t x, int32_t y)
+{
+	return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32)
+		| static_cast<uint64_t>(static_cast<uint32_t>(y));
+}
+
+SrvWorldGrid::Cell& SrvWorldGrid::getCell(const std::string& area, const Vector3& position)
+{
+	int32_t x = 0, y = 0;
+	getCellCoords(position, x, y);
+	return mAreas[area][getCellKey(x, y)];
+}
+
+void SrvWorldGrid::removeFromCell(Cell& cell, SrvEntityBase* entity, SrvEntityPlayer* player)
+{
+	// order doesn't matter, so we swap with the last one
+	for (size_t i = 0; i < cell.entities.size(); ++i) {
+		if (cell.entities[i] == entity) {
+			cell.entities[i] = cell.entities.back();
+			cell.entities.pop_back();
+			break;
+		}
+	}
+
+	if (!player)
+		return;
+
+	for (size_t i = 0; i < cell.players.size(); ++i) {
+		if (cell.players[i] == player) {
+			cell.players[i] = cell.players.back();
+			cell.players.pop_back();
+			break;
+		}
+	}
+}
+
+void SrvWorldGrid::addEntity(SrvEntityBase* entity, SrvEntityPlayer* player)
+{
+	Vector3 position;
+	entity->getPosition(position);
+	Cell& cell = getCell(entity->getArea(), position);
+	cell.entities.push_back(entity);
+	if (player)
+		cell.players.push_back(player);
+}
+
+void SrvWorldGrid::removeEntity(SrvEntityBase* entity, SrvEntityPlayer* player)
+{
+	Vector3 position;
+	entity->getPosition(position);
+	removeFromCell(getCell(entity->getArea(), position), entity, player);
+}
+
+bool SrvWorldGrid::moveEntity(SrvEntityBase* entity, SrvEntityPlayer* player,
+			      const std::string& oldArea, const Vector3& oldPosition)
+{
+	Vector3 position;
+	entity->getPosition(position);
+
+	int32_t oldX = 0, oldY = 0, x = 0, y = 0;
+	getCellCoords(oldPosition, oldX, oldY);
+	getCellCoords(position, x, y);
+	if (oldX == x && oldY == y && oldArea == entity->getArea())
+		return false;
+
+	removeFromCell(getCell(oldArea, oldPosition), entity, player);
+	Cell& cell = getCell(entity->getArea(), position);
+	cell.entities.push_back(entity);
+	if (player)
+		cell.players.push_back(player);
+	return true;
+}
+
+void SrvWorldGrid::getNeighbourhood(const std::string& area, const Vector3& position,
+				    std::vector<Cell*>& cells)
+{
+	map<std::string, CellMap>::iterator itArea = mAreas.find(area);
+	if (itArea == mAreas.end())
+		return;
+
+	int32_t x = 0, y = 0;
+	getCellCoords(position, x, y);
+	for (int32_t i = x-1; i <= x+1; ++i) {
+		for (int32_t j = y-1; j <= y+1; ++j) {
+			CellMap::iterator it = itArea->second.find(getCellKey(i, j));
+			if (it != itArea->second.end())
+				cells.push_back(&it->second);
+		}
+	}
+}
+
+void SrvWorldGrid::getCellsInRadius(const std::string& area, const Vector3& center,
+				    float radius,
+				    std::vector<const Cell*>& cells) const
+{
+	map<std::string, CellMap>::const_iterator itArea = mAreas.find(area);
+	if (itArea == mAreas.end())
+		return;
+	const CellMap& cellMap = itArea->second;
+
+	int32_t minX = 0, minY = 0, maxX = 0, maxY = 0;
+	getCellCoords(Vector3(center.x - radius, center.y - radius, 0.0f), minX, minY);
+	getCellCoords(Vector3(center.x + radius, center.y + radius, 0.0f), maxX, maxY);
+
+	// mafm: with big radius (in example, for chat) there can be more cells
+	// in the square than cells used in the area, so it's cheaper to check
+	// the cells of the area instead
+	uint64_t window = static_cast<uint64_t>(maxX - minX + 1) * static_cast<uint64_t>(maxY - minY + 1);
+	if (window > cellMap.size()) {
+		for (CellMap::const_iterator it = cellMap.begin(); it != cellMap.end(); ++it) {
+			int32_t x = static_cast<int32_t>(it->first >> 32);
+			int32_t y = static_cast<int32_t>(it->first & 0xFFFFFFFF);
+			if (x >= minX && x <= maxX && y >= minY && y <= maxY)
+				cells.push_back(&it->second);
+		}
+	} else {
+		for (int32_t i = minX; i <= maxX; ++i) {
+			for (int32_t j = minY; j <= maxY; ++j) {
+				CellMap::const_iterator it = cellMap.find(getCellKey(i, j));
+				if (it != cellMap.end())
+					cells.push_back(&it->second);
+			}
+		}
+	}
+}
+
+void SrvWorldGrid::getEntitiesInRadius(const std::string& area, const Vector3& center,
+				       float radius,
+				       std::vector<SrvEntityBase*>& entities) const
+{
+	vector<const Cell*> cells;
+	getCellsInRadius(area, center, radius, cells);
+
+	float radius2 = radius * radius;
+	Vector3 position;
+	for (size_t i = 0; i < cells.size(); ++i) {
+		const vector<SrvEntityBase*>& cellEntities = cells[i]->entities;
+		for (size_t j = 0; j < cellEntities.size(); ++j) {
+			cellEntities[j]->getPosition(position);
+			if (center.squaredDistance(position) <= radius2)
+				entities.push_back(cellEntities[j]);
+		}
+	}
+}
+
+void SrvWorldGrid::getPlayersInRadius(const std::string& area, const Vector3& center,
+				      float radius,
+				      std::vector<SrvEntityPlayer*>& players) const
+{
+	vector<const Cell*> cells;
+	getCellsInRadius(area, center, radius, cells);
+
+	float radius2 = radius * radius;
+	Vector3 position;
+	for (size_t i = 0; i < cells.size(); ++i) {
+		const vector<SrvEntityPlayer*>& cellPlayers = cells[i]->players;
+		for (size_t j = 0; j < cellPlayers.size(); ++j) {
+			cellPlayers[j]->getPosition(position);
+			if (center.squaredDistance(position) <= radius2)
+				players.push_back(cellPlayers[j]);
+		}
+	}
+}
+
+void SrvWorldGrid::getNearestEntities(const std::string& area, const Vector3& center,
+				      size_t count, float maxRadius,
+				      std::vector<SrvEntityBase*>& entities) const
+{
+	map<std::string, CellMap>::const_iterator itArea = mAreas.find(area);
+	if (itArea == mAreas.end() || count == 0)
+		return;
+	const CellMap& cellMap = itArea->second;
+
+	// mafm: we check the cells in rings around the one of the position,
+	// until we have enough candidates and the next rings can't have
+	// anything closer (cells in the ring N are at least (N-1)*size away)
+	typedef std::pair<float, SrvEntityBase*> Candidate;
+	vector<Candidate> candidates;
+	float maxRadius2 = maxRadius * maxRadius;
+	int32_t x = 0, y = 0;
+	getCellCoords(center, x, y);
+	int32_t maxRing = static_cast<int32_t>(ceilf(maxRadius / mCellSize));
+	size_t cellsVisited = 0;
+	Vector3 position;
+	for (int32_t ring = 0; ring <= maxRing && cellsVisited < cellMap.size(); ++ring) {
+		for (int32_t i = x-ring; i <= x+ring; ++i) {
+			// only the border of the square, the inside was done
+			int32_t step = (i == x-ring || i == x+ring) ? 1 : 2*ring;
+			for (int32_t j = y-ring; j <= y+ring; j += step) {
+				CellMap::const_iterator it = cellMap.find(getCellKey(i, j));
+				if (it == cellMap.end())
+					continue;
+				++cellsVisited;
+				const vector<SrvEntityBase*>& cellEntities = it->second.entities;
+				for (size_t k = 0; k < cellEntities.size(); ++k) {
+					cellEntities[k]->getPosition(position);
+					float distance2 = center.squaredDistance(position);
+					if (distance2 <= maxRadius2)
+						candidates.push_back(Candidate(distance2, cellEntities[k]));
+				}
+			}
+		}
+
+		if (candidates.size() >= count) {
+			std::nth_element(candidates.begin(), candidates.begin() + (count - 1),
+					 candidates.end());
+			float reach = ring * mCellSize;
+			if (candidates[count - 1].first <= reach * reach)
+				break;
+		}
+	}
+
+	size_t found = min(count, candidates.size());
+	std::partial_sort(candidates.begin(), candidates.begin() + found, candidates.end());
+	for (size_t i = 0; i < found; ++i) {
+		entities.push_back(candidates[i].second);
+	}
+}
+
+void SrvWorldGrid::clear()
+{
+	mAreas.clear();
+}
+
+
+// Local Variables: ***
+// mode: C++ ***
+// tab-width: 8 ***
+// c-basic-offset: 8 ***
+// indent-tabs-mode: t ***
+// fill-column: 80 ***
+// End: ***
+// ex: shiftwidth=2 tabstop=8
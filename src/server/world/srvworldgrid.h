@@ -0,0 +1,137 @@
+/*
+ * srvworldgrid.h
+ * Copyright (C) 2006-2008 by Manuel A. Fernandez Montecelo <mafm@users.sourceforge.net>
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FEARANN_SERVER_WORLD_GRID_H__
+#define __FEARANN_SERVER_WORLD_GRID_H__
+
+
+#include "common/datatypes.h"
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+class SrvEntityBase;
+class SrvEntityPlayer;
+
+
+/** Uniform grid dividing each area in square cells, on the ground plane (X and
+ * Y axes), to know which entities are close to each other without checking
+ * all of them.
+ *
+ * The world manager uses this for the interest management: the size of the
+ * cells is the view radius, so all the entities within the radius of a player
+ * are in the cell of the player or in the 8 cells around (the neighbourhood),
+ * and players are only subscribed to the entities of their neighbourhood.
+ *
+ * @author mafm
+ */
+class SrvWorldGrid
+{
+public:
+	/** Cell of the grid, with the entities inside */
+	class Cell {
+	public:
+		/// All the entities in the cell (including players)
+		std::vector<SrvEntityBase*> entities;
+		/// Players in the cell (also present in the list of entities)
+		std::vector<SrvEntityPlayer*> players;
+	};
+
+	/** Default constructor */
+	SrvWorldGrid();
+
+	/** Set the size of the cells, only before adding entities */
+	void setCellSize(float size);
+	/** Get the size of the cells */
+	float getCellSize() const;
+
+	/** Add an entity in the cell of its current position, player is the
+	 * same entity if it's a player, 0 otherwise */
+	void addEntity(SrvEntityBase* entity, SrvEntityPlayer* player);
+	/** Remove an entity from the cell of its current position */
+	void removeEntity(SrvEntityBase* entity, SrvEntityPlayer* player);
+	/** Move an entity from the cell of the old position to the cell of its
+	 * current position, returns false if both are the same (so it wasn't
+	 * moved) */
+	bool moveEntity(SrvEntityBase* entity, SrvEntityPlayer* player,
+			const std::string& oldArea, const Vector3& oldPosition);
+
+	/** Get the cells around the given position (the cell of the position
+	 * and the 8 surrounding it), only those which exist */
+	void getNeighbourhood(const std::string& area, const Vector3& position,
+			      std::vector<Cell*>& cells);
+
+	/** Get the entities (including players) within the radius of the given
+	 * position, appended to the list */
+	void getEntitiesInRadius(const std::string& area, const Vector3& center,
+				 float radius,
+				 std::vector<SrvEntityBase*>& entities) const;
+	/** Get the players within the radius of the given position, appended
+	 * to the list */
+	void getPlayersInRadius(const std::string& area, const Vector3& center,
+				float radius,
+				std::vector<SrvEntityPlayer*>& players) const;
+	/** Get the given number of entities (including players) nearest to the
+	 * position, but not further than maxRadius, ordered by distance and
+	 * appended to the list */
+	void getNearestEntities(const std::string& area, const Vector3& center,
+				size_t count, float maxRadius,
+				std::vector<SrvEntityBase*>& entities) const;
+
+	/** Remove all the entities */
+	void clear();
+
+private:
+	/// Cells of an area, the key made of the coordinates of the cell
+	typedef std::map<uint64_t, Cell> CellMap;
+
+	/// Size of the cells
+	float mCellSize;
+	/// Cells of each area
+	std::map<std::string, CellMap> mAreas;
+
+	/** Get the coordinates of the cell containing the position */
+	void getCellCoords(const Vector3& position, int32_t& x, int32_t& y) const;
+	/** Get the key of the cell with the given coordinates */
+	static uint64_t getCellKey(int32_t x, int32_t y);
+	/** Get the cell containing the position, creating it if needed */
+	Cell& getCell(const std::string& area, const Vector3& position);
+	/** Get the cells which might contain entities within the radius of the
+	 * position */
+	void getCellsInRadius(const std::string& area, const Vector3& center,
+			      float radius,
+			      std::vector<const Cell*>& cells) const;
+	/** Remove the entity from the given cell */
+	static void removeFromCell(Cell& cell, SrvEntityBase* entity, SrvEntityPlayer* player);
+};
+
+
+#endif
+
+
+// Local Variables: ***
+// mode: C++ ***
+// tab-width: 8 ***
+// c-basic-offset: 8 ***
+// indent-tabs-mode: t ***
+// fill-column: 80 ***
+// End: ***
+// ex: shiftwidth=2 tabstop=8
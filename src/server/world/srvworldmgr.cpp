@@ -20,6 +20,7 @@
 
 #include "srvworldmgr.h"
 
+#include "common/configmgr.h"
 #include "common/net/msgs.h"
 #include "common/tablemgr.h"
 
@@ -50,34 +51,140 @@ const float PICKUP_DISTANCE = 10.0f;
  ******************************************************************************/
 template <> SrvWorldMgr* Singleton<SrvWorldMgr>::INSTANCE = 0;
 
-SrvWorldMgr::SrvWorldMgr()
+SrvWorldMgr::SrvWorldMgr() :
+	mCheckpointInterval(60*1000), mCheckpointTicks(0)
 {
+	// mafm: the cells of the grid have the size of the view radius, so
+	// players get subscribed to everything within the radius (and some
+	// entities a bit further, up to twice the radius, in the corners of the
+	// neighbourhood)
+	float viewRadius = atof(ConfigMgr::instance().getConfigVar("Server.World.ViewRadius", "0"));
+	if (viewRadius <= 0.0f) {
+		LogERR("Couldn't get ViewRadius from the config file, using default (%.1f)",
+		       mGrid.getCellSize());
+	} else {
+		mGrid.setCellSize(viewRadius);
+	}
+
+	int interval = atoi(ConfigMgr::instance().getConfigVar("Server.World.CheckpointInterval", "0"));
+	if (interval <= 0) {
+		LogERR("Couldn't get CheckpointInterval from the config file, using default (%u)",
+		       mCheckpointInterval/1000);
+	} else {
+		mCheckpointInterval = static_cast<uint32_t>(interval)*1000;
+	}
 }
 
 void SrvWorldMgr::finalize()
 {
-	// clear players
-	for (size_t i = 0; i < mPlayerList.size(); ++i) {
-		removePlayer(mPlayerList[i]->getLoginData());
+	// save what changed since the last checkpoint (entities are saved
+	// when destroyed anyway, but this way it's done in a single batch)
+	checkpoint();
+
+	// clear players (removing them erases them from the list)
+	while (!mPlayerList.empty()) {
+		removePlayer(mPlayerList.back()->getLoginData());
 	}
-	mPlayerList.clear();
 
 	// clear creatures
-	for (size_t i = 0; i < mCreatureList.size(); ++i) {
-		removeEntity(mCreatureList[i]);
+	while (!mCreatureList.empty()) {
+		removeEntity(mCreatureList.back());
 	}
-	mCreatureList.clear();
 
 	// clear objects
-	for (size_t i = 0; i < mObjectList.size(); ++i) {
-		removeEntity(mObjectList[i]);
+	while (!mObjectList.empty()) {
+		removeEntity(mObjectList.back());
 	}
-	mObjectList.clear();
+
+	mGrid.clear();
 
 	// clear areas
 	mAreaList.clear();
 }
 
+void SrvWorldMgr::sendTick(uint32_t ticks)
+{
+	mCheckpointTicks += ticks;
+	if (mCheckpointTicks >= mCheckpointInterval) {
+		mCheckpointTicks = 0;
+		checkpoint();
+	}
+}
+
+uint32_t SrvWorldMgr::getMsecsToNextTick() const
+{
+	if (mCheckpointTicks >= mCheckpointInterval)
+		return 0;
+	else
+		return mCheckpointInterval - mCheckpointTicks;
+}
+
+void SrvWorldMgr::checkpoint()
+{
+	// mafm: saving each entity separately would mean a couple of statements
+	// per player each time, so we collect the ones changed and update them
+	// with a statement per table, all in the same transaction
+	SrvDBBatchUpdate playerPos("usr_chars", "charname", "varchar");
+	SrvDBBatchUpdate playerStats("player_stats", "charname", "varchar");
+	SrvDBBatchUpdate creaturePos("creatures", "id", "bigint");
+	SrvDBBatchUpdate objectPos("entities", "id", "bigint");
+	SrvDBBatchUpdate* posBatches[] = { &playerPos, &creaturePos, &objectPos };
+	for (size_t i = 0; i < sizeof(posBatches)/sizeof(posBatches[0]); ++i) {
+		posBatches[i]->addColumn("area", "varchar");
+		posBatches[i]->addColumn("pos1", "double precision");
+		posBatches[i]->addColumn("pos2", "double precision");
+		posBatches[i]->addColumn("pos3", "double precision");
+		posBatches[i]->addColumn("rot", "double precision");
+	}
+	playerStats.addColumn("health", "integer");
+	playerStats.addColumn("magic", "integer");
+	playerStats.addColumn("stamina", "integer");
+	playerStats.addColumn("gold", "integer");
+
+	vector<string> values;
+	for (size_t i = 0; i < mPlayerList.size(); ++i) {
+		SrvEntityPlayer* player = mPlayerList[i];
+		uint32_t dirty = player->getDirty();
+		if (dirty & SrvEntityBase::DIRTY_POSITION) {
+			player->getPositionForDB(values);
+			playerPos.addRow(player->getName(), values);
+		}
+		if (dirty & SrvEntityBase::DIRTY_STATS) {
+			player->getStatsForDB(values);
+			playerStats.addRow(player->getName(), values);
+		}
+		player->clearDirty();
+	}
+	for (size_t i = 0; i < mCreatureList.size(); ++i) {
+		SrvEntityCreature* creature = mCreatureList[i];
+		if (creature->getDirty() & SrvEntityBase::DIRTY_POSITION) {
+			creature->getPositionForDB(values);
+			creaturePos.addRow(StrFmt("%lu", creature->getID()), values);
+		}
+		creature->clearDirty();
+	}
+	for (size_t i = 0; i < mObjectList.size(); ++i) {
+		SrvEntityObject* object = mObjectList[i];
+		if (object->getDirty() & SrvEntityBase::DIRTY_POSITION) {
+			object->getPositionForDB(values);
+			objectPos.addRow(StrFmt("%lu", object->getID()), values);
+		}
+		object->clearDirty();
+	}
+
+	vector<const SrvDBBatchUpdate*> batches;
+	batches.push_back(&playerPos);
+	batches.push_back(&playerStats);
+	batches.push_back(&creaturePos);
+	batches.push_back(&objectPos);
+	SrvDBMgr::instance().queueBatchUpdates(batches);
+
+	LogDBG("Checkpoint: %zu player positions, %zu player stats, "
+	       "%zu creatures, %zu objects",
+	       playerPos.getNumberOfRows(), playerStats.getNumberOfRows(),
+	       creaturePos.getNumberOfRows(), objectPos.getNumberOfRows());
+}
+
 bool SrvWorldMgr::isAreaLoaded(const std::string& name) const
 {
 	for (size_t i = 0; i < mAreaList.size(); ++i) {
@@ -108,12 +215,11 @@ bool SrvWorldMgr::loadObjectsFromDB(const std::string& area)
 	// 1- get data from the db
 	MsgEntityCreate msgBasic;
 	MsgEntityMove msgMove;
-	string id, pos1, pos2, pos3, rot;
-	Vector3 position;
 
 	SrvDBQuery query;
 	query.setTables("entities");
-	query.setCondition("owner ISNULL AND area='" + area + "'");
+	query.setCondition("owner ISNULL AND area=?");
+	query.addConditionValue(area);
 	query.setOrder("id");
 	query.addColumnWithoutValue("id");
 	query.addColumnWithoutValue("pos1");
@@ -132,24 +238,32 @@ bool SrvWorldMgr::loadObjectsFromDB(const std::string& area)
 		return false;
 	}
 
-	for (int row = 0; row < numresults; ++row) {
-		query.getResult()->getValue(row, "id", id);
-		query.getResult()->getValue(row, "pos1", pos1);
-		query.getResult()->getValue(row, "pos2", pos2);
-		query.getResult()->getValue(row, "pos3", pos3);
-		query.getResult()->getValue(row, "rot", rot);
-		query.getResult()->getValue(row, "type", msgBasic.meshType);
-		query.getResult()->getValue(row, "subtype", msgBasic.meshSubtype);
-
-		msgBasic.entityID = StrToUInt64(id);
+	// mafm: the columns are looked up only once, areas may have lots of
+	// entities
+	SrvDBResultCursor cursor(query.getResult());
+	int colID = cursor.getColumn("id");
+	int colPos1 = cursor.getColumn("pos1");
+	int colPos2 = cursor.getColumn("pos2");
+	int colPos3 = cursor.getColumn("pos3");
+	int colRot = cursor.getColumn("rot");
+	int colType = cursor.getColumn("type");
+	int colSubtype = cursor.getColumn("subtype");
+	const Table* objectsTable = TableMgr::instance().getTable("objects");
+	while (cursor.next()) {
+		cursor.getString(colType, msgBasic.meshType);
+		cursor.getString(colSubtype, msgBasic.meshSubtype);
+
+		msgBasic.entityID = cursor.getUInt64(colID);
 		msgMove.area = area;
-		msgMove.position = Vector3(atof(pos1.c_str()), atof(pos2.c_str()), atof(pos3.c_str()));
-		msgMove.rot = atof(rot.c_str());
+		msgMove.position = Vector3(cursor.getFloat(colPos1),
+					   cursor.getFloat(colPos2),
+					   cursor.getFloat(colPos3));
+		msgMove.rot = cursor.getFloat(colRot);
 		msgBasic.entityClass = "Object";
 		msgBasic.entityName = msgBasic.meshType;
 
 		SrvEntityObject* object = new SrvEntityObject(msgBasic, msgMove);
-		float load = TableMgr::instance().getTable("objects")->getValueAsInt(msgBasic.meshType, "load");
+		float load = objectsTable->getValueAsInt(msgBasic.meshType, "load");
 		object->setLoad(load);
 		addEntity(object);
 	}
@@ -167,12 +281,11 @@ bool SrvWorldMgr::loadCreaturesFromDB(const std::string& area)
 	MsgEntityCreate msgBasic;
 	MsgEntityMove msgMove;
 	MsgPlayerData msgPlayer;
-	string id, pos1, pos2, pos3, rot;
-	Vector3 position;
 
 	SrvDBQuery query;
 	query.setTables("creatures");
-	query.setCondition("owner ISNULL AND area='" + area + "'");
+	query.setCondition("owner ISNULL AND area=?");
+	query.addConditionValue(area);
 	query.setOrder("id");
 	query.addColumnWithoutValue("id");
 	query.addColumnWithoutValue("pos1");
@@ -191,30 +304,38 @@ bool SrvWorldMgr::loadCreaturesFromDB(const std::string& area)
 		return false;
 	}
 
-	for (int row = 0; row < numresults; ++row) {
-		query.getResult()->getValue(row, "id", id);
-		query.getResult()->getValue(row, "pos1", pos1);
-		query.getResult()->getValue(row, "pos2", pos2);
-		query.getResult()->getValue(row, "pos3", pos3);
-		query.getResult()->getValue(row, "rot", rot);
-		query.getResult()->getValue(row, "type", msgBasic.meshType);
-		query.getResult()->getValue(row, "subtype", msgBasic.meshSubtype);
-
-		msgBasic.entityID = StrToUInt64(id);
+	// mafm: the columns are looked up only once, areas may have lots of
+	// entities
+	SrvDBResultCursor cursor(query.getResult());
+	int colID = cursor.getColumn("id");
+	int colPos1 = cursor.getColumn("pos1");
+	int colPos2 = cursor.getColumn("pos2");
+	int colPos3 = cursor.getColumn("pos3");
+	int colRot = cursor.getColumn("rot");
+	int colType = cursor.getColumn("type");
+	int colSubtype = cursor.getColumn("subtype");
+	const Table* creaturesTable = TableMgr::instance().getTable("creatures");
+	while (cursor.next()) {
+		cursor.getString(colType, msgBasic.meshType);
+		cursor.getString(colSubtype, msgBasic.meshSubtype);
+
+		msgBasic.entityID = cursor.getUInt64(colID);
 		msgMove.area = area;
-		msgMove.position = Vector3(atof(pos1.c_str()), atof(pos2.c_str()), atof(pos3.c_str()));
-		msgMove.rot = atof(rot.c_str());
+		msgMove.position = Vector3(cursor.getFloat(colPos1),
+					   cursor.getFloat(colPos2),
+					   cursor.getFloat(colPos3));
+		msgMove.rot = cursor.getFloat(colRot);
 		msgBasic.entityClass = "Creature";
 		msgBasic.entityName = msgBasic.meshType;
 
-		msgPlayer.ab_con = TableMgr::instance().getTable("creatures")->getValueAsInt(msgBasic.meshType, "con");
-		msgPlayer.ab_str = TableMgr::instance().getTable("creatures")->getValueAsInt(msgBasic.meshType, "str");
-		msgPlayer.ab_dex = TableMgr::instance().getTable("creatures")->getValueAsInt(msgBasic.meshType, "dex");
-		msgPlayer.ab_int = TableMgr::instance().getTable("creatures")->getValueAsInt(msgBasic.meshType, "int");
-		msgPlayer.ab_wis = TableMgr::instance().getTable("creatures")->getValueAsInt(msgBasic.meshType, "wis");
-		msgPlayer.ab_cha = TableMgr::instance().getTable("creatures")->getValueAsInt(msgBasic.meshType, "cha");
+		msgPlayer.ab_con = creaturesTable->getValueAsInt(msgBasic.meshType, "con");
+		msgPlayer.ab_str = creaturesTable->getValueAsInt(msgBasic.meshType, "str");
+		msgPlayer.ab_dex = creaturesTable->getValueAsInt(msgBasic.meshType, "dex");
+		msgPlayer.ab_int = creaturesTable->getValueAsInt(msgBasic.meshType, "int");
+		msgPlayer.ab_wis = creaturesTable->getValueAsInt(msgBasic.meshType, "wis");
+		msgPlayer.ab_cha = creaturesTable->getValueAsInt(msgBasic.meshType, "cha");
 
-		std::string hd = TableMgr::instance().getTable("creatures")->getValue(msgBasic.meshType, "hd");
+		std::string hd = creaturesTable->getValue(msgBasic.meshType, "hd");
 		msgPlayer.health_max = RollDie::instance().roll(hd);
 		msgPlayer.health_cur = msgPlayer.health_max;
 
@@ -227,17 +348,16 @@ bool SrvWorldMgr::loadCreaturesFromDB(const std::string& area)
 
 SrvEntityPlayer* SrvWorldMgr::findPlayer(const LoginData* loginData) const
 {
-	// mafm: We can use a hash for the player list, so the performance
-	// should be better (O(1) instead of O(n)).  Since STL doesn't seem to
-	// have hash functions as standard, and maps/set are logaritmic but you
-	// don't seem to be able to remove a key after inserted (which gives a
-	// lot of problems and additional test after player logged off), we'll
-	// use plain vectors for now.
+	// mafm: the lists are still used to iterate over all the entities, but
+	// for searching we keep hashed indices too, by entity ID
+	SrvEntityPlayer* player = loginData->getPlayerEntity();
+	if (!player)
+		return 0;
 
-	for (size_t i = 0; i < mPlayerList.size(); ++i) {
-		if (loginData->getPlayerEntity() == mPlayerList[i]) {
-			return mPlayerList[i];
-		}
+	std::tr1::unordered_map<EntityID, SrvEntityPlayer*>::const_iterator it =
+		mPlayerIndex.find(player->getID());
+	if (it != mPlayerIndex.end() && it->second == player) {
+		return player;
 	}
 	// not found
 	return 0;
@@ -245,11 +365,10 @@ SrvEntityPlayer* SrvWorldMgr::findPlayer(const LoginData* loginData) const
 
 SrvEntityCreature* SrvWorldMgr::findCreature(EntityID entityID) const
 {
-	// mafm: Read the comment for players about performance.
-	for (size_t i = 0; i < mCreatureList.size(); ++i) {
-		if (entityID == mCreatureList[i]->getID()) {
-			return mCreatureList[i];
-		}
+	std::tr1::unordered_map<EntityID, SrvEntityCreature*>::const_iterator it =
+		mCreatureIndex.find(entityID);
+	if (it != mCreatureIndex.end()) {
+		return it->second;
 	}
 	// not found
 	return 0;
@@ -257,11 +376,10 @@ SrvEntityCreature* SrvWorldMgr::findCreature(EntityID entityID) const
 
 SrvEntityObject* SrvWorldMgr::findObject(EntityID entityID) const
 {
-	// mafm: Read the comment for players about performance.
-	for (size_t i = 0; i < mObjectList.size(); ++i) {
-		if (entityID == mObjectList[i]->getID()) {
-			return mObjectList[i];
-		}
+	std::tr1::unordered_map<EntityID, SrvEntityObject*>::const_iterator it =
+		mObjectIndex.find(entityID);
+	if (it != mObjectIndex.end()) {
+		return it->second;
 	}
 	// not found
 	return 0;
@@ -275,39 +393,31 @@ void SrvWorldMgr::addPlayer(LoginData* loginData)
 	SrvEntityPlayer* player = loginData->getPlayerEntity();
 	loginData->setPlaying(true);
 
-	// mafm: just subscribing everybody, do something more elaborate in the
-	// future if needed
-	for (size_t i = 0; i < mPlayerList.size(); ++i) {
-		// mafm: we can do a small optimization avoiding this
-		// comparison, but only if we're sure that player is always
-		// added after being subscribed (to do the comparison elsewhere,
-		// in example in the subscription class, doesn't help)
-		if (player == mPlayerList[i]) {
-			LogWRN("Player '%s' added to the player list before being subscribed",
-			       player->getName());
-			continue;
-		}
-		mPlayerList[i]->attachObserver(player);
-		player->attachObserver(mPlayerList[i]);
+	if (findPlayer(loginData)) {
+		LogWRN("Player '%s' added to the player list before being subscribed",
+		       player->getName());
+		return;
 	}
 
 	// notifying client about game time, to set up environment lights and
 	// whatever it might need
 	SrvWorldTimeMgr::instance().sendTimeToPlayer(loginData);
 
-	// subscribing to entities 
-	for (size_t i = 0; i < mCreatureList.size(); ++i) {
-		mCreatureList[i]->attachObserver(player);
-	}
-	for (size_t i = 0; i < mObjectList.size(); ++i) {
-		mObjectList[i]->attachObserver(player);
-	}
+	// subscribing to the entities around (and the players around to this
+	// one), the rest will come when moving
+	mGrid.addEntity(player, player);
+	Vector3 position;
+	player->getPosition(position);
+	vector<SrvWorldGrid::Cell*> cells;
+	mGrid.getNeighbourhood(player->getArea(), position, cells);
+	subscribeToCells(player, player, cells, true);
 
 	// contact notification
 	SrvWorldContactMgr::playerStatusChange(loginData, true);
 
 	// now after subscribing, add to the list
 	mPlayerList.push_back(player);
+	mPlayerIndex[player->getID()] = player;
 
 	// broadcasting message
 	MsgChat msg;
@@ -330,20 +440,15 @@ void SrvWorldMgr::removePlayer(LoginData* loginData)
 
 	// remove from the list -- unsubscription works automatically from other
 	// players and creatures
-	vector<SrvEntityPlayer*>::iterator itFound = mPlayerList.end();
-	for (vector<SrvEntityPlayer*>::iterator it = mPlayerList.begin();
-	     it != mPlayerList.end(); ++it) {
-		if (*it == player) {
-			itFound = it;
-		}
-	}
-	if (itFound == mPlayerList.end()) {
+	if (!findPlayer(loginData)) {
 		LogERR("Player '%s' not found in list while trying to remove it",
 		       player->getName());
 		return;
 	} else {
-		mPlayerList.erase(itFound);
+		mPlayerIndex.erase(player->getID());
+		mPlayerList.erase(std::find(mPlayerList.begin(), mPlayerList.end(), player));
 	}
+	mGrid.removeEntity(player, player);
 
 	// contact status
 	SrvWorldContactMgr::playerStatusChange(loginData, false);
@@ -366,15 +471,88 @@ void SrvWorldMgr::removePlayer(LoginData* loginData)
 	delete player;
 }
 
+void SrvWorldMgr::updateEntityPosition(SrvEntityBase* entity,
+				       const std::string& oldArea,
+				       const Vector3& oldPosition)
+{
+	// mafm: players are the only observers, so we only care about them
+	// seeing entities (or other players) and not the other way around;
+	// entities not added to the world (in example, players still in the
+	// login process) are not in the grid and must be ignored
+	SrvEntityPlayer* player = dynamic_cast<SrvEntityPlayer*>(entity);
+	if (player && !player->getLoginData()->isPlaying())
+		return;
+
+	// nothing to do if still in the same cell
+	if (!mGrid.moveEntity(entity, player, oldArea, oldPosition))
+		return;
+
+	Vector3 position;
+	entity->getPosition(position);
+	vector<SrvWorldGrid::Cell*> oldCells, newCells;
+	mGrid.getNeighbourhood(oldArea, oldPosition, oldCells);
+	mGrid.getNeighbourhood(entity->getArea(), position, newCells);
+
+	// cells no longer in the neighbourhood, and the new ones
+	vector<SrvWorldGrid::Cell*> leaving, entering;
+	for (size_t i = 0; i < oldCells.size(); ++i) {
+		if (std::find(newCells.begin(), newCells.end(), oldCells[i]) == newCells.end())
+			leaving.push_back(oldCells[i]);
+	}
+	for (size_t i = 0; i < newCells.size(); ++i) {
+		if (std::find(oldCells.begin(), oldCells.end(), newCells[i]) == oldCells.end())
+			entering.push_back(newCells[i]);
+	}
+
+	subscribeToCells(entity, player, leaving, false);
+	subscribeToCells(entity, player, entering, true);
+}
+
+void SrvWorldMgr::subscribeToCells(SrvEntityBase* entity,
+				   SrvEntityPlayer* player,
+				   const vector<SrvWorldGrid::Cell*>& cells,
+				   bool subscribe)
+{
+	for (size_t i = 0; i < cells.size(); ++i) {
+		// players in the cells see the entity
+		const vector<SrvEntityPlayer*>& players = cells[i]->players;
+		for (size_t j = 0; j < players.size(); ++j) {
+			if (players[j] == player)
+				continue;
+			if (subscribe)
+				entity->attachObserver(players[j]);
+			else
+				entity->detachObserver(players[j]);
+		}
+
+		if (!player)
+			continue;
+
+		// and players see the entities in the cells
+		const vector<SrvEntityBase*>& entities = cells[i]->entities;
+		for (size_t j = 0; j < entities.size(); ++j) {
+			if (entities[j] == entity)
+				continue;
+			if (subscribe)
+				entities[j]->attachObserver(player);
+			else
+				entities[j]->detachObserver(player);
+		}
+	}
+}
+
 void SrvWorldMgr::getNearbyPlayers(const LoginData* player,
 				   float radius,
 				   vector<LoginData*>& nearbyPlayers) const
 {
-	for (size_t i = 0; i < mPlayerList.size(); ++i) {
-		float distance = player->getPlayerEntity()->getDistanceToEntity(*mPlayerList[i]);
-		if (distance <= radius) {
-			nearbyPlayers.push_back(mPlayerList[i]->getLoginData());
-		}
+	const SrvEntityPlayer* entity = player->getPlayerEntity();
+	Vector3 position;
+	entity->getPosition(position);
+
+	vector<SrvEntityPlayer*> players;
+	mGrid.getPlayersInRadius(entity->getArea(), position, radius, players);
+	for (size_t i = 0; i < players.size(); ++i) {
+		nearbyPlayers.push_back(players[i]->getLoginData());
 	}
 }
 
@@ -383,21 +561,26 @@ void SrvWorldMgr::addEntity(SrvEntityBase* entity)
 	LogNTC("Adding entity '%lu' to world manager, class '%s'",
 	       entity->getID(), entity->getEntityClass());
 
-	// mafm: just subscribing everybody, do something more elaborate in the
-	// future if needed
-	for (size_t i = 0; i < mPlayerList.size(); ++i) {
-		entity->attachObserver(mPlayerList[i]);
-	}
-
 	// add to the list
 	if (SrvEntityCreature* c = dynamic_cast<SrvEntityCreature*>(entity)) {
 		mCreatureList.push_back(c);
+		mCreatureIndex[c->getID()] = c;
 	} else if (SrvEntityObject* o = dynamic_cast<SrvEntityObject*>(entity)) {
 		mObjectList.push_back(o);
+		mObjectIndex[o->getID()] = o;
 	} else {
 		LogERR("Class '%s' is unknown, for entity '%lu'",
 		       entity->getEntityClass(), entity->getID());
+		return;
 	}
+
+	// subscribing the players around
+	mGrid.addEntity(entity, 0);
+	Vector3 position;
+	entity->getPosition(position);
+	vector<SrvWorldGrid::Cell*> cells;
+	mGrid.getNeighbourhood(entity->getArea(), position, cells);
+	subscribeToCells(entity, 0, cells, true);
 }
 
 void SrvWorldMgr::removeEntity(SrvEntityBase* entity)
@@ -410,15 +593,18 @@ void SrvWorldMgr::removeEntity(SrvEntityBase* entity)
 
 	// removing entity from our list
 	if (dynamic_cast<SrvEntityCreature*>(entity)) {
+		mCreatureIndex.erase(entity->getID());
 		mCreatureList.erase(std::remove(mCreatureList.begin(), mCreatureList.end(), entity),
 				    mCreatureList.end());
 	} else if (dynamic_cast<SrvEntityObject*>(entity)) {
+		mObjectIndex.erase(entity->getID());
 		mObjectList.erase(std::remove(mObjectList.begin(), mObjectList.end(), entity),
 				    mObjectList.end());
 	} else {
 		LogERR("Class '%s' is unknown, for entity '%lu'",
 		       entity->getEntityClass(), entity->getID());
 	}
+	mGrid.removeEntity(entity, 0);
 
 	// delete, at last
 	delete entity;
@@ -442,7 +628,7 @@ void SrvWorldMgr::playerGetItem(SrvEntityPlayer* player, EntityID entityID)
 		SrvEntityObject* object = findObject(entityID);
 		if (!object) {
 			throw "EntityID not found or not an object";
-		} else if (player->getDistanceToEntity(*object) > PICKUP_DISTANCE) {
+		} else if (!player->isWithinDistance(*object, PICKUP_DISTANCE)) {
 			throw "Object too far away";
 		} else if (!player->addToInventory(object)) {
 			throw "Cannot put the object into the inventory";
@@ -545,7 +731,8 @@ bool SrvWorldMgr::changeObjectOwner(EntityID entityID, const std::string& charna
 
 	SrvDBQuery query;
 	query.setTables("entities");
-	query.setCondition("id='" + id + "'");
+	query.setCondition("id=?");
+	query.addConditionValue(id);
 	query.addColumnWithValue("owner", charname);
 	bool success = SrvDBMgr::instance().queryUpdate(&query);
 	if (!success) {
@@ -581,7 +768,8 @@ bool SrvWorldMgr::dropObjectFromInventory(EntityID entityID,
 
 	SrvDBQuery query;
 	query.setTables("entities");
-	query.setCondition("id='" + id + "'");
+	query.setCondition("id=?");
+	query.addConditionValue(id);
 	query.addColumnWithoutValue("type");
 	query.addColumnWithoutValue("subtype");
 	int numresults = SrvDBMgr::instance().querySelect(&query);
@@ -607,9 +795,10 @@ bool SrvWorldMgr::dropObjectFromInventory(EntityID entityID,
 	// 3- mark as removed from inventory
 	SrvDBQuery query2;
 	query2.setTables("entities");
-	query2.setCondition("id='" + id + "'");
+	query2.setCondition("id=?");
+	query2.addConditionValue(id);
 	query2.addColumnWithValue("owner", "NULL", false);
-	query2.addColumnWithValue("area", area, false);
+	query2.addColumnWithValue("area", area);
 	bool success = SrvDBMgr::instance().queryUpdate(&query2);
 	if (!success) {
 		LogERR("Error marking the object as an outside object");
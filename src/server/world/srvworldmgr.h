@@ -23,7 +23,10 @@
 #include "common/patterns/singleton.h"
 #include "common/datatypes.h"
 
+#include "server/world/srvworldgrid.h"
+
 #include <vector>
+#include <tr1/unordered_map>
 
 
 class LoginData;
@@ -67,8 +70,15 @@ public:
 	void addPlayer(LoginData* loginData);
 	/** Remove a player */
 	void removePlayer(LoginData* loginData);
+	/** Update the subscriptions of an entity which moved, given the area
+	 * and position where it was before (the entity already has the new
+	 * ones) */
+	void updateEntityPosition(SrvEntityBase* entity,
+				  const std::string& oldArea,
+				  const Vector3& oldPosition);
 	/** Returns the list of players within a certain radius from a given
-	 * player (useful in example to distribute chat messages) */
+	 * player (useful in example to distribute chat messages), in the same
+	 * area */
 	void getNearbyPlayers(const LoginData* player,
 			      float radius,
 			      std::vector<LoginData*>& nearbyPlayers) const;
@@ -80,6 +90,15 @@ public:
 	/** Change the owner of the object (useful for trading, in example) */
 	bool changeObjectOwner(EntityID entityID, const std::string& charname);
 
+	/** Tick, so the world can save its state periodically (milliseconds
+	 * since the last tick) */
+	void sendTick(uint32_t ticks);
+	/** Get the milliseconds left until the next checkpoint */
+	uint32_t getMsecsToNextTick() const;
+	/** Save the entities changed since the last checkpoint to the DB, in
+	 * batches */
+	void checkpoint();
+
 private:
 	/** Singleton friend access */
 	friend class Singleton<SrvWorldMgr>;
@@ -93,6 +112,19 @@ private:
 	std::vector<SrvEntityCreature*> mCreatureList;
 	/// List of objects
 	std::vector<SrvEntityObject*> mObjectList;
+	/// Index of the players connected, by entity ID
+	std::tr1::unordered_map<EntityID, SrvEntityPlayer*> mPlayerIndex;
+	/// Index of the creatures, by entity ID
+	std::tr1::unordered_map<EntityID, SrvEntityCreature*> mCreatureIndex;
+	/// Index of the objects, by entity ID
+	std::tr1::unordered_map<EntityID, SrvEntityObject*> mObjectIndex;
+	/// Grid with the location of the entities, to subscribe players only
+	/// to the entities around them
+	SrvWorldGrid mGrid;
+	/// Milliseconds between checkpoints
+	uint32_t mCheckpointInterval;
+	/// Milliseconds since the last checkpoint
+	uint32_t mCheckpointTicks;
 
 
 	/** Default constructor */
@@ -118,6 +150,13 @@ private:
 	void addEntity(SrvEntityBase* entity);
 	/** Remove an entity */
 	void removeEntity(SrvEntityBase* entity);
+	/** Subscribe the players in the cells to the entity and, if the entity
+	 * is a player, the player to the entities in the cells (or unsubscribe
+	 * them, the opposite) */
+	void subscribeToCells(SrvEntityBase* entity,
+			      SrvEntityPlayer* player,
+			      const std::vector<SrvWorldGrid::Cell*>& cells,
+			      bool subscribe);
 
 	/** Get an object to an inventory
 	 *
@@ -56,6 +56,14 @@ void SrvWorldTimeMgr::sendTick(uint32_t ticks)
 	}
 }
 
+uint32_t SrvWorldTimeMgr::getMsecsToNextTick() const
+{
+	if (mTicks >= 5000)
+		return 0;
+	else
+		return 5000 - mTicks;
+}
+
 void SrvWorldTimeMgr::sendTimeToPlayer(const LoginData* player) const
 {
 	MsgTimeMinute msg;
@@ -106,10 +114,7 @@ void SrvWorldTimeMgr::saveToDB()
 	SrvDBQuery query;
 	query.setTables("world");
 	query.addColumnWithValue("time", time);
-	bool success = SrvDBMgr::instance().queryUpdate(&query);
-	if (!success) {
-		LogERR("Couldn't save the game time to the DB");
-	}
+	SrvDBMgr::instance().queueUpdate(&query);
 }
 
 
@@ -39,6 +39,9 @@ public:
 	/** Receives the tick from the main application to count the game
 	 * time */
 	void sendTick(uint32_t ticks);
+	/** Get the milliseconds left until the next game time increase, so
+	 * the main loop knows how much it can sleep */
+	uint32_t getMsecsToNextTick() const;
 	/** Get game time */
 	uint32_t getGameTime() const;
 	/** Change the time by the given number of minutes */